@@ -9,6 +9,7 @@
 #define OOOPSI_HPP_
 
 #include <cstddef>
+#include <cstdint>
 #include <string>
 
 #ifdef _MSC_VER
@@ -36,19 +37,79 @@ typedef void (*LogFunc)(const char*);
 /// Pointer alias. Avoid uint64_t/uintptr_t because they are a PITA when using printf.
 using pointer_t = const void*;
 
+/// Predicate for stack frames: receives the (mangled) function name of a frame.
+typedef bool (*FramePredicate)(const char*);
+
+/// Controls which frames of a stack trace are collected/printed. These settings are applied
+/// while unwinding the stack, so no time is spent on frames that aren't needed.
+struct TraceSettings
+{
+    /// number of frames to skip at the top of the stack (after the internal frames, see below),
+    /// inlined calls are part of their frame
+    size_t skipFrames = 0;
+    /// maximum number of frames (including inlined calls)
+    size_t maxFrames = 128;
+    /// skip the library's own frames and - if called from a signal handler - the handler's
+    /// frames up to and including the signal trampoline? (Linux only)
+    bool skipInternalFrames = false;
+    /// optional: stop after the first frame for which this returns true, e.g. at 'main' or at a
+    /// thread pool's entry function (only called for frames with a function name)
+    FramePredicate stopAt = nullptr;
+};
+
 /// Parameters for printStackTrace().
-struct LogSettings
+struct LogSettings : TraceSettings
 {
     /// the log function to use (nullptr: use the current handler)
     LogFunc logFunc = nullptr;
     /// demangle C++ function names? (recommended: don't in a Linux signal handler)
     bool demangleNames = true;
+    /// render the demangled names compactly, see demangleCompact()?
+    /// For crashes caught by the handlers, set the environment variable
+    /// OOOPSI_COMPACT_NAMES=<maxTemplateDepth> instead.
+    bool compactNames = false;
+    /// for compact names: number of nested template argument lists to keep
+    unsigned maxTemplateDepth = 1;
+    /// add frames for inlined function calls, using the debug information of the modules?
+    /// (Linux only, recommended: don't in a signal handler)
+    bool expandInlinedFrames = true;
+    /// look up the function names in the recorded stack traces of the async parents (see
+    /// captureAsyncParent())? Otherwise, only their modules and offsets are printed. (Linux only,
+    /// recommended: don't in a signal handler, this reads the modules' symbol tables)
+    bool resolveAsyncParents = true;
 };
 
 /// Parameters for abort()
 struct AbortSettings : LogSettings
 {
     bool printStackTrace = true;
+    /// if not 0: print the stack trace in two phases, first the raw addresses, then the full
+    /// trace with symbols - and give up if this takes longer than the given number of
+    /// milliseconds (e.g. due to a corrupted stack). Linux only.
+    /// For crashes caught by the handlers, set the environment variable
+    /// OOOPSI_SYMBOLIZE_TIMEOUT_MS instead.
+    unsigned symbolizeTimeoutMs = 0;
+    /// number of breadcrumbs to print per thread (see leaveBreadcrumb(), at most 64)
+    size_t numBreadcrumbs = 16;
+    /// print the breadcrumbs of all threads? (default: only the current thread's)
+    bool allThreadBreadcrumbs = false;
+    /// for crashes caught by the handlers: print the general-purpose registers and a hexdump of
+    /// the memory around the stack pointer and the faulting address? (Linux only)
+    bool printRegisters = false;
+    /// number of bytes to dump around each of these addresses (at most 4096, 0: none)
+    size_t memoryDumpSize = 256;
+    /// end by raising the signal that caused the crash (SIGABRT if there was none) with its
+    /// default action, instead of exiting with an exit code - so the system writes a core dump
+    /// (if enabled, see RLIMIT_CORE and core_pattern). To keep it small, exclude large regions
+    /// via excludeFromCoreDump(). Linux only.
+    /// For crashes caught by the handlers, set the environment variable OOOPSI_DUMP_CORE=1
+    /// instead.
+    bool dumpCore = false;
+    /// append the library's own counters and timings (see getStats()) to the report (before it
+    /// ends), including the time spent in abort() until then. For crashes caught by the
+    /// handlers, set the environment variable OOOPSI_STATS=1 instead (which also prints them at
+    /// exit).
+    bool printStats = false;
 };
 
 /// Prints a stack trace using the given log settings.
@@ -70,11 +131,16 @@ struct StackFrame
     /// (de)mangled function name (if possible)
     std::string function;
 
-    /// offset of 'address' relative to the start of the function
+    /// offset of 'address' relative to the start of the function (0 for inlined frames)
     size_t offset = 0;
+
+    /// true if this is a synthetic frame for an inlined function call (the call was made from
+    /// the function of the next frame, which has the same address)
+    bool inlined = false;
 };
 
-/// Collects a stack trace into the given buffer.
+/// Collects a stack trace into the given buffer, including frames for inlined function calls
+/// (if debug information is available).
 /// Note: not safe to use in signal handlers due to the allocation of the function name.
 ///
 /// @param[out] buffer           buffer that will be filled with stack frames
@@ -82,6 +148,143 @@ struct StackFrame
 /// @return number of actually stored frames in 'buffer'
 OOOPSI_EXPORT size_t collectStackTrace(StackFrame* buffer, size_t bufferSize) noexcept;
 
+/// Same as above, but only collects the frames selected by 'settings'.
+/// At most min(bufferSize, settings.maxFrames) frames are stored.
+OOOPSI_EXPORT size_t collectStackTrace(StackFrame* buffer, size_t bufferSize,
+                                       const TraceSettings& settings) noexcept;
+
+/// Updates the cached list of loaded modules, which is used to print module-relative addresses
+/// and build-ids in stack traces. The list is updated automatically at startup and when
+/// collecting a stack trace via collectStackTrace(), but not from within printStackTrace()
+/// (which must be usable in signal handlers). Call this after loading libraries at runtime
+/// (e.g. via dlopen) to have them included in crash reports.
+/// This is cheap if no modules have been loaded or unloaded since the last call.
+/// Note: not safe to use in signal handlers. Linux only (no-op on other systems).
+OOOPSI_EXPORT void refreshModuleMap() noexcept;
+
+/// The function containing an address, see symbolizeAddresses().
+struct SymbolInfo
+{
+    /// the (mangled) function name, nullptr if not found - valid for the lifetime of the process
+    const char* function = nullptr;
+    /// offset of the address relative to the start of the function
+    size_t offset = 0;
+};
+
+/// Looks up the functions containing many addresses at once, e.g. for a profile or a set of
+/// collected stack traces. This is a lot faster than looking them up one by one: the addresses
+/// are deduplicated and grouped by module, so each distinct address is searched for once in its
+/// module's symbol table, and the work is distributed over several threads (each module's symbol
+/// table is loaded once and shared by all of them). Inlined calls aren't expanded.
+/// Note: not safe to use in signal handlers. Linux only (no names on other systems).
+///
+/// @param[in]  addresses   the addresses to look up (duplicates are fine)
+/// @param[in]  count       number of addresses
+/// @param[out] results     receives a result for each address, in the same order
+/// @param[in]  numThreads  maximum number of threads to use (0: one per CPU core)
+OOOPSI_EXPORT void symbolizeAddresses(const pointer_t* addresses, size_t count,
+                                      SymbolInfo* results, unsigned numThreads = 0) noexcept;
+
+/// Looks up the function containing an address outside of all loaded modules, see
+/// setSymbolLookupFunc(). Returns the name or nullptr if unknown, and sets '*offset' to the
+/// offset of the address relative to the start of the function. The library keeps a copy of
+/// each distinct name for the lifetime of the process, up to 65536 of them: further names aren't
+/// shown (return names that identify the function, not e.g. its address).
+typedef const char* (*SymbolLookupFunc)(pointer_t address, size_t* offset);
+
+/// Registers the name of a function that isn't part of any module's symbol table, e.g. code
+/// generated by a JIT compiler. Stack traces then show this name for addresses in
+/// [address, address + size) that aren't found otherwise. Overlapping ranges are fine: the one
+/// starting last wins (or the one registered last, if they start at the same address).
+/// The file /tmp/perf-<pid>.map (the format JIT compilers write for perf) is read automatically
+/// as well, when addresses aren't found and it has grown since.
+/// The names are copied and kept for the lifetime of the process (so looked up names stay valid),
+/// registering many distinct names therefore accumulates memory.
+/// Note: thread-safe, not safe to use in signal handlers. Linux only (no-op on other systems).
+///
+/// @param[in] address  start of the function
+/// @param[in] size     size of the function in bytes
+/// @param[in] name     the function's (possibly mangled) name
+/// @return false if out of memory (always on other systems)
+OOOPSI_EXPORT bool registerSymbol(pointer_t address, size_t size, const char* name) noexcept;
+
+/// Unregisters all functions registered via registerSymbol() (or read from the perf map) that
+/// start in [address, address + size), e.g. when the JIT compiler frees its code.
+/// Note: thread-safe, not safe to use in signal handlers. Linux only (no-op on other systems).
+///
+/// @return the number of unregistered functions
+OOOPSI_EXPORT size_t unregisterSymbols(pointer_t address, size_t size) noexcept;
+
+/// Sets a function that is asked for addresses outside of all loaded modules that aren't
+/// registered either (nullptr: none). It may be called concurrently, but not from signal
+/// handlers (crash reports only use the registered functions).
+/// Linux only (no-op on other systems).
+OOOPSI_EXPORT void setSymbolLookupFunc(SymbolLookupFunc func) noexcept;
+
+/// Starts a helper process that takes over symbolizing crash reports (Linux only): on a crash,
+/// the crashing process only sends the raw stack trace, the registers, the referenced modules,
+/// the breadcrumbs and the memory dumps to the helper and exits right away, without looking up
+/// any symbols. The helper does the rest and logs the report. Until then, it only waits for its
+/// parent to crash or exit (detected via PR_SET_PDEATHSIG) and shares all memory pages with it
+/// (copy-on-write).
+/// This can also be enabled by setting the environment variable OOOPSI_CRASH_HELPER=1.
+///
+/// Notes:
+///  - Call this early from the main thread, before any other threads are created. The helper
+///    exits when the thread that started it terminates.
+///  - The helper uses the log function that was active when it was started. Crashes using a
+///    different log function are reported in-process.
+///  - Only crashes of the process that started the helper are handed off: forked children
+///    report their crashes in-process (unless they start a helper of their own).
+///  - Reports of the helper don't include the traces of async parents (see
+///    captureAsyncParent()) or the stats (see AbortSettings::printStats), and the breadcrumbs
+///    and memory dumps are truncated after 64 KiB.
+///  - The helper inherits all open file descriptors.
+///  - Not thread-safe. Returns true if the helper is running.
+OOOPSI_EXPORT bool startCrashHelper() noexcept;
+
+/// Memory paged in for crash reports, see prefaultCrashPath().
+struct PrefaultStats
+{
+    /// bytes paged in (whole pages)
+    size_t touchedBytes = 0;
+    /// bytes locked in memory (part of the above)
+    size_t lockedBytes = 0;
+};
+
+/// Pages in everything a crash report needs (Linux only): the unwind tables (.eh_frame_hdr and
+/// .eh_frame) and symbol tables of all loaded modules, the alternate signal stack and the crash
+/// handlers' buffers. Otherwise, on a memory-pressured host, the first crash after a long uptime
+/// may have to read them back from disk, which can take seconds. Optionally, the memory is
+/// locked as well (mlock), which needs a sufficient RLIMIT_MEMLOCK (or CAP_IPC_LOCK).
+/// Modules loaded later are taken care of when the module map is updated (e.g. via
+/// refreshModuleMap()).
+/// This can also be enabled by setting the environment variable OOOPSI_PREFAULT=1 (or =lock),
+/// the amount of memory is logged then (via the current log function).
+///
+/// Only the first call does anything, later ones just return the current stats.
+///
+/// @param[in] lock     lock the memory as well?
+/// @return how much memory has been paged in and locked (including later loaded modules), zero
+///         on other systems
+OOOPSI_EXPORT PrefaultStats prefaultCrashPath(bool lock = false) noexcept;
+
+/// Excludes memory from core dumps (Linux only, via madvise(MADV_DONTDUMP)), e.g. large caches
+/// or arenas whose contents aren't needed to debug a crash. This keeps the core dumps written
+/// with AbortSettings::dumpCore small and fast. Only whole pages are excluded (the range is
+/// shrunk to page boundaries). The memory stays excluded until includeInCoreDump() is called or
+/// it's unmapped - reuse it for other data with care.
+/// Note: thread-safe.
+///
+/// @param[in] address  start of the memory
+/// @param[in] size     size in bytes
+/// @return false if it couldn't be excluded (e.g. not mapped, always on other systems)
+OOOPSI_EXPORT bool excludeFromCoreDump(pointer_t address, size_t size) noexcept;
+
+/// Includes memory excluded via excludeFromCoreDump() in core dumps again (returns false if that
+/// failed, always on other systems than Linux).
+OOOPSI_EXPORT bool includeInCoreDump(pointer_t address, size_t size) noexcept;
+
 /// Tries to demangle a C++ symbol (usually a function name).
 /// Note: not safe to use in signal handlers due to the allocation of the function name.
 ///
@@ -95,6 +298,573 @@ inline std::string demangle(const std::string& symbol)
     return demangle(symbol.c_str());
 }
 
+/// Demangles many symbols at once, e.g. a whole symbol table or the symbols of a profile, into
+/// caller-owned memory. This is a lot cheaper than demangling them one by one: the demangler's
+/// output buffer is reused for all symbols, and the names are stored in a single string, so
+/// there's no allocation per name once 'output' is large enough (pass the same string for the
+/// next batch).
+/// Note: not safe to use in signal handlers.
+///
+/// @param[in]  symbols     the symbols to demangle (nullptr: an empty name)
+/// @param[in]  count       number of symbols
+/// @param[out] output      receives the names (each the demangled name or a copy of the symbol
+///                         as fallback), each terminated by a '\0' - cleared first
+/// @param[out] offsets     receives the offset of each name in 'output' ('count' entries), i.e.
+///                         name i is 'output.c_str() + offsets[i]'
+OOOPSI_EXPORT void demangle(const char* const* symbols, size_t count, std::string& output,
+                            size_t* offsets);
+
+/// Same as demangle(), but renders the name compactly - names of template-heavy code can get
+/// very long (and a line of a stack trace is truncated after 1024 characters):
+///  - template argument lists nested deeper than 'maxTemplateDepth' are elided ("<...>")
+///  - inline namespaces are dropped ("std::__cxx11::") and well-known typedefs are used
+///    ("std::string" instead of "std::basic_string<char, ...>")
+///  - lambdas only keep their number ("{lambda#1}"), "(anonymous namespace)" becomes "(anon)"
+/// This is a pass over the demangled name (the demangler's parse tree isn't accessible): it
+/// tells template argument lists from operators and comparisons by their context, following the
+/// output of GCC's and LLVM's demanglers. Anything it doesn't recognize is kept as is.
+/// Note: not safe to use in signal handlers due to the allocation of the function name.
+///
+/// @param[in] symbol               the symbol to demangle
+/// @param[in] maxTemplateDepth     number of nested template argument lists to keep (0: none)
+/// @return either the demangled name or a copy of 'symbol' as fallback
+OOOPSI_EXPORT std::string demangleCompact(const char* symbol, unsigned maxTemplateDepth = 1);
+
+/// A compact stack trace: the addresses, offsets and function names are stored in a single
+/// contiguous block of memory (24 bytes per frame), which is allocated once per capture - or
+/// not at all when using a user-provided buffer. This makes it cheap to keep many traces in
+/// memory, e.g. for tracking allocations or lock contention.
+///
+/// Function names are looked up lazily on first access (or via symbolize()) and are stored as
+/// pointers to the (mangled) names in the modules' symbol tables, which stay valid for the
+/// lifetime of the process. Inlined calls aren't expanded. The names are Linux only.
+///
+/// Note: not thread-safe (name lookups modify the trace, even if it is 'const').
+class OOOPSI_EXPORT StackTrace
+{
+public:
+    /// maximum number of frames per trace
+    static constexpr size_t MAX_FRAMES = 128;
+
+    /// A frame of a trace (a lightweight reference, only valid as long as the trace).
+    class Frame
+    {
+    public:
+        Frame(const StackTrace& trace, size_t index) noexcept : m_trace(&trace), m_index(index) {}
+
+        /// the return address - or the faulting instruction after a signal frame
+        pointer_t address() const noexcept { return m_trace->address(m_index); }
+        /// the (mangled) function name or nullptr if unknown
+        const char* function() const noexcept { return m_trace->function(m_index); }
+        /// offset of 'address' relative to the start of the function
+        size_t offset() const noexcept { return m_trace->offset(m_index); }
+        /// the demangled function name (allocates memory)
+        std::string demangledFunction() const { return demangle(function()); }
+
+    private:
+        const StackTrace* m_trace;
+        size_t m_index;
+    };
+
+    /// Iterator over the frames of a trace.
+    class const_iterator
+    {
+    public:
+        const_iterator(const StackTrace& trace, size_t index) noexcept
+          : m_trace(&trace), m_index(index)
+        {
+        }
+
+        Frame operator*() const noexcept { return Frame(*m_trace, m_index); }
+        const_iterator& operator++() noexcept
+        {
+            ++m_index;
+            return *this;
+        }
+        bool operator==(const const_iterator& rhs) const noexcept
+        {
+            return m_index == rhs.m_index && m_trace == rhs.m_trace;
+        }
+        bool operator!=(const const_iterator& rhs) const noexcept { return !(*this == rhs); }
+
+    private:
+        const StackTrace* m_trace;
+        size_t m_index;
+    };
+
+    /// Creates an empty trace that allocates memory when capturing.
+    StackTrace() noexcept = default;
+    /// Creates an empty trace that uses the given buffer (which must outlive the trace) instead
+    /// of allocating memory. The number of frames is limited by the buffer's size (see
+    /// bufferSizeFor()).
+    StackTrace(void* buffer, size_t bufferSize) noexcept;
+    ~StackTrace();
+
+    // movable, but not copyable
+    StackTrace(StackTrace&& rhs) noexcept;
+    StackTrace& operator=(StackTrace&& rhs) noexcept;
+    StackTrace(const StackTrace&) = delete;
+    StackTrace& operator=(const StackTrace&) = delete;
+
+    /// Returns the buffer size needed for the given number of frames.
+    static constexpr size_t bufferSizeFor(size_t numFrames) noexcept
+    {
+        return numFrames * sizeof(Entry);
+    }
+
+    /// Captures the current stack trace (starting at the caller), replacing the previous one.
+    /// No symbols are looked up (unless 'settings.stopAt' is used), so with a user-provided
+    /// buffer, this is safe to use in signal handlers on Linux.
+    ///
+    /// @param[in] settings     which frames to collect (at most MAX_FRAMES)
+    /// @return the number of frames, 0 if memory allocation failed
+    size_t capture(const TraceSettings& settings = TraceSettings()) noexcept;
+
+    /// Looks up all function names now (instead of on first access).
+    void symbolize() const noexcept;
+
+    size_t size() const noexcept { return m_size; }
+    bool empty() const noexcept { return m_size == 0; }
+    Frame operator[](size_t index) const noexcept { return Frame(*this, index); }
+    const_iterator begin() const noexcept { return const_iterator(*this, 0); }
+    const_iterator end() const noexcept { return const_iterator(*this, m_size); }
+
+    /// accessors for a single frame (see Frame)
+    pointer_t address(size_t index) const noexcept { return m_entries[index].address; }
+    const char* function(size_t index) const noexcept;
+    size_t offset(size_t index) const noexcept;
+
+private:
+    /// per-frame storage (the name is looked up lazily)
+    struct Entry
+    {
+        pointer_t address;
+        const char* function;
+        uint32_t offset;
+        uint32_t flags;
+    };
+
+    /// Looks up the name of the given frame (if not done yet).
+    void resolve(size_t index) const noexcept;
+
+    Entry* m_entries = nullptr;
+    uint32_t m_size = 0;
+    uint32_t m_capacity = 0;
+    bool m_ownsEntries = false;
+};
+
+/// Returns the lower end (lowest address, the stack's size limit) of the current thread's stack,
+/// 0 if unknown (used by captureCallers()).
+OOOPSI_EXPORT uintptr_t currentStackStart() noexcept;
+
+/// Returns the upper end (highest address) of the current thread's stack, 0 if unknown (used by
+/// captureCallers()).
+OOOPSI_EXPORT uintptr_t currentStackEnd() noexcept;
+
+/// Collects the return addresses of the calling function and its callers by unwinding the stack,
+/// like captureCallers(), but without relying on frame pointers (and a lot slower).
+///
+/// @param[out] buffer      receives the addresses, the rest is set to nullptr
+/// @param[in]  count       size of 'buffer'
+/// @return number of stored addresses
+OOOPSI_EXPORT size_t collectCallers(pointer_t* buffer, size_t count) noexcept;
+
+/// Looks up the (demangled) name of the function a return address (e.g. collected via
+/// captureCallers()) points into. The names are cached, so repeated lookups of the same address
+/// are cheap. Not safe to use in signal handlers. Linux only.
+///
+/// @param[in] returnAddress    the address
+/// @return the name (valid for the lifetime of the process), nullptr if unknown (always on
+///         other systems)
+OOOPSI_EXPORT const char* callerName(pointer_t returnAddress) noexcept;
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__aarch64__))
+
+/// Implementation of captureCallers(): reads the return address of frame I and follows the frame
+/// pointer to the next frame (unrolled at compile time).
+template <size_t N, size_t I = 0>
+struct CallerWalker
+{
+    __attribute__((always_inline)) static size_t walk(pointer_t* out, const void* const* frame,
+                                                      uintptr_t stackEnd) noexcept
+    {
+        // the frame record: the caller's frame pointer, followed by the return address
+        out[I] = frame[1];
+        const auto* next = static_cast<const void* const*>(frame[0]);
+        // the stack grows downwards: stop at anything that isn't a frame further up the stack
+        const auto nextAddress = reinterpret_cast<uintptr_t>(next);
+        if (nextAddress <= reinterpret_cast<uintptr_t>(frame) ||
+            nextAddress + 2 * sizeof(void*) > stackEnd || nextAddress % sizeof(void*) != 0)
+        {
+            return I + 1;
+        }
+        return CallerWalker<N, I + 1>::walk(out, next, stackEnd);
+    }
+};
+
+/// end of the recursion
+template <size_t N>
+struct CallerWalker<N, N>
+{
+    static size_t walk(pointer_t* /*out*/, const void* const* /*frame*/,
+                       uintptr_t /*stackEnd*/) noexcept
+    {
+        return N;
+    }
+};
+
+/// The bounds of a thread's stack.
+struct StackBounds
+{
+    uintptr_t start;
+    uintptr_t end;
+};
+
+/// Returns the bounds of the current thread's stack (cached, see currentStackStart() and
+/// currentStackEnd()).
+inline const StackBounds& cachedStackBounds() noexcept
+{
+    static thread_local StackBounds s_stack = { 0, 0 };
+    if (s_stack.end == 0)
+    {
+        s_stack.start = currentStackStart();
+        s_stack.end = currentStackEnd();
+    }
+    return s_stack;
+}
+
+/// Captures the return addresses of the calling function and its callers - for the common "who
+/// called me" case (e.g. tagging log lines or allocations with their call sites), where a full
+/// stack trace would be overkill: this is inlined and unrolled at compile time, following the
+/// frame pointers, so it takes only a few nanoseconds. Use callerName() to look up the
+/// functions.
+///
+/// Note: the first address is always correct, the others require the callers to be compiled
+/// with frame pointers (-fno-omit-frame-pointer), otherwise some callers may be missing. Only
+/// frames on the current thread's stack are read, so this never crashes: when called on another
+/// stack (e.g. the alternate signal stack or a fiber's stack), and on other platforms, this falls
+/// back to collectCallers().
+///
+/// @param[out] out     receives the addresses, the rest is set to nullptr
+/// @return number of stored addresses
+template <size_t N>
+__attribute__((always_inline)) inline size_t captureCallers(pointer_t (&out)[N]) noexcept
+{
+    const auto* frame = static_cast<const void* const*>(__builtin_frame_address(0));
+    const StackBounds& stack = cachedStackBounds();
+    // (the frames further up are checked against the end only: they're above this one)
+    if (reinterpret_cast<uintptr_t>(frame) < stack.start ||
+        reinterpret_cast<uintptr_t>(frame) + 2 * sizeof(void*) > stack.end)
+    {
+        // e.g. on the alternate signal stack
+        return collectCallers(out, N);
+    }
+    const size_t count = CallerWalker<N>::walk(out, frame, stack.end);
+    for (size_t i = count; i < N; ++i)
+    {
+        out[i] = nullptr;
+    }
+    return count;
+}
+
+#else
+
+/// see above
+template <size_t N>
+inline size_t captureCallers(pointer_t (&out)[N]) noexcept
+{
+    return collectCallers(out, N);
+}
+
+#endif
+
+/// Leaves a breadcrumb for the current thread: a small record kept in a per-thread ring buffer
+/// (the 64 most recent ones), which is printed along with the stack trace on a crash, to show
+/// what the thread was doing. This is meant for hot paths: there's no formatting, allocation or
+/// locking, only a timestamp and a few stores.
+/// Safe to use in signal handlers (once the thread has left its first breadcrumb).
+///
+/// @param[in] message      a string literal (or any other string that is never freed)
+/// @param[in] arg1         optional: some context, e.g. an ID or size
+/// @param[in] arg2         optional: some more context
+OOOPSI_EXPORT void leaveBreadcrumb(const char* message, uint64_t arg1 = 0,
+                                   uint64_t arg2 = 0) noexcept;
+
+/// Identifies the causal parent of an asynchronous task (0: none), see captureAsyncParent().
+typedef uint32_t AsyncParentId;
+
+/// Records the current stack trace as the causal parent of a task, e.g. when enqueuing it into a
+/// thread pool or event loop. Install the returned ID via AsyncParentScope while the task runs:
+/// stack traces printed in that time (including crash reports) list the parent's frames below
+/// the native ones, followed by the parent's own parents (if it was captured by a task itself).
+///
+/// The raw addresses are stored in a fixed-size, lock-free depot, so this doesn't allocate and
+/// doesn't look up any symbols. Identical traces are stored only once and never removed.
+/// To keep the overhead low in hot paths, only every n-th call per thread can be recorded (see
+/// setAsyncSampling()); the other calls (and those failing because the depot is full) return
+/// the current thread's parent instead, so the chain stays intact, but skips a link.
+/// Safe to use in signal handlers.
+OOOPSI_EXPORT AsyncParentId captureAsyncParent() noexcept;
+
+/// Returns the causal parent installed for the current thread (0 if none).
+OOOPSI_EXPORT AsyncParentId currentAsyncParent() noexcept;
+
+/// Records only every n-th call of captureAsyncParent() per thread (0 disables recording,
+/// the default is 1, i.e. record every call). This can also be set via the environment
+/// variable OOOPSI_ASYNC_SAMPLING=<n>.
+OOOPSI_EXPORT void setAsyncSampling(unsigned interval) noexcept;
+
+/// RAII helper class to install the causal parent of a task for the current thread: create one at
+/// the start of the task, passing the ID returned by captureAsyncParent() when it was enqueued.
+/// The previous parent is restored when the scope ends.
+class OOOPSI_EXPORT AsyncParentScope
+{
+public:
+    explicit AsyncParentScope(AsyncParentId parent) noexcept;
+    ~AsyncParentScope();
+
+    // not copyable or movable
+    AsyncParentScope(const AsyncParentScope&) = delete;
+    AsyncParentScope& operator=(const AsyncParentScope&) = delete;
+    AsyncParentScope(AsyncParentScope&&) = delete;
+    AsyncParentScope& operator=(AsyncParentScope&&) = delete;
+
+private:
+    /// the parent to restore
+    AsyncParentId m_previous;
+};
+
+/// A named trace point, see OOOPSI_TRACEPOINT().
+struct TracePoint;
+
+/// Registers a trace point (use OOOPSI_TRACEPOINT() instead of calling this directly).
+///
+/// @param[in] name     a string literal (or any other string that is never freed)
+/// @return the trace point, or nullptr if too many have been registered
+OOOPSI_EXPORT TracePoint* registerTracePoint(const char* name) noexcept;
+
+/// Counts a hit of a trace point (use OOOPSI_TRACEPOINT() instead of calling this directly).
+/// Safe to use in signal handlers.
+OOOPSI_EXPORT void hitTracePoint(TracePoint* point) noexcept;
+
+/// Records the raw stack trace of only every n-th hit of each trace point (0 disables recording,
+/// the default is 1000). This can also be set via the environment variable
+/// OOOPSI_TRACEPOINT_SAMPLING=<n>.
+OOOPSI_EXPORT void setTracePointSampling(unsigned interval) noexcept;
+
+/// Prints all trace points with their number of hits and their most frequently sampled stack
+/// traces (looking up the symbols). Not safe to use in signal handlers.
+///
+/// @param settings     controls log function etc.
+/// @param maxStacks    maximum number of stack traces to print per trace point
+OOOPSI_EXPORT void printTracePoints(LogSettings settings = LogSettings(), size_t maxStacks = 3);
+
+/// Marks a named trace point, e.g. OOOPSI_TRACEPOINT("cache-miss"), to find out how often a
+/// (rare, but expensive) event happens in production, and where it's coming from - without
+/// running a profiler. Every hit increments a counter, which is striped over threads, so it's
+/// cheap enough for hot paths. Every n-th hit (see setTracePointSampling()) records the raw
+/// stack trace in a small per-trace-point table. Print them via printTracePoints().
+/// Each use of the macro is a separate trace point, even with the same name.
+#define OOOPSI_TRACEPOINT(name)                                                                  \
+    do                                                                                           \
+    {                                                                                            \
+        static ooopsi::TracePoint* const s_ooopsiTracePoint = ooopsi::registerTracePoint(name); \
+        ooopsi::hitTracePoint(s_ooopsiTracePoint);                                               \
+    } while (false)
+
+/// Reports something suspicious, but not fatal: logs the message followed by the stack trace -
+/// but only the first time for each distinct stack trace, and only as often as the rate limit
+/// allows (see setReportRateLimit()). This way, it can't flood the log or burn CPU, even when
+/// called a million times per second: repeated calls are recognized by their innermost callers
+/// (see captureCallers()), and calls exceeding the rate limit return right away - both without
+/// capturing the stack trace. Suppressed reports are counted, see printReportSummary().
+/// Note: traces that only differ beyond their innermost 8 callers are reported once.
+///
+/// @param message      a string literal (or any other string that is never freed)
+/// @param settings     controls log function etc.
+/// @return true if the report has been logged
+OOOPSI_EXPORT bool reportOnce(const char* message, LogSettings settings = LogSettings());
+
+/// Sets the rate limit of reportOnce(), a token bucket: every logged report consumes a token
+/// (repeated ones don't), if there is none left, the call returns right away. The default is 10
+/// per second with a burst of 10.
+///
+/// @param reportsPerSecond     rate at which the bucket is refilled (0: no reports at all)
+/// @param burst                size of the bucket
+OOOPSI_EXPORT void setReportRateLimit(unsigned reportsPerSecond, unsigned burst) noexcept;
+
+/// Prints the reported stack traces with the number of suppressed reports for each of them, and
+/// the number of reports suppressed by the rate limit.
+///
+/// @param settings     controls log function etc.
+OOOPSI_EXPORT void printReportSummary(LogSettings settings = LogSettings());
+
+/// What a thread has been waiting for, see recordLockWait().
+enum class LockWaitKind
+{
+    Mutex,
+    ReadLock,
+    WriteLock,
+    Condition
+};
+
+/// Records a thread that had to wait for a lock: counts the wait and samples the stack trace,
+/// weighted by the blocked time. Waits of at least the sampling interval are always sampled,
+/// shorter ones with a probability proportional to their duration (see setLockWaitSampling()).
+///
+/// On Linux, the library ooopsi-lockprof calls this for all contended pthread mutexes and
+/// read/write locks (and for condition variable waits), just link or LD_PRELOAD it. Only a
+/// failed trylock is timed, so uncontended locks stay as cheap as before. Custom locks (e.g.
+/// spin locks) can call this directly.
+///
+/// @param kind         what the thread has been waiting for
+/// @param waitNanos    the blocked time
+/// @param skipFrames   number of frames to skip, in addition to the library's own ones
+OOOPSI_EXPORT void recordLockWait(LockWaitKind kind, uint64_t waitNanos,
+                                  size_t skipFrames = 0) noexcept;
+
+/// Sets the sampling interval of recordLockWait() in nanoseconds (0: sample every wait, the
+/// default is 10 microseconds). This can also be set via the environment variable
+/// OOOPSI_LOCK_SAMPLING=<ns>.
+OOOPSI_EXPORT void setLockWaitSampling(uint64_t intervalNanos) noexcept;
+
+/// Prints the contention profile: the number of waits and the blocked time per kind, and the
+/// stack traces that have been blocked the longest (looking up the symbols). Not safe to use in
+/// signal handlers. ooopsi-lockprof prints it at exit if OOOPSI_LOCK_PROFILE=1 is set.
+///
+/// @param settings     controls log function etc.
+/// @param maxStacks    maximum number of stack traces to print
+OOOPSI_EXPORT void printLockContention(LogSettings settings = LogSettings(),
+                                       size_t maxStacks = 10);
+
+/// A stack trace with a value, see writeProfile().
+struct ProfileSample
+{
+    /// the return addresses, innermost first (e.g. of the non-inlined frames collected via
+    /// collectStackTrace())
+    const pointer_t* frames = nullptr;
+    size_t numFrames = 0;
+    /// the value, e.g. how often this trace has been seen
+    int64_t value = 0;
+};
+
+/// Writes stack traces as profile for pprof (https://github.com/google/pprof): a gzip-compressed
+/// profile.proto with the modules (including their build-ids) and the function names, so it can
+/// be viewed without the binaries, e.g. "pprof -http=: <path>". The file is written while
+/// encoding, so the memory needed only depends on the number of distinct addresses and
+/// functions. Linux only (returns false on other systems).
+/// Note: only throws if memory allocation fails.
+///
+/// @param path         the file to write
+/// @param samples      the stack traces
+/// @param numSamples   number of stack traces
+/// @param sampleType   what the values are, e.g. "samples" or "allocations"
+/// @param unit         the unit of the values, e.g. "count" or "bytes"
+/// @return false if the file couldn't be written
+OOOPSI_EXPORT bool writeProfile(const char* path, const ProfileSample* samples, size_t numSamples,
+                                const char* sampleType = "samples", const char* unit = "count");
+
+/// Writes stack traces in the "folded" format used for flame graphs: a line per distinct stack
+/// trace, with the function names from the outermost to the innermost frame separated by ';',
+/// followed by the sum of the values, e.g. "main;run;parse 42". Render them with the
+/// ooopsi-flamegraph tool (or any other tool that reads this format). Inlined calls aren't
+/// expanded.
+/// Note: only throws if memory allocation fails.
+///
+/// @param path             the file to write
+/// @param samples          the stack traces
+/// @param numSamples       number of stack traces
+/// @param compactNames     render the names compactly, see demangleCompact()?
+/// @param maxTemplateDepth see demangleCompact()
+/// @return false if the file couldn't be written
+OOOPSI_EXPORT bool writeFoldedStacks(const char* path, const ProfileSample* samples,
+                                     size_t numSamples, bool compactNames = false,
+                                     unsigned maxTemplateDepth = 1);
+
+/// Writes the sampled stack traces of the trace points as pprof profile (see writeProfile()),
+/// each labeled with the trace point's name.
+OOOPSI_EXPORT bool writeTracePointProfile(const char* path);
+
+/// Writes the contention profile as pprof profile (see writeProfile()), with the estimated number
+/// of waits ("contentions") and the blocked time ("delay") per stack trace, like Go's mutex
+/// profile.
+OOOPSI_EXPORT bool writeLockContentionProfile(const char* path);
+
+/// Histogram of durations with power-of-two buckets.
+struct LatencyHistogram
+{
+    /// number of buckets: bucket i counts the durations in [2^i, 2^(i+1)) nanoseconds (the first
+    /// one also counts 0, the last one everything above)
+    static constexpr size_t NUM_BUCKETS = 40;
+
+    /// number of recorded durations
+    uint64_t count = 0;
+    /// sum of the recorded durations
+    uint64_t totalNanos = 0;
+    uint64_t buckets[NUM_BUCKETS] = {};
+
+    /// Returns the upper bound of the bucket containing the given percentile (0 - 100) in
+    /// nanoseconds, i.e. an estimate that's at most twice the real value (0 if there's no data).
+    uint64_t percentile(double p) const noexcept
+    {
+        if (count == 0)
+        {
+            return 0;
+        }
+        const double rank = p / 100.0 * static_cast<double>(count);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < NUM_BUCKETS; ++i)
+        {
+            seen += buckets[i];
+            if (static_cast<double>(seen) >= rank && seen > 0)
+            {
+                return (uint64_t{ 2 } << i) - 1;
+            }
+        }
+        return UINT64_MAX;
+    }
+};
+
+/// The library's own counters and timings (since the start of the process), e.g. to find out
+/// whether the stack traces collected by an application are costly.
+struct Stats
+{
+    /// number of collected stack traces (except for captureCallers())
+    uint64_t captures = 0;
+    /// number of frames unwound for them
+    uint64_t framesWalked = 0;
+    /// time spent unwinding (excluding the symbol lookups)
+    LatencyHistogram unwindTime;
+
+    /// number of looked up addresses
+    uint64_t symbolLookups = 0;
+    /// a module's symbol table was already loaded / had to be loaded for a lookup
+    uint64_t symbolTableHits = 0;
+    uint64_t symbolTableMisses = 0;
+    /// callerName() found the name in its cache / had to look it up
+    uint64_t callerNameHits = 0;
+    uint64_t callerNameMisses = 0;
+    /// time spent demangling (the number of demangled names is the histogram's count)
+    LatencyHistogram demangleTime;
+
+    /// number of lines and bytes logged (via the log functions of the settings)
+    uint64_t logLines = 0;
+    uint64_t logBytes = 0;
+
+    /// time from entering abort() until just before the stats are printed - only recorded when
+    /// they are (see AbortSettings::printStats and OOOPSI_STATS)
+    LatencyHistogram abortTime;
+};
+
+/// Returns the library's counters and timings, summed up over all threads. The counters are
+/// updated without any locks, so concurrent updates may be partially visible.
+OOOPSI_EXPORT Stats getStats() noexcept;
+
+/// Prints the library's counters and timings (see getStats()).
+///
+/// @param settings     controls log function etc.
+OOOPSI_EXPORT void printStats(LogSettings settings = LogSettings());
+
 /// Aborts the current process' execution, similar to std::abort, but logs a stack trace and the
 /// given reason (optional).
 ///
@@ -124,6 +894,27 @@ OOOPSI_EXPORT LogFunc getAbortLogFunc() noexcept;
 /// RAII helper class to register all necessary handlers and hooks.
 /// You only need this class when building a static library - the shared lib does this
 /// automatically.
+///
+/// A process supervisor (e.g. a load balancer) can be notified about a crash before the stack
+/// trace is produced, which allows draining traffic early. Set one of these environment
+/// variables:
+///  - OOOPSI_NOTIFY_FD=<fd>: an inherited socket, pipe or eventfd
+///  - OOOPSI_NOTIFY_SOCKET=<path>: a unix datagram socket ('@' for the abstract namespace)
+/// Sockets and pipes receive the line "ooopsi: crash pid=<pid> signal=<sig>" (signal 0 if not
+/// caused by a signal), an eventfd is incremented.
+///
+/// The breadcrumbs printed in crash reports can be controlled via OOOPSI_BREADCRUMBS=<n> (per
+/// thread, 0 disables them) and OOOPSI_ALL_THREAD_BREADCRUMBS=1. Registers and memory contents
+/// are printed with OOOPSI_PRINT_REGISTERS=1 (and OOOPSI_MEMORY_DUMP_SIZE=<bytes>).
+///
+/// To keep crash reports even if nobody reads the log (e.g. a pipe whose reader is gone), set
+/// OOOPSI_JOURNAL=<path>: the file is mapped into memory at startup, and reports are copied into
+/// it without any system calls (see OOOPSI_JOURNAL_SIZE, default: 1MB). The oldest reports are
+/// overwritten when it's full. Use the ooopsi-journal tool to extract them. Linux only.
+///
+/// With OOOPSI_STATS=1, the library's own counters and timings (see printStats()) are printed at
+/// exit and at the end of crash reports (not of those handed off to the crash helper, see
+/// startCrashHelper()).
 class OOOPSI_EXPORT HandlerSetup
 {
 public:
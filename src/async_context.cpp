@@ -0,0 +1,71 @@
+/**
+ * @file    async_context.cpp
+ * @brief   causal parents of asynchronous tasks
+ */
+
+// public library header
+#include "ooopsi.hpp"
+// private library headers
+#include "internal.hpp"
+#include "stack_depot.hpp"
+
+#include <atomic>
+
+namespace ooopsi
+{
+
+/// the causal parent of the current thread's task
+static thread_local AsyncParentId s_asyncParent OOOPSI_TLS_INITIAL_EXEC = 0;
+/// counts the calls of captureAsyncParent() for sampling
+static thread_local unsigned s_captureCount OOOPSI_TLS_INITIAL_EXEC = 0;
+/// record every n-th call (0: none)
+static std::atomic<unsigned> s_samplingInterval{ 1 };
+
+
+AsyncParentId captureAsyncParent() noexcept
+{
+    const unsigned interval = s_samplingInterval.load(std::memory_order_relaxed);
+    if (interval == 0 || ++s_captureCount < interval)
+    {
+        return s_asyncParent;
+    }
+    s_captureCount = 0;
+
+    TraceSettings settings;
+    settings.maxFrames = s_MAX_DEPOT_FRAMES;
+    // skip this function
+    settings.skipFrames = 1;
+    RawFrame frames[s_MAX_DEPOT_FRAMES];
+    const size_t numFrames = collectRawStackTrace(frames, s_MAX_DEPOT_FRAMES, settings);
+
+    pointer_t addresses[s_MAX_DEPOT_FRAMES];
+    for (size_t i = 0; i < numFrames; ++i)
+    {
+        addresses[i] = frames[i].address;
+    }
+    const AsyncParentId id = depotStore(addresses, numFrames, s_asyncParent);
+    return id != 0 ? id : s_asyncParent;
+}
+
+AsyncParentId currentAsyncParent() noexcept
+{
+    return s_asyncParent;
+}
+
+void setAsyncSampling(unsigned interval) noexcept
+{
+    s_samplingInterval.store(interval, std::memory_order_relaxed);
+}
+
+
+AsyncParentScope::AsyncParentScope(AsyncParentId parent) noexcept : m_previous(s_asyncParent)
+{
+    s_asyncParent = parent;
+}
+
+AsyncParentScope::~AsyncParentScope()
+{
+    s_asyncParent = m_previous;
+}
+
+} // namespace ooopsi
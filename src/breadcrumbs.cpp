@@ -0,0 +1,212 @@
+/**
+ * @file    breadcrumbs.cpp
+ * @brief   per-thread flight recorder
+ */
+
+// public library header
+#include "ooopsi.hpp"
+// private library headers
+#include "breadcrumbs.hpp"
+
+#ifdef OOOPSI_LINUX
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+
+namespace ooopsi
+{
+
+/*
+ * Every thread writes its breadcrumbs to a ring buffer from a static pool, which it claims on
+ * its first breadcrumb and releases when it terminates. Only the owning thread writes to a ring,
+ * so writing a breadcrumb is a plain store and one atomic counter update.
+ */
+
+/// maximum number of threads with breadcrumbs at the same time
+static constexpr size_t s_MAX_BREADCRUMB_THREADS = 256;
+
+namespace
+{
+/// a single breadcrumb (32 bytes on 64-bit systems)
+struct Breadcrumb
+{
+    /// nanoseconds of the monotonic clock
+    uint64_t timestamp;
+    const char* message;
+    uint64_t arg1;
+    uint64_t arg2;
+};
+
+/// the breadcrumbs of a thread
+struct BreadcrumbRing
+{
+    /// claimed by a thread?
+    std::atomic<bool> inUse;
+    /// the owning thread's ID
+    uint64_t threadId;
+    /// number of breadcrumbs written so far
+    std::atomic<uint64_t> count;
+    Breadcrumb entries[s_BREADCRUMBS_PER_THREAD];
+};
+
+/// releases the current thread's ring when the thread terminates
+struct RingOwner
+{
+    ~RingOwner();
+};
+} // namespace
+
+static BreadcrumbRing s_rings[s_MAX_BREADCRUMB_THREADS];
+
+/// the current thread's ring (nullptr: not claimed yet)
+static thread_local BreadcrumbRing* s_ring OOOPSI_TLS_INITIAL_EXEC = nullptr;
+/// set if the pool was exhausted, so the thread doesn't try again on every breadcrumb
+static thread_local bool s_noRing OOOPSI_TLS_INITIAL_EXEC = false;
+static thread_local RingOwner s_ringOwner;
+
+RingOwner::~RingOwner()
+{
+    if (s_ring != nullptr)
+    {
+        s_ring->inUse.store(false, std::memory_order_release);
+        s_ring = nullptr;
+    }
+}
+
+/// Returns the monotonic time in nanoseconds.
+static uint64_t now() noexcept
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                   std::chrono::steady_clock::now().time_since_epoch())
+                                   .count());
+}
+
+/// Returns the current thread's ID (as shown by the OS tools).
+static uint64_t currentThreadId() noexcept
+{
+#ifdef OOOPSI_WINDOWS
+    return GetCurrentThreadId();
+#else
+    return static_cast<uint64_t>(syscall(SYS_gettid));
+#endif
+}
+
+/// Claims a ring for the current thread (nullptr if none is available).
+static BreadcrumbRing* claimRing() noexcept
+{
+    if (s_noRing)
+    {
+        return nullptr;
+    }
+    for (BreadcrumbRing& ring : s_rings)
+    {
+        bool inUse = false;
+        if (!ring.inUse.load(std::memory_order_relaxed) &&
+            ring.inUse.compare_exchange_strong(inUse, true, std::memory_order_acquire))
+        {
+            ring.threadId = currentThreadId();
+            ring.count.store(0, std::memory_order_release);
+            // registers the destructor
+            std::ignore = &s_ringOwner;
+            s_ring = &ring;
+            return &ring;
+        }
+    }
+    s_noRing = true;
+    return nullptr;
+}
+
+void leaveBreadcrumb(const char* message, uint64_t arg1, uint64_t arg2) noexcept
+{
+    BreadcrumbRing* ring = s_ring;
+    if (ring == nullptr)
+    {
+        ring = claimRing();
+        if (ring == nullptr)
+        {
+            return;
+        }
+    }
+    const uint64_t count = ring->count.load(std::memory_order_relaxed);
+    Breadcrumb& entry = ring->entries[count % s_BREADCRUMBS_PER_THREAD];
+    entry.timestamp = now();
+    entry.message = message;
+    entry.arg1 = arg1;
+    entry.arg2 = arg2;
+    ring->count.store(count + 1, std::memory_order_release);
+}
+
+
+/// Logs the most recent breadcrumbs of a single thread.
+static void logRing(const LogSettings& settings, const BreadcrumbRing& ring, size_t maxEntries,
+                    bool isCurrent, uint64_t timestamp)
+{
+    const uint64_t count = ring.count.load(std::memory_order_acquire);
+    const uint64_t numEntries = std::min<uint64_t>(count, maxEntries);
+    if (numEntries == 0)
+    {
+        return;
+    }
+
+    char messageBuffer[512];
+    snprintf(messageBuffer, sizeof(messageBuffer), "  thread %" PRIu64 "%s:", ring.threadId,
+             isCurrent ? " (current)" : "");
+    logLine(settings, messageBuffer);
+
+    for (uint64_t i = count - numEntries; i < count; ++i)
+    {
+        const Breadcrumb& entry = ring.entries[i % s_BREADCRUMBS_PER_THREAD];
+        const uint64_t ageUs =
+          timestamp > entry.timestamp ? (timestamp - entry.timestamp) / 1000 : 0;
+        snprintf(messageBuffer, sizeof(messageBuffer),
+                 "    -%" PRIu64 ".%03" PRIu64 " ms  %s (%" PRIu64 ", %" PRIu64 ")",
+                 ageUs / 1000, ageUs % 1000, entry.message != nullptr ? entry.message : "(null)",
+                 entry.arg1, entry.arg2);
+        logLine(settings, messageBuffer);
+    }
+}
+
+void logBreadcrumbs(const LogSettings& settings, size_t maxEntries, bool allThreads)
+{
+    maxEntries = std::min(maxEntries, s_BREADCRUMBS_PER_THREAD);
+    if (maxEntries == 0)
+    {
+        return;
+    }
+
+    // anything to log at all?
+    const BreadcrumbRing* current = s_ring;
+    bool hasEntries = current != nullptr && current->count.load(std::memory_order_acquire) > 0;
+    for (size_t i = 0; allThreads && !hasEntries && i < s_MAX_BREADCRUMB_THREADS; ++i)
+    {
+        hasEntries = s_rings[i].inUse.load(std::memory_order_acquire) &&
+                     s_rings[i].count.load(std::memory_order_acquire) > 0;
+    }
+    if (!hasEntries)
+    {
+        return;
+    }
+
+    const uint64_t timestamp = now();
+    logLine(settings, "--------- BREADCRUMBS ---------");
+    if (current != nullptr)
+    {
+        logRing(settings, *current, maxEntries, true, timestamp);
+    }
+    for (size_t i = 0; allThreads && i < s_MAX_BREADCRUMB_THREADS; ++i)
+    {
+        const BreadcrumbRing& ring = s_rings[i];
+        if (&ring != current && ring.inUse.load(std::memory_order_acquire))
+        {
+            logRing(settings, ring, maxEntries, false, timestamp);
+        }
+    }
+    logLine(settings, "-------------------------------");
+}
+
+} // namespace ooopsi
@@ -0,0 +1,31 @@
+/**
+ * @file    breadcrumbs.hpp
+ * @brief   per-thread flight recorder
+ */
+
+#ifndef BREADCRUMBS_HPP_
+#define BREADCRUMBS_HPP_
+
+#include "internal.hpp"
+
+namespace ooopsi
+{
+
+/// number of breadcrumbs kept per thread (older ones are overwritten)
+static constexpr size_t s_BREADCRUMBS_PER_THREAD = 64;
+
+/**
+ * Logs the most recent breadcrumbs (see leaveBreadcrumb()), starting with the current thread.
+ * Nothing is logged if there are none. Safe to use in signal handlers: this neither allocates
+ * memory nor takes locks. The breadcrumbs of other threads are read while they may be running,
+ * so a line might be torn (i.e. this is best effort).
+ *
+ * @param[in] settings      log settings (the log function must be set)
+ * @param[in] maxEntries    maximum number of breadcrumbs per thread
+ * @param[in] allThreads    include the other threads' breadcrumbs?
+ */
+void logBreadcrumbs(const LogSettings& settings, size_t maxEntries, bool allThreads);
+
+} // namespace ooopsi
+
+#endif /* BREADCRUMBS_HPP_ */
@@ -0,0 +1,182 @@
+/**
+ * @file    bulk_symbolizer.cpp
+ * @brief   parallel symbol lookup for many addresses
+ */
+
+// public library header
+#include "ooopsi.hpp"
+// private library headers
+#include "internal.hpp"
+
+#ifdef OOOPSI_LINUX
+
+#include "module_map.hpp"
+#include "symbolizer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace ooopsi
+{
+
+/// number of addresses a worker looks up at once
+static constexpr size_t s_CHUNK_SIZE = 4096;
+
+/**
+ * Runs 'task' for the indexes 0..numTasks-1, using up to 'numThreads' threads (including the
+ * calling one). Falls back to fewer threads if they can't be created.
+ */
+template <typename Task>
+static void runParallel(size_t numTasks, unsigned numThreads, const Task& task)
+{
+    std::atomic<size_t> next{ 0 };
+    auto worker = [&next, numTasks, &task]() {
+        for (size_t i = next++; i < numTasks; i = next++)
+        {
+            task(i);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    const size_t numHelpers = std::min<size_t>(numThreads, numTasks);
+    for (size_t i = 1; i < numHelpers; ++i)
+    {
+        try
+        {
+            threads.emplace_back(worker);
+        }
+        catch (const std::system_error&)
+        {
+            break;
+        }
+    }
+    worker();
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+}
+
+void symbolizeAddresses(const pointer_t* addresses, size_t count, SymbolInfo* results,
+                        unsigned numThreads) noexcept
+{
+    std::fill(results, results + count, SymbolInfo());
+    if (numThreads == 0)
+    {
+        numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    try
+    {
+        // deduplicate and sort, so every module's addresses form a contiguous range
+        std::vector<uintptr_t> unique(count);
+        std::transform(addresses, addresses + count, unique.begin(),
+                       [](pointer_t addr) { return reinterpret_cast<uintptr_t>(addr); });
+        std::sort(unique.begin(), unique.end());
+        unique.erase(std::unique(unique.begin(), unique.end()), unique.end());
+
+        updateModuleMap();
+        const ModuleMap& modules = currentModuleMap();
+
+        // one range per module
+        struct ModuleRange
+        {
+            const ModuleInfo* module;
+            size_t begin;
+            size_t end;
+            const ModuleSymbols* symbols;
+        };
+        std::vector<ModuleRange> ranges;
+        // the addresses outside of all modules (e.g. JIT code)
+        std::vector<size_t> unknown;
+        for (size_t i = 0; i < unique.size();)
+        {
+            const ModuleInfo* module = modules.find(unique[i]);
+            if (module == nullptr)
+            {
+                unknown.push_back(i++);
+                continue;
+            }
+            const size_t begin = i;
+            while (i < unique.size() && unique[i] < module->end)
+            {
+                ++i;
+            }
+            ranges.push_back(ModuleRange{ module, begin, i, nullptr });
+        }
+
+        // load the symbol tables (in parallel, the larger ones take a while)
+        runParallel(ranges.size(), numThreads, [&ranges](size_t i) {
+            ranges[i].symbols = loadModuleSymbols(*ranges[i].module);
+        });
+
+        // look up the addresses in chunks, which may span several modules
+        std::vector<SymbolInfo> uniqueResults(unique.size());
+        const size_t numChunks = (unique.size() + s_CHUNK_SIZE - 1) / s_CHUNK_SIZE;
+        runParallel(numChunks, numThreads, [&](size_t chunk) {
+            const size_t begin = chunk * s_CHUNK_SIZE;
+            const size_t end = std::min(begin + s_CHUNK_SIZE, unique.size());
+            auto range = std::upper_bound(ranges.begin(), ranges.end(), begin,
+                                          [](size_t index, const ModuleRange& r) {
+                                              return index < r.end;
+                                          });
+            for (; range != ranges.end() && range->begin < end; ++range)
+            {
+                if (range->symbols == nullptr)
+                {
+                    continue;
+                }
+                for (size_t i = std::max(begin, range->begin); i < std::min(end, range->end); ++i)
+                {
+                    uint64_t offset = 0;
+                    uniqueResults[i].function = findSymbol(*range->symbols, unique[i], offset);
+                    uniqueResults[i].offset = static_cast<size_t>(offset);
+                }
+            }
+        });
+        // (the registered functions are guarded by a single lock, no need to parallelize)
+        for (size_t i : unknown)
+        {
+            uint64_t offset = 0;
+            uniqueResults[i].function = findProvidedSymbol(unique[i], offset);
+            uniqueResults[i].offset = static_cast<size_t>(offset);
+        }
+
+        // back to the input order
+        const size_t numInputChunks = (count + s_CHUNK_SIZE - 1) / s_CHUNK_SIZE;
+        runParallel(numInputChunks, numThreads, [&](size_t chunk) {
+            const size_t end = std::min((chunk + 1) * s_CHUNK_SIZE, count);
+            for (size_t i = chunk * s_CHUNK_SIZE; i < end; ++i)
+            {
+                const auto addr = reinterpret_cast<uintptr_t>(addresses[i]);
+                const auto pos = std::lower_bound(unique.begin(), unique.end(), addr);
+                results[i] = uniqueResults[static_cast<size_t>(pos - unique.begin())];
+            }
+        });
+    }
+    catch (const std::bad_alloc&)
+    {
+        // nothing found
+    }
+}
+
+} // namespace ooopsi
+
+#else // !OOOPSI_LINUX
+
+namespace ooopsi
+{
+
+void symbolizeAddresses(const pointer_t* /*addresses*/, size_t count, SymbolInfo* results,
+                        unsigned /*numThreads*/) noexcept
+{
+    // not supported (yet)
+    std::fill(results, results + count, SymbolInfo());
+}
+
+} // namespace ooopsi
+
+#endif // OOOPSI_LINUX
@@ -0,0 +1,133 @@
+/**
+ * @file    callers.cpp
+ * @brief   support functions for captureCallers()
+ */
+
+// public library header
+#include "ooopsi.hpp"
+// private library headers
+#include "internal.hpp"
+
+#ifdef OOOPSI_LINUX
+#include "module_map.hpp"
+#include "stats.hpp"
+#include "symbolizer.hpp"
+
+#include <pthread.h>
+#endif
+
+#include <algorithm>
+#include <mutex>
+#include <new>
+#include <string>
+#include <unordered_map>
+
+namespace ooopsi
+{
+
+#ifdef OOOPSI_LINUX
+/// Gets the lowest address and the size of the current thread's stack.
+static bool getCurrentStack(uintptr_t& address, size_t& size) noexcept
+{
+    pthread_attr_t attr;
+    if (pthread_getattr_np(pthread_self(), &attr) != 0)
+    {
+        return false;
+    }
+    void* stackAddr = nullptr;
+    const int rc = pthread_attr_getstack(&attr, &stackAddr, &size);
+    pthread_attr_destroy(&attr);
+    address = reinterpret_cast<uintptr_t>(stackAddr);
+    return rc == 0;
+}
+#endif
+
+uintptr_t currentStackStart() noexcept
+{
+#ifdef OOOPSI_LINUX
+    uintptr_t address = 0;
+    size_t size = 0;
+    return getCurrentStack(address, size) ? address : 0;
+#else
+    // not supported (yet)
+    return 0;
+#endif
+}
+
+uintptr_t currentStackEnd() noexcept
+{
+#ifdef OOOPSI_LINUX
+    uintptr_t address = 0;
+    size_t size = 0;
+    return getCurrentStack(address, size) ? address + size : 0;
+#else
+    // not supported (yet)
+    return 0;
+#endif
+}
+
+size_t collectCallers(pointer_t* buffer, size_t count) noexcept
+{
+    TraceSettings settings;
+    // skip this function and the caller
+    settings.skipFrames = 2;
+    RawFrame frames[s_MAX_STACK_FRAMES];
+    const size_t numFrames =
+      collectRawStackTrace(frames, std::min(count, s_MAX_STACK_FRAMES), settings);
+    for (size_t i = 0; i < count; ++i)
+    {
+        buffer[i] = i < numFrames ? frames[i].address : nullptr;
+    }
+    return numFrames;
+}
+
+#ifdef OOOPSI_LINUX
+
+/// guards s_callerNames
+static std::mutex s_callerNamesMutex;
+/// cached names by return address (never removed, the names must stay valid)
+static std::unordered_map<pointer_t, std::string> s_callerNames;
+
+const char* callerName(pointer_t returnAddress) noexcept
+{
+    try
+    {
+        const std::lock_guard<std::mutex> lock(s_callerNamesMutex);
+        auto it = s_callerNames.find(returnAddress);
+        if (it != s_callerNames.end())
+        {
+            countStat(StatCounter::CallerNameHits);
+        }
+        else
+        {
+            countStat(StatCounter::CallerNameMisses);
+            // look up the call instruction, a return address may point to the next function
+            const auto address = reinterpret_cast<uintptr_t>(returnAddress) - 1;
+            updateModuleMap();
+            const ModuleInfo* module = currentModuleMap().find(address);
+            uint64_t offset = 0;
+            const char* symbol = module != nullptr ? findSymbol(*module, address, offset)
+                                                   : findProvidedSymbol(address, offset);
+            it = s_callerNames
+                   .emplace(returnAddress, symbol != nullptr ? demangle(symbol) : std::string())
+                   .first;
+        }
+        return it->second.empty() ? nullptr : it->second.c_str();
+    }
+    catch (const std::bad_alloc&)
+    {
+        return nullptr;
+    }
+}
+
+#else // !OOOPSI_LINUX
+
+const char* callerName(pointer_t /*returnAddress*/) noexcept
+{
+    // not supported (yet)
+    return nullptr;
+}
+
+#endif // OOOPSI_LINUX
+
+} // namespace ooopsi
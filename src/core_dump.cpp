@@ -0,0 +1,69 @@
+/**
+ * @file    core_dump.cpp
+ * @brief   keeping memory out of core dumps
+ */
+
+// public library header
+#include "ooopsi.hpp"
+// private library headers
+#include "internal.hpp"
+
+#ifdef OOOPSI_LINUX
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace ooopsi
+{
+
+/// Applies madvise() advice to the whole pages in [address, address + size).
+static bool adviseWholePages(pointer_t address, size_t size, int advice) noexcept
+{
+    const auto pageSize = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    const auto addr = reinterpret_cast<uintptr_t>(address);
+    if (addr + size < addr)
+    {
+        return false;
+    }
+    const uintptr_t begin = (addr + pageSize - 1) & ~(pageSize - 1);
+    const uintptr_t end = (addr + size) & ~(pageSize - 1);
+    if (begin >= end)
+    {
+        // not a single page: nothing to do
+        return true;
+    }
+    return madvise(reinterpret_cast<void*>(begin), end - begin, advice) == 0;
+}
+
+bool excludeFromCoreDump(pointer_t address, size_t size) noexcept
+{
+    return adviseWholePages(address, size, MADV_DONTDUMP);
+}
+
+bool includeInCoreDump(pointer_t address, size_t size) noexcept
+{
+    return adviseWholePages(address, size, MADV_DODUMP);
+}
+
+} // namespace ooopsi
+
+#else // !OOOPSI_LINUX
+
+namespace ooopsi
+{
+
+bool excludeFromCoreDump(pointer_t /*address*/, size_t /*size*/) noexcept
+{
+    // not supported (yet)
+    return false;
+}
+
+bool includeInCoreDump(pointer_t /*address*/, size_t /*size*/) noexcept
+{
+    // not supported (yet)
+    return false;
+}
+
+} // namespace ooopsi
+
+#endif // OOOPSI_LINUX
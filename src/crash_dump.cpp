@@ -0,0 +1,144 @@
+/**
+ * @file    crash_dump.cpp
+ * @brief   registers and memory contents for crash reports (Linux only)
+ */
+
+// private library header
+#include "crash_dump.hpp"
+
+#ifdef OOOPSI_LINUX
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+
+namespace ooopsi
+{
+
+/// names of the registers stored in ucontext_t::uc_mcontext.gregs
+static const char* const s_REGISTER_NAMES[] = {
+    "r8",  "r9",  "r10", "r11", "r12", "r13", "r14",    "r15",    "rdi",  "rsi",    "rbp", "rbx",
+    "rdx", "rax", "rcx", "rsp", "rip", "eflags", "csgsfs", "err", "trapno", "oldmask", "cr2"
+};
+static_assert(sizeof(s_REGISTER_NAMES) / sizeof(s_REGISTER_NAMES[0]) == s_NUM_REGISTERS,
+              "unexpected register layout");
+
+/// bytes per line of a hexdump
+static constexpr uintptr_t s_BYTES_PER_LINE = 16;
+
+
+void logRegisters(const LogSettings& settings, const uint64_t* registers, size_t numRegisters)
+{
+    logLine(settings, "---------- REGISTERS ----------");
+    char messageBuffer[128];
+    messageBuffer[0] = '\0';
+    for (size_t i = 0; i < numRegisters; ++i)
+    {
+        const size_t len = strlen(messageBuffer);
+        snprintf(messageBuffer + len, sizeof(messageBuffer) - len, "  %-7s 0x%016" PRIx64,
+                 s_REGISTER_NAMES[i], registers[i]);
+        if (i % 3 == 2 || i + 1 == numRegisters)
+        {
+            logLine(settings, messageBuffer);
+            messageBuffer[0] = '\0';
+        }
+    }
+    logLine(settings, "-------------------------------");
+}
+
+void logMemory(const LogSettings& settings, const char* header, pointer_t address, size_t before,
+               size_t after)
+{
+    const auto addr = reinterpret_cast<uintptr_t>(address);
+    const uintptr_t begin = (addr - std::min<uintptr_t>(addr, before)) & ~(s_BYTES_PER_LINE - 1);
+    const uintptr_t end = addr + std::min<uintptr_t>(after, UINTPTR_MAX - addr);
+
+    logLine(settings, header);
+    // process_vm_readv() reports unreadable memory instead of raising another signal
+    const pid_t self = getpid();
+    bool skipping = false;
+    for (uintptr_t line = begin; line < end && line <= UINTPTR_MAX - s_BYTES_PER_LINE;
+         line += s_BYTES_PER_LINE)
+    {
+        unsigned char bytes[s_BYTES_PER_LINE];
+        iovec local{ bytes, sizeof(bytes) };
+        iovec remote{ reinterpret_cast<void*>(line), sizeof(bytes) };
+        char messageBuffer[128];
+        if (process_vm_readv(self, &local, 1, &remote, 1, 0) != sizeof(bytes))
+        {
+            // log only the first line of an unreadable range
+            if (!skipping)
+            {
+                snprintf(messageBuffer, sizeof(messageBuffer),
+                         "   0x%016" PRIxPTR ":  (not readable)", line);
+                logLine(settings, messageBuffer);
+                skipping = true;
+            }
+            continue;
+        }
+        skipping = false;
+
+        uint64_t words[2];
+        memcpy(words, bytes, sizeof(words));
+        char ascii[s_BYTES_PER_LINE + 1];
+        for (size_t i = 0; i < s_BYTES_PER_LINE; ++i)
+        {
+            ascii[i] = bytes[i] >= 0x20 && bytes[i] < 0x7f ? static_cast<char>(bytes[i]) : '.';
+        }
+        ascii[s_BYTES_PER_LINE] = '\0';
+        const bool highlight = addr >= line && addr - line < s_BYTES_PER_LINE;
+        snprintf(messageBuffer, sizeof(messageBuffer),
+                 "%s0x%016" PRIxPTR ":  %016" PRIx64 " %016" PRIx64 "  |%s|",
+                 highlight ? "=> " : "   ", line, words[0], words[1], ascii);
+        logLine(settings, messageBuffer);
+    }
+    logLine(settings, "-------------------------------");
+}
+
+void logMachineState(const AbortSettings& settings, const CrashContext& context)
+{
+    if (!settings.printRegisters || context.ucontext == nullptr)
+    {
+        return;
+    }
+
+    const auto* uc = static_cast<const ucontext_t*>(context.ucontext);
+    uint64_t registers[s_NUM_REGISTERS];
+    for (size_t i = 0; i < s_NUM_REGISTERS; ++i)
+    {
+        registers[i] = static_cast<uint64_t>(uc->uc_mcontext.gregs[i]);
+    }
+    logRegisters(settings, registers, s_NUM_REGISTERS);
+
+    const size_t size = std::min(settings.memoryDumpSize, s_MAX_MEMORY_DUMP_SIZE);
+    if (size == 0)
+    {
+        return;
+    }
+    // mostly the caller's frames, which are above the stack pointer
+    const auto stackPtr = reinterpret_cast<pointer_t>(uc->uc_mcontext.gregs[REG_RSP]);
+    logMemory(settings, "------------ STACK ------------", stackPtr, size / 4, size - size / 4);
+    if (context.dataAddr != nullptr)
+    {
+        logMemory(settings, "-------- FAULT ADDRESS --------", *context.dataAddr, size / 2,
+                  size - size / 2);
+    }
+}
+
+} // namespace ooopsi
+
+#else // !OOOPSI_LINUX
+
+namespace ooopsi
+{
+
+void logMachineState(const AbortSettings& /*settings*/, const CrashContext& /*context*/)
+{
+    // not supported (yet)
+}
+
+} // namespace ooopsi
+
+#endif // OOOPSI_LINUX
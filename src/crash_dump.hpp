@@ -0,0 +1,61 @@
+/**
+ * @file    crash_dump.hpp
+ * @brief   registers and memory contents for crash reports (Linux only)
+ */
+
+#ifndef CRASH_DUMP_HPP_
+#define CRASH_DUMP_HPP_
+
+#include "internal.hpp"
+
+#ifdef OOOPSI_LINUX
+#include <sys/ucontext.h>
+#endif
+
+namespace ooopsi
+{
+
+/// upper limit for AbortSettings::memoryDumpSize
+static constexpr size_t s_MAX_MEMORY_DUMP_SIZE = 4096;
+
+#ifdef OOOPSI_LINUX
+/// number of registers stored in ucontext_t::uc_mcontext.gregs
+static constexpr size_t s_NUM_REGISTERS = NGREG;
+
+/**
+ * Logs the general-purpose registers, three per line.
+ *
+ * @param[in] settings      log settings (the log function must be set)
+ * @param[in] registers     the register values, in the order of ucontext_t::uc_mcontext.gregs
+ * @param[in] numRegisters  number of values
+ */
+void logRegisters(const LogSettings& settings, const uint64_t* registers, size_t numRegisters);
+
+/**
+ * Logs a hexdump of the memory around the given address, 16 bytes per line. The line containing
+ * the address is highlighted. Memory that isn't readable (e.g. not mapped) is skipped: it's read
+ * without the risk of faulting again. Safe to use in signal handlers.
+ *
+ * @param[in] settings      log settings (the log function must be set)
+ * @param[in] header        the section's header line
+ * @param[in] address       the address of interest
+ * @param[in] before        number of bytes to dump before 'address'
+ * @param[in] after         number of bytes to dump starting at 'address'
+ */
+void logMemory(const LogSettings& settings, const char* header, pointer_t address, size_t before,
+               size_t after);
+#endif // OOOPSI_LINUX
+
+/**
+ * Logs the registers and the memory around the stack pointer and the faulting address, as
+ * requested by the settings (see AbortSettings::printRegisters). Does nothing if the context
+ * has no ucontext. Linux only.
+ *
+ * @param[in] settings      the abort settings (the log function must be set)
+ * @param[in] context       details about the crash
+ */
+void logMachineState(const AbortSettings& settings, const CrashContext& context);
+
+} // namespace ooopsi
+
+#endif /* CRASH_DUMP_HPP_ */
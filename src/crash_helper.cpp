@@ -0,0 +1,383 @@
+/**
+ * @file    crash_helper.cpp
+ * @brief   pre-forked helper process that symbolizes crash reports
+ */
+
+// public library header
+#include "ooopsi.hpp"
+// private library headers
+#include "breadcrumbs.hpp"
+#include "crash_dump.hpp"
+#include "crash_helper.hpp"
+#include "journal.hpp"
+#include "module_map.hpp"
+
+#ifdef OOOPSI_LINUX
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/ucontext.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+
+namespace ooopsi
+{
+
+/// identifies a crash record ("OOPS")
+static constexpr uint32_t s_RECORD_MAGIC = 0x53504f4f;
+/// space for the sections logged by the crashing process (breadcrumbs, memory dumps)
+static constexpr size_t s_MAX_RECORD_TEXT = 64 * 1024;
+/// appended to the sections when they didn't fit
+static const char s_TEXT_TRUNCATED[] = "  ... (truncated)\n";
+
+namespace
+{
+/// Everything the helper needs to know about a crash. The modules are stored last, so only the
+/// used part of the record needs to be sent.
+struct CrashRecord
+{
+    uint32_t magic;
+    uint32_t size;
+    char reason[512];
+    bool hasFaultAddr;
+    pointer_t faultAddr;
+    bool compactNames;
+    uint32_t maxTemplateDepth;
+    uint32_t numRegisters;
+    uint64_t registers[s_NUM_REGISTERS];
+    uint32_t numFrames;
+    RawFrame frames[s_MAX_STACK_FRAMES];
+    /// lines terminated by '\n' (not by '\0')
+    uint32_t textSize;
+    char text[s_MAX_RECORD_TEXT];
+    uint32_t numModules;
+    ModuleInfo modules[s_MAX_STACK_FRAMES];
+};
+} // namespace
+
+/// size of a record without any modules
+static constexpr size_t s_MIN_RECORD_SIZE = offsetof(CrashRecord, modules);
+
+/// socket connected to the helper (-1 if not running)
+static int s_helperSocket = -1;
+/// the process that started the helper: forked children inherit the socket, but not the helper
+static pid_t s_helperOwner = 0;
+/// the log function used by the helper
+static LogFunc s_helperLogFunc = nullptr;
+/// set by the first thread that hands off a crash
+static std::atomic<bool> s_crashHandedOff{ false };
+/// the record is too large for the (alternate) stack
+static CrashRecord s_record;
+
+/// set when the record's text is full
+static bool s_recordTextFull = false;
+
+/// set in the helper when its parent terminated
+static volatile sig_atomic_t s_parentDied = 0;
+
+
+/// Log function that appends the lines to the record's text (whole lines only).
+static void appendToRecord(const char* line)
+{
+    CrashRecord& record = s_record;
+    if (line == nullptr || s_recordTextFull)
+    {
+        return;
+    }
+    const size_t length = strlen(line);
+    // keep space for the truncation marker
+    const size_t available =
+      sizeof(record.text) - (sizeof(s_TEXT_TRUNCATED) - 1) - record.textSize;
+    if (length + 1 > available)
+    {
+        memcpy(record.text + record.textSize, s_TEXT_TRUNCATED, sizeof(s_TEXT_TRUNCATED) - 1);
+        record.textSize += static_cast<uint32_t>(sizeof(s_TEXT_TRUNCATED) - 1);
+        s_recordTextFull = true;
+        return;
+    }
+    memcpy(record.text + record.textSize, line, length);
+    record.text[record.textSize + length] = '\n';
+    record.textSize += static_cast<uint32_t>(length + 1);
+}
+
+bool handOffCrash(const char* reason, const AbortSettings& settings,
+                  const CrashContext& context) noexcept
+{
+    if (s_helperSocket < 0 || getpid() != s_helperOwner || settings.logFunc != s_helperLogFunc ||
+        s_crashHandedOff.exchange(true))
+    {
+        return false;
+    }
+
+    CrashRecord& record = s_record;
+    record.magic = s_RECORD_MAGIC;
+    strncpy(record.reason, reason != nullptr ? reason : "", sizeof(record.reason) - 1);
+    record.reason[sizeof(record.reason) - 1] = '\0';
+    record.hasFaultAddr = context.faultAddr != nullptr;
+    record.faultAddr = record.hasFaultAddr ? *context.faultAddr : nullptr;
+    record.compactNames = settings.compactNames;
+    record.maxTemplateDepth = settings.maxTemplateDepth;
+
+    // the sections that only the crashing process can log: the breadcrumbs are in its memory,
+    // the stack and the faulting address may be overwritten before the helper reads them
+    record.textSize = 0;
+    s_recordTextFull = false;
+    AbortSettings textSettings = settings;
+    textSettings.logFunc = appendToRecord;
+    logBreadcrumbs(textSettings, settings.numBreadcrumbs, settings.allThreadBreadcrumbs);
+    logMachineState(textSettings, context);
+
+    // (already part of the text if requested)
+    record.numRegisters = 0;
+    if (context.ucontext != nullptr && !settings.printRegisters)
+    {
+        const auto* uc = static_cast<const ucontext_t*>(context.ucontext);
+        for (size_t i = 0; i < s_NUM_REGISTERS; ++i)
+        {
+            record.registers[i] = static_cast<uint64_t>(uc->uc_mcontext.gregs[i]);
+        }
+        record.numRegisters = s_NUM_REGISTERS;
+    }
+
+    const size_t numFrames = collectRawStackTrace(record.frames, s_MAX_STACK_FRAMES);
+    record.numFrames = static_cast<uint32_t>(numFrames);
+
+    // only send the modules referenced by the trace
+    size_t numModules = 0;
+    for (size_t i = 0; i < numFrames; ++i)
+    {
+        const ModuleInfo* module = findModule(record.frames[i].address);
+        if (module == nullptr)
+        {
+            continue;
+        }
+        ModuleInfo* end = record.modules + numModules;
+        if (std::find_if(record.modules, end, [module](const ModuleInfo& mod) {
+                return mod.begin == module->begin;
+            }) == end)
+        {
+            record.modules[numModules++] = *module;
+        }
+    }
+    std::sort(record.modules, record.modules + numModules,
+              [](const ModuleInfo& lhs, const ModuleInfo& rhs) { return lhs.begin < rhs.begin; });
+    record.numModules = static_cast<uint32_t>(numModules);
+    record.size = static_cast<uint32_t>(s_MIN_RECORD_SIZE + numModules * sizeof(ModuleInfo));
+
+    // a single message: the record is either sent as a whole or not at all
+    ssize_t sent;
+    do
+    {
+        sent = send(s_helperSocket, &record, record.size, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    // otherwise, the helper is gone
+    return sent == static_cast<ssize_t>(record.size);
+}
+
+
+/// Logs a crash record of the given process, looking up all symbols.
+static void logCrash(const CrashRecord& record, pid_t crashed)
+{
+    LogSettings settings;
+    settings.logFunc = startJournalReport(s_helperLogFunc, crashed);
+    settings.demangleNames = true;
+    settings.compactNames = record.compactNames;
+    settings.maxTemplateDepth = record.maxTemplateDepth;
+    settings.expandInlinedFrames = true;
+
+    if (record.reason[0] != '\0')
+    {
+        logLine(settings, record.reason);
+    }
+    char lineBuffer[512];
+    for (size_t begin = 0; begin < record.textSize;)
+    {
+        const char* end = static_cast<const char*>(
+          memchr(record.text + begin, '\n', record.textSize - begin));
+        const size_t length = static_cast<size_t>(end - record.text) - begin;
+        const size_t copied = std::min(length, sizeof(lineBuffer) - 1);
+        memcpy(lineBuffer, record.text + begin, copied);
+        lineBuffer[copied] = '\0';
+        logLine(settings, lineBuffer);
+        begin += length + 1;
+    }
+    printRawStackTrace(record.frames, record.numFrames, settings,
+                       record.hasFaultAddr ? &record.faultAddr : nullptr, true, record.modules,
+                       record.numModules);
+    if (record.numRegisters > 0)
+    {
+        logRegisters(settings, record.registers, record.numRegisters);
+    }
+    logLine(settings, nullptr);
+}
+
+/// Checks that a received crash record is complete and consistent.
+static bool isValid(const CrashRecord& record, size_t size)
+{
+    return size >= s_MIN_RECORD_SIZE && record.magic == s_RECORD_MAGIC && record.size == size &&
+           record.numFrames <= s_MAX_STACK_FRAMES && record.numModules <= s_MAX_STACK_FRAMES &&
+           record.numRegisters <= s_NUM_REGISTERS && record.textSize <= sizeof(record.text) &&
+           (record.textSize == 0 || record.text[record.textSize - 1] == '\n') &&
+           size == s_MIN_RECORD_SIZE + record.numModules * sizeof(ModuleInfo) &&
+           record.reason[sizeof(record.reason) - 1] == '\0';
+}
+
+/// SIGHUP handler of the helper, see PR_SET_PDEATHSIG
+static void onParentDeath(int /*sig*/)
+{
+    s_parentDied = 1;
+}
+
+/**
+ * Main function of the helper process: waits until the parent sends a crash record or
+ * terminates. The helper doesn't do anything while waiting, so apart from the pages touched
+ * here, all memory stays shared with the parent (copy-on-write).
+ *
+ * @param[in] sock      socket connected to the parent
+ * @param[in] parent    the parent's process ID
+ */
+[[noreturn]] static void runHelper(int sock, pid_t parent)
+{
+    prctl(PR_SET_NAME, "ooopsi-helper", 0, 0, 0);
+
+    // SIGHUP is only unblocked while waiting in ppoll(), so it can't get lost
+    sigset_t hupMask;
+    sigset_t waitMask;
+    sigemptyset(&hupMask);
+    sigaddset(&hupMask, SIGHUP);
+    sigprocmask(SIG_BLOCK, &hupMask, &waitMask);
+    sigdelset(&waitMask, SIGHUP);
+
+    struct sigaction act; // NOLINT (initialization below)
+    memset(&act, 0, sizeof(act));
+    sigemptyset(&act.sa_mask);
+    act.sa_handler = onParentDeath;
+    sigaction(SIGHUP, &act, nullptr);
+    // Ctrl+C is sent to the whole process group: let the parent decide what happens
+    signal(SIGINT, SIG_IGN);
+
+    // the socket may be inherited by other children of the parent, so it doesn't necessarily
+    // signal EOF when the parent dies - the kernel tells us instead
+    prctl(PR_SET_PDEATHSIG, SIGHUP, 0, 0, 0);
+    if (getppid() != parent)
+    {
+        // too late
+        s_parentDied = 1;
+    }
+
+    CrashRecord& record = s_record;
+    size_t received = 0;
+    for (;;)
+    {
+        // once the parent is gone, only read what's left in the socket
+        pollfd pfd{ sock, POLLIN, 0 };
+        const timespec noWait{ 0, 0 };
+        const int rc = ppoll(&pfd, 1, s_parentDied ? &noWait : nullptr, &waitMask);
+        if (rc < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (rc <= 0)
+        {
+            break;
+        }
+        // the record is a single message
+        const ssize_t n = recv(sock, &record, sizeof(record), MSG_DONTWAIT);
+        if (n < 0 && (errno == EINTR || errno == EAGAIN))
+        {
+            continue;
+        }
+        if (n > 0)
+        {
+            received = static_cast<size_t>(n);
+        }
+        // (or EOF)
+        break;
+    }
+
+    if (isValid(record, received))
+    {
+        try
+        {
+            logCrash(record, parent);
+        }
+        catch (...)
+        {
+            // nothing we can do about it
+        }
+    }
+    _exit(0);
+}
+
+bool startCrashHelper() noexcept
+{
+    if (s_helperSocket >= 0)
+    {
+        if (s_helperOwner == getpid())
+        {
+            return true;
+        }
+        // inherited from the parent: its helper stays with the parent
+        close(s_helperSocket);
+        s_helperSocket = -1;
+    }
+
+    int sockets[2];
+    // message boundaries are kept, so a record can't be received partially
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sockets) != 0)
+    {
+        return false;
+    }
+    // a record is sent as a single message, so the buffer must be able to hold a whole one
+    const int bufferSize = static_cast<int>(sizeof(CrashRecord));
+    setsockopt(sockets[0], SOL_SOCKET, SO_SNDBUF, &bufferSize, sizeof(bufferSize));
+    s_helperLogFunc = getAbortLogFunc();
+
+    const pid_t parent = getpid();
+    const pid_t pid = fork();
+    if (pid < 0)
+    {
+        close(sockets[0]);
+        close(sockets[1]);
+        return false;
+    }
+    if (pid == 0)
+    {
+        close(sockets[0]);
+        runHelper(sockets[1], parent);
+    }
+    close(sockets[1]);
+    s_helperSocket = sockets[0];
+    s_helperOwner = parent;
+    return true;
+}
+
+} // namespace ooopsi
+
+#else // !OOOPSI_LINUX
+
+namespace ooopsi
+{
+
+bool handOffCrash(const char* /*reason*/, const AbortSettings& /*settings*/,
+                  const CrashContext& /*context*/) noexcept
+{
+    return false;
+}
+
+bool startCrashHelper() noexcept
+{
+    // not supported (yet)
+    return false;
+}
+
+} // namespace ooopsi
+
+#endif // OOOPSI_LINUX
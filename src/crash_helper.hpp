@@ -0,0 +1,35 @@
+/**
+ * @file    crash_helper.hpp
+ * @brief   pre-forked helper process that symbolizes crash reports (Linux only)
+ */
+
+#ifndef CRASH_HELPER_HPP_
+#define CRASH_HELPER_HPP_
+
+#include "internal.hpp"
+
+namespace ooopsi
+{
+
+/**
+ * Passes a crash to the helper process (if it's running): collects the raw stack trace, the
+ * registers, the referenced modules and the sections that need the crashing process' memory
+ * (breadcrumbs and memory dumps, as requested by 'settings') and sends them to the helper, which
+ * symbolizes and logs them. This is safe to use in signal handlers (no allocation, no locks).
+ *
+ * The hand-off is refused if the helper isn't running, if it was started by another process
+ * (i.e. this is a forked child), if another thread already handed off a crash or if 'settings'
+ * use a different log function than the helper (which uses the one that was active when it was
+ * started).
+ *
+ * @param[in] reason        the abort reason (optional)
+ * @param[in] settings      the abort settings (log function must be set)
+ * @param[in] context       details about the crash
+ * @return true if the helper took over, i.e. the caller should exit without logging anything
+ */
+bool handOffCrash(const char* reason, const AbortSettings& settings,
+                  const CrashContext& context) noexcept;
+
+} // namespace ooopsi
+
+#endif /* CRASH_HELPER_HPP_ */
@@ -0,0 +1,232 @@
+/**
+ * @file    crash_notify.cpp
+ * @brief   early notification of a process supervisor about a crash
+ */
+
+// private library header
+#include "crash_notify.hpp"
+
+#ifdef OOOPSI_LINUX
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+
+namespace ooopsi
+{
+
+/// how to deliver the notification
+enum class NotifyType
+{
+    NONE,
+    SOCKET,
+    EVENTFD,
+    FILE
+};
+
+/// the notification target
+static int s_notifyFd = -1;
+static NotifyType s_notifyType = NotifyType::NONE;
+/// s_notifyFd was opened here (and is closed when replaced)?
+static bool s_ownsNotifyFd = false;
+/// set by the first notification
+static std::atomic<bool> s_notified{ false };
+
+
+/// Determines how to write to an inherited file descriptor.
+static NotifyType detectType(int fd) noexcept
+{
+    struct stat st; // NOLINT (initialized by fstat)
+    if (fstat(fd, &st) != 0)
+    {
+        return NotifyType::NONE;
+    }
+    if (S_ISSOCK(st.st_mode))
+    {
+        return NotifyType::SOCKET;
+    }
+    // an eventfd is an anonymous inode - check its name
+    char procPath[64];
+    char target[64];
+    snprintf(procPath, sizeof(procPath), "/proc/self/fd/%d", fd);
+    const ssize_t len = readlink(procPath, target, sizeof(target) - 1);
+    if (len > 0)
+    {
+        target[len] = '\0';
+        if (strcmp(target, "anon_inode:[eventfd]") == 0)
+        {
+            return NotifyType::EVENTFD;
+        }
+    }
+    return NotifyType::FILE;
+}
+
+/// Connects a datagram socket to the given unix socket path.
+static int connectSocket(const char* path) noexcept
+{
+    sockaddr_un addr; // NOLINT (initialization below)
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    const size_t pathLen = strlen(path);
+    if (pathLen == 0 || pathLen >= sizeof(addr.sun_path))
+    {
+        return -1;
+    }
+    memcpy(addr.sun_path, path, pathLen);
+    if (path[0] == '@')
+    {
+        // abstract namespace
+        addr.sun_path[0] = '\0';
+    }
+
+    const int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    const auto addrLen = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + pathLen +
+                                                (path[0] == '@' ? 0 : 1));
+    if (connect(fd, reinterpret_cast<const sockaddr*>(&addr), addrLen) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Opens an inherited pipe, FIFO or file again, non-blocking: a full pipe must not stall the crash
+ * path. Setting O_NONBLOCK on the inherited descriptor itself would affect the other processes
+ * sharing it (e.g. the supervisor reading from it), so that's only the fallback.
+ *
+ * @return the new descriptor, -1 if the inherited one has to be used
+ */
+static int reopenNonBlocking(int fd) noexcept
+{
+    char procPath[64];
+    snprintf(procPath, sizeof(procPath), "/proc/self/fd/%d", fd);
+    const int reopened =
+      open(procPath, O_WRONLY | O_APPEND | O_NONBLOCK | O_CLOEXEC); // flawfinder: ignore
+    if (reopened < 0)
+    {
+        // e.g. a FIFO without a reader (yet)
+        const int flags = fcntl(fd, F_GETFL);
+        if (flags >= 0)
+        {
+            fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+        }
+    }
+    return reopened;
+}
+
+/// Replaces the notification target, closing the previous one if it was opened here.
+static void setNotifyTarget(int fd, NotifyType type, bool owned) noexcept
+{
+    if (s_ownsNotifyFd && s_notifyFd >= 0 && s_notifyFd != fd)
+    {
+        close(s_notifyFd);
+    }
+    s_notifyFd = fd;
+    s_notifyType = type;
+    s_ownsNotifyFd = owned;
+}
+
+void setupCrashNotification() noexcept
+{
+    const char* opt = getenv("OOOPSI_NOTIFY_SOCKET"); // flawfinder: ignore
+    if (opt != nullptr)
+    {
+        const int fd = connectSocket(opt);
+        if (fd >= 0)
+        {
+            setNotifyTarget(fd, NotifyType::SOCKET, true);
+            return;
+        }
+    }
+    opt = getenv("OOOPSI_NOTIFY_FD"); // flawfinder: ignore
+    if (opt != nullptr)
+    {
+        char* end = nullptr;
+        const long value = strtol(opt, &end, 10);
+        if (end != opt && *end == '\0' && value >= 0 && value <= INT32_MAX)
+        {
+            const auto fd = static_cast<int>(value);
+            const NotifyType type = detectType(fd);
+            // sockets are written with MSG_DONTWAIT, an eventfd only blocks if its counter
+            // overflows
+            const int reopened = type == NotifyType::FILE ? reopenNonBlocking(fd) : -1;
+            if (reopened >= 0)
+            {
+                setNotifyTarget(reopened, type, true);
+            }
+            else
+            {
+                setNotifyTarget(type != NotifyType::NONE ? fd : -1, type, false);
+            }
+        }
+    }
+}
+
+void notifyCrash(int sig) noexcept
+{
+    if (s_notifyFd < 0 || s_notified.exchange(true))
+    {
+        return;
+    }
+
+    const int savedErrno = errno;
+    if (s_notifyType == NotifyType::EVENTFD)
+    {
+        const uint64_t value = 1;
+        std::ignore = write(s_notifyFd, &value, sizeof(value));
+    }
+    else
+    {
+        char message[64];
+        const int len = snprintf(message, sizeof(message), "ooopsi: crash pid=%d signal=%d\n",
+                                 static_cast<int>(getpid()), sig);
+        const auto size = static_cast<size_t>(len);
+        if (s_notifyType == NotifyType::SOCKET)
+        {
+            // never block: the supervisor may not be reading
+            std::ignore = send(s_notifyFd, message, size, MSG_DONTWAIT | MSG_NOSIGNAL);
+        }
+        else
+        {
+            // a pipe without a reader must not kill us (we're terminating anyway, so the
+            // signal can stay blocked), a full one doesn't block (see reopenNonBlocking())
+            sigset_t pipeMask;
+            sigemptyset(&pipeMask);
+            sigaddset(&pipeMask, SIGPIPE);
+            pthread_sigmask(SIG_BLOCK, &pipeMask, nullptr);
+            std::ignore = write(s_notifyFd, message, size);
+        }
+    }
+    errno = savedErrno;
+}
+
+} // namespace ooopsi
+
+#else // !OOOPSI_LINUX
+
+namespace ooopsi
+{
+
+void setupCrashNotification() noexcept
+{
+    // not supported (yet)
+}
+
+void notifyCrash(int /*sig*/) noexcept {}
+
+} // namespace ooopsi
+
+#endif // OOOPSI_LINUX
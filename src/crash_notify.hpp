@@ -0,0 +1,36 @@
+/**
+ * @file    crash_notify.hpp
+ * @brief   early notification of a process supervisor about a crash (Linux only)
+ */
+
+#ifndef CRASH_NOTIFY_HPP_
+#define CRASH_NOTIFY_HPP_
+
+#include "internal.hpp"
+
+namespace ooopsi
+{
+
+/**
+ * Sets up the crash notification from the environment:
+ *  - OOOPSI_NOTIFY_FD=<fd>: an inherited file descriptor (socket, pipe or eventfd)
+ *  - OOOPSI_NOTIFY_SOCKET=<path>: a unix datagram socket (a leading '@' denotes the abstract
+ *    namespace)
+ * Invalid settings are ignored.
+ */
+void setupCrashNotification() noexcept;
+
+/**
+ * Notifies the supervisor about a crash, before any expensive work (unwinding, symbolization)
+ * starts. Only the first call has an effect. Safe to use in signal handlers.
+ *
+ * Sockets and pipes receive a single line "ooopsi: crash pid=<pid> signal=<sig>" (signal 0 if
+ * not caused by a signal), an eventfd is incremented by 1.
+ *
+ * @param[in] sig       the signal number (0 if none)
+ */
+void notifyCrash(int sig) noexcept;
+
+} // namespace ooopsi
+
+#endif /* CRASH_NOTIFY_HPP_ */
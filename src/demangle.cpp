@@ -3,7 +3,10 @@
  * @brief   function name de-mangling implementation
  */
 
+// public library header
 #include "ooopsi.hpp"
+// private library headers
+#include "stats.hpp"
 
 #ifdef OOOPSI_MSVC
 #include <windows.h>
@@ -15,67 +18,407 @@
 #include <cxxabi.h>
 #endif
 
+#include <cctype>
 #include <cstdlib>
 #include <cstring>
+#include <tuple> // for std::ignore
+#include <vector>
 
 namespace ooopsi
 {
 
-std::string demangle(const char* symbol)
+namespace
+{
+/// a well-known typedef of a standard library template
+struct Typedef
+{
+    /// the template's name (following "std::")
+    const char* name;
+    /// its template arguments, without spaces and inline namespaces
+    const char* arguments;
+    /// the name of the typedef
+    const char* typedefName;
+};
+} // namespace
+
+/// typedefs used by compactName()
+static const Typedef s_TYPEDEFS[] = {
+    { "basic_string", "char,std::char_traits<char>,std::allocator<char>", "string" },
+    { "basic_string_view", "char,std::char_traits<char>", "string_view" },
+    { "basic_ostream", "char,std::char_traits<char>", "ostream" },
+    { "basic_istream", "char,std::char_traits<char>", "istream" },
+    { "basic_iostream", "char,std::char_traits<char>", "iostream" },
+};
+
+/// inline namespaces of the standard libraries (libstdc++ and libc++), dropped from the names
+static const char* const s_INLINE_NAMESPACES[] = { "__cxx11::", "__1::" };
+
+/// Checks if 'name' contains 'str' at the given position.
+static bool matches(const std::string& name, size_t pos, const char* str)
+{
+    return name.compare(pos, strlen(str), str) == 0;
+}
+
+/// Checks if a character can be part of an identifier.
+static bool isNameChar(char c)
+{
+    return isalnum(static_cast<unsigned char>(c)) != 0 || c == '_' || c == '$';
+}
+
+/// Checks if the given position isn't preceded by a part of an identifier.
+static bool isNameStart(const std::string& name, size_t pos)
+{
+    return pos == 0 || !isNameChar(name[pos - 1]);
+}
+
+/// Returns the length of the inline namespace at the given position (0 if there's none).
+static size_t inlineNamespaceLength(const std::string& name, size_t pos)
+{
+    for (const char* inlineNamespace : s_INLINE_NAMESPACES)
+    {
+        if (matches(name, pos, inlineNamespace))
+        {
+            return strlen(inlineNamespace);
+        }
+    }
+    return 0;
+}
+
+/// Returns the length of the operator name at the given position (0 if there's none), e.g. of
+/// "operator<<=" or "operator->": their '<' and '>' aren't template argument lists.
+static size_t operatorLength(const std::string& name, size_t pos)
+{
+    if (!isNameStart(name, pos) || !matches(name, pos, "operator"))
+    {
+        return 0;
+    }
+    size_t end = pos + 8;
+    while (end < name.size() && strchr("<>=-*", name[end]) != nullptr)
+    {
+        ++end;
+    }
+    return end - pos;
+}
+
+/**
+ * Checks if the '<' at the given position starts a template argument list. The demangler only
+ * prints those right after a name (GCC adds a space after an operator's name, e.g.
+ * "operator< <int>"), while a comparison in a template argument follows a parenthesized operand.
+ */
+static bool isListStart(const std::string& name, size_t pos, size_t operatorEnd)
+{
+    return pos > 0 &&
+           (isNameChar(name[pos - 1]) || (pos == operatorEnd + 1 && name[operatorEnd] == ' '));
+}
+
+/**
+ * Returns the position of the '>' closing the template argument list starting at 'pos' (at its
+ * '<'), or std::string::npos. The brackets within parentheses are skipped: those are function
+ * types or expressions, where a '>' may be a comparison (the demanglers parenthesize those).
+ */
+static size_t findListEnd(const std::string& name, size_t pos)
+{
+    size_t depth = 0;
+    size_t parentheses = 0;
+    size_t operatorEnd = std::string::npos;
+    for (; pos < name.size(); ++pos)
+    {
+        const size_t length = operatorLength(name, pos);
+        if (length > 0)
+        {
+            operatorEnd = pos + length;
+            pos = operatorEnd - 1;
+        }
+        else if (name[pos] == '(')
+        {
+            ++parentheses;
+        }
+        else if (name[pos] == ')' && parentheses > 0)
+        {
+            --parentheses;
+        }
+        else if (parentheses > 0)
+        {
+            continue;
+        }
+        else if (name[pos] == '<' && isListStart(name, pos, operatorEnd))
+        {
+            ++depth;
+        }
+        else if (name[pos] == '>' && name[pos - 1] != '-' && depth > 0 && --depth == 0)
+        {
+            return pos;
+        }
+    }
+    return std::string::npos;
+}
+
+/**
+ * Checks if the template at the given position (following "std::") is one of the well-known
+ * typedefs. The arguments are compared without spaces and inline namespaces, which is where the
+ * output of the demanglers differs (e.g. "> >" vs. ">>").
+ *
+ * @param[in]  name     the demangled name
+ * @param[in]  pos      position of the template's name
+ * @param[out] end      receives the position behind the template argument list
+ * @return the typedef, nullptr if it isn't one
+ */
+static const char* findTypedef(const std::string& name, size_t pos, size_t& end)
+{
+    for (const Typedef& type : s_TYPEDEFS)
+    {
+        const size_t listStart = pos + strlen(type.name);
+        if (!matches(name, pos, type.name) || listStart >= name.size() || name[listStart] != '<')
+        {
+            continue;
+        }
+        const size_t listEnd = findListEnd(name, listStart);
+        if (listEnd == std::string::npos)
+        {
+            return nullptr;
+        }
+        std::string arguments;
+        for (size_t i = listStart + 1; i < listEnd; ++i)
+        {
+            const size_t skip = isNameStart(name, i) ? inlineNamespaceLength(name, i) : 0;
+            if (skip > 0)
+            {
+                i += skip - 1;
+            }
+            else if (name[i] != ' ')
+            {
+                arguments += name[i];
+            }
+        }
+        if (arguments == type.arguments)
+        {
+            end = listEnd + 1;
+            return type.typedefName;
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * Renders a demangled name compactly (see demangleCompact()). The demangler doesn't expose its
+ * parse tree, so this is a pass over its output: it tells template argument lists from
+ * operators and comparisons by their context (see isListStart() and findListEnd()), which holds
+ * for the output of GCC's and LLVM's demanglers. Anything it doesn't recognize is kept as is.
+ */
+static std::string compactName(const std::string& name, unsigned maxTemplateDepth)
 {
     std::string result;
+    result.reserve(name.size());
 
-    // shall never happen, but just in case...
-    if (symbol == nullptr)
+    // the levels of parentheses at which the currently open template argument lists started
+    std::vector<size_t> lists;
+    size_t parentheses = 0;
+    // end of the last operator name
+    size_t operatorEnd = std::string::npos;
+    // appends to the result, unless within an elided argument list
+    auto append = [&result, &lists, maxTemplateDepth](const char* str, size_t length) {
+        if (lists.size() <= maxTemplateDepth)
+        {
+            result.append(str, length);
+        }
+    };
+
+    size_t pos = 0;
+    while (pos < name.size())
     {
-        return result;
+        const char c = name[pos];
+        const size_t length = operatorLength(name, pos);
+        if (length > 0)
+        {
+            append(name.data() + pos, length);
+            pos += length;
+            operatorEnd = pos;
+        }
+        else if (isNameStart(name, pos) && matches(name, pos, "std::"))
+        {
+            append("std::", 5);
+            pos += 5;
+            pos += inlineNamespaceLength(name, pos);
+            size_t end = 0;
+            const char* typedefName = findTypedef(name, pos, end);
+            if (typedefName != nullptr)
+            {
+                append(typedefName, strlen(typedefName));
+                pos = end;
+            }
+        }
+        else if (isNameStart(name, pos) && matches(name, pos, "(anonymous namespace)"))
+        {
+            append("(anon)", 6);
+            pos += strlen("(anonymous namespace)");
+        }
+        else if (matches(name, pos, "{lambda("))
+        {
+            // the lambda's number is sufficient, skip its parameters
+            append("{lambda", 7);
+            pos += 7;
+            size_t depth = 0;
+            do
+            {
+                if (name[pos] == '(')
+                {
+                    ++depth;
+                }
+                else if (name[pos] == ')')
+                {
+                    --depth;
+                }
+                ++pos;
+            } while (pos < name.size() && depth > 0);
+        }
+        else if (c == '<' && isListStart(name, pos, operatorEnd))
+        {
+            lists.push_back(parentheses);
+            if (lists.size() == maxTemplateDepth + 1)
+            {
+                result += "<...";
+            }
+            append(&c, 1);
+            ++pos;
+        }
+        else if (c == '>' && !lists.empty() && lists.back() == parentheses && name[pos - 1] != '-')
+        {
+            if (lists.size() == maxTemplateDepth + 1)
+            {
+                result += '>';
+            }
+            append(&c, 1);
+            lists.pop_back();
+            ++pos;
+        }
+        else
+        {
+            if (c == '(')
+            {
+                ++parentheses;
+            }
+            else if (c == ')' && parentheses > 0)
+            {
+                --parentheses;
+            }
+            append(&c, 1);
+            ++pos;
+        }
     }
+    return result;
+}
+
+/**
+ * Appends the demangled symbol to 'output' (or the symbol itself, if it can't be demangled).
+ *
+ * @param[in]     symbol        the symbol to demangle
+ * @param[in,out] output        the string to append to
+ * @param[in,out] buffer        output buffer of the demangler, allocated via malloc (or nullptr),
+ *                              may be reallocated - pass it again for the next symbol
+ * @param[in,out] bufferSize    size of 'buffer'
+ */
+static void appendDemangled(const char* symbol, std::string& output, char*& buffer,
+                            size_t& bufferSize)
+{
+    const ScopedTiming timing(StatTiming::Demangle);
 
 #ifdef _CXXABI_H
 
-    // call GCC's demangler - will allocate a proper buffer
+    // call GCC's demangler - will (re)allocate the buffer if needed
     int status = 0;
-    char* demangledName = abi::__cxa_demangle(symbol, nullptr, nullptr, &status);
+    if (buffer == nullptr)
+    {
+        bufferSize = 0;
+    }
+    char* demangledName = abi::__cxa_demangle(symbol, buffer, &bufferSize, &status);
     if (demangledName != nullptr && status == 0)
     {
-        result = demangledName;
+        buffer = demangledName;
+        output += demangledName;
     }
     else
     {
         // may not be C++, but plain C - use the original name
-        result = symbol;
-    }
-    if (demangledName != nullptr)
-    {
-        free(demangledName); // NOLINT (yes, manual memory management is bad..)
+        output += symbol;
     }
 
 #elif defined(OOOPSI_MSVC)
 
+    std::ignore = buffer;
+    std::ignore = bufferSize;
     {
-        char buffer[MAX_SYM_NAME + 1];
-        memset(buffer, 0, sizeof(buffer));
+        char nameBuffer[MAX_SYM_NAME + 1];
+        memset(nameBuffer, 0, sizeof(nameBuffer));
 
         constexpr DWORD flags = UNDNAME_NO_MS_KEYWORDS | UNDNAME_NO_ACCESS_SPECIFIERS;
         const std::lock_guard<DbgHelpMutex> lock(s_dbgHelpMutex);
-        if (UnDecorateSymbolName(symbol, buffer, sizeof(buffer) - 1, flags) > 0)
+        if (UnDecorateSymbolName(symbol, nameBuffer, sizeof(nameBuffer) - 1, flags) > 0)
         {
-            result = buffer;
+            output += nameBuffer;
         }
         else
         {
-            result = symbol;
+            output += symbol;
         }
     }
 
 #else
 
     // not supported with this OS/compiler
-    result = name;
+    std::ignore = buffer;
+    std::ignore = bufferSize;
+    output += symbol;
 
 #endif // _CXXABI_H
+}
 
+std::string demangle(const char* symbol)
+{
+    std::string result;
+
+    // shall never happen, but just in case...
+    if (symbol == nullptr)
+    {
+        return result;
+    }
+
+    char* buffer = nullptr;
+    size_t bufferSize = 0;
+    appendDemangled(symbol, result, buffer, bufferSize);
+    free(buffer); // NOLINT (yes, manual memory management is bad..)
     return result;
 }
 
+void demangle(const char* const* symbols, size_t count, std::string& output, size_t* offsets)
+{
+    output.clear();
+
+    // the demangler's buffer is reused for all symbols
+    char* buffer = nullptr;
+    size_t bufferSize = 0;
+    try
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            offsets[i] = output.size();
+            if (symbols[i] != nullptr)
+            {
+                appendDemangled(symbols[i], output, buffer, bufferSize);
+            }
+            output += '\0';
+        }
+    }
+    catch (...)
+    {
+        free(buffer); // NOLINT
+        throw;
+    }
+    free(buffer); // NOLINT
+}
+
+std::string demangleCompact(const char* symbol, unsigned maxTemplateDepth)
+{
+    return compactName(demangle(symbol), maxTemplateDepth);
+}
+
 } // namespace ooopsi
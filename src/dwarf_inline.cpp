@@ -0,0 +1,1148 @@
+/**
+ * @file    dwarf_inline.cpp
+ *
+ * Minimal DWARF (versions 2-5) reader that indexes DW_TAG_inlined_subroutine ranges.
+ *
+ * Only the parts required for inlined frames are parsed: unit headers, abbreviation tables,
+ * address ranges and the names of the inlined functions' abstract origins. Everything else is
+ * skipped without interpretation.
+ */
+
+// private library headers
+#include "dwarf_inline.hpp"
+#include "elf_file.hpp"
+#include "interval_index.hpp"
+#include "module_map.hpp"
+
+#ifdef OOOPSI_LINUX
+
+#include <algorithm>
+#include <memory>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace ooopsi
+{
+
+/*
+ * DWARF constants (see the DWARF 5 standard, section 7)
+ */
+static constexpr uint64_t DW_TAG_inlined_subroutine = 0x1d;
+static constexpr uint64_t DW_TAG_compile_unit = 0x11;
+static constexpr uint64_t DW_TAG_partial_unit = 0x3c;
+
+static constexpr uint64_t DW_AT_name = 0x03;
+static constexpr uint64_t DW_AT_low_pc = 0x11;
+static constexpr uint64_t DW_AT_high_pc = 0x12;
+static constexpr uint64_t DW_AT_abstract_origin = 0x31;
+static constexpr uint64_t DW_AT_specification = 0x47;
+static constexpr uint64_t DW_AT_ranges = 0x55;
+static constexpr uint64_t DW_AT_linkage_name = 0x6e;
+static constexpr uint64_t DW_AT_str_offsets_base = 0x72;
+static constexpr uint64_t DW_AT_addr_base = 0x73;
+static constexpr uint64_t DW_AT_rnglists_base = 0x74;
+static constexpr uint64_t DW_AT_MIPS_linkage_name = 0x2007;
+
+static constexpr uint64_t DW_FORM_addr = 0x01;
+static constexpr uint64_t DW_FORM_block2 = 0x03;
+static constexpr uint64_t DW_FORM_block4 = 0x04;
+static constexpr uint64_t DW_FORM_data2 = 0x05;
+static constexpr uint64_t DW_FORM_data4 = 0x06;
+static constexpr uint64_t DW_FORM_data8 = 0x07;
+static constexpr uint64_t DW_FORM_string = 0x08;
+static constexpr uint64_t DW_FORM_block = 0x09;
+static constexpr uint64_t DW_FORM_block1 = 0x0a;
+static constexpr uint64_t DW_FORM_data1 = 0x0b;
+static constexpr uint64_t DW_FORM_flag = 0x0c;
+static constexpr uint64_t DW_FORM_sdata = 0x0d;
+static constexpr uint64_t DW_FORM_strp = 0x0e;
+static constexpr uint64_t DW_FORM_udata = 0x0f;
+static constexpr uint64_t DW_FORM_ref_addr = 0x10;
+static constexpr uint64_t DW_FORM_ref1 = 0x11;
+static constexpr uint64_t DW_FORM_ref2 = 0x12;
+static constexpr uint64_t DW_FORM_ref4 = 0x13;
+static constexpr uint64_t DW_FORM_ref8 = 0x14;
+static constexpr uint64_t DW_FORM_ref_udata = 0x15;
+static constexpr uint64_t DW_FORM_indirect = 0x16;
+static constexpr uint64_t DW_FORM_sec_offset = 0x17;
+static constexpr uint64_t DW_FORM_exprloc = 0x18;
+static constexpr uint64_t DW_FORM_flag_present = 0x19;
+static constexpr uint64_t DW_FORM_strx = 0x1a;
+static constexpr uint64_t DW_FORM_addrx = 0x1b;
+static constexpr uint64_t DW_FORM_ref_sup4 = 0x1c;
+static constexpr uint64_t DW_FORM_strp_sup = 0x1d;
+static constexpr uint64_t DW_FORM_data16 = 0x1e;
+static constexpr uint64_t DW_FORM_line_strp = 0x1f;
+static constexpr uint64_t DW_FORM_ref_sig8 = 0x20;
+static constexpr uint64_t DW_FORM_implicit_const = 0x21;
+static constexpr uint64_t DW_FORM_loclistx = 0x22;
+static constexpr uint64_t DW_FORM_rnglistx = 0x23;
+static constexpr uint64_t DW_FORM_ref_sup8 = 0x24;
+static constexpr uint64_t DW_FORM_strx1 = 0x25;
+static constexpr uint64_t DW_FORM_strx2 = 0x26;
+static constexpr uint64_t DW_FORM_strx3 = 0x27;
+static constexpr uint64_t DW_FORM_strx4 = 0x28;
+static constexpr uint64_t DW_FORM_addrx1 = 0x29;
+static constexpr uint64_t DW_FORM_addrx2 = 0x2a;
+static constexpr uint64_t DW_FORM_addrx3 = 0x2b;
+static constexpr uint64_t DW_FORM_addrx4 = 0x2c;
+static constexpr uint64_t DW_FORM_GNU_addr_index = 0x1f01;
+static constexpr uint64_t DW_FORM_GNU_str_index = 0x1f02;
+static constexpr uint64_t DW_FORM_GNU_ref_alt = 0x1f20;
+static constexpr uint64_t DW_FORM_GNU_strp_alt = 0x1f21;
+
+static constexpr uint8_t DW_UT_compile = 0x01;
+static constexpr uint8_t DW_UT_partial = 0x03;
+
+static constexpr uint8_t DW_RLE_end_of_list = 0x00;
+static constexpr uint8_t DW_RLE_base_addressx = 0x01;
+static constexpr uint8_t DW_RLE_startx_endx = 0x02;
+static constexpr uint8_t DW_RLE_startx_length = 0x03;
+static constexpr uint8_t DW_RLE_offset_pair = 0x04;
+static constexpr uint8_t DW_RLE_base_address = 0x05;
+static constexpr uint8_t DW_RLE_start_end = 0x06;
+static constexpr uint8_t DW_RLE_start_length = 0x07;
+
+/// limits following DW_AT_abstract_origin/DW_AT_specification chains
+static constexpr int s_MAX_NAME_INDIRECTIONS = 8;
+
+/// limits the number of nested inlined calls reported for a single address
+static constexpr size_t s_MAX_INLINE_DEPTH = 64;
+
+
+/// Bounds-checked little-endian reader. Reading past the end yields zeros and sets an error flag.
+class DwarfReader
+{
+public:
+    DwarfReader(const ElfSection& section, size_t offset = 0) noexcept
+      : m_begin(section.data), m_pos(section.data), m_end(section.data + section.size)
+    {
+        seek(offset);
+    }
+
+    bool ok() const noexcept { return m_ok; }
+    size_t tell() const noexcept { return static_cast<size_t>(m_pos - m_begin); }
+    size_t remaining() const noexcept { return static_cast<size_t>(m_end - m_pos); }
+
+    void seek(size_t offset) noexcept
+    {
+        if (offset > static_cast<size_t>(m_end - m_begin))
+        {
+            m_ok = false;
+            m_pos = m_end;
+        }
+        else
+        {
+            m_pos = m_begin + offset;
+        }
+    }
+
+    void skip(uint64_t n) noexcept
+    {
+        if (n > remaining())
+        {
+            m_ok = false;
+            m_pos = m_end;
+        }
+        else
+        {
+            m_pos += n;
+        }
+    }
+
+    uint64_t fixed(size_t n) noexcept
+    {
+        if (n > 8 || n > remaining())
+        {
+            m_ok = false;
+            m_pos = m_end;
+            return 0;
+        }
+        uint64_t value = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            value |= static_cast<uint64_t>(m_pos[i]) << (8 * i);
+        }
+        m_pos += n;
+        return value;
+    }
+
+    uint8_t u8() noexcept { return static_cast<uint8_t>(fixed(1)); }
+    uint16_t u16() noexcept { return static_cast<uint16_t>(fixed(2)); }
+
+    uint64_t uleb() noexcept
+    {
+        uint64_t value = 0;
+        unsigned shift = 0;
+        while (m_pos < m_end)
+        {
+            const uint8_t byte = *m_pos++;
+            if (shift < 64)
+            {
+                value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            }
+            shift += 7;
+            if ((byte & 0x80) == 0)
+            {
+                return value;
+            }
+        }
+        m_ok = false;
+        return 0;
+    }
+
+    int64_t sleb() noexcept
+    {
+        uint64_t value = 0;
+        unsigned shift = 0;
+        while (m_pos < m_end)
+        {
+            const uint8_t byte = *m_pos++;
+            if (shift < 64)
+            {
+                value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            }
+            shift += 7;
+            if ((byte & 0x80) == 0)
+            {
+                if (shift < 64 && (byte & 0x40) != 0)
+                {
+                    value |= ~uint64_t(0) << shift;
+                }
+                return static_cast<int64_t>(value);
+            }
+        }
+        m_ok = false;
+        return 0;
+    }
+
+    /// Reads a NUL-terminated string in place.
+    const char* cstr() noexcept
+    {
+        const auto* nul = static_cast<const uint8_t*>(memchr(m_pos, 0, remaining()));
+        if (nul == nullptr)
+        {
+            m_ok = false;
+            m_pos = m_end;
+            return nullptr;
+        }
+        const char* str = reinterpret_cast<const char*>(m_pos);
+        m_pos = nul + 1;
+        return str;
+    }
+
+private:
+    const uint8_t* m_begin;
+    const uint8_t* m_pos;
+    const uint8_t* m_end;
+    bool m_ok = true;
+};
+
+
+/// A single attribute specification in an abbreviation.
+struct AttrSpec
+{
+    uint64_t name;
+    uint64_t form;
+    int64_t implicitConst;
+};
+
+/// An abbreviation (DIE "layout"), referring to a slice of AbbrevTable::attrs.
+struct Abbrev
+{
+    uint64_t tag = 0;
+    bool hasChildren = false;
+    uint32_t firstAttr = 0;
+    uint32_t numAttrs = 0;
+};
+
+/// All abbreviations of one unit, stored compactly.
+struct AbbrevTable
+{
+    /// abbreviations by code (codes are usually dense, starting at 1)
+    std::vector<Abbrev> abbrevs;
+    std::vector<AttrSpec> attrs;
+
+    const Abbrev* find(uint64_t code) const noexcept
+    {
+        if (code == 0 || code > abbrevs.size() || abbrevs[code - 1].tag == 0)
+        {
+            return nullptr;
+        }
+        return &abbrevs[code - 1];
+    }
+};
+
+/// A decoded attribute value (only what we need).
+struct AttrValue
+{
+    uint64_t form = 0;
+    uint64_t value = 0;
+    const char* str = nullptr;
+};
+
+/// An inlined call: the interval index value.
+struct InlinedCall
+{
+    const char* name;
+    uint32_t depth;
+};
+
+/// Information about a (compile or partial) unit in .debug_info.
+struct CompUnit
+{
+    /// section offset of the unit header and of its end
+    uint64_t offset = 0;
+    uint64_t end = 0;
+    /// section offset of the first DIE
+    uint64_t dieOffset = 0;
+    uint64_t abbrevOffset = 0;
+    uint16_t version = 0;
+    uint8_t addrSize = 8;
+    uint8_t offsetSize = 4;
+
+    /// attributes of the unit DIE, valid once 'prepared' is set
+    bool prepared = false;
+    uint64_t baseAddress = 0;
+    uint64_t strOffsetsBase = 0;
+    uint64_t addrBase = 0;
+    uint64_t rnglistsBase = 0;
+
+    /// the unit's inlined calls (built on first use)
+    std::unique_ptr<IntervalIndex<InlinedCall>> inlinedCalls;
+};
+
+
+/// The debug information of a single module.
+class DwarfModule
+{
+public:
+    /// Maps the file and checks for debug information.
+    bool load(const char* path) noexcept;
+
+    /// Looks up the inlined calls at the given (module-relative) address.
+    size_t findCalls(uint64_t addr, const char** names, size_t maxNames);
+
+private:
+    void scanUnits();
+    bool prepareUnit(CompUnit& unit);
+    void indexUnit(CompUnit& unit);
+
+    const AbbrevTable* abbrevTable(uint64_t offset);
+    bool readAttr(DwarfReader& reader, uint64_t form, int64_t implicitConst, const CompUnit& unit,
+                  AttrValue& value) const noexcept;
+    const char* string(const AttrValue& value, const CompUnit& unit) const noexcept;
+    bool address(const AttrValue& value, const CompUnit& unit, uint64_t& addr) const noexcept;
+    uint64_t reference(const AttrValue& value, const CompUnit& unit) const noexcept;
+    template <class Func>
+    void forEachRange(const AttrValue& value, const CompUnit& unit, Func&& func) const;
+    template <class Func>
+    bool forEachAttr(DwarfReader& reader, const AbbrevTable& table, const Abbrev& abbrev,
+                     const CompUnit& unit, Func&& func) const;
+
+    CompUnit* unitContaining(uint64_t offset) noexcept;
+    const char* functionName(uint64_t dieOffset, int indirections);
+
+    ElfFile m_elf;
+    ElfSection m_info;
+    ElfSection m_abbrev;
+    ElfSection m_str;
+    ElfSection m_lineStr;
+    ElfSection m_strOffsets;
+    ElfSection m_addr;
+    ElfSection m_ranges;
+    ElfSection m_rnglists;
+
+    /// all units, sorted by offset
+    std::vector<CompUnit> m_units;
+    /// address ranges of the units (by index into m_units)
+    IntervalIndex<uint32_t> m_unitRanges;
+    bool m_scanned = false;
+
+    /// abbreviation tables by offset (only those of visited units)
+    std::unordered_map<uint64_t, std::unique_ptr<AbbrevTable>> m_abbrevTables;
+    /// function names by DIE offset (abstract origins are usually shared by many calls)
+    std::unordered_map<uint64_t, const char*> m_names;
+};
+
+
+bool DwarfModule::load(const char* path) noexcept
+{
+    if (!m_elf.open(path))
+    {
+        return false;
+    }
+    m_info = m_elf.section(".debug_info");
+    m_abbrev = m_elf.section(".debug_abbrev");
+    m_str = m_elf.section(".debug_str");
+    m_lineStr = m_elf.section(".debug_line_str");
+    m_strOffsets = m_elf.section(".debug_str_offsets");
+    m_addr = m_elf.section(".debug_addr");
+    m_ranges = m_elf.section(".debug_ranges");
+    m_rnglists = m_elf.section(".debug_rnglists");
+    return m_info && m_abbrev;
+}
+
+const AbbrevTable* DwarfModule::abbrevTable(uint64_t offset)
+{
+    auto it = m_abbrevTables.find(offset);
+    if (it != m_abbrevTables.end())
+    {
+        return it->second.get();
+    }
+
+    std::unique_ptr<AbbrevTable> table(new AbbrevTable);
+    DwarfReader reader(m_abbrev, offset);
+    while (reader.ok())
+    {
+        const uint64_t code = reader.uleb();
+        if (code == 0 || code > 0xffff)
+        {
+            // end of table (or a code we don't expect in practice)
+            break;
+        }
+        Abbrev abbrev;
+        abbrev.tag = reader.uleb();
+        abbrev.hasChildren = reader.u8() != 0;
+        abbrev.firstAttr = static_cast<uint32_t>(table->attrs.size());
+        while (reader.ok())
+        {
+            AttrSpec spec{ reader.uleb(), reader.uleb(), 0 };
+            if (spec.name == 0 && spec.form == 0)
+            {
+                break;
+            }
+            if (spec.form == DW_FORM_implicit_const)
+            {
+                spec.implicitConst = reader.sleb();
+            }
+            table->attrs.push_back(spec);
+        }
+        abbrev.numAttrs = static_cast<uint32_t>(table->attrs.size()) - abbrev.firstAttr;
+        if (table->abbrevs.size() < code)
+        {
+            table->abbrevs.resize(code);
+        }
+        table->abbrevs[code - 1] = abbrev;
+    }
+    table->abbrevs.shrink_to_fit();
+    table->attrs.shrink_to_fit();
+
+    const AbbrevTable* result = table.get();
+    m_abbrevTables.emplace(offset, std::move(table));
+    return result;
+}
+
+bool DwarfModule::readAttr(DwarfReader& reader, uint64_t form, int64_t implicitConst,
+                           const CompUnit& unit, AttrValue& value) const noexcept
+{
+    value.form = form;
+    value.value = 0;
+    value.str = nullptr;
+
+    switch (form)
+    {
+    case DW_FORM_addr:
+        value.value = reader.fixed(unit.addrSize);
+        break;
+    case DW_FORM_data1:
+    case DW_FORM_ref1:
+    case DW_FORM_flag:
+    case DW_FORM_strx1:
+    case DW_FORM_addrx1:
+        value.value = reader.fixed(1);
+        break;
+    case DW_FORM_data2:
+    case DW_FORM_ref2:
+    case DW_FORM_strx2:
+    case DW_FORM_addrx2:
+        value.value = reader.fixed(2);
+        break;
+    case DW_FORM_strx3:
+    case DW_FORM_addrx3:
+        value.value = reader.fixed(3);
+        break;
+    case DW_FORM_data4:
+    case DW_FORM_ref4:
+    case DW_FORM_ref_sup4:
+    case DW_FORM_strx4:
+    case DW_FORM_addrx4:
+        value.value = reader.fixed(4);
+        break;
+    case DW_FORM_data8:
+    case DW_FORM_ref8:
+    case DW_FORM_ref_sig8:
+    case DW_FORM_ref_sup8:
+        value.value = reader.fixed(8);
+        break;
+    case DW_FORM_data16:
+        reader.skip(16);
+        break;
+    case DW_FORM_sdata:
+        value.value = static_cast<uint64_t>(reader.sleb());
+        break;
+    case DW_FORM_udata:
+    case DW_FORM_ref_udata:
+    case DW_FORM_strx:
+    case DW_FORM_addrx:
+    case DW_FORM_loclistx:
+    case DW_FORM_rnglistx:
+    case DW_FORM_GNU_addr_index:
+    case DW_FORM_GNU_str_index:
+        value.value = reader.uleb();
+        break;
+    case DW_FORM_string:
+        value.str = reader.cstr();
+        break;
+    case DW_FORM_strp:
+    case DW_FORM_line_strp:
+    case DW_FORM_sec_offset:
+    case DW_FORM_strp_sup:
+    case DW_FORM_GNU_ref_alt:
+    case DW_FORM_GNU_strp_alt:
+        value.value = reader.fixed(unit.offsetSize);
+        break;
+    case DW_FORM_ref_addr:
+        value.value = reader.fixed(unit.version <= 2 ? unit.addrSize : unit.offsetSize);
+        break;
+    case DW_FORM_block1:
+        reader.skip(reader.fixed(1));
+        break;
+    case DW_FORM_block2:
+        reader.skip(reader.fixed(2));
+        break;
+    case DW_FORM_block4:
+        reader.skip(reader.fixed(4));
+        break;
+    case DW_FORM_block:
+    case DW_FORM_exprloc:
+        reader.skip(reader.uleb());
+        break;
+    case DW_FORM_flag_present:
+        value.value = 1;
+        break;
+    case DW_FORM_implicit_const:
+        value.value = static_cast<uint64_t>(implicitConst);
+        break;
+    case DW_FORM_indirect:
+    {
+        const uint64_t actualForm = reader.uleb();
+        if (actualForm == DW_FORM_indirect || actualForm == DW_FORM_implicit_const)
+        {
+            return false;
+        }
+        return readAttr(reader, actualForm, 0, unit, value);
+    }
+    default:
+        // unknown form: we can't determine its size, so the rest of the unit is unreadable
+        return false;
+    }
+    return reader.ok();
+}
+
+const char* DwarfModule::string(const AttrValue& value, const CompUnit& unit) const noexcept
+{
+    uint64_t offset = 0;
+    const ElfSection* section = &m_str;
+
+    switch (value.form)
+    {
+    case DW_FORM_string:
+        return value.str;
+    case DW_FORM_strp:
+        offset = value.value;
+        break;
+    case DW_FORM_line_strp:
+        offset = value.value;
+        section = &m_lineStr;
+        break;
+    case DW_FORM_strx:
+    case DW_FORM_strx1:
+    case DW_FORM_strx2:
+    case DW_FORM_strx3:
+    case DW_FORM_strx4:
+    case DW_FORM_GNU_str_index:
+    {
+        DwarfReader reader(m_strOffsets, unit.strOffsetsBase + value.value * unit.offsetSize);
+        offset = reader.fixed(unit.offsetSize);
+        if (!reader.ok())
+        {
+            return nullptr;
+        }
+        break;
+    }
+    default:
+        return nullptr;
+    }
+
+    DwarfReader reader(*section, offset);
+    return reader.ok() ? reader.cstr() : nullptr;
+}
+
+bool DwarfModule::address(const AttrValue& value, const CompUnit& unit,
+                          uint64_t& addr) const noexcept
+{
+    switch (value.form)
+    {
+    case DW_FORM_addr:
+        addr = value.value;
+        return true;
+    case DW_FORM_addrx:
+    case DW_FORM_addrx1:
+    case DW_FORM_addrx2:
+    case DW_FORM_addrx3:
+    case DW_FORM_addrx4:
+    case DW_FORM_GNU_addr_index:
+    {
+        DwarfReader reader(m_addr, unit.addrBase + value.value * unit.addrSize);
+        addr = reader.fixed(unit.addrSize);
+        return reader.ok();
+    }
+    default:
+        return false;
+    }
+}
+
+uint64_t DwarfModule::reference(const AttrValue& value, const CompUnit& unit) const noexcept
+{
+    switch (value.form)
+    {
+    case DW_FORM_ref1:
+    case DW_FORM_ref2:
+    case DW_FORM_ref4:
+    case DW_FORM_ref8:
+    case DW_FORM_ref_udata:
+        // relative to the unit header
+        return unit.offset + value.value;
+    case DW_FORM_ref_addr:
+        return value.value;
+    default:
+        // references into other files (.dwo, dwz) are not supported
+        return 0;
+    }
+}
+
+template <class Func>
+void DwarfModule::forEachRange(const AttrValue& value, const CompUnit& unit, Func&& func) const
+{
+    const uint64_t maxAddr =
+      unit.addrSize >= 8 ? ~uint64_t(0) : (uint64_t(1) << (8 * unit.addrSize)) - 1;
+    uint64_t base = unit.baseAddress;
+
+    if (unit.version < 5)
+    {
+        // .debug_ranges: pairs of offsets, terminated by (0, 0)
+        DwarfReader reader(m_ranges, value.value);
+        while (reader.ok())
+        {
+            const uint64_t begin = reader.fixed(unit.addrSize);
+            const uint64_t end = reader.fixed(unit.addrSize);
+            if (!reader.ok() || (begin == 0 && end == 0))
+            {
+                break;
+            }
+            if (begin == maxAddr)
+            {
+                // base address selection entry
+                base = end;
+                continue;
+            }
+            func(base + begin, base + end);
+        }
+        return;
+    }
+
+    // .debug_rnglists: either a direct offset or an index into the unit's offset table
+    uint64_t offset = value.value;
+    if (value.form == DW_FORM_rnglistx)
+    {
+        DwarfReader reader(m_rnglists, unit.rnglistsBase + value.value * unit.offsetSize);
+        offset = unit.rnglistsBase + reader.fixed(unit.offsetSize);
+        if (!reader.ok())
+        {
+            return;
+        }
+    }
+
+    auto indexedAddress = [&](uint64_t index, uint64_t& addr) {
+        AttrValue indexed;
+        indexed.form = DW_FORM_addrx;
+        indexed.value = index;
+        return address(indexed, unit, addr);
+    };
+
+    DwarfReader reader(m_rnglists, offset);
+    while (reader.ok())
+    {
+        uint64_t begin = 0;
+        uint64_t end = 0;
+        switch (reader.u8())
+        {
+        case DW_RLE_end_of_list:
+            return;
+        case DW_RLE_base_addressx:
+            if (!indexedAddress(reader.uleb(), base))
+            {
+                return;
+            }
+            continue;
+        case DW_RLE_startx_endx:
+            if (!indexedAddress(reader.uleb(), begin) || !indexedAddress(reader.uleb(), end))
+            {
+                return;
+            }
+            break;
+        case DW_RLE_startx_length:
+            if (!indexedAddress(reader.uleb(), begin))
+            {
+                return;
+            }
+            end = begin + reader.uleb();
+            break;
+        case DW_RLE_offset_pair:
+            begin = base + reader.uleb();
+            end = base + reader.uleb();
+            break;
+        case DW_RLE_base_address:
+            base = reader.fixed(unit.addrSize);
+            continue;
+        case DW_RLE_start_end:
+            begin = reader.fixed(unit.addrSize);
+            end = reader.fixed(unit.addrSize);
+            break;
+        case DW_RLE_start_length:
+            begin = reader.fixed(unit.addrSize);
+            end = begin + reader.uleb();
+            break;
+        default:
+            return;
+        }
+        if (reader.ok())
+        {
+            func(begin, end);
+        }
+    }
+}
+
+template <class Func>
+bool DwarfModule::forEachAttr(DwarfReader& reader, const AbbrevTable& table, const Abbrev& abbrev,
+                              const CompUnit& unit, Func&& func) const
+{
+    AttrValue value;
+    for (uint32_t i = 0; i < abbrev.numAttrs; ++i)
+    {
+        const AttrSpec& spec = table.attrs[abbrev.firstAttr + i];
+        if (!readAttr(reader, spec.form, spec.implicitConst, unit, value))
+        {
+            return false;
+        }
+        func(spec.name, value);
+    }
+    return true;
+}
+
+void DwarfModule::scanUnits()
+{
+    m_scanned = true;
+
+    // collect the unit headers
+    DwarfReader reader(m_info);
+    while (reader.ok() && reader.remaining() > 0)
+    {
+        CompUnit unit;
+        unit.offset = reader.tell();
+        uint64_t length = reader.fixed(4);
+        if (length == 0xffffffff)
+        {
+            unit.offsetSize = 8;
+            length = reader.fixed(8);
+        }
+        else if (length >= 0xfffffff0)
+        {
+            break;
+        }
+        if (!reader.ok() || length > reader.remaining())
+        {
+            break;
+        }
+        unit.end = reader.tell() + length;
+
+        unit.version = reader.u16();
+        uint8_t unitType = DW_UT_compile;
+        if (unit.version >= 5)
+        {
+            unitType = reader.u8();
+            unit.addrSize = reader.u8();
+            unit.abbrevOffset = reader.fixed(unit.offsetSize);
+        }
+        else
+        {
+            unit.abbrevOffset = reader.fixed(unit.offsetSize);
+            unit.addrSize = reader.u8();
+        }
+        unit.dieOffset = reader.tell();
+        const uint64_t end = unit.end;
+
+        // skip type and split units: they don't contain code
+        if (reader.ok() && unit.version >= 2 && unit.version <= 5 &&
+            (unitType == DW_UT_compile || unitType == DW_UT_partial) &&
+            (unit.addrSize == 4 || unit.addrSize == 8))
+        {
+            m_units.push_back(std::move(unit));
+        }
+        reader.seek(end);
+    }
+    m_units.shrink_to_fit();
+
+    // collect the address ranges of all units
+    for (size_t i = 0; i < m_units.size(); ++i)
+    {
+        CompUnit& unit = m_units[i];
+        if (!prepareUnit(unit))
+        {
+            continue;
+        }
+        const AbbrevTable* table = abbrevTable(unit.abbrevOffset);
+        DwarfReader dies(m_info, unit.dieOffset);
+        const Abbrev* abbrev = table->find(dies.uleb());
+        if (abbrev == nullptr)
+        {
+            continue;
+        }
+        AttrValue low, high, ranges;
+        forEachAttr(dies, *table, *abbrev, unit, [&](uint64_t name, const AttrValue& value) {
+            if (name == DW_AT_low_pc)
+                low = value;
+            else if (name == DW_AT_high_pc)
+                high = value;
+            else if (name == DW_AT_ranges)
+                ranges = value;
+        });
+
+        const auto index = static_cast<uint32_t>(i);
+        uint64_t begin = 0;
+        uint64_t end = 0;
+        if (ranges.form != 0)
+        {
+            forEachRange(ranges, unit, [&](uint64_t b, uint64_t e) {
+                m_unitRanges.add(b, e, index);
+            });
+        }
+        else if (address(low, unit, begin) && high.form != 0)
+        {
+            if (!address(high, unit, end))
+            {
+                end = begin + high.value;
+            }
+            m_unitRanges.add(begin, end, index);
+        }
+    }
+    m_unitRanges.build();
+
+    // the abbreviation tables were only needed for the unit DIEs - don't keep them all
+    m_abbrevTables.clear();
+}
+
+bool DwarfModule::prepareUnit(CompUnit& unit)
+{
+    if (unit.prepared)
+    {
+        return true;
+    }
+
+    const AbbrevTable* table = abbrevTable(unit.abbrevOffset);
+    DwarfReader reader(m_info, unit.dieOffset);
+    const Abbrev* abbrev = table->find(reader.uleb());
+    if (abbrev == nullptr ||
+        (abbrev->tag != DW_TAG_compile_unit && abbrev->tag != DW_TAG_partial_unit))
+    {
+        return false;
+    }
+
+    // the base attributes are required to resolve the others, so they come first
+    AttrValue low;
+    const bool ok =
+      forEachAttr(reader, *table, *abbrev, unit, [&](uint64_t name, const AttrValue& value) {
+          if (name == DW_AT_str_offsets_base)
+              unit.strOffsetsBase = value.value;
+          else if (name == DW_AT_addr_base)
+              unit.addrBase = value.value;
+          else if (name == DW_AT_rnglists_base)
+              unit.rnglistsBase = value.value;
+          else if (name == DW_AT_low_pc)
+              low = value;
+      });
+    if (!ok)
+    {
+        return false;
+    }
+    if (low.form != 0)
+    {
+        address(low, unit, unit.baseAddress);
+    }
+    unit.prepared = true;
+    return true;
+}
+
+CompUnit* DwarfModule::unitContaining(uint64_t offset) noexcept
+{
+    auto it = std::upper_bound(
+      m_units.begin(), m_units.end(), offset,
+      [](uint64_t off, const CompUnit& unit) { return off < unit.offset; });
+    if (it == m_units.begin())
+    {
+        return nullptr;
+    }
+    --it;
+    return offset < it->end ? &*it : nullptr;
+}
+
+const char* DwarfModule::functionName(uint64_t dieOffset, int indirections)
+{
+    auto cached = m_names.find(dieOffset);
+    if (cached != m_names.end())
+    {
+        return cached->second;
+    }
+
+    const char* result = nullptr;
+    CompUnit* unit = unitContaining(dieOffset);
+    if (unit != nullptr && prepareUnit(*unit))
+    {
+        const AbbrevTable* table = abbrevTable(unit->abbrevOffset);
+        DwarfReader reader(m_info, dieOffset);
+        const Abbrev* abbrev = table->find(reader.uleb());
+        const char* linkageName = nullptr;
+        const char* plainName = nullptr;
+        uint64_t origin = 0;
+        if (abbrev != nullptr)
+        {
+            forEachAttr(reader, *table, *abbrev, *unit,
+                        [&](uint64_t name, const AttrValue& value) {
+                            if (name == DW_AT_linkage_name || name == DW_AT_MIPS_linkage_name)
+                                linkageName = string(value, *unit);
+                            else if (name == DW_AT_name)
+                                plainName = string(value, *unit);
+                            else if (name == DW_AT_abstract_origin ||
+                                     name == DW_AT_specification)
+                                origin = reference(value, *unit);
+                        });
+        }
+
+        // prefer the mangled name: it is qualified and will be demangled like any other symbol
+        result = linkageName;
+        if (result == nullptr && origin != 0 && indirections > 0)
+        {
+            result = functionName(origin, indirections - 1);
+        }
+        if (result == nullptr)
+        {
+            result = plainName;
+        }
+    }
+
+    if (result == nullptr)
+    {
+        result = "??";
+    }
+    m_names.emplace(dieOffset, result);
+    return result;
+}
+
+void DwarfModule::indexUnit(CompUnit& unit)
+{
+    std::unique_ptr<IntervalIndex<InlinedCall>> index(new IntervalIndex<InlinedCall>);
+
+    const AbbrevTable* table = abbrevTable(unit.abbrevOffset);
+    DwarfReader reader(m_info, unit.dieOffset);
+
+    // number of enclosing inlined calls for the children of every open DIE
+    std::vector<uint32_t> depthStack;
+
+    while (reader.ok() && reader.tell() < unit.end)
+    {
+        const uint64_t code = reader.uleb();
+        if (code == 0)
+        {
+            // end of the current sibling chain
+            if (depthStack.empty())
+            {
+                break;
+            }
+            depthStack.pop_back();
+            continue;
+        }
+        const Abbrev* abbrev = table->find(code);
+        if (abbrev == nullptr)
+        {
+            break;
+        }
+
+        const uint32_t depth = depthStack.empty() ? 0 : depthStack.back();
+        const bool inlined = abbrev->tag == DW_TAG_inlined_subroutine;
+
+        AttrValue low, high, ranges;
+        uint64_t origin = 0;
+        const bool ok =
+          forEachAttr(reader, *table, *abbrev, unit, [&](uint64_t name, const AttrValue& value) {
+              if (!inlined)
+                  return;
+              if (name == DW_AT_low_pc)
+                  low = value;
+              else if (name == DW_AT_high_pc)
+                  high = value;
+              else if (name == DW_AT_ranges)
+                  ranges = value;
+              else if (name == DW_AT_abstract_origin)
+                  origin = reference(value, unit);
+          });
+        if (!ok)
+        {
+            break;
+        }
+
+        if (inlined && origin != 0)
+        {
+            const InlinedCall call{ functionName(origin, s_MAX_NAME_INDIRECTIONS), depth };
+            uint64_t begin = 0;
+            uint64_t end = 0;
+            if (ranges.form != 0)
+            {
+                forEachRange(ranges, unit,
+                             [&](uint64_t b, uint64_t e) { index->add(b, e, call); });
+            }
+            else if (address(low, unit, begin) && high.form != 0)
+            {
+                if (!address(high, unit, end))
+                {
+                    end = begin + high.value;
+                }
+                index->add(begin, end, call);
+            }
+        }
+
+        if (abbrev->hasChildren)
+        {
+            depthStack.push_back(inlined ? depth + 1 : depth);
+        }
+    }
+
+    index->build();
+    unit.inlinedCalls = std::move(index);
+}
+
+size_t DwarfModule::findCalls(uint64_t addr, const char** names, size_t maxNames)
+{
+    if (!m_scanned)
+    {
+        scanUnits();
+    }
+
+    InlinedCall calls[s_MAX_INLINE_DEPTH];
+    size_t numCalls = 0;
+
+    m_unitRanges.forEachContaining(addr, [&](const IntervalIndex<uint32_t>::Entry& entry) {
+        CompUnit& unit = m_units[entry.value];
+        if (!unit.inlinedCalls)
+        {
+            if (!prepareUnit(unit))
+            {
+                return;
+            }
+            indexUnit(unit);
+        }
+        unit.inlinedCalls->forEachContaining(
+          addr, [&](const IntervalIndex<InlinedCall>::Entry& call) {
+              if (numCalls < s_MAX_INLINE_DEPTH)
+              {
+                  calls[numCalls++] = call.value;
+              }
+          });
+    });
+
+    // innermost call first
+    std::sort(calls, calls + numCalls, [](const InlinedCall& lhs, const InlinedCall& rhs) {
+        return lhs.depth > rhs.depth;
+    });
+    const size_t n = std::min(numCalls, maxNames);
+    for (size_t i = 0; i < n; ++i)
+    {
+        names[i] = calls[i].name;
+    }
+    return n;
+}
+
+
+namespace
+{
+
+/// A loaded module and its debug information.
+struct ModuleDebugInfo
+{
+    ModuleDebugInfo(uintptr_t b, const char* p) : bias(b), path(p) {}
+
+    uintptr_t bias;
+    std::string path;
+    bool hasDebugInfo = false;
+    DwarfModule dwarf;
+};
+
+} // namespace
+
+/// guards s_modules and all DwarfModule instances
+static std::mutex s_dwarfMutex;
+
+/// all modules we've looked at (never freed: names handed out point into their mappings)
+static std::vector<std::unique_ptr<ModuleDebugInfo>> s_modules;
+
+
+size_t findInlinedCalls(pointer_t pc, const char** names, size_t maxNames) noexcept
+{
+    const ModuleInfo* module = findModule(pc);
+    if (module == nullptr)
+    {
+        return 0;
+    }
+    return findInlinedCalls(*module, pc, names, maxNames);
+}
+
+size_t findInlinedCalls(const ModuleInfo& module, pointer_t pc, const char** names,
+                        size_t maxNames) noexcept
+{
+    try
+    {
+        const std::lock_guard<std::mutex> lock(s_dwarfMutex);
+
+        ModuleDebugInfo* debugInfo = nullptr;
+        for (const auto& mod : s_modules)
+        {
+            if (mod->bias == module.base && mod->path == module.path)
+            {
+                debugInfo = mod.get();
+                break;
+            }
+        }
+        if (debugInfo == nullptr)
+        {
+            s_modules.emplace_back(new ModuleDebugInfo(module.base, module.path));
+            debugInfo = s_modules.back().get();
+            debugInfo->hasDebugInfo = debugInfo->dwarf.load(module.path);
+        }
+        if (!debugInfo->hasDebugInfo)
+        {
+            return 0;
+        }
+        return debugInfo->dwarf.findCalls(reinterpret_cast<uintptr_t>(pc) - module.base, names,
+                                          maxNames);
+    }
+    catch (const std::bad_alloc&)
+    {
+        return 0;
+    }
+}
+
+} // namespace ooopsi
+
+#endif // OOOPSI_LINUX
@@ -0,0 +1,48 @@
+/**
+ * @file    dwarf_inline.hpp
+ * @brief   lookup of inlined function calls using DWARF debug information (Linux only)
+ */
+
+#ifndef DWARF_INLINE_HPP_
+#define DWARF_INLINE_HPP_
+
+#include "internal.hpp"
+
+#ifdef OOOPSI_LINUX
+
+#include "module_map.hpp"
+
+namespace ooopsi
+{
+
+/**
+ * Looks up the chain of functions that were inlined at the given code address, using the
+ * DW_TAG_inlined_subroutine entries of the module's debug information.
+ *
+ * The per-module index is built lazily, one compilation unit at a time, when an address inside
+ * that unit is looked up for the first time. Modules without (uncompressed) debug information
+ * yield no results.
+ *
+ * The module is looked up in the current module map, which isn't updated here (that takes the
+ * loader lock): call updateModuleMap() once per trace instead.
+ *
+ * Note: not safe to use in signal handlers (allocates memory and maps files).
+ *
+ * @param[in]  pc           the code address (for return addresses, pass the call's address,
+ *                          e.g. 'pc - 1')
+ * @param[out] names        receives the (usually mangled) function names, innermost call first
+ * @param[in]  maxNames     capacity of 'names'
+ * @return number of names stored in 'names'
+ */
+size_t findInlinedCalls(pointer_t pc, const char** names, size_t maxNames) noexcept;
+
+/// Same as above, but for an address in the given module (which may be taken from another
+/// process' module map).
+size_t findInlinedCalls(const ModuleInfo& module, pointer_t pc, const char** names,
+                        size_t maxNames) noexcept;
+
+} // namespace ooopsi
+
+#endif // OOOPSI_LINUX
+
+#endif /* DWARF_INLINE_HPP_ */
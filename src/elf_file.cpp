@@ -0,0 +1,140 @@
+/**
+ * @file    elf_file.cpp
+ * @brief   minimal read-only access to ELF64 files
+ */
+
+// private library header
+#include "elf_file.hpp"
+
+#ifdef OOOPSI_LINUX
+
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+
+namespace ooopsi
+{
+
+ElfFile::~ElfFile()
+{
+    if (m_data != nullptr)
+    {
+        munmap(const_cast<uint8_t*>(m_data), m_size);
+    }
+}
+
+bool ElfFile::open(const char* path) noexcept
+{
+    if (m_data != nullptr || path == nullptr || *path == '\0')
+    {
+        return false;
+    }
+
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC); // flawfinder: ignore
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat st; // NOLINT (initialized by fstat)
+    void* mapping = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= static_cast<off_t>(sizeof(Elf64_Ehdr)))
+    {
+        mapping = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        return false;
+    }
+
+    const auto size = static_cast<size_t>(st.st_size);
+    const auto* ehdr = static_cast<const Elf64_Ehdr*>(mapping);
+    const bool valid = memcmp(ehdr->e_ident, ELFMAG, SELFMAG) == 0 &&
+                       ehdr->e_ident[EI_CLASS] == ELFCLASS64 &&
+                       ehdr->e_ident[EI_DATA] == ELFDATA2LSB &&
+                       ehdr->e_shentsize == sizeof(Elf64_Shdr) && ehdr->e_shoff < size &&
+                       ehdr->e_shnum <= (size - ehdr->e_shoff) / sizeof(Elf64_Shdr) &&
+                       ehdr->e_shstrndx < ehdr->e_shnum;
+    if (!valid)
+    {
+        munmap(mapping, size);
+        return false;
+    }
+
+    m_data = static_cast<const uint8_t*>(mapping);
+    m_size = size;
+    return true;
+}
+
+ElfSection ElfFile::section(const char* name) const noexcept
+{
+    ElfSection result;
+    if (m_data == nullptr)
+    {
+        return result;
+    }
+
+    const auto* ehdr = reinterpret_cast<const Elf64_Ehdr*>(m_data);
+    const auto* shdrs = reinterpret_cast<const Elf64_Shdr*>(m_data + ehdr->e_shoff);
+    const Elf64_Shdr& strtab = shdrs[ehdr->e_shstrndx];
+    if (strtab.sh_offset >= m_size || strtab.sh_size > m_size - strtab.sh_offset)
+    {
+        return result;
+    }
+    const char* names = reinterpret_cast<const char*>(m_data + strtab.sh_offset);
+    const size_t nameLen = strlen(name);
+
+    for (size_t i = 0; i < ehdr->e_shnum; ++i)
+    {
+        const Elf64_Shdr& shdr = shdrs[i];
+        if (shdr.sh_name + nameLen >= strtab.sh_size ||
+            memcmp(names + shdr.sh_name, name, nameLen + 1) != 0)
+        {
+            continue;
+        }
+        // we can neither use sections without file contents, nor decompress anything
+        if (shdr.sh_type == SHT_NOBITS || (shdr.sh_flags & SHF_COMPRESSED) != 0 ||
+            shdr.sh_offset > m_size || shdr.sh_size > m_size - shdr.sh_offset)
+        {
+            break;
+        }
+        result.data = m_data + shdr.sh_offset;
+        result.size = shdr.sh_size;
+        result.address = shdr.sh_addr;
+        break;
+    }
+    return result;
+}
+
+uint64_t ElfFile::imageBase() const noexcept
+{
+    if (m_data == nullptr)
+    {
+        return 0;
+    }
+
+    const auto* ehdr = reinterpret_cast<const Elf64_Ehdr*>(m_data);
+    if (ehdr->e_phentsize != sizeof(Elf64_Phdr) || ehdr->e_phoff >= m_size ||
+        ehdr->e_phnum > (m_size - ehdr->e_phoff) / sizeof(Elf64_Phdr))
+    {
+        return 0;
+    }
+    const auto* phdrs = reinterpret_cast<const Elf64_Phdr*>(m_data + ehdr->e_phoff);
+    for (size_t i = 0; i < ehdr->e_phnum; ++i)
+    {
+        if (phdrs[i].p_type == PT_LOAD)
+        {
+            // address and offset are congruent modulo the page size
+            return phdrs[i].p_vaddr - phdrs[i].p_offset;
+        }
+    }
+    return 0;
+}
+
+} // namespace ooopsi
+
+#endif // OOOPSI_LINUX
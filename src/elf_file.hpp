@@ -0,0 +1,72 @@
+/**
+ * @file    elf_file.hpp
+ * @brief   minimal read-only access to ELF64 files (Linux only)
+ */
+
+#ifndef ELF_FILE_HPP_
+#define ELF_FILE_HPP_
+
+#include "internal.hpp"
+
+#ifdef OOOPSI_LINUX
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ooopsi
+{
+
+/// A section's contents inside the memory-mapped file.
+struct ElfSection
+{
+    /// pointer to the first byte (nullptr if the section doesn't exist)
+    const uint8_t* data = nullptr;
+    /// size in bytes
+    size_t size = 0;
+    /// virtual address the section is linked at (0 for non-allocated sections)
+    uint64_t address = 0;
+
+    explicit operator bool() const noexcept { return data != nullptr; }
+};
+
+/**
+ * Memory-maps an ELF file for reading. Only the parts that are actually accessed will be paged
+ * in, so this is cheap even for huge binaries.
+ * Only 64-bit little-endian files are supported.
+ */
+class ElfFile
+{
+public:
+    ElfFile() noexcept = default;
+    ~ElfFile();
+
+    // not copyable or movable (sections point into the mapping)
+    ElfFile(const ElfFile&) = delete;
+    ElfFile& operator=(const ElfFile&) = delete;
+    ElfFile(ElfFile&&) = delete;
+    ElfFile& operator=(ElfFile&&) = delete;
+
+    /// Maps the given file. Returns false if the file doesn't exist or isn't a valid ELF file.
+    bool open(const char* path) noexcept;
+
+    /// Has a file been mapped successfully?
+    bool isOpen() const noexcept { return m_data != nullptr; }
+
+    /// Looks up a section by name. Compressed and SHT_NOBITS sections are reported as missing.
+    ElfSection section(const char* name) const noexcept;
+
+    /// Returns the link-time address that the start of the file is mapped to, based on the
+    /// first loadable segment (usually 0 for shared libraries and PIEs). Together with a
+    /// mapping's runtime address and file offset, this gives the module's load bias.
+    uint64_t imageBase() const noexcept;
+
+private:
+    const uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+};
+
+} // namespace ooopsi
+
+#endif // OOOPSI_LINUX
+
+#endif /* ELF_FILE_HPP_ */
@@ -0,0 +1,91 @@
+/**
+ * @file    folded_stacks.cpp
+ * @brief   export of stack traces in the "folded" format used for flame graphs
+ */
+
+// public library header
+#include "ooopsi.hpp"
+// private library headers
+#include "internal.hpp"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace ooopsi
+{
+
+bool writeFoldedStacks(const char* path, const ProfileSample* samples, size_t numSamples,
+                       bool compactNames, unsigned maxTemplateDepth)
+{
+    // look up all functions at once (the call instructions, not the return addresses)
+    std::vector<pointer_t> addresses;
+    for (size_t i = 0; i < numSamples; ++i)
+    {
+        for (size_t j = 0; j < samples[i].numFrames; ++j)
+        {
+            addresses.push_back(static_cast<const char*>(samples[i].frames[j]) - 1);
+        }
+    }
+    std::vector<SymbolInfo> symbols(addresses.size());
+    symbolizeAddresses(addresses.data(), addresses.size(), symbols.data());
+
+    // the names are demangled only once per function
+    std::map<const char*, std::string> names;
+    const auto frameName = [&](size_t index) -> const std::string& {
+        const SymbolInfo& symbol = symbols[index];
+        std::string& name = names[symbol.function];
+        if (name.empty())
+        {
+            if (symbol.function != nullptr)
+            {
+                name = compactNames ? demangleCompact(symbol.function, maxTemplateDepth)
+                                    : demangle(symbol.function);
+                // the separator mustn't show up in the names
+                std::replace(name.begin(), name.end(), ';', ':');
+            }
+            else
+            {
+                name = "[unknown]";
+            }
+        }
+        return name;
+    };
+
+    // identical stacks are merged (and sorted, as the usual tools do)
+    std::map<std::string, int64_t> folded;
+    size_t index = 0;
+    std::string stack;
+    for (size_t i = 0; i < numSamples; ++i)
+    {
+        // outermost frame first
+        stack.clear();
+        index += samples[i].numFrames;
+        for (size_t j = 0; j < samples[i].numFrames; ++j)
+        {
+            if (j > 0)
+            {
+                stack += ';';
+            }
+            stack += frameName(index - j - 1);
+        }
+        folded[stack] += samples[i].value;
+    }
+
+    FILE* file = fopen(path, "w"); // flawfinder: ignore
+    if (file == nullptr)
+    {
+        return false;
+    }
+    bool ok = true;
+    for (const auto& entry : folded)
+    {
+        ok = fprintf(file, "%s %" PRId64 "\n", entry.first.c_str(), entry.second) > 0 && ok;
+    }
+    return fclose(file) == 0 && ok;
+}
+
+} // namespace ooopsi
@@ -0,0 +1,366 @@
+/**
+ * @file    gzip_writer.cpp
+ * @brief   streaming gzip compression (self-contained, no zlib)
+ */
+
+#include "gzip_writer.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <new>
+
+namespace ooopsi
+{
+
+// see RFC 1951 (deflate) and RFC 1952 (gzip)
+
+/// size of the LZ77 window (maximum distance of a match)
+static constexpr size_t s_WINDOW_SIZE = 32 * 1024;
+/// minimum length of a match
+static constexpr size_t s_MIN_MATCH = 3;
+/// maximum length of a match
+static constexpr size_t s_MAX_MATCH = 258;
+/// number of hash chains (indexed by the hash of the next three bytes)
+static constexpr size_t s_HASH_SIZE = 16 * 1024;
+/// maximum number of candidates to check per position
+static constexpr unsigned s_MAX_CHAIN = 32;
+/// end of block symbol
+static constexpr unsigned s_END_OF_BLOCK = 256;
+
+/// smallest length of each length symbol (starting at 257) and its number of extra bits
+static constexpr uint16_t s_LENGTH_BASE[] = { 3,  4,  5,  6,  7,  8,  9,  10, 11,  13,
+                                              15, 17, 19, 23, 27, 31, 35, 43, 51,  59,
+                                              67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static constexpr uint8_t s_LENGTH_EXTRA[] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                              2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+/// smallest distance of each distance code and its number of extra bits
+static constexpr uint16_t s_DISTANCE_BASE[] = { 1,    2,    3,    4,    5,    7,     9,    13,
+                                                17,   25,   33,   49,   65,   97,    129,  193,
+                                                257,  385,  513,  769,  1025, 1537,  2049, 3073,
+                                                4097, 6145, 8193, 12289, 16385, 24577 };
+static constexpr uint8_t s_DISTANCE_EXTRA[] = { 0, 0, 0, 0, 1, 1, 2,  2,  3,  3,
+                                                4, 4, 5, 5, 6, 6, 7,  7,  8,  8,
+                                                9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+/// the state of the compression (too large for the stack)
+struct GzipWriter::State
+{
+    /// the data: the window (already compressed) followed by the data to compress
+    uint8_t window[2 * s_WINDOW_SIZE];
+    /// number of bytes in 'window'
+    size_t filled = 0;
+    /// position of the next byte to compress
+    size_t pos = 0;
+    /// the most recent position of each hash (-1: none)
+    int32_t head[s_HASH_SIZE];
+    /// the previous position with the same hash, indexed by position modulo the window size
+    int32_t prev[s_WINDOW_SIZE];
+
+    /// checksum and size of the uncompressed data
+    uint32_t crc = 0;
+    uint32_t inputSize = 0;
+
+    /// the bits not written to 'output' yet
+    uint64_t bitBuffer = 0;
+    unsigned bitCount = 0;
+    /// the compressed data not written to the file yet
+    uint8_t output[16 * 1024];
+    size_t outputSize = 0;
+};
+
+
+/// Updates a CRC-32 checksum.
+static uint32_t updateCrc32(uint32_t crc, const uint8_t* data, size_t size)
+{
+    struct Table
+    {
+        uint32_t entries[256];
+        Table()
+        {
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                uint32_t value = i;
+                for (int bit = 0; bit < 8; ++bit)
+                {
+                    value = (value & 1) != 0 ? 0xedb88320 ^ (value >> 1) : value >> 1;
+                }
+                entries[i] = value;
+            }
+        }
+    };
+    static const Table s_table;
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i)
+    {
+        crc = s_table.entries[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+/// Reverses the lowest 'count' bits (Huffman codes are stored starting with the MSB).
+static uint32_t reverseBits(uint32_t code, unsigned count)
+{
+    uint32_t result = 0;
+    for (unsigned i = 0; i < count; ++i)
+    {
+        result = (result << 1) | ((code >> i) & 1);
+    }
+    return result;
+}
+
+/// Hashes the three bytes at 'data'.
+static size_t hash3(const uint8_t* data)
+{
+    return ((size_t{ data[0] } << 10) ^ (size_t{ data[1] } << 5) ^ data[2]) % s_HASH_SIZE;
+}
+
+
+GzipWriter::GzipWriter() noexcept = default;
+
+GzipWriter::~GzipWriter()
+{
+    if (m_file != nullptr)
+    {
+        fclose(m_file);
+    }
+}
+
+bool GzipWriter::open(const char* path) noexcept
+{
+    m_state.reset(new (std::nothrow) State);
+    if (m_state == nullptr)
+    {
+        return false;
+    }
+    std::fill(std::begin(m_state->head), std::end(m_state->head), -1);
+    std::fill(std::begin(m_state->prev), std::end(m_state->prev), -1);
+
+    m_file = fopen(path, "wb"); // flawfinder: ignore
+    if (m_file == nullptr)
+    {
+        return false;
+    }
+    m_failed = false;
+
+    // no file name, time stamp etc., the OS is "Unix"
+    static const uint8_t s_header[] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3 };
+    for (uint8_t byte : s_header)
+    {
+        putBits(byte, 8);
+    }
+    return true;
+}
+
+void GzipWriter::write(const void* data, size_t size) noexcept
+{
+    if (m_file == nullptr)
+    {
+        return;
+    }
+    State& state = *m_state;
+    const auto* bytes = static_cast<const uint8_t*>(data);
+    state.crc = updateCrc32(state.crc, bytes, size);
+    state.inputSize += static_cast<uint32_t>(size);
+
+    while (size > 0)
+    {
+        const size_t chunk = std::min(size, sizeof(state.window) - state.filled);
+        memcpy(state.window + state.filled, bytes, chunk);
+        state.filled += chunk;
+        bytes += chunk;
+        size -= chunk;
+        if (state.filled == sizeof(state.window))
+        {
+            compress(false);
+        }
+    }
+}
+
+bool GzipWriter::finish() noexcept
+{
+    if (m_file == nullptr)
+    {
+        return false;
+    }
+    State& state = *m_state;
+    compress(true);
+    // pad the last byte
+    putBits(0, (8 - state.bitCount % 8) % 8);
+    for (uint32_t value : { state.crc, state.inputSize })
+    {
+        putBits(value, 32);
+    }
+    flushOutput();
+
+    const bool ok = !m_failed && fclose(m_file) == 0;
+    m_file = nullptr;
+    m_state.reset();
+    return ok;
+}
+
+void GzipWriter::compress(bool final) noexcept
+{
+    State& state = *m_state;
+    // keep a lookahead for the longest match (the next block continues with it)
+    const size_t limit = final ? state.filled : state.filled - s_MAX_MATCH;
+
+    // one block with the fixed Huffman codes
+    putBits(final ? 1 : 0, 1);
+    putBits(1, 2);
+
+    const auto insert = [&state](size_t pos) {
+        const size_t hash = hash3(state.window + pos);
+        state.prev[pos % s_WINDOW_SIZE] = state.head[hash];
+        state.head[hash] = static_cast<int32_t>(pos);
+    };
+    while (state.pos < limit)
+    {
+        const size_t pos = state.pos;
+        size_t bestLength = 0;
+        size_t bestDistance = 0;
+        if (pos + s_MIN_MATCH <= state.filled)
+        {
+            const size_t maxLength = std::min(s_MAX_MATCH, state.filled - pos);
+            int32_t candidate = state.head[hash3(state.window + pos)];
+            for (unsigned chain = 0; chain < s_MAX_CHAIN && candidate >= 0; ++chain)
+            {
+                const auto start = static_cast<size_t>(candidate);
+                if (pos - start > s_WINDOW_SIZE)
+                {
+                    break;
+                }
+                size_t length = 0;
+                while (length < maxLength &&
+                       state.window[start + length] == state.window[pos + length])
+                {
+                    ++length;
+                }
+                if (length > bestLength)
+                {
+                    bestLength = length;
+                    bestDistance = pos - start;
+                    if (length == maxLength)
+                    {
+                        break;
+                    }
+                }
+                // (positions older than the window have been overwritten)
+                const int32_t next = state.prev[start % s_WINDOW_SIZE];
+                if (next >= candidate)
+                {
+                    break;
+                }
+                candidate = next;
+            }
+            insert(pos);
+        }
+
+        if (bestLength >= s_MIN_MATCH)
+        {
+            putMatch(static_cast<unsigned>(bestLength), static_cast<unsigned>(bestDistance));
+            for (size_t i = 1; i < bestLength; ++i)
+            {
+                if (pos + i + s_MIN_MATCH <= state.filled)
+                {
+                    insert(pos + i);
+                }
+            }
+            state.pos += bestLength;
+        }
+        else
+        {
+            putSymbol(state.window[pos]);
+            ++state.pos;
+        }
+    }
+    putSymbol(s_END_OF_BLOCK);
+
+    if (!final)
+    {
+        // slide by the window size, so the hash chains' indices stay valid
+        memmove(state.window, state.window + s_WINDOW_SIZE, state.filled - s_WINDOW_SIZE);
+        state.filled -= s_WINDOW_SIZE;
+        state.pos -= s_WINDOW_SIZE;
+        const auto rebase = [](int32_t& pos) {
+            pos = pos >= static_cast<int32_t>(s_WINDOW_SIZE)
+                    ? pos - static_cast<int32_t>(s_WINDOW_SIZE)
+                    : -1;
+        };
+        std::for_each(std::begin(state.head), std::end(state.head), rebase);
+        std::for_each(std::begin(state.prev), std::end(state.prev), rebase);
+    }
+}
+
+void GzipWriter::putBits(uint32_t bits, unsigned count) noexcept
+{
+    State& state = *m_state;
+    state.bitBuffer |= uint64_t{ bits } << state.bitCount;
+    state.bitCount += count;
+    while (state.bitCount >= 8)
+    {
+        state.output[state.outputSize++] = static_cast<uint8_t>(state.bitBuffer);
+        state.bitBuffer >>= 8;
+        state.bitCount -= 8;
+        if (state.outputSize == sizeof(state.output))
+        {
+            flushOutput();
+        }
+    }
+}
+
+void GzipWriter::putSymbol(unsigned symbol) noexcept
+{
+    // the fixed Huffman codes
+    if (symbol < 144)
+    {
+        putBits(reverseBits(0x30 + symbol, 8), 8);
+    }
+    else if (symbol < 256)
+    {
+        putBits(reverseBits(0x190 + symbol - 144, 9), 9);
+    }
+    else if (symbol < 280)
+    {
+        putBits(reverseBits(symbol - 256, 7), 7);
+    }
+    else
+    {
+        putBits(reverseBits(0xc0 + symbol - 280, 8), 8);
+    }
+}
+
+void GzipWriter::putMatch(unsigned length, unsigned distance) noexcept
+{
+    unsigned lengthCode = 0;
+    while (lengthCode + 1 < sizeof(s_LENGTH_BASE) / sizeof(s_LENGTH_BASE[0]) &&
+           s_LENGTH_BASE[lengthCode + 1] <= length)
+    {
+        ++lengthCode;
+    }
+    putSymbol(257 + lengthCode);
+    putBits(length - s_LENGTH_BASE[lengthCode], s_LENGTH_EXTRA[lengthCode]);
+
+    unsigned distanceCode = 0;
+    while (distanceCode + 1 < sizeof(s_DISTANCE_BASE) / sizeof(s_DISTANCE_BASE[0]) &&
+           s_DISTANCE_BASE[distanceCode + 1] <= distance)
+    {
+        ++distanceCode;
+    }
+    putBits(reverseBits(distanceCode, 5), 5);
+    putBits(distance - s_DISTANCE_BASE[distanceCode], s_DISTANCE_EXTRA[distanceCode]);
+}
+
+void GzipWriter::flushOutput() noexcept
+{
+    State& state = *m_state;
+    if (state.outputSize > 0 &&
+        fwrite(state.output, 1, state.outputSize, m_file) != state.outputSize)
+    {
+        m_failed = true;
+    }
+    state.outputSize = 0;
+}
+
+} // namespace ooopsi
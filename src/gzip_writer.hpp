@@ -0,0 +1,65 @@
+/**
+ * @file    gzip_writer.hpp
+ * @brief   streaming gzip compression (self-contained, no zlib)
+ */
+
+#ifndef GZIP_WRITER_HPP_
+#define GZIP_WRITER_HPP_
+
+#include "internal.hpp"
+
+#include <cstdio>
+#include <memory>
+
+namespace ooopsi
+{
+
+/**
+ * Writes a gzip file, compressing the data as it's written. The compression is plain LZ77 with
+ * deflate's fixed Huffman codes: not as good as zlib, but good enough for repetitive data like
+ * profiles - and memory use is bounded (about 300KB), no matter how much is written.
+ */
+class GzipWriter
+{
+public:
+    GzipWriter() noexcept;
+    ~GzipWriter();
+
+    // not copyable or movable
+    GzipWriter(const GzipWriter&) = delete;
+    GzipWriter& operator=(const GzipWriter&) = delete;
+    GzipWriter(GzipWriter&&) = delete;
+    GzipWriter& operator=(GzipWriter&&) = delete;
+
+    /// Creates (or truncates) the file and writes the gzip header. Returns false on errors.
+    bool open(const char* path) noexcept;
+
+    /// Compresses and writes the data (buffered). Errors are reported by finish().
+    void write(const void* data, size_t size) noexcept;
+
+    /// Writes the remaining data and the gzip trailer, and closes the file. Returns false if
+    /// anything failed since open().
+    bool finish() noexcept;
+
+private:
+    struct State;
+
+    /// Compresses the buffered data (except for a lookahead, unless it's the final block).
+    void compress(bool final) noexcept;
+    /// Appends bits to the output, LSB first.
+    void putBits(uint32_t bits, unsigned count) noexcept;
+    /// Appends a literal or length symbol (fixed Huffman code).
+    void putSymbol(unsigned symbol) noexcept;
+    /// Appends a match.
+    void putMatch(unsigned length, unsigned distance) noexcept;
+    /// Writes the complete bytes of the output to the file.
+    void flushOutput() noexcept;
+
+    std::FILE* m_file = nullptr;
+    bool m_failed = false;
+    std::unique_ptr<State> m_state;
+};
+
+} // namespace ooopsi
+
+#endif /* GZIP_WRITER_HPP_ */
@@ -5,8 +5,12 @@
 
 // public library header
 #include "ooopsi.hpp"
-// private library header
+// private library headers
+#include "crash_notify.hpp"
 #include "internal.hpp"
+#include "journal.hpp"
+#include "module_map.hpp"
+#include "prefault.hpp"
 
 #include <csignal>
 #include <cstring>
@@ -26,6 +30,26 @@ namespace ooopsi
 
 /// Demangling is by default disabled in signal handlers: allow to overwrite this.
 static bool s_forceDemangling = false;
+/// The same goes for expanding inlined frames (which needs to read debug information).
+static bool s_forceInlinedFrames = false;
+/// Deadline for crash reports in milliseconds (0: none).
+static unsigned s_symbolizeTimeoutMs = 0;
+/// Number of breadcrumbs per thread in crash reports.
+static size_t s_numBreadcrumbs = 16;
+/// Print the breadcrumbs of all threads in crash reports?
+static bool s_allThreadBreadcrumbs = false;
+/// Print the registers in crash reports?
+static bool s_printRegisters = false;
+/// Bytes of memory to dump around the stack pointer and the faulting address.
+static size_t s_memoryDumpSize = 256;
+/// Render the names compactly? (see demangleCompact())
+static bool s_compactNames = false;
+/// Number of nested template argument lists to keep in compact names.
+static unsigned s_maxTemplateDepth = 1;
+/// Re-raise the signal for a core dump?
+static bool s_dumpCore = false;
+/// Print the library's own stats in crash reports (and at exit)?
+static bool s_printStats = false;
 
 /// Creates AbortSettings from the current context.
 inline AbortSettings makeSettings(bool inSignalHandler = false) noexcept
@@ -33,9 +57,20 @@ inline AbortSettings makeSettings(bool inSignalHandler = false) noexcept
     AbortSettings settings;
 #ifdef OOOPSI_LINUX
     settings.demangleNames = !inSignalHandler || s_forceDemangling;
+    settings.expandInlinedFrames = !inSignalHandler || s_forceInlinedFrames;
+    settings.resolveAsyncParents = !inSignalHandler;
+    settings.symbolizeTimeoutMs = s_symbolizeTimeoutMs;
 #else
     std::ignore = inSignalHandler;
 #endif
+    settings.numBreadcrumbs = s_numBreadcrumbs;
+    settings.allThreadBreadcrumbs = s_allThreadBreadcrumbs;
+    settings.printRegisters = s_printRegisters;
+    settings.memoryDumpSize = s_memoryDumpSize;
+    settings.compactNames = s_compactNames;
+    settings.maxTemplateDepth = s_maxTemplateDepth;
+    settings.dumpCore = s_dumpCore;
+    settings.printStats = s_printStats;
     return settings;
 }
 
@@ -231,6 +266,11 @@ static LONG WINAPI onWindowsException(EXCEPTION_POINTERS* excInfo)
 /// for systems supporting it, statically reserve it as an actual stack
 static std::array<uint8_t, s_ALT_STACK_SIZE> s_ALT_STACK;
 
+CrashPathBuffer altStackBuffer() noexcept
+{
+    return CrashPathBuffer{ s_ALT_STACK.data(), s_ALT_STACK.size() };
+}
+
 /**
  * Signal handler implementation for Linux.
  * @param[in] sig       the signal number
@@ -239,6 +279,9 @@ static std::array<uint8_t, s_ALT_STACK_SIZE> s_ALT_STACK;
  */
 [[noreturn]] static void signalHandler(int sig, siginfo_t* info, void* ctx)
 {
+    // let the supervisor know before doing anything expensive
+    notifyCrash(sig);
+
     char buf[64];
     const char* what = "";
     const char* detail = nullptr;
@@ -409,13 +452,20 @@ static std::array<uint8_t, s_ALT_STACK_SIZE> s_ALT_STACK;
     char reason[256];
     formatReason(reason, what, detail, addr);
     constexpr bool inSigHandler = true;
-    abort(reason, makeSettings(inSigHandler), faultAddr);
+    CrashContext crashContext;
+    crashContext.faultAddr = faultAddr;
+    crashContext.signal = sig;
+    crashContext.ucontext = ctx;
+    crashContext.dataAddr = addr;
+    abort(reason, makeSettings(inSigHandler), crashContext);
 }
 #endif // OOOPSI_WINDOWS
 
 /// What to do when std::terminate is called
 [[noreturn]] static void onTerminate()
 {
+    notifyCrash(0);
+
     /*
      * Note: This currently doesn't work with Visual Studio, see
      * https://developercommunity.visualstudio.com/content/problem/135332/stdcurrent-exception-returns-null-in-a-stdterminat.html
@@ -530,6 +580,12 @@ static std::array<uint8_t, s_ALT_STACK_SIZE> s_ALT_STACK;
 
 static bool s_handlersRegistered = false;
 
+/// Prints the library's own stats at exit.
+static void printStatsAtExit()
+{
+    printStats();
+}
+
 // Register signal and std::terminate handlers
 HandlerSetup::HandlerSetup() noexcept
 {
@@ -545,6 +601,97 @@ HandlerSetup::HandlerSetup() noexcept
     {
         s_forceDemangling = true;
     }
+    // same for inlined frames
+    opt = getenv("OOOPSI_FORCE_INLINED_FRAMES"); // flawfinder: ignore
+    if (opt != nullptr && strcmp(opt, "1") == 0)
+    {
+        s_forceInlinedFrames = true;
+    }
+    // time limit for crash reports
+    opt = getenv("OOOPSI_SYMBOLIZE_TIMEOUT_MS"); // flawfinder: ignore
+    if (opt != nullptr)
+    {
+        s_symbolizeTimeoutMs = static_cast<unsigned>(strtoul(opt, nullptr, 10));
+    }
+    // breadcrumbs in crash reports
+    opt = getenv("OOOPSI_BREADCRUMBS"); // flawfinder: ignore
+    if (opt != nullptr)
+    {
+        s_numBreadcrumbs = static_cast<size_t>(strtoul(opt, nullptr, 10));
+    }
+    opt = getenv("OOOPSI_ALL_THREAD_BREADCRUMBS"); // flawfinder: ignore
+    if (opt != nullptr && strcmp(opt, "1") == 0)
+    {
+        s_allThreadBreadcrumbs = true;
+    }
+    // registers and memory contents in crash reports
+    opt = getenv("OOOPSI_PRINT_REGISTERS"); // flawfinder: ignore
+    if (opt != nullptr && strcmp(opt, "1") == 0)
+    {
+        s_printRegisters = true;
+    }
+    opt = getenv("OOOPSI_MEMORY_DUMP_SIZE"); // flawfinder: ignore
+    if (opt != nullptr)
+    {
+        s_memoryDumpSize = static_cast<size_t>(strtoul(opt, nullptr, 10));
+    }
+    // shorter function names
+    opt = getenv("OOOPSI_COMPACT_NAMES"); // flawfinder: ignore
+    if (opt != nullptr)
+    {
+        s_compactNames = true;
+        s_maxTemplateDepth = static_cast<unsigned>(strtoul(opt, nullptr, 10));
+    }
+    // end with the original signal, so the system writes a core dump
+    opt = getenv("OOOPSI_DUMP_CORE"); // flawfinder: ignore
+    if (opt != nullptr && strcmp(opt, "1") == 0)
+    {
+        s_dumpCore = true;
+    }
+    // the library's own counters and timings
+    opt = getenv("OOOPSI_STATS"); // flawfinder: ignore
+    if (opt != nullptr && strcmp(opt, "1") == 0 && !s_printStats)
+    {
+        s_printStats = true;
+        atexit(printStatsAtExit);
+    }
+    // how often to record the causal parents of async tasks
+    opt = getenv("OOOPSI_ASYNC_SAMPLING"); // flawfinder: ignore
+    if (opt != nullptr)
+    {
+        setAsyncSampling(static_cast<unsigned>(strtoul(opt, nullptr, 10)));
+    }
+    opt = getenv("OOOPSI_TRACEPOINT_SAMPLING"); // flawfinder: ignore
+    if (opt != nullptr)
+    {
+        setTracePointSampling(static_cast<unsigned>(strtoul(opt, nullptr, 10)));
+    }
+    opt = getenv("OOOPSI_LOCK_SAMPLING"); // flawfinder: ignore
+    if (opt != nullptr)
+    {
+        setLockWaitSampling(strtoull(opt, nullptr, 10));
+    }
+    // where to send the early crash notification (if at all)
+    setupCrashNotification();
+    // where to keep a copy of the crash reports (if at all)
+    setupCrashJournal();
+#ifdef OOOPSI_LINUX
+    // optionally, page in (and lock) what the handlers need, before memory gets tight
+    opt = getenv("OOOPSI_PREFAULT"); // flawfinder: ignore
+    if (opt != nullptr && (strcmp(opt, "1") == 0 || strcmp(opt, "lock") == 0))
+    {
+        const PrefaultStats stats = prefaultCrashPath(strcmp(opt, "lock") == 0);
+        // the memory isn't for free: tell how much it is
+        LogSettings settings;
+        settings.logFunc = getAbortLogFunc();
+        char messageBuffer[128];
+        snprintf(messageBuffer, sizeof(messageBuffer),
+                 "ooopsi: paged in %zu KiB for crash reports (%zu KiB locked)",
+                 stats.touchedBytes / 1024, stats.lockedBytes / 1024);
+        logLine(settings, messageBuffer);
+        logLine(settings, nullptr);
+    }
+#endif // OOOPSI_LINUX
 
 
     if (s_handlersRegistered)
@@ -578,6 +725,9 @@ HandlerSetup::HandlerSetup() noexcept
         abort(messageBuffer, makeSettings());
     };
 
+    // take the initial snapshot of the loaded modules (can't be done in the signal handler)
+    updateModuleMap();
+
     // use an alternate stack in case we have a stack overflow!
     {
         stack_t altStack;
@@ -607,6 +757,13 @@ HandlerSetup::HandlerSetup() noexcept
             err("sigaction", sig);
         }
     }
+
+    // optionally, leave the symbolization to a helper process
+    opt = getenv("OOOPSI_CRASH_HELPER"); // flawfinder: ignore
+    if (opt != nullptr && strcmp(opt, "1") == 0)
+    {
+        startCrashHelper();
+    }
 #endif // OOOPSI_WINDOWS
 }
 
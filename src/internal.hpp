@@ -45,6 +45,14 @@
 #define OOOPSI_MSVC
 #endif
 
+// thread-local variables accessed from signal handlers: make sure that the first access doesn't
+// have to allocate the thread's TLS block
+#ifdef OOOPSI_LINUX
+#define OOOPSI_TLS_INITIAL_EXEC __attribute__((tls_model("initial-exec")))
+#else
+#define OOOPSI_TLS_INITIAL_EXEC
+#endif
+
 
 #ifdef OOOPSI_WINDOWS
 #include <windows.h>
@@ -60,10 +68,82 @@ static constexpr size_t s_ALT_STACK_SIZE = 16 * 1024;
 static constexpr size_t s_MAX_STACK_FRAMES = 128;
 
 
+/// Details about a crash caused by a signal/exception (all optional).
+struct CrashContext
+{
+    /// address of the faulting instruction (used to highlight the according backtrace line)
+    const pointer_t* faultAddr = nullptr;
+    /// the signal number (0 if not caused by a signal)
+    int signal = 0;
+    /// the signal's ucontext_t (Linux only)
+    const void* ucontext = nullptr;
+    /// the memory address that caused the fault (e.g. of an invalid access)
+    const pointer_t* dataAddr = nullptr;
+};
+
 /// Extension of the public abort() function with an optional address that caused the fault.
 /// The address will be used to highlight the according backtrace line.
 [[noreturn]] void abort(const char* reason, AbortSettings settings, const pointer_t* faultAddr);
 
+/// Extension of the public abort() function with details about the crash.
+[[noreturn]] void abort(const char* reason, AbortSettings settings, const CrashContext& context);
+
+
+/// A frame of a stack trace without symbol information.
+struct RawFrame
+{
+    /// the return address - or the faulting instruction if 'exact' is set
+    pointer_t address;
+    /// true if 'address' is the instruction that was executed (the frame after a signal frame)
+    bool exact;
+};
+
+/// Collects the addresses of the current stack trace, starting at the caller. This doesn't look
+/// up any symbols and is therefore much faster than collecting a full trace. On Linux, this is
+/// safe to use in signal handlers (unless 'settings.stopAt' is used, which requires symbol
+/// lookups).
+///
+/// @param[out] buffer           buffer that will be filled with stack frames
+/// @param[in]  bufferSize       maximum number of frames to store in 'buffer'
+/// @param[in]  settings         which frames to collect
+/// @return number of actually stored frames in 'buffer'
+size_t collectRawStackTrace(RawFrame* buffer, size_t bufferSize,
+                            const TraceSettings& settings) noexcept;
+
+/// Same as above, collecting all frames.
+inline size_t collectRawStackTrace(RawFrame* buffer, size_t bufferSize) noexcept
+{
+    return collectRawStackTrace(buffer, bufferSize, TraceSettings());
+}
+
+/// Same as printStackTrace(), but doesn't end the log (e.g. to append more sections).
+///
+/// @param[in] settings     log settings (the log function must be set)
+/// @param[in] faultAddr    optional: address of the fault (highlighted)
+void logStackTrace(const LogSettings& settings, const pointer_t* faultAddr);
+
+/// A loaded module (Linux only, see module_map.hpp).
+struct ModuleInfo;
+
+/// Prints a trace collected via collectRawStackTrace(), optionally looking up the symbols.
+/// Unlike printStackTrace(), this doesn't end the log (by passing a nullptr to the log function).
+///
+/// @param[in] frames           the frames to print
+/// @param[in] numFrames        number of frames
+/// @param[in] settings         log settings (the log function must be set)
+/// @param[in] faultAddr        optional: address of the fault (highlighted)
+/// @param[in] resolveSymbols   look up symbols? (not safe in signal handlers)
+/// @param[in] modules          optional: sorted list of modules to use instead of the current
+///                             module map (e.g. received from another process)
+/// @param[in] numModules       number of entries in 'modules'
+void printRawStackTrace(const RawFrame* frames, size_t numFrames, const LogSettings& settings,
+                        const pointer_t* faultAddr, bool resolveSymbols,
+                        const ModuleInfo* modules = nullptr, size_t numModules = 0);
+
+/// Passes a line to the log function of the settings (a nullptr ends the log), counting the
+/// logged lines and bytes (see getStats()).
+void logLine(const LogSettings& settings, const char* line);
+
 /// define the error string prefix as a macro to allow composing compile-time messages
 #define REASON_PREFIX "!!! TERMINATING DUE TO "
 
@@ -0,0 +1,198 @@
+/**
+ * @file    interval_index.hpp
+ * @brief   compact, sorted index of (possibly nested) address ranges
+ */
+
+#ifndef INTERVAL_INDEX_HPP_
+#define INTERVAL_INDEX_HPP_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace ooopsi
+{
+
+/**
+ * Index of half-open address intervals [low, high), each carrying a small value.
+ *
+ * All intervals are stored in a single vector sorted by their start address (intervals with the
+ * same start keep the order they were added in). On top of it, a small implicit binary tree holds
+ * the maximum end address of each block of s_BLOCK_SIZE intervals and of each subtree, so the
+ * intervals containing an address (nested ones as well) are found without scanning over intervals
+ * that end before it, no matter how long some earlier interval is.
+ *
+ * Usage: add() all intervals, call build(), then query using findLast() or forEachContaining().
+ * More intervals can be added later on, the next build() merges them into the sorted ones.
+ */
+template <class Value>
+class IntervalIndex
+{
+public:
+    struct Entry
+    {
+        uint64_t low;
+        uint64_t high;
+        Value value;
+    };
+
+    /// Adds an interval (empty ones are ignored). Invalidates the index until build() is called.
+    void add(uint64_t low, uint64_t high, const Value& value)
+    {
+        if (low < high)
+        {
+            m_entries.push_back(Entry{ low, high, value });
+        }
+    }
+
+    /// Sorts the intervals added since the last call, merges them into the others and prepares
+    /// the lookup tree. Releases unused memory when building from scratch.
+    void build()
+    {
+        const auto byLow = [](const Entry& lhs, const Entry& rhs) { return lhs.low < rhs.low; };
+        const auto middle = m_entries.begin() + static_cast<std::ptrdiff_t>(m_numSorted);
+        std::stable_sort(middle, m_entries.end(), byLow);
+        std::inplace_merge(m_entries.begin(), middle, m_entries.end(), byLow);
+        if (m_numSorted == 0)
+        {
+            m_entries.shrink_to_fit();
+        }
+        m_numSorted = m_entries.size();
+        buildTree();
+    }
+
+    /// Returns the interval containing 'addr' with the highest start address (of those with the
+    /// same start, the one added last), or nullptr.
+    const Entry* findLast(uint64_t addr) const noexcept
+    {
+        const size_t i = findLastReaching(upperBound(addr), addr);
+        return i != s_NONE ? &m_entries[i] : nullptr;
+    }
+
+    /// Calls 'func(const Entry&)' for every interval containing 'addr' (in descending order of
+    /// their start address, i.e. inner intervals before outer ones).
+    template <class Func>
+    void forEachContaining(uint64_t addr, Func&& func) const
+    {
+        size_t i = upperBound(addr);
+        while ((i = findLastReaching(i, addr)) != s_NONE)
+        {
+            func(m_entries[i]);
+        }
+    }
+
+    /// Removes the intervals for which 'pred(const Entry&)' returns true. Keeps the index valid
+    /// (if it was built).
+    template <class Pred>
+    size_t removeIf(Pred&& pred)
+    {
+        const size_t oldSize = m_entries.size();
+        const auto middle = m_entries.begin() + static_cast<std::ptrdiff_t>(m_numSorted);
+        const auto sortedEnd = std::remove_if(m_entries.begin(), middle, pred);
+        const auto end = std::move(middle, std::remove_if(middle, m_entries.end(), pred),
+                                   sortedEnd);
+        m_numSorted = static_cast<size_t>(sortedEnd - m_entries.begin());
+        m_entries.erase(end, m_entries.end());
+        buildTree();
+        return oldSize - m_entries.size();
+    }
+
+    /// Removes all intervals.
+    void clear()
+    {
+        m_entries.clear();
+        m_numSorted = 0;
+        m_tree.clear();
+        m_numLeaves = 0;
+    }
+
+    size_t size() const noexcept { return m_entries.size(); }
+    bool empty() const noexcept { return m_entries.empty(); }
+
+private:
+    /// number of intervals per leaf of the tree
+    static constexpr size_t s_BLOCK_SIZE = 16;
+    /// "no interval"
+    static constexpr size_t s_NONE = SIZE_MAX;
+
+    /// Fills the tree from the (sorted) intervals.
+    void buildTree()
+    {
+        const size_t numBlocks = (m_entries.size() + s_BLOCK_SIZE - 1) / s_BLOCK_SIZE;
+        // more leaves than blocks: a search never has to start past the last leaf
+        m_numLeaves = 1;
+        while (m_numLeaves <= numBlocks)
+        {
+            m_numLeaves *= 2;
+        }
+        m_tree.assign(2 * m_numLeaves, 0);
+        for (size_t i = 0; i < m_entries.size(); ++i)
+        {
+            uint64_t& leaf = m_tree[m_numLeaves + i / s_BLOCK_SIZE];
+            leaf = std::max(leaf, m_entries[i].high);
+        }
+        for (size_t node = m_numLeaves - 1; node > 0; --node)
+        {
+            m_tree[node] = std::max(m_tree[2 * node], m_tree[2 * node + 1]);
+        }
+    }
+
+    /// Returns the index of the first interval starting after 'addr'.
+    size_t upperBound(uint64_t addr) const noexcept
+    {
+        auto it = std::upper_bound(m_entries.begin(), m_entries.end(), addr,
+                                   [](uint64_t a, const Entry& entry) { return a < entry.low; });
+        return static_cast<size_t>(it - m_entries.begin());
+    }
+
+    /// Returns the index of the last interval before 'end' which ends after 'addr', or s_NONE.
+    size_t findLastReaching(size_t end, uint64_t addr) const noexcept
+    {
+        // the intervals before 'end' in its own block
+        const size_t block = end / s_BLOCK_SIZE;
+        size_t i = end;
+        while (i > block * s_BLOCK_SIZE)
+        {
+            --i;
+            if (m_entries[i].high > addr)
+            {
+                return i;
+            }
+        }
+        // the nearest subtree left of the block that reaches 'addr' ...
+        size_t node = m_numLeaves + block;
+        while (node > 1 && ((node & 1) == 0 || m_tree[node - 1] <= addr))
+        {
+            node /= 2;
+        }
+        if (node <= 1)
+        {
+            return s_NONE;
+        }
+        // ... and its rightmost block that does
+        --node;
+        while (node < m_numLeaves)
+        {
+            node = m_tree[2 * node + 1] > addr ? 2 * node + 1 : 2 * node;
+        }
+        i = (node - m_numLeaves + 1) * s_BLOCK_SIZE;
+        do
+        {
+            --i;
+        } while (m_entries[i].high <= addr);
+        return i;
+    }
+
+    std::vector<Entry> m_entries;
+    /// number of intervals (at the front of m_entries) that are sorted
+    size_t m_numSorted = 0;
+    /// maximum end address per subtree: node 1 is the root, the children of node n are 2n and
+    /// 2n + 1, the leaves (one per block of intervals) start at m_numLeaves
+    std::vector<uint64_t> m_tree;
+    size_t m_numLeaves = 0;
+};
+
+} // namespace ooopsi
+
+#endif /* INTERVAL_INDEX_HPP_ */
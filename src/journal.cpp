@@ -0,0 +1,229 @@
+/**
+ * @file    journal.cpp
+ * @brief   memory-mapped crash journal
+ */
+
+// private library header
+#include "journal.hpp"
+
+#ifdef OOOPSI_LINUX
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <ctime>
+
+namespace ooopsi
+{
+
+/// the mapped journal file (nullptr if not set up)
+static JournalHeader* s_journal = nullptr;
+/// size of the mapping
+static size_t s_journalSize = 0;
+/// set when the first report is started
+static std::atomic<bool> s_reportStarted{ false };
+/// the report being written
+static JournalRecord* s_record = nullptr;
+/// maximum length of its text
+static size_t s_recordCapacity = 0;
+/// end of the space reserved for it
+static uint64_t s_reservedEnd = 0;
+/// the current process (cached, getpid() is a system call)
+static pid_t s_processId = 0;
+/// the log function to forward the report to
+static LogFunc s_forwardLogFunc = nullptr;
+
+
+/// Rounds up to the record alignment.
+static uint64_t alignRecord(uint64_t offset)
+{
+    return (offset + 7) & ~uint64_t{ 7 };
+}
+
+/// Offset of the first record.
+static constexpr uint64_t s_DATA_START = (sizeof(JournalHeader) + 7) & ~uint64_t{ 7 };
+
+/// Updates the cached process ID in forked children.
+static void updateProcessId()
+{
+    s_processId = getpid();
+}
+
+/// Checks whether an existing file is a valid journal.
+static bool isValid(const JournalHeader& header, uint64_t fileSize)
+{
+    return memcmp(header.magic, s_JOURNAL_MAGIC, sizeof(header.magic)) == 0 &&
+           header.headerSize == sizeof(JournalHeader) && header.fileSize == fileSize &&
+           header.writeOffset >= s_DATA_START && header.writeOffset <= fileSize &&
+           header.writeOffset % 8 == 0;
+}
+
+void setupCrashJournal() noexcept
+{
+    if (s_journal != nullptr)
+    {
+        return;
+    }
+    const char* path = getenv("OOOPSI_JOURNAL"); // flawfinder: ignore
+    if (path == nullptr || *path == '\0')
+    {
+        return;
+    }
+    size_t size = s_JOURNAL_DEFAULT_SIZE;
+    const char* opt = getenv("OOOPSI_JOURNAL_SIZE"); // flawfinder: ignore
+    if (opt != nullptr)
+    {
+        size = std::max<size_t>(strtoull(opt, nullptr, 10), s_JOURNAL_MIN_SIZE);
+        size = static_cast<size_t>(alignRecord(size));
+    }
+
+    const int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600); // flawfinder: ignore
+    if (fd < 0)
+    {
+        return;
+    }
+
+    // keep the reports of an existing journal
+    bool valid = false;
+    struct stat st; // NOLINT (initialized by fstat)
+    JournalHeader header;
+    if (fstat(fd, &st) == 0 && static_cast<uint64_t>(st.st_size) >= s_JOURNAL_MIN_SIZE &&
+        pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+        isValid(header, static_cast<uint64_t>(st.st_size)))
+    {
+        size = static_cast<size_t>(st.st_size);
+        valid = true;
+    }
+    // allocate all blocks now: writing to a hole of a sparse file would raise SIGBUS if the
+    // disk is full by the time of the crash
+    if ((!valid && ftruncate(fd, static_cast<off_t>(size)) != 0) ||
+        posix_fallocate(fd, 0, static_cast<off_t>(size)) != 0)
+    {
+        close(fd);
+        return;
+    }
+    void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED)
+    {
+        return;
+    }
+
+    s_journal = static_cast<JournalHeader*>(mem);
+    s_journalSize = size;
+    s_processId = getpid();
+    pthread_atfork(nullptr, nullptr, updateProcessId);
+    if (!valid)
+    {
+        memset(s_journal, 0, sizeof(JournalHeader));
+        memcpy(s_journal->magic, s_JOURNAL_MAGIC, sizeof(s_journal->magic));
+        s_journal->headerSize = sizeof(JournalHeader);
+        s_journal->fileSize = size;
+        s_journal->writeOffset = s_DATA_START;
+        s_journal->nextSequence = 1;
+    }
+}
+
+/// Appends text to the current report.
+static void appendToRecord(const char* text, size_t len)
+{
+    JournalRecord& record = *s_record;
+    const size_t available = s_recordCapacity - record.length;
+    if (len > available)
+    {
+        len = available;
+        record.flags |= s_JOURNAL_RECORD_TRUNCATED;
+    }
+    memcpy(reinterpret_cast<char*>(&record + 1) + record.length, text, len);
+    record.length += len;
+}
+
+/// Hands the unused part of the reserved space back - unless another report has been started
+/// after this one in the meantime (by another process), which leaves a gap.
+static void releaseUnusedSpace()
+{
+    const auto recordOffset =
+      static_cast<uint64_t>(reinterpret_cast<char*>(s_record) - reinterpret_cast<char*>(s_journal));
+    const uint64_t end = alignRecord(recordOffset + sizeof(JournalRecord) + s_record->length);
+    uint64_t expected = s_reservedEnd;
+    __atomic_compare_exchange_n(&s_journal->writeOffset, &expected, end, false, __ATOMIC_RELEASE,
+                                __ATOMIC_RELAXED);
+}
+
+/// Log function writing to the journal.
+static void logToJournal(const char* message)
+{
+    if (message != nullptr)
+    {
+        appendToRecord(message, strlen(message));
+        appendToRecord("\n", 1);
+    }
+    else
+    {
+        s_record->flags |= s_JOURNAL_RECORD_COMPLETE;
+        releaseUnusedSpace();
+    }
+    s_forwardLogFunc(message);
+}
+
+LogFunc startJournalReport(LogFunc forward, int64_t processId) noexcept
+{
+    if (s_journal == nullptr || s_reportStarted.exchange(true))
+    {
+        return forward;
+    }
+
+    // reserve the space for the largest possible report: other processes using the same
+    // journal (e.g. forked children) may crash at the same time (start over at the beginning
+    // if it doesn't fit)
+    const uint64_t maxSize =
+      std::min<uint64_t>(s_JOURNAL_MAX_REPORT_SIZE, (s_journalSize - s_DATA_START) / 4);
+    uint64_t current = __atomic_load_n(&s_journal->writeOffset, __ATOMIC_RELAXED);
+    uint64_t offset = 0;
+    do
+    {
+        offset = s_journalSize - current < maxSize ? s_DATA_START : current;
+    } while (!__atomic_compare_exchange_n(&s_journal->writeOffset, &current, offset + maxSize,
+                                          true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    s_reservedEnd = offset + maxSize;
+
+    s_record = reinterpret_cast<JournalRecord*>(reinterpret_cast<char*>(s_journal) + offset);
+    s_record->magic = s_JOURNAL_RECORD_MAGIC;
+    s_record->flags = 0;
+    s_record->sequence = __atomic_fetch_add(&s_journal->nextSequence, 1, __ATOMIC_RELAXED);
+    // (read via the vDSO, not a system call)
+    s_record->timestamp = static_cast<int64_t>(time(nullptr));
+    s_record->processId = processId != 0 ? processId : s_processId;
+    s_record->length = 0;
+    s_recordCapacity = static_cast<size_t>(maxSize - sizeof(JournalRecord));
+
+    s_forwardLogFunc = forward;
+    return logToJournal;
+}
+
+} // namespace ooopsi
+
+#else // !OOOPSI_LINUX
+
+namespace ooopsi
+{
+
+void setupCrashJournal() noexcept
+{
+    // not supported (yet)
+}
+
+LogFunc startJournalReport(LogFunc forward, int64_t /*processId*/) noexcept
+{
+    return forward;
+}
+
+} // namespace ooopsi
+
+#endif // OOOPSI_LINUX
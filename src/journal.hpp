@@ -0,0 +1,97 @@
+/**
+ * @file    journal.hpp
+ * @brief   memory-mapped crash journal (Linux only)
+ */
+
+#ifndef JOURNAL_HPP_
+#define JOURNAL_HPP_
+
+#include "internal.hpp"
+
+namespace ooopsi
+{
+
+/*
+ * File format: a header, followed by the reports. Each report consists of a record header and
+ * the report's text (the logged lines, each terminated by '\n'). Records are 8-byte aligned and
+ * written one after the other; when the end of the file is reached, writing continues at the
+ * start, overwriting the oldest reports. All values are stored in native byte order.
+ *
+ * Several processes may share a journal (e.g. forked children inherit OOOPSI_JOURNAL): a report
+ * reserves the space for the largest possible report in the header atomically and hands the
+ * unused part back at its end, unless another report has been started in the meantime, which
+ * leaves a gap between the records.
+ */
+
+/// identifies a journal file
+static constexpr char s_JOURNAL_MAGIC[8] = { 'O', 'O', 'O', 'P', 'S', 'I', 'J', '1' };
+/// identifies a record ("OJRN")
+static constexpr uint32_t s_JOURNAL_RECORD_MAGIC = 0x4e524a4f;
+/// record flag: the report is complete (else the process died while writing it)
+static constexpr uint32_t s_JOURNAL_RECORD_COMPLETE = 1;
+/// record flag: the report didn't fit and was cut off
+static constexpr uint32_t s_JOURNAL_RECORD_TRUNCATED = 2;
+
+/// default size of a journal file
+static constexpr size_t s_JOURNAL_DEFAULT_SIZE = 1024 * 1024;
+/// minimum size of a journal file
+static constexpr size_t s_JOURNAL_MIN_SIZE = 64 * 1024;
+/// maximum size of a single report (but at most a quarter of the file)
+static constexpr size_t s_JOURNAL_MAX_REPORT_SIZE = 256 * 1024;
+
+/// header of a journal file
+struct JournalHeader
+{
+    char magic[8];
+    /// size of this header
+    uint32_t headerSize;
+    uint32_t reserved;
+    /// size of the file
+    uint64_t fileSize;
+    /// where to write the next record
+    uint64_t writeOffset;
+    /// sequence number of the next record
+    uint64_t nextSequence;
+};
+
+/// header of a report
+struct JournalRecord
+{
+    uint32_t magic;
+    /// see s_JOURNAL_RECORD_*
+    uint32_t flags;
+    /// increases with every report (the order of the records in the file doesn't tell)
+    uint64_t sequence;
+    /// when the report was started (seconds since the epoch)
+    int64_t timestamp;
+    /// the crashing process
+    int64_t processId;
+    /// length of the text following this header
+    uint64_t length;
+};
+
+/**
+ * Sets up the journal from the environment:
+ *  - OOOPSI_JOURNAL=<path>: the journal file (created if necessary)
+ *  - OOOPSI_JOURNAL_SIZE=<bytes>: its size (default: 1MB), used when creating the file or if
+ *    the file is invalid (which resets it)
+ * The file is mapped into memory, so reports are written without any system calls (the process
+ * ID is cached, the timestamp is read via the vDSO) and persisted by the kernel even if the
+ * process exits right away. Does nothing if already set up.
+ */
+void setupCrashJournal() noexcept;
+
+/**
+ * Starts a new report in the journal (if set up). Only the first call has an effect, so
+ * concurrent crashes don't mix their output. Safe to use in signal handlers.
+ *
+ * @param[in] forward       the log function to forward the lines to
+ * @param[in] processId     the crashing process (0: the current one)
+ * @return a log function that writes to the journal and forwards to 'forward' - or 'forward'
+ *         itself if the journal isn't set up or a report was already started
+ */
+LogFunc startJournalReport(LogFunc forward, int64_t processId = 0) noexcept;
+
+} // namespace ooopsi
+
+#endif /* JOURNAL_HPP_ */
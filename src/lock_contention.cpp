@@ -0,0 +1,291 @@
+/**
+ * @file    lock_contention.cpp
+ * @brief   contention profile: sampled stack traces of threads waiting for locks
+ */
+
+// public library header
+#include "ooopsi.hpp"
+// private library headers
+#include "internal.hpp"
+#include "stack_depot.hpp"
+#ifdef OOOPSI_LINUX
+#include "pprof_writer.hpp"
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <tuple> // for std::ignore
+
+namespace ooopsi
+{
+
+/// maximum number of distinct (kind, stack trace) pairs
+static constexpr size_t s_MAX_LOCK_WAIT_STACKS = 512;
+/// number of lock wait kinds
+static constexpr size_t s_NUM_LOCK_WAIT_KINDS = 4;
+
+namespace
+{
+/// the waits of one kind with the same stack trace
+struct LockWaitStack
+{
+    /// depot ID and kind: (id << 2) | kind (0: unused)
+    std::atomic<uint64_t> key;
+    /// number of samples
+    std::atomic<uint64_t> samples;
+    /// estimated number of waits (a sample can represent several short ones)
+    std::atomic<uint64_t> waits;
+    /// estimated blocked nanoseconds (sum of the sample weights)
+    std::atomic<uint64_t> nanos;
+};
+
+/// totals of one kind, counted for all waits (sampled or not)
+struct alignas(64) LockWaitTotals
+{
+    /// number of waits
+    std::atomic<uint64_t> waits;
+    /// blocked nanoseconds
+    std::atomic<uint64_t> nanos;
+};
+} // namespace
+
+/// the sampled stack traces (open addressing)
+static LockWaitStack s_lockWaitStacks[s_MAX_LOCK_WAIT_STACKS];
+/// samples that didn't fit into the table (or the depot)
+static std::atomic<uint64_t> s_droppedLockWaitSamples{ 0 };
+/// totals per kind
+static LockWaitTotals s_lockWaitTotals[s_NUM_LOCK_WAIT_KINDS];
+/// waits this long are always sampled, shorter ones with a probability proportional to their
+/// duration (0: sample every wait)
+static std::atomic<uint64_t> s_lockWaitSampling{ 10 * 1000 };
+/// per-thread random state for the sampling decision (0: not seeded yet)
+static thread_local uint64_t s_lockWaitRandom OOOPSI_TLS_INITIAL_EXEC = 0;
+/// set while recording a wait, capturing the stack trace may take locks itself
+static thread_local bool s_recordingLockWait OOOPSI_TLS_INITIAL_EXEC = false;
+
+/// names of the wait kinds
+static const char* const s_LOCK_WAIT_NAMES[s_NUM_LOCK_WAIT_KINDS] = { "mutex", "read lock",
+                                                                      "write lock", "condition" };
+
+
+/// Returns a random number (xorshift64*, seeded per thread).
+static uint64_t nextRandom()
+{
+    uint64_t x = s_lockWaitRandom;
+    if (x == 0)
+    {
+        // any non-zero seed will do, but threads shouldn't use the same sequence
+        x = reinterpret_cast<uintptr_t>(&s_lockWaitRandom) | 1;
+    }
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    s_lockWaitRandom = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+/**
+ * Decides whether a wait is sampled: long waits always are, shorter ones with a probability of
+ * waitNanos / interval - and then represent 'interval' nanoseconds, so the profile's estimate
+ * of the blocked time stays unbiased.
+ *
+ * @param[in]  waitNanos    the blocked time
+ * @param[out] weight       the sample's weight (estimated blocked nanoseconds)
+ * @return true if the wait is sampled
+ */
+static bool sampleLockWait(uint64_t waitNanos, uint64_t& weight)
+{
+    const uint64_t interval = s_lockWaitSampling.load(std::memory_order_relaxed);
+    if (waitNanos >= interval)
+    {
+        weight = waitNanos;
+        return true;
+    }
+    weight = interval;
+    return nextRandom() % interval < waitNanos;
+}
+
+/// Adds a sample to the entry of the given kind and trace, returns false if the table is full.
+static bool addLockWaitSample(uint32_t id, size_t kind, uint64_t waitNanos, uint64_t weight)
+{
+    const uint64_t key = (uint64_t{ id } << 2) | kind;
+    for (size_t i = 0; i < s_MAX_LOCK_WAIT_STACKS; ++i)
+    {
+        LockWaitStack& entry = s_lockWaitStacks[(key + i) % s_MAX_LOCK_WAIT_STACKS];
+        uint64_t entryKey = entry.key.load(std::memory_order_acquire);
+        if (entryKey == 0 && entry.key.compare_exchange_strong(entryKey, key))
+        {
+            entryKey = key;
+        }
+        if (entryKey == key)
+        {
+            entry.samples.fetch_add(1, std::memory_order_relaxed);
+            entry.waits.fetch_add(weight / std::max<uint64_t>(waitNanos, 1),
+                                  std::memory_order_relaxed);
+            entry.nanos.fetch_add(weight, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+void recordLockWait(LockWaitKind kind, uint64_t waitNanos, size_t skipFrames) noexcept
+{
+    const auto index = static_cast<size_t>(kind);
+    if (index >= s_NUM_LOCK_WAIT_KINDS)
+    {
+        return;
+    }
+    LockWaitTotals& totals = s_lockWaitTotals[index];
+    totals.waits.fetch_add(1, std::memory_order_relaxed);
+    totals.nanos.fetch_add(waitNanos, std::memory_order_relaxed);
+
+    uint64_t weight = 0;
+    if (s_recordingLockWait || !sampleLockWait(waitNanos, weight))
+    {
+        return;
+    }
+    s_recordingLockWait = true;
+
+    TraceSettings settings;
+    settings.maxFrames = s_MAX_DEPOT_FRAMES;
+    settings.skipInternalFrames = true;
+    settings.skipFrames = skipFrames;
+    RawFrame frames[s_MAX_DEPOT_FRAMES];
+    const size_t numFrames = collectRawStackTrace(frames, s_MAX_DEPOT_FRAMES, settings);
+
+    pointer_t addresses[s_MAX_DEPOT_FRAMES];
+    for (size_t i = 0; i < numFrames; ++i)
+    {
+        addresses[i] = frames[i].address;
+    }
+    const uint32_t id = depotStore(addresses, numFrames);
+    if (id == 0 || !addLockWaitSample(id, index, waitNanos, weight))
+    {
+        s_droppedLockWaitSamples.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    s_recordingLockWait = false;
+}
+
+void setLockWaitSampling(uint64_t intervalNanos) noexcept
+{
+    s_lockWaitSampling.store(intervalNanos, std::memory_order_relaxed);
+}
+
+void printLockContention(LogSettings settings, size_t maxStacks)
+{
+    if (settings.logFunc == nullptr)
+    {
+        settings.logFunc = getAbortLogFunc();
+    }
+
+    logLine(settings, "------- LOCK CONTENTION -------");
+
+    char messageBuffer[512];
+    for (size_t kind = 0; kind < s_NUM_LOCK_WAIT_KINDS; ++kind)
+    {
+        const LockWaitTotals& totals = s_lockWaitTotals[kind];
+        const uint64_t waits = totals.waits.load(std::memory_order_relaxed);
+        if (waits > 0)
+        {
+            snprintf(messageBuffer, sizeof(messageBuffer),
+                     "%s: %" PRIu64 " waits, %" PRIu64 " us blocked", s_LOCK_WAIT_NAMES[kind],
+                     waits, totals.nanos.load(std::memory_order_relaxed) / 1000);
+            logLine(settings, messageBuffer);
+        }
+    }
+
+    // the stack traces that blocked the longest first
+    size_t order[s_MAX_LOCK_WAIT_STACKS];
+    uint64_t keys[s_MAX_LOCK_WAIT_STACKS];
+    uint64_t nanos[s_MAX_LOCK_WAIT_STACKS];
+    size_t numStacks = 0;
+    for (size_t i = 0; i < s_MAX_LOCK_WAIT_STACKS; ++i)
+    {
+        keys[i] = s_lockWaitStacks[i].key.load(std::memory_order_acquire);
+        nanos[i] = s_lockWaitStacks[i].nanos.load(std::memory_order_relaxed);
+        if (keys[i] != 0)
+        {
+            order[numStacks++] = i;
+        }
+    }
+    std::stable_sort(order, order + numStacks,
+                     [&nanos](size_t lhs, size_t rhs) { return nanos[lhs] > nanos[rhs]; });
+
+    for (size_t i = 0; i < std::min(numStacks, maxStacks); ++i)
+    {
+        const size_t index = order[i];
+        const pointer_t* addresses = nullptr;
+        uint32_t parent = 0;
+        const size_t numFrames =
+          depotGet(static_cast<uint32_t>(keys[index] >> 2), addresses, parent);
+
+        RawFrame frames[s_MAX_DEPOT_FRAMES];
+        for (size_t j = 0; j < numFrames; ++j)
+        {
+            frames[j].address = addresses[j];
+            frames[j].exact = false;
+        }
+        snprintf(messageBuffer, sizeof(messageBuffer),
+                 "  %s: %" PRIu64 " us blocked, %" PRIu64 " samples:",
+                 s_LOCK_WAIT_NAMES[keys[index] & 3], nanos[index] / 1000,
+                 s_lockWaitStacks[index].samples.load(std::memory_order_relaxed));
+        logLine(settings, messageBuffer);
+        printRawStackTrace(frames, numFrames, settings, nullptr, true);
+    }
+    const uint64_t dropped = s_droppedLockWaitSamples.load(std::memory_order_relaxed);
+    if (dropped > 0)
+    {
+        snprintf(messageBuffer, sizeof(messageBuffer), "  %" PRIu64 " samples dropped", dropped);
+        logLine(settings, messageBuffer);
+    }
+
+    logLine(settings, "-------------------------------");
+    // END
+    logLine(settings, nullptr);
+}
+
+bool writeLockContentionProfile(const char* path)
+{
+#ifdef OOOPSI_LINUX
+    PprofWriter writer;
+    if (!writer.open(path))
+    {
+        return false;
+    }
+    writer.addSampleType("contentions", "count");
+    writer.addSampleType("delay", "nanoseconds");
+    for (const LockWaitStack& entry : s_lockWaitStacks)
+    {
+        const uint64_t key = entry.key.load(std::memory_order_acquire);
+        if (key == 0)
+        {
+            continue;
+        }
+        const pointer_t* frames = nullptr;
+        uint32_t parent = 0;
+        const size_t numFrames = depotGet(static_cast<uint32_t>(key >> 2), frames, parent);
+        uintptr_t addresses[s_MAX_DEPOT_FRAMES];
+        for (size_t i = 0; i < numFrames; ++i)
+        {
+            addresses[i] = reinterpret_cast<uintptr_t>(frames[i]);
+        }
+        const int64_t values[] = {
+            static_cast<int64_t>(entry.waits.load(std::memory_order_relaxed)),
+            static_cast<int64_t>(entry.nanos.load(std::memory_order_relaxed))
+        };
+        writer.addSample(addresses, numFrames, false, values, 2, "kind",
+                         s_LOCK_WAIT_NAMES[key & 3]);
+    }
+    return writer.finish();
+#else
+    // not supported (yet)
+    std::ignore = path;
+    return false;
+#endif
+}
+
+} // namespace ooopsi
@@ -0,0 +1,163 @@
+/**
+ * @file    lock_interpose.cpp
+ * @brief   ooopsi-lockprof: times contended pthread locks for the contention profile (Linux only)
+ *
+ * This is a separate library, so only processes that want the profile pay for it: link it or
+ * use LD_PRELOAD. It defines pthread_mutex_lock() etc., which take precedence over the ones in
+ * libc. Each of them tries the lock first, which costs the same as an uncontended lock. Only if
+ * that fails, the wait is timed and passed to ooopsi::recordLockWait().
+ */
+
+// public library header
+#include "ooopsi.hpp"
+// private library headers
+#include "internal.hpp"
+
+#include <chrono>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <dlfcn.h>
+#include <pthread.h>
+
+namespace
+{
+
+using MutexLockFunc = int (*)(pthread_mutex_t*);
+using RwLockFunc = int (*)(pthread_rwlock_t*);
+using CondWaitFunc = int (*)(pthread_cond_t*, pthread_mutex_t*);
+
+/// the interposed functions in libc
+struct RealFunctions
+{
+    MutexLockFunc mutexLock;
+    RwLockFunc rdLock;
+    RwLockFunc wrLock;
+    CondWaitFunc condWait;
+};
+
+/// Looks up the next definition of a function (the one we're hiding).
+template <typename Func>
+Func lookupNext(const char* name)
+{
+    Func func = nullptr;
+    void* symbol = dlsym(RTLD_NEXT, name);
+    static_assert(sizeof(func) == sizeof(symbol), "unexpected function pointer size");
+    memcpy(&func, &symbol, sizeof(func));
+    if (func == nullptr)
+    {
+        ooopsi::abort("ooopsi-lockprof: pthread function not found");
+    }
+    return func;
+}
+
+/// Returns the interposed functions (looked up by the first call - glibc's dlsym() doesn't use
+/// pthread locks, so this can't recurse).
+const RealFunctions& realFunctions()
+{
+    static const RealFunctions s_real = { lookupNext<MutexLockFunc>("pthread_mutex_lock"),
+                                          lookupNext<RwLockFunc>("pthread_rwlock_rdlock"),
+                                          lookupNext<RwLockFunc>("pthread_rwlock_wrlock"),
+                                          lookupNext<CondWaitFunc>("pthread_cond_wait") };
+    return s_real;
+}
+
+/// Returns the current time in nanoseconds (monotonic clock).
+uint64_t now()
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                   std::chrono::steady_clock::now().time_since_epoch())
+                                   .count());
+}
+
+/// Calls a blocking function and records its wait (if successful). Always inlined, so the
+/// interposed function is the only frame to skip.
+template <typename Func, typename... Args>
+inline __attribute__((always_inline)) int timeWait(ooopsi::LockWaitKind kind, Func func,
+                                                   Args... args)
+{
+    const uint64_t start = now();
+    const int rc = func(args...);
+    const uint64_t waitNanos = now() - start;
+    if (rc == 0)
+    {
+        // skip the interposed function
+        ooopsi::recordLockWait(kind, waitNanos, 1);
+    }
+    return rc;
+}
+
+/// prints the profile at exit (if enabled)
+struct ProfilePrinter
+{
+    ProfilePrinter() noexcept
+    {
+        // make sure the lookup doesn't happen in the middle of something else
+        realFunctions();
+        const char* opt = getenv("OOOPSI_LOCK_PROFILE"); // flawfinder: ignore
+        m_enabled = opt != nullptr && strcmp(opt, "1") == 0;
+    }
+    ~ProfilePrinter()
+    {
+        if (m_enabled)
+        {
+            ooopsi::printLockContention();
+        }
+    }
+
+    // not copyable or movable
+    ProfilePrinter(const ProfilePrinter&) = delete;
+    ProfilePrinter& operator=(const ProfilePrinter&) = delete;
+    ProfilePrinter(ProfilePrinter&&) = delete;
+    ProfilePrinter& operator=(ProfilePrinter&&) = delete;
+
+private:
+    bool m_enabled;
+};
+
+ProfilePrinter s_profilePrinter;
+
+} // namespace
+
+
+extern "C" {
+
+OOOPSI_DLL_EXPORT int pthread_mutex_lock(pthread_mutex_t* mutex)
+{
+    // (EBUSY is the only error of trylock that lock wouldn't report as well)
+    const int rc = pthread_mutex_trylock(mutex);
+    if (rc != EBUSY)
+    {
+        return rc;
+    }
+    return timeWait(ooopsi::LockWaitKind::Mutex, realFunctions().mutexLock, mutex);
+}
+
+OOOPSI_DLL_EXPORT int pthread_rwlock_rdlock(pthread_rwlock_t* rwlock)
+{
+    const int rc = pthread_rwlock_tryrdlock(rwlock);
+    if (rc != EBUSY)
+    {
+        return rc;
+    }
+    return timeWait(ooopsi::LockWaitKind::ReadLock, realFunctions().rdLock, rwlock);
+}
+
+OOOPSI_DLL_EXPORT int pthread_rwlock_wrlock(pthread_rwlock_t* rwlock)
+{
+    const int rc = pthread_rwlock_trywrlock(rwlock);
+    if (rc != EBUSY)
+    {
+        return rc;
+    }
+    return timeWait(ooopsi::LockWaitKind::WriteLock, realFunctions().wrLock, rwlock);
+}
+
+OOOPSI_DLL_EXPORT int pthread_cond_wait(pthread_cond_t* cond, pthread_mutex_t* mutex)
+{
+    // always blocks (there's no "trywait"), the profile shows the time until woken up
+    return timeWait(ooopsi::LockWaitKind::Condition, realFunctions().condWait, cond, mutex);
+}
+
+} // extern "C"
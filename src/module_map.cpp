@@ -0,0 +1,219 @@
+/**
+ * @file    module_map.cpp
+ * @brief   cached list of loaded modules
+ */
+
+// public library header
+#include "ooopsi.hpp"
+// private library header
+#include "module_map.hpp"
+
+#ifdef OOOPSI_LINUX
+
+#include <elf.h>
+#include <link.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+
+namespace ooopsi
+{
+
+/// double-buffered snapshots: updates write the inactive one, then switch
+static ModuleMap s_moduleMaps[2];
+/// index of the current snapshot
+static std::atomic<unsigned> s_currentMap{ 0 };
+
+/// serializes updates
+static std::mutex s_updateMutex;
+/// dl_iterate_phdr generation counters of the current snapshot
+static unsigned long long s_loadedCount = 0; // NOLINT (matches dl_phdr_info)
+static unsigned long long s_unloadedCount = 0; // NOLINT
+static bool s_initialized = false;
+/// notified about changes
+static ModuleMapListener s_listener = nullptr;
+
+
+const ModuleInfo* findModule(const ModuleInfo* modules, size_t count, uintptr_t addr) noexcept
+{
+    const ModuleInfo* begin = modules;
+    const ModuleInfo* end = modules + count;
+    const ModuleInfo* it = std::upper_bound(
+      begin, end, addr, [](uintptr_t a, const ModuleInfo& mod) { return a < mod.begin; });
+    if (it == begin)
+    {
+        return nullptr;
+    }
+    --it;
+    return addr < it->end ? it : nullptr;
+}
+
+/// Extracts the GNU build-id from a module's PT_NOTE segments.
+static void readBuildId(const dl_phdr_info& info, ModuleInfo& module) noexcept
+{
+    module.buildIdSize = 0;
+    for (size_t i = 0; i < info.dlpi_phnum; ++i)
+    {
+        const ElfW(Phdr)& phdr = info.dlpi_phdr[i];
+        if (phdr.p_type != PT_NOTE)
+        {
+            continue;
+        }
+        const size_t align = phdr.p_align == 8 ? 8 : 4;
+        auto alignUp = [align](size_t n) { return (n + align - 1) & ~(align - 1); };
+
+        const auto* pos = reinterpret_cast<const uint8_t*>(info.dlpi_addr + phdr.p_vaddr);
+        const uint8_t* const end = pos + phdr.p_memsz;
+        while (static_cast<size_t>(end - pos) >= sizeof(ElfW(Nhdr)))
+        {
+            const auto* note = reinterpret_cast<const ElfW(Nhdr)*>(pos);
+            const uint8_t* name = pos + sizeof(ElfW(Nhdr));
+            const uint8_t* desc = name + alignUp(note->n_namesz);
+            const uint8_t* next = desc + alignUp(note->n_descsz);
+            if (next > end || next <= pos)
+            {
+                break;
+            }
+            if (note->n_type == NT_GNU_BUILD_ID && note->n_namesz == 4 &&
+                memcmp(name, "GNU", 4) == 0)
+            {
+                module.buildIdSize =
+                  static_cast<uint8_t>(std::min<size_t>(note->n_descsz, s_MAX_BUILD_ID_SIZE));
+                memcpy(module.buildId, desc, module.buildIdSize);
+                return;
+            }
+            pos = next;
+        }
+    }
+}
+
+/// Copies a module path, truncating it if necessary.
+static void copyPath(const char* path, ModuleInfo& module) noexcept
+{
+    if (path == nullptr || *path == '\0')
+    {
+        // the main executable doesn't have a name
+        const ssize_t len = readlink("/proc/self/exe", module.path, sizeof(module.path) - 1);
+        module.path[len > 0 ? len : 0] = '\0';
+        return;
+    }
+    strncpy(module.path, path, sizeof(module.path) - 1);
+    module.path[sizeof(module.path) - 1] = '\0';
+}
+
+namespace
+{
+/// state of an update
+struct UpdateContext
+{
+    ModuleMap& map;
+    /// number of modules stored in 'map' so far
+    size_t count;
+    bool first;
+};
+} // namespace
+
+/// dl_iterate_phdr callback: fills the given ModuleMap, unless nothing has changed
+static int addModule(struct dl_phdr_info* info, size_t size, void* data)
+{
+    auto* ctx = static_cast<UpdateContext*>(data);
+
+    // the first call tells us if anything has changed since the last update
+    if (ctx->first && size >= offsetof(dl_phdr_info, dlpi_subs) + sizeof(info->dlpi_subs))
+    {
+        ctx->first = false;
+        if (s_initialized && info->dlpi_adds == s_loadedCount &&
+            info->dlpi_subs == s_unloadedCount)
+        {
+            return 1;
+        }
+        s_loadedCount = info->dlpi_adds;
+        s_unloadedCount = info->dlpi_subs;
+    }
+    if (ctx->count >= s_MAX_MODULES)
+    {
+        return 0;
+    }
+
+    ModuleInfo& module = ctx->map.modules[ctx->count];
+    module.begin = UINTPTR_MAX;
+    module.end = 0;
+    module.base = info->dlpi_addr;
+    for (size_t i = 0; i < info->dlpi_phnum; ++i)
+    {
+        const ElfW(Phdr)& phdr = info->dlpi_phdr[i];
+        if (phdr.p_type == PT_LOAD)
+        {
+            module.begin = std::min<uintptr_t>(module.begin, info->dlpi_addr + phdr.p_vaddr);
+            module.end =
+              std::max<uintptr_t>(module.end, info->dlpi_addr + phdr.p_vaddr + phdr.p_memsz);
+        }
+    }
+    if (module.begin >= module.end)
+    {
+        // nothing mapped
+        return 0;
+    }
+    readBuildId(*info, module);
+    copyPath(info->dlpi_name, module);
+    ctx->count++;
+    return 0;
+}
+
+void updateModuleMap() noexcept
+{
+    const std::lock_guard<std::mutex> lock(s_updateMutex);
+
+    // the inactive snapshot may still be read (e.g. by a signal handler that looked up the
+    // current one right before the last update): only touch it if anything has changed
+    const unsigned next = (s_currentMap.load(std::memory_order_relaxed) + 1) % 2;
+    ModuleMap& map = s_moduleMaps[next];
+    UpdateContext ctx{ map, 0, true };
+    if (dl_iterate_phdr(addModule, &ctx) != 0)
+    {
+        // unchanged
+        return;
+    }
+    map.count = ctx.count;
+    std::sort(map.modules, map.modules + map.count,
+              [](const ModuleInfo& lhs, const ModuleInfo& rhs) { return lhs.begin < rhs.begin; });
+    s_initialized = true;
+    s_currentMap.store(next, std::memory_order_release);
+    if (s_listener != nullptr)
+    {
+        s_listener(map);
+    }
+}
+
+void setModuleMapListener(ModuleMapListener listener) noexcept
+{
+    const std::lock_guard<std::mutex> lock(s_updateMutex);
+    s_listener = listener;
+}
+
+const ModuleMap& currentModuleMap() noexcept
+{
+    return s_moduleMaps[s_currentMap.load(std::memory_order_acquire)];
+}
+
+void refreshModuleMap() noexcept
+{
+    updateModuleMap();
+}
+
+} // namespace ooopsi
+
+#else // !OOOPSI_LINUX
+
+namespace ooopsi
+{
+
+void refreshModuleMap() noexcept
+{
+    // not supported (yet)
+}
+
+} // namespace ooopsi
+
+#endif // OOOPSI_LINUX
@@ -0,0 +1,111 @@
+/**
+ * @file    module_map.hpp
+ * @brief   cached list of loaded modules (Linux only)
+ */
+
+#ifndef MODULE_MAP_HPP_
+#define MODULE_MAP_HPP_
+
+#include "internal.hpp"
+
+#ifdef OOOPSI_LINUX
+
+namespace ooopsi
+{
+
+/// maximum number of modules in a snapshot (additional ones are ignored)
+static constexpr size_t s_MAX_MODULES = 512;
+
+/// maximum length of a module path (longer ones are truncated)
+static constexpr size_t s_MAX_MODULE_PATH = 256;
+
+/// maximum size of a build-id (usually 20 bytes for SHA1)
+static constexpr size_t s_MAX_BUILD_ID_SIZE = 32;
+
+/// A loaded module (executable or shared library).
+struct ModuleInfo
+{
+    /// address range covered by the module's loadable segments
+    uintptr_t begin;
+    uintptr_t end;
+    /// load bias: difference between the runtime and the link-time addresses
+    uintptr_t base;
+    /// the GNU build-id (if present)
+    uint8_t buildIdSize;
+    uint8_t buildId[s_MAX_BUILD_ID_SIZE];
+    /// full path (the main executable's path is resolved via /proc/self/exe)
+    char path[s_MAX_MODULE_PATH];
+
+    /// Returns the file name without directories.
+    const char* name() const noexcept
+    {
+        const char* slash = strrchr(path, '/');
+        return slash != nullptr ? slash + 1 : path;
+    }
+
+    /// Formats the build-id as hex string (empty if there is none).
+    template <size_t N>
+    void formatBuildId(char (&buffer)[N]) const noexcept
+    {
+        static_assert(N > 2 * s_MAX_BUILD_ID_SIZE, "buffer too small");
+        static const char digits[] = "0123456789abcdef";
+        for (size_t i = 0; i < buildIdSize; ++i)
+        {
+            buffer[2 * i] = digits[buildId[i] >> 4];
+            buffer[2 * i + 1] = digits[buildId[i] & 0xf];
+        }
+        buffer[2 * buildIdSize] = '\0';
+    }
+};
+
+/// Finds the module containing the given address in a list sorted by address (nullptr if not
+/// found).
+const ModuleInfo* findModule(const ModuleInfo* modules, size_t count, uintptr_t addr) noexcept;
+
+/// A snapshot of all loaded modules, sorted by address.
+struct ModuleMap
+{
+    size_t count;
+    ModuleInfo modules[s_MAX_MODULES];
+
+    /// Finds the module containing the given address (nullptr if not found).
+    const ModuleInfo* find(uintptr_t addr) const noexcept
+    {
+        return findModule(modules, count, addr);
+    }
+};
+
+/**
+ * Updates the cached module map if modules have been loaded or unloaded since the last call
+ * (detected using the dl_iterate_phdr generation counters, which makes this call cheap).
+ * Note: not safe to use in signal handlers (takes the loader lock).
+ */
+void updateModuleMap() noexcept;
+
+/**
+ * Returns the most recent module map snapshot. This doesn't lock anything and is safe to use in
+ * signal handlers - the snapshot is double-buffered, so it won't change while being read unless
+ * the map is updated twice in the meantime.
+ */
+const ModuleMap& currentModuleMap() noexcept;
+
+/// Called after the module map has changed, with the new snapshot.
+typedef void (*ModuleMapListener)(const ModuleMap& map);
+
+/**
+ * Sets a function to call whenever updateModuleMap() found changes (nullptr: none). It's called
+ * while updates are serialized, so it must not update the map itself.
+ */
+void setModuleMapListener(ModuleMapListener listener) noexcept;
+
+/// Shortcut: looks up an address in the current snapshot (signal-safe).
+inline const ModuleInfo* findModule(pointer_t addr) noexcept
+{
+    return currentModuleMap().find(reinterpret_cast<uintptr_t>(addr));
+}
+
+} // namespace ooopsi
+
+#endif // OOOPSI_LINUX
+
+#endif /* MODULE_MAP_HPP_ */
@@ -4,7 +4,28 @@
  */
 
 #include "ooopsi.hpp"
+#include "breadcrumbs.hpp"
+#include "crash_dump.hpp"
+#include "crash_helper.hpp"
+#include "crash_notify.hpp"
+#include "internal.hpp"
+#include "journal.hpp"
+#include "prefault.hpp"
+#include "stats.hpp"
 
+#ifdef OOOPSI_LINUX
+#include <signal.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// not defined by older versions of glibc
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+#endif
+
+#include <cinttypes>
 #include <cstdio>
 #include <cstdlib>
 
@@ -49,29 +70,285 @@ LogFunc getAbortLogFunc() noexcept
     return s_logFunc;
 }
 
+/**
+ * Ends the process after a report. If 'coreSignal' isn't 0, it's raised with its default action
+ * first, so the system writes a core dump (if enabled). Linux only.
+ */
+[[noreturn]] static void endProcess(int coreSignal)
+{
+#ifdef OOOPSI_LINUX
+    if (coreSignal != 0)
+    {
+        struct sigaction act; // NOLINT (initialization below)
+        memset(&act, 0, sizeof(act));
+        sigemptyset(&act.sa_mask);
+        act.sa_handler = SIG_DFL;
+        sigaction(coreSignal, &act, nullptr);
+        // the signal is blocked while its handler runs
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, coreSignal);
+        pthread_sigmask(SIG_UNBLOCK, &mask, nullptr);
+        raise(coreSignal);
+    }
+#else
+    std::ignore = coreSignal;
+#endif
+    // no core dump wanted (or the signal didn't terminate the process)
+    std::_Exit(OOOPSI_EXIT_CODE);
+}
+
+#ifdef OOOPSI_LINUX
+/// the log function used by a time-bounded report
+static LogFunc s_deadlineLogFunc = nullptr;
+/// set while the log function is running - it must not be re-entered when the deadline passes
+static volatile sig_atomic_t s_inLogFunc = 0;
+/// set when the deadline passed while the log function was running
+static volatile sig_atomic_t s_deadlinePassed = 0;
+/// formatted in advance, so the deadline handler doesn't have to
+static char s_deadlineMessage[128];
+/// the signal to end a time-bounded report with (see endProcess())
+static int s_deadlineCoreSignal = 0;
+/// the deadline timer (only valid while a time-bounded report is running)
+static timer_t s_deadlineTimer;
+/// the raw trace (too large for the alternate signal stack)
+static RawFrame s_rawFrames[s_MAX_STACK_FRAMES];
+
+CrashPathBuffer rawFramesBuffer() noexcept
+{
+    return CrashPathBuffer{ s_rawFrames, sizeof(s_rawFrames) };
+}
+
+/// grace period for the log function to return after the deadline passed
+static constexpr long s_LOG_GRACE_PERIOD_NS = 100 * 1000 * 1000;
+
+/// Creates the deadline timer. It sends SIGALRM to the calling (i.e. crashing) thread only: a
+/// timer of the whole process (like setitimer()'s) may run the handler in any other thread that
+/// doesn't block the signal. This is a plain system call, no threads or memory are involved.
+static bool createDeadlineTimer()
+{
+    sigevent event; // NOLINT (initialization below)
+    memset(&event, 0, sizeof(event));
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = SIGALRM;
+    event.sigev_notify_thread_id = static_cast<pid_t>(syscall(SYS_gettid));
+    return timer_create(CLOCK_MONOTONIC, &event, &s_deadlineTimer) == 0;
+}
+
+/// Arms the (one-shot) deadline timer.
+static void armDeadline(time_t sec, long nsec)
+{
+    itimerspec timer; // NOLINT (initialization below)
+    memset(&timer, 0, sizeof(timer));
+    timer.it_value.tv_sec = sec;
+    timer.it_value.tv_nsec = nsec;
+    timer_settime(s_deadlineTimer, 0, &timer, nullptr);
+}
+
+/// Ends a report that was cut short.
+[[noreturn]] static void cutShort()
+{
+    s_deadlineLogFunc(s_deadlineMessage);
+    s_deadlineLogFunc(nullptr);
+    // don't interrupt writing a core dump
+    timer_delete(s_deadlineTimer);
+    endProcess(s_deadlineCoreSignal);
+}
+
+/// SIGALRM handler: the report took too long, give up
+static void onDeadline(int /*sig*/)
+{
+    if (!s_inLogFunc)
+    {
+        cutShort();
+    }
+    if (s_deadlinePassed)
+    {
+        // the log function is stuck
+        endProcess(s_deadlineCoreSignal);
+    }
+    // let the log function finish its current line first
+    s_deadlinePassed = 1;
+    armDeadline(0, s_LOG_GRACE_PERIOD_NS);
+}
+
+/// Log function wrapper for time-bounded reports.
+static void logWithDeadline(const char* message)
+{
+    s_inLogFunc = 1;
+    s_deadlineLogFunc(message);
+    s_inLogFunc = 0;
+    if (s_deadlinePassed)
+    {
+        cutShort();
+    }
+}
+
+/**
+ * Prints the stack trace in two phases: first the raw addresses (fast), then the full trace
+ * with symbols. If the given deadline passes before the trace is complete (e.g. because
+ * libunwind gets lost on a corrupted stack), the process exits immediately. Doesn't end the log.
+ */
+static void logTimeBoundedStackTrace(LogSettings settings, const pointer_t* faultAddr,
+                                     unsigned timeoutMs, int coreSignal)
+{
+    if (!createDeadlineTimer())
+    {
+        // no deadline then
+        logStackTrace(settings, faultAddr);
+        return;
+    }
+    s_deadlineLogFunc = settings.logFunc;
+    s_deadlineCoreSignal = coreSignal;
+    settings.logFunc = logWithDeadline;
+    snprintf(s_deadlineMessage, sizeof(s_deadlineMessage),
+             "!!! SYMBOLIZATION CUT SHORT (deadline of %u ms exceeded)", timeoutMs);
+
+    struct sigaction act; // NOLINT (initialization below)
+    memset(&act, 0, sizeof(act));
+    sigemptyset(&act.sa_mask);
+    act.sa_handler = onDeadline;
+    sigaction(SIGALRM, &act, nullptr);
+    sigset_t alarmMask;
+    sigemptyset(&alarmMask);
+    sigaddset(&alarmMask, SIGALRM);
+    pthread_sigmask(SIG_UNBLOCK, &alarmMask, nullptr);
+
+    armDeadline(static_cast<time_t>(timeoutMs / 1000),
+                static_cast<long>(timeoutMs % 1000) * 1000 * 1000);
+
+    // phase 1: addresses and module offsets only, which can be symbolized offline
+    const size_t numFrames = collectRawStackTrace(s_rawFrames, s_MAX_STACK_FRAMES);
+    printRawStackTrace(s_rawFrames, numFrames, settings, faultAddr, false);
+
+    // phase 2: the full trace
+    logStackTrace(settings, faultAddr);
+    // done: don't interrupt writing a core dump
+    timer_delete(s_deadlineTimer);
+}
+#endif // OOOPSI_LINUX
+
+/// Formats a line with a timing (count, average and percentiles).
+template <size_t N>
+static void formatTiming(char (&buffer)[N], const char* name, const LatencyHistogram& timing)
+{
+    if (timing.count == 0)
+    {
+        snprintf(buffer, N, "%-15s none", name);
+        return;
+    }
+    const uint64_t average = timing.totalNanos / timing.count;
+    snprintf(buffer, N,
+             "%-15s %" PRIu64 " x, avg %" PRIu64 " ns, p50 < %" PRIu64 " ns, p99 < %" PRIu64
+             " ns",
+             name, timing.count, average, timing.percentile(50), timing.percentile(99));
+}
+
+/// Logs the stats section (see printStats()), without ending the log.
+static void logStats(const LogSettings& settings)
+{
+    const Stats stats = getStats();
+    char messageBuffer[256];
+
+    logLine(settings, "------------ STATS ------------");
+    snprintf(messageBuffer, sizeof(messageBuffer),
+             "captures:       %" PRIu64 " (%" PRIu64 " frames walked)", stats.captures,
+             stats.framesWalked);
+    logLine(settings, messageBuffer);
+    formatTiming(messageBuffer, "unwind time:", stats.unwindTime);
+    logLine(settings, messageBuffer);
+    snprintf(messageBuffer, sizeof(messageBuffer),
+             "symbol lookups: %" PRIu64 " (symbol tables: %" PRIu64 " hits, %" PRIu64
+             " misses)",
+             stats.symbolLookups, stats.symbolTableHits, stats.symbolTableMisses);
+    logLine(settings, messageBuffer);
+    snprintf(messageBuffer, sizeof(messageBuffer),
+             "caller names:   %" PRIu64 " hits, %" PRIu64 " misses", stats.callerNameHits,
+             stats.callerNameMisses);
+    logLine(settings, messageBuffer);
+    formatTiming(messageBuffer, "demangling:", stats.demangleTime);
+    logLine(settings, messageBuffer);
+    snprintf(messageBuffer, sizeof(messageBuffer),
+             "logged:         %" PRIu64 " lines, %" PRIu64 " bytes", stats.logLines,
+             stats.logBytes);
+    logLine(settings, messageBuffer);
+    if (stats.abortTime.count > 0)
+    {
+        snprintf(messageBuffer, sizeof(messageBuffer), "abort time:     %" PRIu64 " ns",
+                 stats.abortTime.totalNanos);
+        logLine(settings, messageBuffer);
+    }
+    logLine(settings, "-------------------------------");
+}
+
 [[noreturn]] void abort(const char* reason, AbortSettings settings, const pointer_t* faultAddr) {
+    CrashContext context;
+    context.faultAddr = faultAddr;
+    abort(reason, settings, context);
+}
+
+[[noreturn]] void abort(const char* reason, AbortSettings settings, const CrashContext& context)
+{
+    const uint64_t startTime = statsNow();
+    // no-op if already done by the handlers
+    notifyCrash(context.signal);
+
     if (settings.logFunc == nullptr)
     {
         settings.logFunc = getAbortLogFunc();
     }
+    // the signal to end with for a core dump (if wanted)
+    int coreSignal = 0;
+#ifdef OOOPSI_LINUX
+    if (settings.dumpCore)
+    {
+        coreSignal = context.signal != 0 ? context.signal : SIGABRT;
+    }
+#endif
+
+    // let the helper process do the work (if running) and get out of here as fast as possible
+    // (without any stats, they would interleave with its output)
+    if (settings.printStackTrace && handOffCrash(reason, settings, context))
+    {
+        endProcess(coreSignal);
+    }
+    // keep a copy of the report that doesn't depend on the log function's reader
+    settings.logFunc = startJournalReport(settings.logFunc);
 
     if (reason != nullptr)
     {
-        settings.logFunc(reason);
+        logLine(settings, reason);
     }
 
     if (settings.printStackTrace)
     {
-        printStackTrace(settings, faultAddr); // NOLINT (slicing is fine here)
+        // what the thread(s) did before
+        logBreadcrumbs(settings, settings.numBreadcrumbs, settings.allThreadBreadcrumbs);
+        logMachineState(settings, context);
+
+#ifdef OOOPSI_LINUX
+        if (settings.symbolizeTimeoutMs > 0)
+        {
+            logTimeBoundedStackTrace(settings, context.faultAddr, // NOLINT (slicing)
+                                     settings.symbolizeTimeoutMs, coreSignal);
+        }
+        else
+#endif
+        {
+            logStackTrace(settings, context.faultAddr);
+        }
     }
-    else
+
+    if (settings.printStats)
     {
-        // allow logging to stop
-        settings.logFunc(nullptr);
+        recordTiming(StatTiming::Abort, statsNow() - startTime);
+        logStats(settings);
     }
+    // allow logging to stop
+    logLine(settings, nullptr);
 
     // the application will now end
-    std::_Exit(OOOPSI_EXIT_CODE);
+    endProcess(coreSignal);
 }
 
   [[noreturn]] void abort(const char* reason, AbortSettings settings)
@@ -80,4 +357,15 @@ LogFunc getAbortLogFunc() noexcept
     abort(reason, settings, nullptr);
 }
 
+void printStats(LogSettings settings)
+{
+    if (settings.logFunc == nullptr)
+    {
+        settings.logFunc = getAbortLogFunc();
+    }
+    logStats(settings);
+
+    logLine(settings, nullptr);
+}
+
 } // namespace ooopsi
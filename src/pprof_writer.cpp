@@ -0,0 +1,331 @@
+/**
+ * @file    pprof_writer.cpp
+ * @brief   streaming encoder for pprof profiles (gzip-compressed profile.proto, Linux only)
+ */
+
+// public library header
+#include "ooopsi.hpp"
+// private library headers
+#include "internal.hpp"
+
+#ifdef OOOPSI_LINUX
+
+#include "pprof_writer.hpp"
+#include "symbolizer.hpp"
+
+#include <chrono>
+
+namespace ooopsi
+{
+
+/// protobuf wire types
+static constexpr uint32_t s_WIRE_VARINT = 0;
+static constexpr uint32_t s_WIRE_LENGTH_DELIMITED = 2;
+
+/// field numbers of the Profile message
+static constexpr uint32_t s_PROFILE_SAMPLE_TYPE = 1;
+static constexpr uint32_t s_PROFILE_SAMPLE = 2;
+static constexpr uint32_t s_PROFILE_MAPPING = 3;
+static constexpr uint32_t s_PROFILE_LOCATION = 4;
+static constexpr uint32_t s_PROFILE_FUNCTION = 5;
+static constexpr uint32_t s_PROFILE_STRING_TABLE = 6;
+static constexpr uint32_t s_PROFILE_TIME_NANOS = 9;
+static constexpr uint32_t s_PROFILE_PERIOD_TYPE = 11;
+static constexpr uint32_t s_PROFILE_PERIOD = 12;
+
+/// encoded data is passed to the compression in chunks of this size
+static constexpr size_t s_PPROF_CHUNK_SIZE = 16 * 1024;
+
+
+/// Appends a base 128 varint.
+static void putVarint(std::string& out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out += static_cast<char>((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+/// Appends a field key.
+static void putKey(std::string& out, uint32_t field, uint32_t wireType)
+{
+    putVarint(out, (uint64_t{ field } << 3) | wireType);
+}
+
+/// Appends an integer field (skipped if 0, which is the default).
+static void putInt(std::string& out, uint32_t field, uint64_t value)
+{
+    if (value != 0)
+    {
+        putKey(out, field, s_WIRE_VARINT);
+        putVarint(out, value);
+    }
+}
+
+/// Appends a field containing bytes: a string, nested message or packed integers.
+static void putBytes(std::string& out, uint32_t field, const std::string& data)
+{
+    putKey(out, field, s_WIRE_LENGTH_DELIMITED);
+    putVarint(out, data.size());
+    out += data;
+}
+
+
+bool PprofWriter::open(const char* path, const ModuleInfo* modules, size_t numModules)
+{
+    if (modules == nullptr)
+    {
+        updateModuleMap();
+        const ModuleMap& map = currentModuleMap();
+        m_ownModules.assign(map.modules, map.modules + map.count);
+        modules = m_ownModules.data();
+        numModules = m_ownModules.size();
+    }
+    setModules(modules, numModules);
+
+    if (!m_file.open(path))
+    {
+        return false;
+    }
+    // the first string must be the empty one
+    internString(std::string());
+    const auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::system_clock::now().time_since_epoch());
+    putInt(m_buffer, s_PROFILE_TIME_NANOS, static_cast<uint64_t>(now.count()));
+    return true;
+}
+
+void PprofWriter::setModules(const ModuleInfo* modules, size_t numModules)
+{
+    m_modules = modules;
+    m_numModules = numModules;
+    m_mappings.assign(numModules, 0);
+    // the addresses may refer to other code now
+    m_locations.clear();
+}
+
+void PprofWriter::addSampleType(const char* type, const char* unit)
+{
+    // ValueType
+    const uint64_t typeIndex = internString(type);
+    const uint64_t unitIndex = internString(unit);
+    putInt(m_message, 1, typeIndex);
+    putInt(m_message, 2, unitIndex);
+    writeMessage(s_PROFILE_SAMPLE_TYPE);
+}
+
+void PprofWriter::setPeriod(const char* type, const char* unit, int64_t period)
+{
+    const uint64_t typeIndex = internString(type);
+    const uint64_t unitIndex = internString(unit);
+    putInt(m_message, 1, typeIndex);
+    putInt(m_message, 2, unitIndex);
+    writeMessage(s_PROFILE_PERIOD_TYPE);
+    putInt(m_buffer, s_PROFILE_PERIOD, static_cast<uint64_t>(period));
+}
+
+void PprofWriter::addSample(const uintptr_t* addresses, size_t numAddresses, bool leafIsExact,
+                            const int64_t* values, size_t numValues, const char* labelKey,
+                            const char* labelValue)
+{
+    // everything the sample refers to must be known first (this may write other messages)
+    m_locationIds.clear();
+    for (size_t i = 0; i < numAddresses; ++i)
+    {
+        // the call instruction, not the one after it (which may be part of another function)
+        const bool isReturnAddress = i > 0 || !leafIsExact;
+        if (addresses[i] != 0)
+        {
+            m_locationIds.push_back(
+              internLocation(isReturnAddress ? addresses[i] - 1 : addresses[i]));
+        }
+    }
+    uint64_t keyIndex = 0;
+    uint64_t valueIndex = 0;
+    if (labelKey != nullptr && labelValue != nullptr)
+    {
+        keyIndex = internString(labelKey);
+        valueIndex = internString(labelValue);
+    }
+
+    // Sample: the location IDs and values are packed
+    m_nested.clear();
+    for (uint64_t id : m_locationIds)
+    {
+        putVarint(m_nested, id);
+    }
+    putBytes(m_message, 1, m_nested);
+    m_nested.clear();
+    for (size_t i = 0; i < numValues; ++i)
+    {
+        putVarint(m_nested, static_cast<uint64_t>(values[i]));
+    }
+    putBytes(m_message, 2, m_nested);
+    if (keyIndex != 0)
+    {
+        // Label
+        m_nested.clear();
+        putInt(m_nested, 1, keyIndex);
+        putInt(m_nested, 2, valueIndex);
+        putBytes(m_message, 3, m_nested);
+    }
+    writeMessage(s_PROFILE_SAMPLE);
+}
+
+bool PprofWriter::finish()
+{
+    m_file.write(m_buffer.data(), m_buffer.size());
+    m_buffer.clear();
+    return m_file.finish();
+}
+
+uint64_t PprofWriter::internString(const std::string& str)
+{
+    const auto it = m_strings.find(str);
+    if (it != m_strings.end())
+    {
+        return it->second;
+    }
+    const uint64_t index = m_strings.size();
+    m_strings.emplace(str, index);
+    putBytes(m_buffer, s_PROFILE_STRING_TABLE, str);
+    return index;
+}
+
+uint64_t PprofWriter::internLocation(uintptr_t address)
+{
+    const auto it = m_locations.find(address);
+    if (it != m_locations.end())
+    {
+        return it->second;
+    }
+
+    uint64_t mappingId = 0;
+    uint64_t functionId = 0;
+    const char* symbol = nullptr;
+    uint64_t offset = 0;
+    const ModuleInfo* module = findModule(m_modules, m_numModules, address);
+    if (module != nullptr)
+    {
+        const auto index = static_cast<size_t>(module - m_modules);
+        if (m_mappings[index] == 0)
+        {
+            // (may have been written for another module list)
+            uint64_t& mapping = m_mappingIds[std::make_tuple(module->begin, module->end,
+                                                             std::string(module->path))];
+            if (mapping == 0)
+            {
+                char buildId[2 * s_MAX_BUILD_ID_SIZE + 1];
+                module->formatBuildId(buildId);
+                const uint64_t fileIndex = internString(module->path);
+                const uint64_t buildIdIndex = internString(buildId);
+
+                // Mapping (the file offset is left out: the symbols are already known)
+                mapping = m_mappingIds.size();
+                putInt(m_message, 1, mapping);
+                putInt(m_message, 2, module->begin);
+                putInt(m_message, 3, module->end);
+                putInt(m_message, 5, fileIndex);
+                putInt(m_message, 6, buildIdIndex);
+                // has_functions
+                putInt(m_message, 7, 1);
+                writeMessage(s_PROFILE_MAPPING);
+            }
+            m_mappings[index] = mapping;
+        }
+        mappingId = m_mappings[index];
+
+        symbol = findSymbol(*module, address, offset);
+    }
+    else if (!m_ownModules.empty())
+    {
+        // not in any module of this process, e.g. JIT code
+        symbol = findProvidedSymbol(address, offset);
+    }
+    if (symbol != nullptr)
+    {
+        uint64_t& id = m_functions[symbol];
+        if (id == 0)
+        {
+            const uint64_t nameIndex = internString(demangle(symbol));
+            const uint64_t systemNameIndex = internString(symbol);
+
+            // Function
+            id = m_functions.size();
+            putInt(m_message, 1, id);
+            putInt(m_message, 2, nameIndex);
+            putInt(m_message, 3, systemNameIndex);
+            writeMessage(s_PROFILE_FUNCTION);
+        }
+        functionId = id;
+    }
+
+    // Location (with a single Line, the function - inlined calls aren't expanded)
+    const uint64_t id = ++m_numLocations;
+    m_locations.emplace(address, id);
+    putInt(m_message, 1, id);
+    putInt(m_message, 2, mappingId);
+    putInt(m_message, 3, address);
+    if (functionId != 0)
+    {
+        m_nested.clear();
+        putInt(m_nested, 1, functionId);
+        putBytes(m_message, 4, m_nested);
+    }
+    writeMessage(s_PROFILE_LOCATION);
+    return id;
+}
+
+void PprofWriter::writeMessage(uint32_t field)
+{
+    putBytes(m_buffer, field, m_message);
+    m_message.clear();
+    if (m_buffer.size() >= s_PPROF_CHUNK_SIZE)
+    {
+        m_file.write(m_buffer.data(), m_buffer.size());
+        m_buffer.clear();
+    }
+}
+
+
+bool writeProfile(const char* path, const ProfileSample* samples, size_t numSamples,
+                  const char* sampleType, const char* unit)
+{
+    PprofWriter writer;
+    if (!writer.open(path))
+    {
+        return false;
+    }
+    writer.addSampleType(sampleType, unit);
+    for (size_t i = 0; i < numSamples; ++i)
+    {
+        const ProfileSample& sample = samples[i];
+        std::vector<uintptr_t> addresses(sample.numFrames);
+        for (size_t j = 0; j < sample.numFrames; ++j)
+        {
+            addresses[j] = reinterpret_cast<uintptr_t>(sample.frames[j]);
+        }
+        writer.addSample(addresses.data(), addresses.size(), false, &sample.value, 1);
+    }
+    return writer.finish();
+}
+
+} // namespace ooopsi
+
+#else // !OOOPSI_LINUX
+
+namespace ooopsi
+{
+
+bool writeProfile(const char* /*path*/, const ProfileSample* /*samples*/, size_t /*numSamples*/,
+                  const char* /*sampleType*/, const char* /*unit*/)
+{
+    // not supported (yet)
+    return false;
+}
+
+} // namespace ooopsi
+
+#endif // OOOPSI_LINUX
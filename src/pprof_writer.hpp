@@ -0,0 +1,133 @@
+/**
+ * @file    pprof_writer.hpp
+ * @brief   streaming encoder for pprof profiles (gzip-compressed profile.proto, Linux only)
+ */
+
+#ifndef PPROF_WRITER_HPP_
+#define PPROF_WRITER_HPP_
+
+#include "internal.hpp"
+
+#ifdef OOOPSI_LINUX
+
+#include "gzip_writer.hpp"
+#include "module_map.hpp"
+
+#include <map>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+namespace ooopsi
+{
+
+/**
+ * Writes a profile in the format read by pprof (https://github.com/google/pprof, see
+ * profile.proto there), without depending on protobuf: the messages are encoded by hand.
+ *
+ * Each sample is written right away, preceded by the strings, mappings, functions and locations
+ * it refers to the first time (protobuf doesn't care about the order of the fields). So only
+ * the IDs of these are kept in memory, not the samples. Symbols are looked up in the modules'
+ * symbol tables, so the profile can be viewed without the binaries.
+ *
+ * Usage: open(), addSampleType() for each value of the samples, addSample() for each sample,
+ * finish(). If the modules change between samples, call setModules() before the samples that
+ * refer to the new ones.
+ */
+class PprofWriter
+{
+public:
+    PprofWriter() noexcept = default;
+
+    // not copyable or movable
+    PprofWriter(const PprofWriter&) = delete;
+    PprofWriter& operator=(const PprofWriter&) = delete;
+    PprofWriter(PprofWriter&&) = delete;
+    PprofWriter& operator=(PprofWriter&&) = delete;
+
+    /**
+     * Creates the file.
+     *
+     * @param[in] path          the file to write
+     * @param[in] modules       optional: sorted list of modules the addresses belong to (e.g.
+     *                          of another process), else the current module map is used
+     * @param[in] numModules    number of entries in 'modules'
+     * @return false on errors
+     */
+    bool open(const char* path, const ModuleInfo* modules = nullptr, size_t numModules = 0);
+
+    /**
+     * Sets the modules the addresses of the following samples belong to, e.g. another process'
+     * modules at the time of these samples (after libraries were loaded or unloaded).
+     *
+     * @param[in] modules       sorted list of modules (must stay valid until the next call, like
+     *                          the ones passed to open())
+     * @param[in] numModules    number of entries in 'modules'
+     */
+    void setModules(const ModuleInfo* modules, size_t numModules);
+
+    /// Adds a kind of value, e.g. ("samples", "count"), each sample has one value per kind.
+    void addSampleType(const char* type, const char* unit);
+
+    /// Sets the sampling period, e.g. ("cpu", "nanoseconds", 10000000).
+    void setPeriod(const char* type, const char* unit, int64_t period);
+
+    /**
+     * Adds a sample.
+     *
+     * @param[in] addresses     the stack trace, innermost first
+     * @param[in] numAddresses  number of addresses
+     * @param[in] leafIsExact   is the first address exact (e.g. the interrupted instruction),
+     *                          rather than a return address?
+     * @param[in] values        the values, one per sample type
+     * @param[in] numValues     number of values
+     * @param[in] labelKey      optional: a label, e.g. "thread"
+     * @param[in] labelValue    optional: the label's value, e.g. the thread name
+     */
+    void addSample(const uintptr_t* addresses, size_t numAddresses, bool leafIsExact,
+                   const int64_t* values, size_t numValues, const char* labelKey = nullptr,
+                   const char* labelValue = nullptr);
+
+    /// Writes the remaining data and closes the file. Returns false if anything failed.
+    bool finish();
+
+private:
+    /// Returns the index of a string in the string table, adding it if necessary.
+    uint64_t internString(const std::string& str);
+    /// Returns the ID of a location (0: none), adding it (and its mapping and function).
+    uint64_t internLocation(uintptr_t address);
+    /// Writes a field of the profile message that contains the message in 'm_message'.
+    void writeMessage(uint32_t field);
+
+    GzipWriter m_file;
+    /// the modules (a copy of the current module map if none were given)
+    const ModuleInfo* m_modules = nullptr;
+    size_t m_numModules = 0;
+    std::vector<ModuleInfo> m_ownModules;
+
+    std::unordered_map<std::string, uint64_t> m_strings;
+    /// mapping IDs by address range and path (of all module lists)
+    std::map<std::tuple<uintptr_t, uintptr_t, std::string>, uint64_t> m_mappingIds;
+    /// mapping IDs by index in the current modules (0: not looked up yet)
+    std::vector<uint64_t> m_mappings;
+    /// function IDs by symbol (the symbol tables keep their names)
+    std::unordered_map<const char*, uint64_t> m_functions;
+    /// location IDs by address (for the current modules)
+    std::unordered_map<uintptr_t, uint64_t> m_locations;
+    uint64_t m_numLocations = 0;
+
+    /// the location IDs of the sample being added
+    std::vector<uint64_t> m_locationIds;
+    /// the message being encoded and a buffer for nested ones
+    std::string m_message;
+    std::string m_nested;
+    /// encoded data not yet passed to m_file
+    std::string m_buffer;
+};
+
+} // namespace ooopsi
+
+#endif // OOOPSI_LINUX
+
+#endif /* PPROF_WRITER_HPP_ */
@@ -0,0 +1,343 @@
+/**
+ * @file    prefault.cpp
+ * @brief   paging in the memory needed for crash reports in advance
+ */
+
+// public library header
+#include "ooopsi.hpp"
+// private library headers
+#include "internal.hpp"
+#include "prefault.hpp"
+
+#ifdef OOOPSI_LINUX
+
+#include "module_map.hpp"
+#include "symbolizer.hpp"
+
+#include <link.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <tuple> // for std::ignore
+#include <utility>
+#include <vector>
+
+namespace ooopsi
+{
+
+// pointer encodings of .eh_frame_hdr (see the LSB specification)
+static constexpr uint8_t DW_EH_PE_absptr = 0x00;
+static constexpr uint8_t DW_EH_PE_udata4 = 0x03;
+static constexpr uint8_t DW_EH_PE_udata8 = 0x04;
+static constexpr uint8_t DW_EH_PE_sdata4 = 0x0b;
+static constexpr uint8_t DW_EH_PE_sdata8 = 0x0c;
+static constexpr uint8_t DW_EH_PE_pcrel = 0x10;
+static constexpr uint8_t DW_EH_PE_datarel = 0x30;
+
+namespace
+{
+/// the unwind tables (.eh_frame_hdr and .eh_frame) of a loaded module
+struct UnwindTables
+{
+    /// load address and name identify the module
+    uintptr_t loadAddress;
+    std::string name;
+    uintptr_t begin;
+    uintptr_t end;
+};
+} // namespace
+
+/// guards all of the following
+static std::mutex s_prefaultMutex;
+/// set by the first call of prefaultCrashPath()
+static bool s_enabled = false;
+/// lock the memory as well?
+static bool s_lock = false;
+/// what has been done so far
+static PrefaultStats s_stats;
+/// modules already taken care of (load address and name)
+static std::vector<std::pair<uintptr_t, std::string>> s_prefaultedModules;
+
+
+/**
+ * Pages in the given memory (whole pages) and optionally locks it (s_prefaultMutex must be
+ * locked).
+ *
+ * @param[in] address   start of the memory
+ * @param[in] size      size in bytes
+ * @param[in] writable  page in writable (private) pages? (anonymous memory would just be mapped
+ *                      to the zero page when reading it)
+ */
+static void prefaultRange(const void* address, size_t size, bool writable)
+{
+    if (address == nullptr || size == 0)
+    {
+        return;
+    }
+    const auto pageSize = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    const uintptr_t begin = reinterpret_cast<uintptr_t>(address) & ~(pageSize - 1);
+    const uintptr_t end = (reinterpret_cast<uintptr_t>(address) + size + pageSize - 1) &
+                          ~(pageSize - 1);
+    void* start = reinterpret_cast<void*>(begin);
+    const size_t length = end - begin;
+
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(start, length, writable ? MADV_POPULATE_WRITE : MADV_POPULATE_READ) != 0)
+#endif
+    {
+        // older kernels: touch every page
+        for (uintptr_t page = begin; page < end; page += pageSize)
+        {
+            if (writable)
+            {
+                // (the buffer may be in use, so write without changing anything)
+                __atomic_fetch_or(reinterpret_cast<uint8_t*>(page), 0, __ATOMIC_RELAXED);
+            }
+            else
+            {
+                std::ignore = *reinterpret_cast<volatile const uint8_t*>(page);
+            }
+        }
+    }
+    s_stats.touchedBytes += length;
+
+    if (s_lock && mlock(start, length) == 0)
+    {
+        s_stats.lockedBytes += length;
+    }
+}
+
+/// MemoryRangeFunc for the symbol tables
+static void prefaultReadOnlyRange(const void* address, size_t size)
+{
+    prefaultRange(address, size, false);
+}
+
+/// Returns the address of .eh_frame, as stored in .eh_frame_hdr (0 if unknown).
+static uintptr_t findEhFrame(uintptr_t ehFrameHdr)
+{
+    const auto* hdr = reinterpret_cast<const uint8_t*>(ehFrameHdr);
+    // version, eh_frame_ptr encoding, fde_count encoding, table encoding, eh_frame_ptr
+    if (hdr[0] != 1)
+    {
+        return 0;
+    }
+    const uint8_t encoding = hdr[1];
+    const uint8_t* field = hdr + 4;
+
+    uintptr_t value = 0;
+    switch (encoding & 0x0f)
+    {
+    case DW_EH_PE_absptr:
+    case DW_EH_PE_udata8:
+    case DW_EH_PE_sdata8:
+        memcpy(&value, field, sizeof(value));
+        break;
+    case DW_EH_PE_udata4:
+    {
+        uint32_t udata = 0;
+        memcpy(&udata, field, sizeof(udata));
+        value = udata;
+        break;
+    }
+    case DW_EH_PE_sdata4:
+    {
+        int32_t sdata = 0;
+        memcpy(&sdata, field, sizeof(sdata));
+        value = static_cast<uintptr_t>(static_cast<intptr_t>(sdata));
+        break;
+    }
+    default:
+        return 0;
+    }
+
+    switch (encoding & 0x70)
+    {
+    case 0:
+        return value;
+    case DW_EH_PE_pcrel:
+        return value + reinterpret_cast<uintptr_t>(field);
+    case DW_EH_PE_datarel:
+        return value + ehFrameHdr;
+    default:
+        return 0;
+    }
+}
+
+/// Returns the end of .eh_frame (following the length of its records) within the given limit.
+static uintptr_t findEhFrameEnd(uintptr_t ehFrame, uintptr_t limit)
+{
+    uintptr_t pos = ehFrame;
+    while (limit - pos >= sizeof(uint32_t))
+    {
+        uint32_t length = 0;
+        memcpy(&length, reinterpret_cast<const void*>(pos), sizeof(length));
+        pos += sizeof(length);
+        if (length == 0)
+        {
+            // terminator
+            break;
+        }
+        uint64_t recordSize = length;
+        if (length == UINT32_MAX)
+        {
+            // 64 bit DWARF
+            if (limit - pos < sizeof(recordSize))
+            {
+                break;
+            }
+            memcpy(&recordSize, reinterpret_cast<const void*>(pos), sizeof(recordSize));
+            pos += sizeof(recordSize);
+        }
+        if (recordSize > limit - pos)
+        {
+            return limit;
+        }
+        pos += static_cast<uintptr_t>(recordSize);
+    }
+    return pos;
+}
+
+/// dl_iterate_phdr callback: collects the unwind tables of all modules
+static int collectUnwindTables(struct dl_phdr_info* info, size_t /*size*/, void* data)
+{
+    auto& tables = *static_cast<std::vector<UnwindTables>*>(data);
+
+    const ElfW(Phdr)* ehFrameHdr = nullptr;
+    for (size_t i = 0; i < info->dlpi_phnum; ++i)
+    {
+        if (info->dlpi_phdr[i].p_type == PT_GNU_EH_FRAME)
+        {
+            ehFrameHdr = &info->dlpi_phdr[i];
+        }
+    }
+    if (ehFrameHdr == nullptr || ehFrameHdr->p_memsz == 0)
+    {
+        return 0;
+    }
+    UnwindTables entry;
+    entry.loadAddress = info->dlpi_addr;
+    entry.begin = info->dlpi_addr + ehFrameHdr->p_vaddr;
+    entry.end = entry.begin + ehFrameHdr->p_memsz;
+
+    // .eh_frame is (usually) in the same segment, the records are scanned up to its end
+    for (size_t i = 0; i < info->dlpi_phnum; ++i)
+    {
+        const ElfW(Phdr)& phdr = info->dlpi_phdr[i];
+        const uintptr_t segment = info->dlpi_addr + phdr.p_vaddr;
+        if (phdr.p_type == PT_LOAD && entry.begin >= segment &&
+            entry.end <= segment + phdr.p_memsz)
+        {
+            const uintptr_t ehFrame = findEhFrame(entry.begin);
+            if (ehFrame >= segment && ehFrame < segment + phdr.p_memsz)
+            {
+                entry.begin = std::min(entry.begin, ehFrame);
+                entry.end = std::max(entry.end, findEhFrameEnd(ehFrame, segment + phdr.p_memsz));
+            }
+            break;
+        }
+    }
+
+    try
+    {
+        entry.name = info->dlpi_name != nullptr ? info->dlpi_name : "";
+        tables.push_back(std::move(entry));
+    }
+    catch (const std::bad_alloc&)
+    {
+        // skip it
+    }
+    return 0;
+}
+
+/// Prefaults the unwind and symbol tables of modules that haven't been taken care of yet.
+static void prefaultModules(const ModuleMap& map)
+{
+    std::vector<UnwindTables> tables;
+    dl_iterate_phdr(collectUnwindTables, &tables);
+
+    const std::lock_guard<std::mutex> lock(s_prefaultMutex);
+    // the module map itself is double-buffered, this takes care of both copies eventually
+    prefaultRange(&map, sizeof(map), true);
+
+    for (const UnwindTables& entry : tables)
+    {
+        const auto key = std::make_pair(entry.loadAddress, entry.name);
+        if (std::find(s_prefaultedModules.begin(), s_prefaultedModules.end(), key) !=
+            s_prefaultedModules.end())
+        {
+            continue;
+        }
+        s_prefaultedModules.push_back(key);
+
+        prefaultRange(reinterpret_cast<const void*>(entry.begin), entry.end - entry.begin, false);
+
+        // the symbol tables as well, so they don't have to be read from the file after a crash
+        const ModuleInfo* module = map.find(entry.begin);
+        const ModuleSymbols* symbols = module != nullptr ? loadModuleSymbols(*module) : nullptr;
+        if (symbols != nullptr)
+        {
+            forEachSymbolTableRange(*symbols, prefaultReadOnlyRange);
+        }
+    }
+}
+
+/// ModuleMapListener: takes care of newly loaded modules
+static void onModuleMapUpdate(const ModuleMap& map)
+{
+    try
+    {
+        prefaultModules(map);
+    }
+    catch (const std::bad_alloc&)
+    {
+        // nothing we can do
+    }
+}
+
+PrefaultStats prefaultCrashPath(bool lock) noexcept
+{
+    {
+        const std::lock_guard<std::mutex> guard(s_prefaultMutex);
+        if (s_enabled)
+        {
+            return s_stats;
+        }
+        s_enabled = true;
+        s_lock = lock;
+
+        const CrashPathBuffer buffers[] = { altStackBuffer(), rawFramesBuffer() };
+        for (const CrashPathBuffer& buffer : buffers)
+        {
+            prefaultRange(buffer.address, buffer.size, true);
+        }
+    }
+
+    setModuleMapListener(onModuleMapUpdate);
+    updateModuleMap();
+    onModuleMapUpdate(currentModuleMap());
+
+    const std::lock_guard<std::mutex> guard(s_prefaultMutex);
+    return s_stats;
+}
+
+} // namespace ooopsi
+
+#else // !OOOPSI_LINUX
+
+namespace ooopsi
+{
+
+PrefaultStats prefaultCrashPath(bool /*lock*/) noexcept
+{
+    // not supported (yet)
+    return PrefaultStats();
+}
+
+} // namespace ooopsi
+
+#endif // OOOPSI_LINUX
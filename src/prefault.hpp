@@ -0,0 +1,37 @@
+/**
+ * @file    prefault.hpp
+ * @brief   paging in the memory needed for crash reports in advance
+ */
+
+#ifndef PREFAULT_HPP_
+#define PREFAULT_HPP_
+
+#include "internal.hpp"
+
+namespace ooopsi
+{
+
+/// A static buffer that is used when handling a crash (e.g. by the signal handlers).
+struct CrashPathBuffer
+{
+    void* address;
+    size_t size;
+};
+
+#ifdef OOOPSI_LINUX
+/*
+ * The buffers paged in by prefaultCrashPath() as well, one function per buffer. They aren't
+ * registered by constructors: prefaultCrashPath() may run during static initialization (see
+ * OOOPSI_PREFAULT), possibly before the constructors of other translation units. The buffers are
+ * zero-initialized, so their addresses are valid at any time.
+ */
+
+/// the alternate signal stack (see handlers.cpp)
+CrashPathBuffer altStackBuffer() noexcept;
+/// the raw trace of time-bounded reports (see ooopsi.cpp)
+CrashPathBuffer rawFramesBuffer() noexcept;
+#endif // OOOPSI_LINUX
+
+} // namespace ooopsi
+
+#endif /* PREFAULT_HPP_ */
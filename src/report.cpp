@@ -0,0 +1,332 @@
+/**
+ * @file    report.cpp
+ * @brief   rate-limited reports of non-fatal problems
+ */
+
+// public library header
+#include "ooopsi.hpp"
+// private library headers
+#include "internal.hpp"
+#include "stack_depot.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+
+namespace ooopsi
+{
+
+/// maximum number of distinct reported stack traces (further ones are suppressed)
+static constexpr size_t s_MAX_REPORTED_TRACES = 256;
+/// number of counters for the rate-limited reports, threads are distributed over them
+static constexpr size_t s_NUM_REPORT_STRIPES = 16;
+/// number of innermost callers identifying a call path (see findReportedPath())
+static constexpr size_t s_CALL_PATH_DEPTH = 8;
+/// maximum number of remembered call paths (further ones capture their stack trace each time)
+static constexpr size_t s_MAX_REPORTED_PATHS = 1024;
+/// maximum number of entries probed when looking up a call path
+static constexpr size_t s_MAX_PATH_PROBES = 8;
+
+namespace
+{
+/// a reported stack trace
+struct ReportedTrace
+{
+    /// the trace's depot ID (0: unused)
+    std::atomic<uint32_t> id;
+    /// the message of the report (set by the reporting thread)
+    std::atomic<const char*> message;
+    /// number of suppressed reports with the same trace
+    std::atomic<uint64_t> suppressed;
+};
+
+/// a call path of a reported stack trace
+struct ReportedPath
+{
+    /// hash of the callers (0: unused)
+    std::atomic<uint64_t> hash;
+    /// the reported trace (nullptr: not set yet)
+    std::atomic<ReportedTrace*> trace;
+};
+
+/// a counter on its own cache line
+struct alignas(64) StripedCounter
+{
+    std::atomic<uint64_t> value;
+};
+} // namespace
+
+/// the reported traces (open addressing)
+static ReportedTrace s_reportedTraces[s_MAX_REPORTED_TRACES];
+/// the call paths of the reported traces (open addressing)
+static ReportedPath s_reportedPaths[s_MAX_REPORTED_PATHS];
+/// reports suppressed because the table was full
+static std::atomic<uint64_t> s_untrackedReports{ 0 };
+/// reports suppressed by the rate limit (without capturing their stack trace)
+static StripedCounter s_rateLimitedReports[s_NUM_REPORT_STRIPES];
+/// the stripe assigned to the next thread
+static std::atomic<size_t> s_nextReportStripe{ 0 };
+/// the current thread's stripe (s_NUM_REPORT_STRIPES: not assigned yet)
+static thread_local size_t s_reportStripe OOOPSI_TLS_INITIAL_EXEC = s_NUM_REPORT_STRIPES;
+
+// the rate limit is a token bucket, implemented as "generic cell rate algorithm": a single
+// timestamp, which is the time when the bucket will be full again
+/// nanoseconds per token (0: no reports at all)
+static std::atomic<uint64_t> s_reportInterval{ 100 * 1000 * 1000 };
+/// size of the bucket
+static std::atomic<uint64_t> s_reportBurst{ 10 };
+/// when the bucket is full again (nanoseconds of the monotonic clock)
+static std::atomic<uint64_t> s_bucketFullTime{ 0 };
+
+
+/// Returns the current time in nanoseconds (monotonic clock).
+static uint64_t now()
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                   std::chrono::steady_clock::now().time_since_epoch())
+                                   .count());
+}
+
+/// Takes a token from the bucket, returns false if it's empty.
+static bool takeToken()
+{
+    const uint64_t interval = s_reportInterval.load(std::memory_order_relaxed);
+    if (interval == 0)
+    {
+        return false;
+    }
+    const uint64_t burst = s_reportBurst.load(std::memory_order_relaxed);
+    const uint64_t capacity = burst <= UINT64_MAX / interval ? interval * burst : UINT64_MAX;
+    const uint64_t time = now();
+    uint64_t fullTime = s_bucketFullTime.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        const uint64_t newFullTime = std::max(fullTime, time) + interval;
+        if (newFullTime - time > capacity)
+        {
+            return false;
+        }
+        if (s_bucketFullTime.compare_exchange_weak(fullTime, newFullTime,
+                                                   std::memory_order_relaxed))
+        {
+            return true;
+        }
+    }
+}
+
+/// Returns a token taken for a report that isn't logged after all.
+static void returnToken()
+{
+    const uint64_t interval = s_reportInterval.load(std::memory_order_relaxed);
+    uint64_t fullTime = s_bucketFullTime.load(std::memory_order_relaxed);
+    while (fullTime >= interval &&
+           !s_bucketFullTime.compare_exchange_weak(fullTime, fullTime - interval,
+                                                   std::memory_order_relaxed))
+    {
+    }
+}
+
+/// Counts a report suppressed by the rate limit.
+static void countRateLimited()
+{
+    size_t stripe = s_reportStripe;
+    if (stripe == s_NUM_REPORT_STRIPES)
+    {
+        stripe = s_nextReportStripe++ % s_NUM_REPORT_STRIPES;
+        s_reportStripe = stripe;
+    }
+    s_rateLimitedReports[stripe].value.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * Looks up the given trace, adding it if it's new.
+ *
+ * @param[in]  id       the trace's depot ID
+ * @param[out] added    set if the trace is new
+ * @return the entry (nullptr if the table is full)
+ */
+static ReportedTrace* findReportedTrace(uint32_t id, bool& added)
+{
+    added = false;
+    for (size_t i = 0; i < s_MAX_REPORTED_TRACES; ++i)
+    {
+        ReportedTrace& entry = s_reportedTraces[(id + i) % s_MAX_REPORTED_TRACES];
+        uint32_t entryId = entry.id.load(std::memory_order_relaxed);
+        if (entryId == 0 && entry.id.compare_exchange_strong(entryId, id))
+        {
+            added = true;
+            return &entry;
+        }
+        if (entryId == id)
+        {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+/// Hashes a call path (FNV-1a, never 0).
+static uint64_t hashCallPath(const pointer_t* callers, size_t numCallers)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < numCallers; ++i)
+    {
+        hash = (hash ^ reinterpret_cast<uintptr_t>(callers[i])) * 1099511628211ull;
+    }
+    return hash != 0 ? hash : 1;
+}
+
+/**
+ * Looks up the trace reported for a call path. This identifies a trace by its innermost callers
+ * only (see captureCallers()), but it's a lot cheaper than capturing the whole stack trace.
+ *
+ * @param[in] hash  the call path's hash
+ * @return the reported trace, nullptr if not known (yet)
+ */
+static ReportedTrace* findReportedPath(uint64_t hash)
+{
+    for (size_t i = 0; i < s_MAX_PATH_PROBES; ++i)
+    {
+        const ReportedPath& entry = s_reportedPaths[(hash + i) % s_MAX_REPORTED_PATHS];
+        const uint64_t entryHash = entry.hash.load(std::memory_order_acquire);
+        if (entryHash == hash)
+        {
+            return entry.trace.load(std::memory_order_acquire);
+        }
+        if (entryHash == 0)
+        {
+            break;
+        }
+    }
+    return nullptr;
+}
+
+/// Remembers the trace reported for a call path (dropped if there's no room for it).
+static void addReportedPath(uint64_t hash, ReportedTrace* trace)
+{
+    for (size_t i = 0; i < s_MAX_PATH_PROBES; ++i)
+    {
+        ReportedPath& entry = s_reportedPaths[(hash + i) % s_MAX_REPORTED_PATHS];
+        uint64_t entryHash = entry.hash.load(std::memory_order_relaxed);
+        if (entryHash == 0 && entry.hash.compare_exchange_strong(entryHash, hash))
+        {
+            entryHash = hash;
+        }
+        if (entryHash == hash)
+        {
+            entry.trace.store(trace, std::memory_order_release);
+            return;
+        }
+    }
+}
+
+bool reportOnce(const char* message, LogSettings settings)
+{
+    // cheapest: the call path has been reported already (no token needed)
+    pointer_t callers[s_CALL_PATH_DEPTH];
+    const uint64_t pathHash = hashCallPath(callers, captureCallers(callers));
+    ReportedTrace* reported = findReportedPath(pathHash);
+    if (reported != nullptr)
+    {
+        reported->suppressed.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    // cheap, unless a token is available
+    if (!takeToken())
+    {
+        countRateLimited();
+        return false;
+    }
+
+    TraceSettings traceSettings;
+    traceSettings.maxFrames = s_MAX_DEPOT_FRAMES;
+    traceSettings.skipInternalFrames = true;
+    RawFrame frames[s_MAX_DEPOT_FRAMES];
+    const size_t numFrames = collectRawStackTrace(frames, s_MAX_DEPOT_FRAMES, traceSettings);
+
+    // the depot hashes and deduplicates the traces
+    pointer_t addresses[s_MAX_DEPOT_FRAMES];
+    for (size_t i = 0; i < numFrames; ++i)
+    {
+        addresses[i] = frames[i].address;
+    }
+    const uint32_t id = depotStore(addresses, numFrames);
+    bool added = false;
+    ReportedTrace* entry = id != 0 ? findReportedTrace(id, added) : nullptr;
+    if (entry == nullptr)
+    {
+        s_untrackedReports.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    addReportedPath(pathHash, entry);
+    if (!added)
+    {
+        // e.g. reported via another call path: only reports that are logged cost a token
+        returnToken();
+        entry->suppressed.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    entry->message.store(message != nullptr ? message : "", std::memory_order_release);
+
+    if (settings.logFunc == nullptr)
+    {
+        settings.logFunc = getAbortLogFunc();
+    }
+    if (message != nullptr)
+    {
+        logLine(settings, message);
+    }
+    printRawStackTrace(frames, numFrames, settings, nullptr, true);
+    // END
+    logLine(settings, nullptr);
+    return true;
+}
+
+void setReportRateLimit(unsigned reportsPerSecond, unsigned burst) noexcept
+{
+    s_reportInterval.store(reportsPerSecond > 0 ? 1000 * 1000 * 1000 / reportsPerSecond : 0,
+                           std::memory_order_relaxed);
+    s_reportBurst.store(std::max(burst, 1u), std::memory_order_relaxed);
+}
+
+void printReportSummary(LogSettings settings)
+{
+    if (settings.logFunc == nullptr)
+    {
+        settings.logFunc = getAbortLogFunc();
+    }
+
+    logLine(settings, "----------- REPORTS -----------");
+
+    char messageBuffer[512];
+    for (const ReportedTrace& entry : s_reportedTraces)
+    {
+        const uint32_t id = entry.id.load(std::memory_order_relaxed);
+        const char* message = entry.message.load(std::memory_order_acquire);
+        if (id != 0 && message != nullptr)
+        {
+            snprintf(messageBuffer, sizeof(messageBuffer),
+                     "  %s (trace %" PRIu32 "): %" PRIu64 " more suppressed", message, id,
+                     entry.suppressed.load(std::memory_order_relaxed));
+            logLine(settings, messageBuffer);
+        }
+    }
+    uint64_t rateLimited = 0;
+    for (const StripedCounter& counter : s_rateLimitedReports)
+    {
+        rateLimited += counter.value.load(std::memory_order_relaxed);
+    }
+    snprintf(messageBuffer, sizeof(messageBuffer),
+             "  %" PRIu64 " suppressed by the rate limit, %" PRIu64 " not tracked", rateLimited,
+             s_untrackedReports.load(std::memory_order_relaxed));
+    logLine(settings, messageBuffer);
+
+    logLine(settings, "-------------------------------");
+    // END
+    logLine(settings, nullptr);
+}
+
+} // namespace ooopsi
@@ -0,0 +1,151 @@
+/**
+ * @file    stack_depot.cpp
+ * @brief   deduplicated storage of raw stack traces
+ */
+
+// private library header
+#include "stack_depot.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+namespace ooopsi
+{
+
+/*
+ * The depot consists of a fixed-size arena that stores the traces one after the other, and a
+ * fixed-size hash table (open addressing) for the deduplication. A trace's ID is its position in
+ * the arena (+1, so 0 is invalid). Both are static: the pages of the arena are only committed
+ * when used.
+ */
+
+/// arena size in words (2MB on 64-bit systems)
+static constexpr uint32_t s_ARENA_WORDS = 256 * 1024;
+/// number of hash table slots (must be a power of 2)
+static constexpr uint32_t s_TABLE_SIZE = 64 * 1024;
+/// give up after this many probes
+static constexpr uint32_t s_MAX_PROBES = 64;
+
+namespace
+{
+/// header of a stored trace, followed by the addresses
+struct DepotEntry
+{
+    uint32_t hash;
+    uint32_t parent;
+    uint32_t numFrames;
+    uint32_t reserved;
+};
+} // namespace
+
+/// size of a DepotEntry in arena words
+static constexpr uint32_t s_HEADER_WORDS = sizeof(DepotEntry) / sizeof(pointer_t);
+static_assert(sizeof(DepotEntry) % sizeof(pointer_t) == 0, "unexpected header size");
+
+static pointer_t s_arena[s_ARENA_WORDS];
+/// next free arena word
+static std::atomic<uint32_t> s_arenaUsed{ 0 };
+/// trace IDs (0: free slot)
+static std::atomic<uint32_t> s_table[s_TABLE_SIZE];
+
+
+/// Hashes a trace (FNV-1a over the addresses).
+static uint32_t hashTrace(const pointer_t* frames, size_t numFrames, uint32_t parent) noexcept
+{
+    uint64_t hash = 14695981039346656037ull ^ parent;
+    for (size_t i = 0; i < numFrames; ++i)
+    {
+        hash ^= reinterpret_cast<uintptr_t>(frames[i]);
+        hash *= 1099511628211ull;
+    }
+    return static_cast<uint32_t>(hash ^ (hash >> 32));
+}
+
+/// Returns the header of the entry with the given ID (must be valid).
+static DepotEntry entryAt(uint32_t id) noexcept
+{
+    DepotEntry entry; // NOLINT (initialized below)
+    memcpy(&entry, &s_arena[id - 1], sizeof(entry));
+    return entry;
+}
+
+/// Compares a stored trace with the given one.
+static bool isEqual(uint32_t id, uint32_t hash, const pointer_t* frames, size_t numFrames,
+                    uint32_t parent) noexcept
+{
+    const DepotEntry entry = entryAt(id);
+    if (entry.hash != hash || entry.parent != parent || entry.numFrames != numFrames)
+    {
+        return false;
+    }
+    const pointer_t* stored = &s_arena[id - 1 + s_HEADER_WORDS];
+    for (size_t i = 0; i < numFrames; ++i)
+    {
+        if (stored[i] != frames[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint32_t depotStore(const pointer_t* frames, size_t numFrames, uint32_t parent) noexcept
+{
+    numFrames = std::min(numFrames, s_MAX_DEPOT_FRAMES);
+    const uint32_t hash = hashTrace(frames, numFrames, parent);
+
+    uint32_t newId = 0;
+    for (uint32_t probe = 0; probe < s_MAX_PROBES; ++probe)
+    {
+        std::atomic<uint32_t>& slot = s_table[(hash + probe) & (s_TABLE_SIZE - 1)];
+        uint32_t id = slot.load(std::memory_order_acquire);
+        if (id == 0)
+        {
+            if (newId == 0)
+            {
+                // not found: store it (note: the space is lost if another thread wins the slot)
+                const auto words = static_cast<uint32_t>(s_HEADER_WORDS + numFrames);
+                if (s_arenaUsed.load(std::memory_order_relaxed) + words > s_ARENA_WORDS)
+                {
+                    // full (checked first to prevent the counter from overflowing)
+                    return 0;
+                }
+                const uint32_t pos = s_arenaUsed.fetch_add(words, std::memory_order_relaxed);
+                if (pos + words > s_ARENA_WORDS)
+                {
+                    return 0;
+                }
+                const DepotEntry entry{ hash, parent, static_cast<uint32_t>(numFrames), 0 };
+                memcpy(&s_arena[pos], &entry, sizeof(entry));
+                std::copy(frames, frames + numFrames, &s_arena[pos + s_HEADER_WORDS]);
+                newId = pos + 1;
+            }
+            if (slot.compare_exchange_strong(id, newId, std::memory_order_acq_rel))
+            {
+                return newId;
+            }
+            // someone else was faster: 'id' is now the slot's content
+        }
+        if (isEqual(id, hash, frames, numFrames, parent))
+        {
+            return id;
+        }
+    }
+    // the table is too crowded
+    return 0;
+}
+
+size_t depotGet(uint32_t id, const pointer_t*& frames, uint32_t& parent) noexcept
+{
+    if (id == 0 || id > s_arenaUsed.load(std::memory_order_acquire))
+    {
+        return 0;
+    }
+    const DepotEntry entry = entryAt(id);
+    frames = &s_arena[id - 1 + s_HEADER_WORDS];
+    parent = entry.parent;
+    return entry.numFrames;
+}
+
+} // namespace ooopsi
@@ -0,0 +1,43 @@
+/**
+ * @file    stack_depot.hpp
+ * @brief   deduplicated storage of raw stack traces
+ */
+
+#ifndef STACK_DEPOT_HPP_
+#define STACK_DEPOT_HPP_
+
+#include "internal.hpp"
+
+namespace ooopsi
+{
+
+/// maximum number of frames per stored trace (additional ones are dropped)
+static constexpr size_t s_MAX_DEPOT_FRAMES = 64;
+
+/**
+ * Stores a raw stack trace in the depot. Identical traces (with the same parent) are stored only
+ * once. Stored traces are never removed, their ID stays valid for the lifetime of the process.
+ *
+ * This is lock-free and doesn't allocate memory (the depot has a fixed capacity), so it's safe to
+ * use in signal handlers and cheap enough for hot paths.
+ *
+ * @param[in] frames        the (return) addresses
+ * @param[in] numFrames     number of addresses
+ * @param[in] parent        optional: ID of a related trace, e.g. the causal parent
+ * @return the trace's ID, or 0 if the depot is full
+ */
+uint32_t depotStore(const pointer_t* frames, size_t numFrames, uint32_t parent = 0) noexcept;
+
+/**
+ * Looks up a trace stored via depotStore(). Safe to use in signal handlers.
+ *
+ * @param[in]  id       the trace's ID
+ * @param[out] frames   receives a pointer to the addresses
+ * @param[out] parent   receives the ID of the related trace (0 if none)
+ * @return the number of addresses (0 for an invalid ID)
+ */
+size_t depotGet(uint32_t id, const pointer_t*& frames, uint32_t& parent) noexcept;
+
+} // namespace ooopsi
+
+#endif /* STACK_DEPOT_HPP_ */
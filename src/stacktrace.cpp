@@ -6,8 +6,13 @@
 
 // public library header
 #include "ooopsi.hpp"
-// private library header
+// private library headers
+#include "dwarf_inline.hpp"
 #include "internal.hpp"
+#include "module_map.hpp"
+#include "stack_depot.hpp"
+#include "stats.hpp"
+#include "symbolizer.hpp"
 
 #ifdef OOOPSI_WINDOWS
 #ifdef OOOPSI_MSVC
@@ -29,10 +34,12 @@
 #define OOOPSI_FORCE_INLINE
 #endif
 
+#include <algorithm>
 #include <tuple> // for std::ignore
 
 #include <cstdint>
 #include <cstdio>
+#include <cstdlib>
 
 namespace ooopsi
 {
@@ -42,15 +49,180 @@ namespace ooopsi
 DbgHelpMutex s_dbgHelpMutex;
 #endif
 
+/// limits the chain of async parents (in case something went wrong)
+static constexpr size_t s_MAX_ASYNC_PARENTS = 16;
+
+#ifdef OOOPSI_LINUX
+/// the signal trampoline is expected within this many frames when called from a signal handler
+static constexpr size_t s_MAX_HANDLER_FRAMES = 16;
+
 /**
- * Implementation of the stack collection: the handler is called for every frame.
+ * Returns the number of frames from the top of the stack up to and including the first signal
+ * frame (0 if there is none within the first few frames).
+ * Note: the cursor is copied, so this doesn't modify the caller's unwinding state.
+ */
+static size_t countSignalHandlerFrames(unw_cursor_t cursor)
+{
+    for (size_t i = 0; i < s_MAX_HANDLER_FRAMES && unw_step(&cursor) > 0; ++i)
+    {
+        if (unw_is_signal_frame(&cursor) > 0)
+        {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+/// Checks if an address belongs to this library (only possible for the shared library: the
+/// static one is part of the executable).
+static bool isInternalFrame(pointer_t address)
+{
+#ifdef OOOPSI_BUILDING_SHARED_LIB
+    static const char s_marker = 0;
+    const ModuleInfo* module = findModule(address);
+    return module != nullptr && module == findModule(&s_marker);
+#else
+    std::ignore = address;
+    return false;
+#endif
+}
+
+/// Applies the skip settings of TraceSettings while unwinding.
+class FrameSkipper
+{
+public:
+    /// Note: must be created before the first unw_step() on 'cursor'.
+    FrameSkipper(const TraceSettings& settings, const unw_cursor_t& cursor)
+      : m_handlerFrames(settings.skipInternalFrames ? countSignalHandlerFrames(cursor) : 0),
+        m_skipInternal(settings.skipInternalFrames && m_handlerFrames == 0),
+        m_skipFrames(settings.skipFrames)
+    {
+    }
+
+    /// Returns true if the frame at the given address (the next one in the trace) is skipped.
+    bool skip(pointer_t address)
+    {
+        // frames of a signal handler (if any), else the library's own ones
+        if (m_handlerFrames > 0)
+        {
+            --m_handlerFrames;
+            return true;
+        }
+        if (m_skipInternal)
+        {
+            if (isInternalFrame(address))
+            {
+                return true;
+            }
+            m_skipInternal = false;
+        }
+        if (m_skipFrames > 0)
+        {
+            --m_skipFrames;
+            return true;
+        }
+        return false;
+    }
+
+private:
+    size_t m_handlerFrames;
+    bool m_skipInternal;
+    size_t m_skipFrames;
+};
+
+/**
+ * Looks up the function of a frame in a module's symbol table. Return addresses are looked up
+ * at the call instruction, like unw_get_proc_name() does: after a call to a noreturn function,
+ * the return address may already belong to the next function.
+ *
+ * @param[in]  module       the module containing 'address'
+ * @param[in]  address      the frame's address
+ * @param[in]  exact        true if 'address' is the executed instruction (see RawFrame)
+ * @param[out] offset       offset of 'address' relative to the start of the function
+ * @return the (mangled) name, nullptr if not found
+ */
+static const char* findFrameSymbol(const ModuleInfo& module, pointer_t address, bool exact,
+                                   uint64_t& offset) noexcept
+{
+    const uintptr_t callAddress = reinterpret_cast<uintptr_t>(address) - (exact ? 0 : 1);
+    const char* name = findSymbol(module, callAddress, offset);
+    offset += exact ? 0 : 1;
+    return name;
+}
+
+/// Same as findFrameSymbol(), for addresses outside of all modules (e.g. JIT code, see
+/// findProvidedSymbol()).
+static const char* findProvidedFrameSymbol(pointer_t address, bool exact, uint64_t& offset,
+                                           bool signalSafe = false) noexcept
+{
+    const uintptr_t callAddress = reinterpret_cast<uintptr_t>(address) - (exact ? 0 : 1);
+    const char* name = findProvidedSymbol(callAddress, offset, signalSafe);
+    offset += exact ? 0 : 1;
+    return name;
+}
+#endif // OOOPSI_LINUX
+
+/// Counts a stack trace capture and the frames walked for it, and records the time spent
+/// unwinding (excluding pauses, e.g. for symbol lookups) when going out of scope.
+class CaptureStats
+{
+public:
+    CaptureStats() noexcept : m_start(statsNow()) {}
+    ~CaptureStats()
+    {
+        resume();
+        countStat(StatCounter::Captures);
+        countStat(StatCounter::FramesWalked, m_frames);
+        recordTiming(StatTiming::Unwind, statsNow() - m_start - m_paused);
+    }
+
+    // not copyable or movable
+    CaptureStats(const CaptureStats&) = delete;
+    CaptureStats& operator=(const CaptureStats&) = delete;
+    CaptureStats(CaptureStats&&) = delete;
+    CaptureStats& operator=(CaptureStats&&) = delete;
+
+    /// Counts walked frames.
+    void addFrames(size_t count) noexcept { m_frames += count; }
+
+    /// Excludes the time until resume() (or the end of the capture) from the unwind time.
+    void pause() noexcept { m_pauseStart = statsNow(); }
+
+    void resume() noexcept
+    {
+        if (m_pauseStart != 0)
+        {
+            m_paused += statsNow() - m_pauseStart;
+            m_pauseStart = 0;
+        }
+    }
+
+private:
+    const uint64_t m_start;
+    uint64_t m_pauseStart = 0;
+    uint64_t m_paused = 0;
+    uint64_t m_frames = 0;
+};
+
+/**
+ * Implementation of the stack collection: the handler is called for every frame selected by
+ * 'settings'. Synthetic frames for inlined calls (if enabled) are passed before the frame
+ * containing them.
  * Note: this function is force-inlined to avoid having it show up in the call stack.
+ *
+ * @param[in]  handler          called for every frame
+ * @param[in]  settings         which frames to collect
+ * @param[in]  expandInlined    add frames for inlined calls?
+ * @param[out] truncated        set if frames were dropped due to 'settings.maxFrames'
+ * @return the number of frames passed to the handler
  */
 template <class Func>
-OOOPSI_FORCE_INLINE size_t collectStackTrace(Func&& handler,
-                                             const size_t maxStackFrames = s_MAX_STACK_FRAMES)
+OOOPSI_FORCE_INLINE size_t collectStackTrace(Func&& handler, const TraceSettings& settings,
+                                             const bool expandInlined, bool& truncated)
 {
     size_t numberOfFrames = 0;
+    truncated = false;
+    CaptureStats stats;
 
 // OS-specific back trace
 #ifdef OOOPSI_WINDOWS
@@ -63,15 +235,21 @@ OOOPSI_FORCE_INLINE size_t collectStackTrace(Func&& handler,
 
         const BOOL symInitOk = SymInitialize(thisProc, NULL, TRUE);
         void* stackFrames[s_MAX_STACK_FRAMES];
-        auto numFrames = std::min(s_MAX_STACK_FRAMES, maxStackFrames);
-        numberOfFrames =
-          RtlCaptureStackBackTrace(0, static_cast<DWORD>(numFrames), stackFrames, NULL);
+        const auto skip = static_cast<DWORD>(std::min<size_t>(settings.skipFrames, 0xffff));
+        const size_t numFrames = RtlCaptureStackBackTrace(
+          skip, static_cast<DWORD>(s_MAX_STACK_FRAMES), stackFrames, NULL);
+        stats.addFrames(numFrames);
 
         char symBuffer[sizeof(SYMBOL_INFO) + MAX_SYM_NAME * sizeof(TCHAR)];
         PSYMBOL_INFO pSymbol = reinterpret_cast<PSYMBOL_INFO>(symBuffer);
 
-        for (size_t i = 0; i < numberOfFrames; ++i)
+        for (size_t i = 0; i < numFrames; ++i)
         {
+            if (numberOfFrames >= settings.maxFrames)
+            {
+                truncated = true;
+                break;
+            }
             const DWORD64 address = reinterpret_cast<DWORD64>(stackFrames[i]);
 
             DWORD64 dwDisplacement = 0;
@@ -89,11 +267,17 @@ OOOPSI_FORCE_INLINE size_t collectStackTrace(Func&& handler,
                 }
             }
 
-            handler(i, stackFrames[i], symName, dwDisplacement);
+            handler(numberOfFrames, stackFrames[i], symName, dwDisplacement, false);
+            numberOfFrames++;
+            if (settings.stopAt != nullptr && symName != nullptr && settings.stopAt(symName))
+            {
+                break;
+            }
         }
 
         SymCleanup(thisProc);
     }
+    std::ignore = expandInlined;
 
 #elif defined(OOOPSI_LINUX)
 
@@ -103,8 +287,14 @@ OOOPSI_FORCE_INLINE size_t collectStackTrace(Func&& handler,
     unw_getcontext(&context);
     unw_init_local(&cursor, &context);
 
+    // the frame after a signal frame contains the faulting address, the others a return address
+    bool exactAddress = false;
+
+    FrameSkipper skipper(settings, cursor);
+
     while (unw_step(&cursor) > 0)
     {
+        stats.addFrames(1);
         unw_word_t offset, pc;
         unw_get_reg(&cursor, UNW_REG_IP, &pc);
         if (pc == 0)
@@ -112,20 +302,69 @@ OOOPSI_FORCE_INLINE size_t collectStackTrace(Func&& handler,
             break;
         }
 
-        if (numberOfFrames >= maxStackFrames)
+        const auto address = reinterpret_cast<pointer_t>(pc);
+        const bool isExact = exactAddress;
+        exactAddress = unw_is_signal_frame(&cursor) > 0;
+
+        if (skipper.skip(address))
+        {
+            continue;
+        }
+        if (numberOfFrames >= settings.maxFrames)
         {
+            truncated = true;
             break;
         }
+        // the symbol lookups and the handler don't count as unwinding
+        stats.pause();
+
+        if (expandInlined)
+        {
+            // look up the call instruction, not the one after it
+            const char* inlinedNames[16];
+            const auto callAddress = reinterpret_cast<pointer_t>(isExact ? pc : pc - 1);
+            const size_t numInlined = findInlinedCalls(callAddress, inlinedNames, 16);
+            for (size_t i = 0; i < numInlined; ++i)
+            {
+                if (numberOfFrames >= settings.maxFrames)
+                {
+                    truncated = true;
+                    return numberOfFrames;
+                }
+                handler(numberOfFrames, address, inlinedNames[i], 0, true);
+                numberOfFrames++;
+                if (settings.stopAt != nullptr && settings.stopAt(inlinedNames[i]))
+                {
+                    return numberOfFrames;
+                }
+            }
+            if (numberOfFrames >= settings.maxFrames)
+            {
+                truncated = true;
+                break;
+            }
+        }
 
         char symBuffer[1024];
         const char* symName = nullptr;
         if (unw_get_proc_name(&cursor, symBuffer, sizeof(symBuffer), &offset) == 0)
         {
+            countStat(StatCounter::SymbolLookups);
             symName = symBuffer;
         }
+        else
+        {
+            // e.g. JIT code (this may run in a signal handler)
+            symName = findProvidedFrameSymbol(address, isExact, offset, true);
+        }
 
-        handler(numberOfFrames, reinterpret_cast<pointer_t>(pc), symName, offset);
+        handler(numberOfFrames, address, symName, offset, false);
         numberOfFrames++;
+        if (settings.stopAt != nullptr && symName != nullptr && settings.stopAt(symName))
+        {
+            break;
+        }
+        stats.resume();
     }
 
 #else
@@ -138,8 +377,21 @@ OOOPSI_FORCE_INLINE size_t collectStackTrace(Func&& handler,
 }
 
 
+/// Looks up the module containing an address in the current module map (Linux only).
+static const ModuleInfo* lookupModule(pointer_t address)
+{
+#ifdef OOOPSI_LINUX
+    return findModule(address);
+#else
+    std::ignore = address;
+    return nullptr;
+#endif
+}
+
+
 static void logFrame(const LogSettings settings, uint64_t num, pointer_t address, const char* sym,
-                     uint64_t offset, const pointer_t* faultAddr)
+                     uint64_t offset, bool inlined, const pointer_t* faultAddr,
+                     const ModuleInfo* module)
 {
     char messageBuffer[1024];
     const char* prefix = "  ";
@@ -149,6 +401,27 @@ static void logFrame(const LogSettings settings, uint64_t num, pointer_t address
     }
     snprintf(messageBuffer, sizeof(messageBuffer), "%s#%-2" PRIu64 "  %p", prefix, num, address);
 
+#ifdef OOOPSI_LINUX
+    // absolute addresses are meaningless after the process is gone (ASLR): add the module, the
+    // address relative to it and its build-id
+    if (module != nullptr)
+    {
+        char buildId[2 * s_MAX_BUILD_ID_SIZE + 1];
+        module->formatBuildId(buildId);
+        const uintptr_t relAddr = reinterpret_cast<uintptr_t>(address) - module->base;
+        size_t bufLen = strlen(messageBuffer);
+        snprintf(messageBuffer + bufLen, sizeof(messageBuffer) - bufLen, " %s+0x%" PRIxPTR,
+                 module->name(), relAddr);
+        if (buildId[0] != '\0')
+        {
+            bufLen = strlen(messageBuffer);
+            snprintf(messageBuffer + bufLen, sizeof(messageBuffer) - bufLen, " [%s]", buildId);
+        }
+    }
+#else
+    std::ignore = module;
+#endif
+
     if (sym != nullptr)
     {
         // append the demangled name + offset
@@ -158,7 +431,9 @@ static void logFrame(const LogSettings settings, uint64_t num, pointer_t address
         {
             if (settings.demangleNames)
             {
-                std::string demangled = demangle(sym);
+                std::string demangled = settings.compactNames
+                                          ? demangleCompact(sym, settings.maxTemplateDepth)
+                                          : demangle(sym);
                 strncat(messageBuffer, demangled.c_str(), sizeof(messageBuffer) - bufLen - 1);
             }
             else
@@ -178,14 +453,125 @@ static void logFrame(const LogSettings settings, uint64_t num, pointer_t address
         }
         if (bufLen < sizeof(messageBuffer))
         {
-            snprintf(messageBuffer + bufLen, sizeof(messageBuffer) - bufLen, "+0x%" PRIx64, offset);
+            // inlined calls have no offset of their own
+            if (inlined)
+                snprintf(messageBuffer + bufLen, sizeof(messageBuffer) - bufLen, " [inlined]");
+            else
+                snprintf(messageBuffer + bufLen, sizeof(messageBuffer) - bufLen,
+                         "+0x%" PRIx64, offset);
         }
     }
     // else: no symbol name, keep the address
 
-    settings.logFunc(messageBuffer);
+    logLine(settings, messageBuffer);
+}
+
+
+/// Logs raw frames (see printRawStackTrace()), numbering them starting at 'num'.
+static void logRawFrames(const RawFrame* frames, size_t numFrames, const LogSettings& settings,
+                         const pointer_t* faultAddr, bool resolveSymbols,
+                         const ModuleInfo* modules, size_t numModules, uint64_t& num)
+{
+    for (size_t i = 0; i < numFrames; ++i)
+    {
+        const pointer_t address = frames[i].address;
+#ifdef OOOPSI_LINUX
+        const ModuleInfo* module =
+          modules != nullptr
+            ? findModule(modules, numModules, reinterpret_cast<uintptr_t>(address))
+            : findModule(address);
+
+        const char* symName = nullptr;
+        uint64_t offset = 0;
+        if (resolveSymbols && module != nullptr)
+        {
+            if (settings.expandInlinedFrames)
+            {
+                // look up the call instruction, not the one after it
+                const char* inlinedNames[16];
+                const pointer_t callAddress =
+                  static_cast<const char*>(address) - (frames[i].exact ? 0 : 1);
+                const size_t numInlined =
+                  findInlinedCalls(*module, callAddress, inlinedNames, 16);
+                for (size_t j = 0; j < numInlined; ++j)
+                {
+                    logFrame(settings, num++, address, inlinedNames[j], 0, true, faultAddr, module);
+                }
+            }
+            symName = findFrameSymbol(*module, address, frames[i].exact, offset);
+        }
+        else if (resolveSymbols && modules == nullptr)
+        {
+            // not in any module of this process, e.g. JIT code
+            symName = findProvidedFrameSymbol(address, frames[i].exact, offset);
+        }
+        logFrame(settings, num++, address, symName, offset, false, faultAddr, module);
+#else
+        // no symbol lookup without an unwinding context
+        std::ignore = resolveSymbols;
+        std::ignore = modules;
+        std::ignore = numModules;
+        logFrame(settings, num++, address, nullptr, 0, false, faultAddr, nullptr);
+#endif
+    }
+}
+
+/// Logs the chain of the current thread's async parents (see captureAsyncParent()), numbering
+/// the frames starting at 'num'.
+static void logAsyncParents(const LogSettings& settings, uint64_t num)
+{
+    AsyncParentId id = currentAsyncParent();
+    for (size_t depth = 0; id != 0 && depth < s_MAX_ASYNC_PARENTS; ++depth)
+    {
+        const pointer_t* addresses = nullptr;
+        uint32_t parent = 0;
+        const size_t numFrames = depotGet(id, addresses, parent);
+
+        RawFrame frames[s_MAX_DEPOT_FRAMES];
+        for (size_t i = 0; i < numFrames; ++i)
+        {
+            frames[i].address = addresses[i];
+            frames[i].exact = false;
+        }
+        logLine(settings, "-------- ASYNC PARENT ---------");
+        logRawFrames(frames, numFrames, settings, nullptr, settings.resolveAsyncParents, nullptr,
+                     0, num);
+        id = parent;
+    }
 }
 
+void logStackTrace(const LogSettings& settings, const pointer_t* faultAddr)
+{
+    logLine(settings, "---------- BACKTRACE ----------");
+
+#ifdef OOOPSI_LINUX
+    if (settings.expandInlinedFrames)
+    {
+        // reading the debug information isn't signal-safe either: pick up new modules (once)
+        updateModuleMap();
+    }
+#endif
+
+    bool truncated = false;
+    size_t n = collectStackTrace(
+      [&](uint64_t num, pointer_t address, const char* symbol, uint64_t offset, bool inlined) {
+          logFrame(settings, num, address, symbol, offset, inlined, faultAddr,
+                   lookupModule(address));
+      },
+      settings, settings.expandInlinedFrames, truncated);
+    if (truncated)
+    {
+        // there are more frames
+        char messageBuffer[512];
+        uint64_t num = n;
+        snprintf(messageBuffer, sizeof(messageBuffer), "  #%-2" PRIu64 " ... (truncating)", num);
+        logLine(settings, messageBuffer);
+    }
+    // the task's origin, if recorded
+    logAsyncParents(settings, n);
+
+    logLine(settings, "-------------------------------");
+}
 
 void printStackTrace(LogSettings settings, const pointer_t* faultAddr)
 {
@@ -193,36 +579,271 @@ void printStackTrace(LogSettings settings, const pointer_t* faultAddr)
     {
         settings.logFunc = getAbortLogFunc();
     }
+    logStackTrace(settings, faultAddr);
+    // END
+    logLine(settings, nullptr);
+}
+
+size_t collectRawStackTrace(RawFrame* buffer, size_t bufferSize,
+                            const TraceSettings& settings) noexcept
+{
+    size_t numberOfFrames = 0;
+    bufferSize = std::min(bufferSize, settings.maxFrames);
+    CaptureStats stats;
+
+#ifdef OOOPSI_WINDOWS
+    void* stackFrames[s_MAX_STACK_FRAMES];
+    const auto numFrames = std::min(s_MAX_STACK_FRAMES, bufferSize);
+    const auto skip = static_cast<DWORD>(std::min<size_t>(settings.skipFrames + 1, 0xffff));
+    numberOfFrames =
+      RtlCaptureStackBackTrace(skip, static_cast<DWORD>(numFrames), stackFrames, NULL);
+    stats.addFrames(numberOfFrames);
+    for (size_t i = 0; i < numberOfFrames; ++i)
+    {
+        buffer[i].address = stackFrames[i];
+        buffer[i].exact = false;
+    }
 
-    settings.logFunc("---------- BACKTRACE ----------");
+#elif defined(OOOPSI_LINUX)
+
+    unw_cursor_t cursor;
+    unw_context_t context;
+
+    unw_getcontext(&context);
+    unw_init_local(&cursor, &context);
 
-    size_t n =
-      collectStackTrace([&](uint64_t num, pointer_t address, const char* symbol, uint64_t offset) {
-          logFrame(settings, num, address, symbol, offset, faultAddr);
-      });
-    if (n == s_MAX_STACK_FRAMES)
+    FrameSkipper skipper(settings, cursor);
+    bool exactAddress = false;
+    while (numberOfFrames < bufferSize && unw_step(&cursor) > 0)
+    {
+        stats.addFrames(1);
+        unw_word_t pc;
+        unw_get_reg(&cursor, UNW_REG_IP, &pc);
+        if (pc == 0)
+        {
+            break;
+        }
+        const auto address = reinterpret_cast<pointer_t>(pc);
+        const bool isExact = exactAddress;
+        exactAddress = unw_is_signal_frame(&cursor) > 0;
+        if (skipper.skip(address))
+        {
+            continue;
+        }
+        buffer[numberOfFrames].address = address;
+        buffer[numberOfFrames].exact = isExact;
+        numberOfFrames++;
+
+        if (settings.stopAt != nullptr)
+        {
+            stats.pause();
+            const ModuleInfo* module = findModule(address);
+            uint64_t offset = 0;
+            const char* symName = module != nullptr
+                                    ? findFrameSymbol(*module, address, isExact, offset)
+                                    : findProvidedFrameSymbol(address, isExact, offset);
+            if (symName != nullptr && settings.stopAt(symName))
+            {
+                break;
+            }
+            stats.resume();
+        }
+    }
+
+#else
+
+#error "Unsupported platform!"
+
+#endif // OOOPSI_WINDOWS/LINUX
+
+    return numberOfFrames;
+}
+
+void printRawStackTrace(const RawFrame* frames, size_t numFrames, const LogSettings& settings,
+                        const pointer_t* faultAddr, bool resolveSymbols,
+                        const ModuleInfo* modules, size_t numModules)
+{
+    logLine(settings, "---------- BACKTRACE ----------");
+
+    uint64_t num = 0;
+    logRawFrames(frames, numFrames, settings, faultAddr, resolveSymbols, modules, numModules, num);
+    if (numFrames == s_MAX_STACK_FRAMES)
     {
         // the trace is (probably) truncated
         char messageBuffer[512];
-        uint64_t num = n;
         snprintf(messageBuffer, sizeof(messageBuffer), "  #%-2" PRIu64 " ... (truncating)", num);
-        settings.logFunc(messageBuffer);
+        logLine(settings, messageBuffer);
     }
 
-    settings.logFunc("-------------------------------");
-    // END
-    settings.logFunc(nullptr);
+    logLine(settings, "-------------------------------");
 }
 
 size_t collectStackTrace(StackFrame* buffer, size_t bufferSize) noexcept
 {
+    TraceSettings settings;
+    settings.maxFrames = bufferSize;
+    return collectStackTrace(buffer, bufferSize, settings);
+}
+
+size_t collectStackTrace(StackFrame* buffer, size_t bufferSize,
+                         const TraceSettings& settings) noexcept
+{
+#ifdef OOOPSI_LINUX
+    // not used in signal handlers, so this is a good opportunity to pick up new modules
+    updateModuleMap();
+#endif
+    TraceSettings limited = settings;
+    limited.maxFrames = std::min(bufferSize, settings.maxFrames);
+    bool truncated = false;
     return collectStackTrace(
-      [&](uint64_t num, pointer_t address, const char* symbol, uint64_t offset) {
+      [&](uint64_t num, pointer_t address, const char* symbol, uint64_t offset, bool inlined) {
           buffer[num].address = address;
           buffer[num].function = demangle(symbol);
           buffer[num].offset = offset;
+          buffer[num].inlined = inlined;
       },
-      bufferSize);
+      limited, true, truncated);
+}
+
+/// StackTrace::Entry flags
+static constexpr uint32_t s_ENTRY_EXACT = 1;
+static constexpr uint32_t s_ENTRY_RESOLVED = 2;
+
+constexpr size_t StackTrace::MAX_FRAMES;
+
+StackTrace::StackTrace(void* buffer, size_t bufferSize) noexcept
+  : m_entries(static_cast<Entry*>(buffer)),
+    m_capacity(static_cast<uint32_t>(std::min(bufferSize / sizeof(Entry), MAX_FRAMES)))
+{
+}
+
+StackTrace::~StackTrace()
+{
+    if (m_ownsEntries)
+    {
+        free(m_entries);
+    }
+}
+
+StackTrace::StackTrace(StackTrace&& rhs) noexcept
+  : m_entries(rhs.m_entries), m_size(rhs.m_size), m_capacity(rhs.m_capacity),
+    m_ownsEntries(rhs.m_ownsEntries)
+{
+    rhs.m_entries = nullptr;
+    rhs.m_size = 0;
+    rhs.m_capacity = 0;
+    rhs.m_ownsEntries = false;
+}
+
+StackTrace& StackTrace::operator=(StackTrace&& rhs) noexcept
+{
+    if (this != &rhs)
+    {
+        if (m_ownsEntries)
+        {
+            free(m_entries);
+        }
+        m_entries = rhs.m_entries;
+        m_size = rhs.m_size;
+        m_capacity = rhs.m_capacity;
+        m_ownsEntries = rhs.m_ownsEntries;
+        rhs.m_entries = nullptr;
+        rhs.m_size = 0;
+        rhs.m_capacity = 0;
+        rhs.m_ownsEntries = false;
+    }
+    return *this;
+}
+
+size_t StackTrace::capture(const TraceSettings& settings) noexcept
+{
+    // a user-provided buffer limits the number of frames, else allocate just enough memory
+    const bool userBuffer = m_entries != nullptr && !m_ownsEntries;
+    TraceSettings adjusted = settings;
+    if (!settings.skipInternalFrames)
+    {
+        // skip this function
+        adjusted.skipFrames++;
+    }
+    RawFrame frames[MAX_FRAMES];
+    const size_t numFrames =
+      collectRawStackTrace(frames, userBuffer ? m_capacity : MAX_FRAMES, adjusted);
+
+    m_size = 0;
+    if (numFrames > m_capacity)
+    {
+        void* memory = malloc(numFrames * sizeof(Entry));
+        if (memory == nullptr)
+        {
+            return 0;
+        }
+        if (m_ownsEntries)
+        {
+            free(m_entries);
+        }
+        m_entries = static_cast<Entry*>(memory);
+        m_capacity = static_cast<uint32_t>(numFrames);
+        m_ownsEntries = true;
+    }
+
+    for (size_t i = 0; i < numFrames; ++i)
+    {
+        m_entries[i].address = frames[i].address;
+        m_entries[i].function = nullptr;
+        m_entries[i].offset = 0;
+        m_entries[i].flags = frames[i].exact ? s_ENTRY_EXACT : 0;
+    }
+    m_size = static_cast<uint32_t>(numFrames);
+    return numFrames;
+}
+
+void StackTrace::resolve(size_t index) const noexcept
+{
+    Entry& entry = m_entries[index];
+    if ((entry.flags & s_ENTRY_RESOLVED) != 0)
+    {
+        return;
+    }
+    entry.flags |= s_ENTRY_RESOLVED;
+#ifdef OOOPSI_LINUX
+    const ModuleInfo* module = findModule(entry.address);
+    const bool exact = (entry.flags & s_ENTRY_EXACT) != 0;
+    uint64_t offset = 0;
+    entry.function = module != nullptr ? findFrameSymbol(*module, entry.address, exact, offset)
+                                       : findProvidedFrameSymbol(entry.address, exact, offset);
+    entry.offset = static_cast<uint32_t>(std::min<uint64_t>(offset, UINT32_MAX));
+#endif
+}
+
+void StackTrace::symbolize() const noexcept
+{
+#ifdef OOOPSI_LINUX
+    updateModuleMap();
+#endif
+    for (size_t i = 0; i < m_size; ++i)
+    {
+        resolve(i);
+    }
 }
 
+const char* StackTrace::function(size_t index) const noexcept
+{
+    if ((m_entries[index].flags & s_ENTRY_RESOLVED) == 0)
+    {
+#ifdef OOOPSI_LINUX
+        updateModuleMap();
+#endif
+        resolve(index);
+    }
+    return m_entries[index].function;
+}
+
+size_t StackTrace::offset(size_t index) const noexcept
+{
+    // looks up the symbol if necessary
+    function(index);
+    return m_entries[index].offset;
+}
+
+
 } // namespace ooopsi
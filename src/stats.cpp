@@ -0,0 +1,141 @@
+/**
+ * @file    stats.cpp
+ * @brief   counters and timings of the library itself
+ */
+
+// public library header
+#include "ooopsi.hpp"
+// private library headers
+#include "internal.hpp"
+#include "stats.hpp"
+
+#include <atomic>
+#include <cstring>
+
+namespace ooopsi
+{
+
+/// number of rows of counters, threads are distributed over them
+static constexpr size_t s_NUM_STAT_STRIPES = 16;
+
+static constexpr size_t s_NUM_COUNTERS = static_cast<size_t>(StatCounter::Count);
+static constexpr size_t s_NUM_TIMINGS = static_cast<size_t>(StatTiming::Count);
+static constexpr size_t s_NUM_BUCKETS = LatencyHistogram::NUM_BUCKETS;
+
+namespace
+{
+/// a histogram of durations (see LatencyHistogram)
+struct AtomicHistogram
+{
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> totalNanos;
+    std::atomic<uint64_t> buckets[s_NUM_BUCKETS];
+};
+
+/// the counters and timings updated by some of the threads, on their own cache lines
+struct alignas(64) StatStripe
+{
+    std::atomic<uint64_t> counters[s_NUM_COUNTERS];
+    AtomicHistogram timings[s_NUM_TIMINGS];
+};
+} // namespace
+
+/// the stripes (zero-initialized)
+static StatStripe s_statStripes[s_NUM_STAT_STRIPES];
+/// the stripe assigned to the next thread
+static std::atomic<size_t> s_nextStatStripe{ 0 };
+/// the current thread's stripe (s_NUM_STAT_STRIPES: not assigned yet)
+static thread_local size_t s_statStripe OOOPSI_TLS_INITIAL_EXEC = s_NUM_STAT_STRIPES;
+
+
+/// Returns the current thread's stripe.
+static StatStripe& currentStripe() noexcept
+{
+    size_t stripe = s_statStripe;
+    if (stripe == s_NUM_STAT_STRIPES)
+    {
+        stripe = s_nextStatStripe++ % s_NUM_STAT_STRIPES;
+        s_statStripe = stripe;
+    }
+    return s_statStripes[stripe];
+}
+
+void countStat(StatCounter counter, uint64_t value) noexcept
+{
+    currentStripe().counters[static_cast<size_t>(counter)].fetch_add(value,
+                                                                     std::memory_order_relaxed);
+}
+
+void recordTiming(StatTiming timing, uint64_t nanos) noexcept
+{
+    size_t bucket = 0;
+    for (uint64_t rest = nanos >> 1; rest != 0 && bucket + 1 < s_NUM_BUCKETS; rest >>= 1)
+    {
+        ++bucket;
+    }
+    AtomicHistogram& histogram = currentStripe().timings[static_cast<size_t>(timing)];
+    histogram.count.fetch_add(1, std::memory_order_relaxed);
+    histogram.totalNanos.fetch_add(nanos, std::memory_order_relaxed);
+    histogram.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+/// Sums up a counter over all stripes.
+static uint64_t sumCounter(StatCounter counter) noexcept
+{
+    uint64_t sum = 0;
+    for (const auto& stripe : s_statStripes)
+    {
+        sum += stripe.counters[static_cast<size_t>(counter)].load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+/// Sums up a timing over all stripes.
+static LatencyHistogram sumTiming(StatTiming timing) noexcept
+{
+    LatencyHistogram result;
+    for (const auto& stripe : s_statStripes)
+    {
+        const AtomicHistogram& histogram = stripe.timings[static_cast<size_t>(timing)];
+        result.count += histogram.count.load(std::memory_order_relaxed);
+        result.totalNanos += histogram.totalNanos.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < s_NUM_BUCKETS; ++i)
+        {
+            result.buckets[i] += histogram.buckets[i].load(std::memory_order_relaxed);
+        }
+    }
+    return result;
+}
+
+Stats getStats() noexcept
+{
+    Stats stats;
+    stats.captures = sumCounter(StatCounter::Captures);
+    stats.framesWalked = sumCounter(StatCounter::FramesWalked);
+    stats.unwindTime = sumTiming(StatTiming::Unwind);
+    stats.symbolLookups = sumCounter(StatCounter::SymbolLookups);
+    stats.symbolTableHits = sumCounter(StatCounter::SymbolTableHits);
+    stats.symbolTableMisses = sumCounter(StatCounter::SymbolTableMisses);
+    stats.callerNameHits = sumCounter(StatCounter::CallerNameHits);
+    stats.callerNameMisses = sumCounter(StatCounter::CallerNameMisses);
+    stats.demangleTime = sumTiming(StatTiming::Demangle);
+    stats.logLines = sumCounter(StatCounter::LogLines);
+    stats.logBytes = sumCounter(StatCounter::LogBytes);
+    stats.abortTime = sumTiming(StatTiming::Abort);
+    return stats;
+}
+
+void logLine(const LogSettings& settings, const char* line)
+{
+    if (line != nullptr)
+    {
+        StatStripe& stripe = currentStripe();
+        stripe.counters[static_cast<size_t>(StatCounter::LogLines)].fetch_add(
+          1, std::memory_order_relaxed);
+        stripe.counters[static_cast<size_t>(StatCounter::LogBytes)].fetch_add(
+          strlen(line), std::memory_order_relaxed);
+    }
+    settings.logFunc(line);
+}
+
+} // namespace ooopsi
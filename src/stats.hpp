@@ -0,0 +1,76 @@
+/**
+ * @file    stats.hpp
+ * @brief   counters and timings of the library itself (see getStats())
+ */
+
+#ifndef STATS_HPP_
+#define STATS_HPP_
+
+#include "internal.hpp"
+
+#include <chrono>
+
+namespace ooopsi
+{
+
+/// The library's counters (see Stats).
+enum class StatCounter : size_t
+{
+    Captures,
+    FramesWalked,
+    SymbolLookups,
+    SymbolTableHits,
+    SymbolTableMisses,
+    CallerNameHits,
+    CallerNameMisses,
+    LogLines,
+    LogBytes,
+    // number of counters
+    Count
+};
+
+/// The library's timings (see Stats).
+enum class StatTiming : size_t
+{
+    Unwind,
+    Demangle,
+    Abort,
+    // number of timings
+    Count
+};
+
+/// Adds to a counter. Lock-free, signal-safe.
+void countStat(StatCounter counter, uint64_t value = 1) noexcept;
+
+/// Records a duration. Lock-free, signal-safe.
+void recordTiming(StatTiming timing, uint64_t nanos) noexcept;
+
+/// Returns the monotonic time in nanoseconds (for the timings).
+inline uint64_t statsNow() noexcept
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                   std::chrono::steady_clock::now().time_since_epoch())
+                                   .count());
+}
+
+/// Records the duration of a scope.
+class ScopedTiming
+{
+public:
+    explicit ScopedTiming(StatTiming timing) noexcept : m_timing(timing), m_start(statsNow()) {}
+    ~ScopedTiming() { recordTiming(m_timing, statsNow() - m_start); }
+
+    // not copyable or movable
+    ScopedTiming(const ScopedTiming&) = delete;
+    ScopedTiming& operator=(const ScopedTiming&) = delete;
+    ScopedTiming(ScopedTiming&&) = delete;
+    ScopedTiming& operator=(ScopedTiming&&) = delete;
+
+private:
+    const StatTiming m_timing;
+    const uint64_t m_start;
+};
+
+} // namespace ooopsi
+
+#endif /* STATS_HPP_ */
@@ -0,0 +1,339 @@
+/**
+ * @file    symbol_providers.cpp
+ * @brief   names of functions outside of all modules (e.g. JIT code), registered by the
+ *          application or read from its perf map
+ */
+
+// public library header
+#include "ooopsi.hpp"
+// private library headers
+#include "internal.hpp"
+
+#ifdef OOOPSI_LINUX
+
+#include "interval_index.hpp"
+#include "stats.hpp"
+#include "symbolizer.hpp"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace ooopsi
+{
+
+namespace
+{
+/// A registered function.
+struct ProvidedSymbol
+{
+    /// the name (interned)
+    const char* name;
+    /// registration order: if two functions start at the same address, the later one wins
+    uint64_t sequence;
+};
+} // namespace
+
+using SymbolIndex = IntervalIndex<ProvidedSymbol>;
+
+/// guards all of the below
+static std::mutex s_providedMutex;
+/// maximum number of distinct names returned by the application's lookup function
+static constexpr size_t s_MAX_LOOKED_UP_NAMES = 64 * 1024;
+
+/// the names (never freed: the lookups return pointers to them)
+static std::unordered_set<std::string> s_providedNames;
+/// number of names added for the application's lookup function
+static size_t s_numLookedUpNames = 0;
+/// the registered functions, except for the most recent ones
+static SymbolIndex s_providedIndex;
+/// functions registered since the index was built (searched linearly by signal handlers, else
+/// merged into the index first)
+static std::vector<SymbolIndex::Entry> s_pendingSymbols;
+/// the next registration's sequence number
+static uint64_t s_nextSequence = 0;
+
+/// process the perf map was read for (it has the pid in its name, so forks start over)
+static pid_t s_perfMapPid = 0;
+/// number of bytes of the perf map that were read
+static off_t s_perfMapSize = 0;
+
+/// the application's lookup function
+static std::atomic<SymbolLookupFunc> s_lookupFunc{ nullptr };
+
+
+/// Copies a name (s_providedMutex must be locked).
+static const char* internName(const char* name)
+{
+    return s_providedNames.emplace(name).first->c_str();
+}
+
+/// Registers a function (s_providedMutex must be locked).
+static void addSymbol(uintptr_t address, size_t size, const char* name)
+{
+    if (size == 0 || address + size < address)
+    {
+        return;
+    }
+    const ProvidedSymbol symbol{ internName(name), s_nextSequence++ };
+    s_pendingSymbols.push_back(SymbolIndex::Entry{ address, address + size, symbol });
+}
+
+/// Adds the recently registered functions to the index (s_providedMutex must be locked).
+static void mergePendingSymbols()
+{
+    if (s_pendingSymbols.empty())
+    {
+        return;
+    }
+    for (const auto& entry : s_pendingSymbols)
+    {
+        s_providedIndex.add(entry.low, entry.high, entry.value);
+    }
+    s_providedIndex.build();
+    s_pendingSymbols.clear();
+}
+
+/// Reads the lines of the perf map that were added since the last call ("START SIZE name" with
+/// hex numbers). s_providedMutex must be locked.
+static void refreshPerfMap()
+{
+    const pid_t pid = getpid();
+    if (pid != s_perfMapPid)
+    {
+        s_perfMapPid = pid;
+        s_perfMapSize = 0;
+    }
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/perf-%d.map", static_cast<int>(pid));
+    struct stat st;
+    if (stat(path, &st) != 0 || st.st_size == s_perfMapSize)
+    {
+        return;
+    }
+
+    FILE* file = fopen(path, "r"); // flawfinder: ignore
+    if (file == nullptr)
+    {
+        return;
+    }
+    // like perf: only trust our own file (it's in /tmp, after all)
+    if (fstat(fileno(file), &st) != 0 || st.st_uid != geteuid() || !S_ISREG(st.st_mode))
+    {
+        fclose(file);
+        return;
+    }
+    if (st.st_size < s_perfMapSize)
+    {
+        // replaced or truncated: start over (the old names are kept)
+        s_perfMapSize = 0;
+    }
+    if (fseeko(file, s_perfMapSize, SEEK_SET) != 0)
+    {
+        fclose(file);
+        return;
+    }
+
+    char line[4096];
+    while (fgets(line, sizeof(line), file) != nullptr) // flawfinder: ignore
+    {
+        const size_t length = strlen(line);
+        if (length == 0 || line[length - 1] != '\n')
+        {
+            if (length + 1 < sizeof(line))
+            {
+                // the last line isn't complete yet, read it again next time
+                break;
+            }
+            // too long: skip the rest of the line
+            int c = 0;
+            while ((c = fgetc(file)) != EOF && c != '\n')
+            {
+            }
+            s_perfMapSize = ftello(file);
+            continue;
+        }
+        s_perfMapSize = ftello(file);
+        line[length - 1] = '\0';
+
+        char* end = nullptr;
+        const uint64_t start = strtoull(line, &end, 16);
+        if (end == line || *end != ' ')
+        {
+            continue;
+        }
+        char* sizeStr = end + 1;
+        const uint64_t size = strtoull(sizeStr, &end, 16);
+        if (end == sizeStr || *end != ' ' || end[1] == '\0')
+        {
+            continue;
+        }
+        addSymbol(static_cast<uintptr_t>(start), static_cast<size_t>(size), end + 1);
+    }
+    fclose(file);
+}
+
+/// Looks up an address in the index and the pending functions (s_providedMutex must be locked).
+static const char* findRegistered(uintptr_t addr, uint64_t& offset) noexcept
+{
+    const SymbolIndex::Entry* best = nullptr;
+    auto consider = [&best](const SymbolIndex::Entry& entry) {
+        if (best == nullptr || entry.low > best->low ||
+            (entry.low == best->low && entry.value.sequence > best->value.sequence))
+        {
+            best = &entry;
+        }
+    };
+    const SymbolIndex::Entry* indexed = s_providedIndex.findLast(addr);
+    if (indexed != nullptr)
+    {
+        consider(*indexed);
+    }
+    for (const auto& entry : s_pendingSymbols)
+    {
+        if (entry.low <= addr && addr < entry.high)
+        {
+            consider(entry);
+        }
+    }
+    if (best == nullptr)
+    {
+        return nullptr;
+    }
+    offset = addr - best->low;
+    return best->value.name;
+}
+
+const char* findProvidedSymbol(uintptr_t addr, uint64_t& offset, bool signalSafe) noexcept
+{
+    countStat(StatCounter::SymbolLookups);
+    if (signalSafe)
+    {
+        // don't wait (the lock may be held by the crashing thread) and don't change anything
+        std::unique_lock<std::mutex> lock(s_providedMutex, std::try_to_lock);
+        return lock.owns_lock() ? findRegistered(addr, offset) : nullptr;
+    }
+
+    try
+    {
+        {
+            const std::lock_guard<std::mutex> lock(s_providedMutex);
+            mergePendingSymbols();
+            const char* name = findRegistered(addr, offset);
+            if (name != nullptr)
+            {
+                return name;
+            }
+            refreshPerfMap();
+            mergePendingSymbols();
+            name = findRegistered(addr, offset);
+            if (name != nullptr)
+            {
+                return name;
+            }
+        }
+
+        // ask the application (without holding the lock, it may register functions)
+        const SymbolLookupFunc func = s_lookupFunc.load();
+        if (func == nullptr)
+        {
+            return nullptr;
+        }
+        size_t funcOffset = 0;
+        const char* name = func(reinterpret_cast<pointer_t>(addr), &funcOffset);
+        if (name == nullptr)
+        {
+            return nullptr;
+        }
+        const std::lock_guard<std::mutex> lock(s_providedMutex);
+        const auto known = s_providedNames.find(name);
+        if (known == s_providedNames.end())
+        {
+            // the names are kept forever: don't let a misbehaving function exhaust the memory
+            if (s_numLookedUpNames >= s_MAX_LOOKED_UP_NAMES)
+            {
+                return nullptr;
+            }
+            ++s_numLookedUpNames;
+        }
+        offset = funcOffset;
+        return known != s_providedNames.end() ? known->c_str() : internName(name);
+    }
+    catch (const std::bad_alloc&)
+    {
+        return nullptr;
+    }
+}
+
+bool registerSymbol(pointer_t address, size_t size, const char* name) noexcept
+{
+    try
+    {
+        const std::lock_guard<std::mutex> lock(s_providedMutex);
+        addSymbol(reinterpret_cast<uintptr_t>(address), size, name);
+        return true;
+    }
+    catch (const std::bad_alloc&)
+    {
+        return false;
+    }
+}
+
+size_t unregisterSymbols(pointer_t address, size_t size) noexcept
+{
+    const auto begin = reinterpret_cast<uintptr_t>(address);
+    const uintptr_t end = begin + size >= begin ? begin + size : UINTPTR_MAX;
+    auto inRange = [begin, end](const SymbolIndex::Entry& entry) {
+        return entry.low >= begin && entry.low < end;
+    };
+
+    const std::lock_guard<std::mutex> lock(s_providedMutex);
+    const size_t oldPending = s_pendingSymbols.size();
+    s_pendingSymbols.erase(
+      std::remove_if(s_pendingSymbols.begin(), s_pendingSymbols.end(), inRange),
+      s_pendingSymbols.end());
+    return oldPending - s_pendingSymbols.size() + s_providedIndex.removeIf(inRange);
+}
+
+void setSymbolLookupFunc(SymbolLookupFunc func) noexcept
+{
+    s_lookupFunc = func;
+}
+
+} // namespace ooopsi
+
+#else // !OOOPSI_LINUX
+
+namespace ooopsi
+{
+
+bool registerSymbol(pointer_t /*address*/, size_t /*size*/, const char* /*name*/) noexcept
+{
+    // not supported (yet)
+    return false;
+}
+
+size_t unregisterSymbols(pointer_t /*address*/, size_t /*size*/) noexcept
+{
+    // not supported (yet)
+    return 0;
+}
+
+void setSymbolLookupFunc(SymbolLookupFunc /*func*/) noexcept
+{
+    // not supported (yet)
+}
+
+} // namespace ooopsi
+
+#endif // OOOPSI_LINUX
@@ -0,0 +1,227 @@
+/**
+ * @file    symbolizer.cpp
+ * @brief   symbol lookup by address using the modules' ELF symbol tables
+ */
+
+// private library headers
+#include "symbolizer.hpp"
+#include "elf_file.hpp"
+#include "stats.hpp"
+
+#ifdef OOOPSI_LINUX
+
+#include <elf.h>
+
+#include <algorithm>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace ooopsi
+{
+
+namespace
+{
+/// A function symbol (the name points into the module's mapping).
+struct Symbol
+{
+    uint64_t address;
+    uint64_t size;
+    const char* name;
+};
+} // namespace
+
+/// The sorted function symbols of a single module.
+class ModuleSymbols
+{
+public:
+    ModuleSymbols(uintptr_t b, const char* p) : bias(b), path(p) {}
+
+    /// Loads the symbol table from the file.
+    void load();
+
+    /// Looks up a module-relative address.
+    const char* find(uint64_t addr, uint64_t& offset) const noexcept;
+
+    /// Calls 'func' for the memory used by the table (see forEachSymbolTableRange()).
+    void forEachRange(MemoryRangeFunc func) const noexcept;
+
+    const uintptr_t bias;
+    const std::string path;
+
+private:
+    bool loadTable(const char* symtabName, const char* strtabName);
+
+    ElfFile m_elf;
+    std::vector<Symbol> m_symbols;
+    /// the string table the names point into
+    ElfSection m_names;
+};
+
+
+void ModuleSymbols::load()
+{
+    if (!m_elf.open(path.c_str()))
+    {
+        return;
+    }
+    // prefer the full symbol table, which includes static functions
+    if (!loadTable(".symtab", ".strtab"))
+    {
+        loadTable(".dynsym", ".dynstr");
+    }
+
+    // sort by address - the stable sort keeps global symbols before their local/weak aliases
+    std::stable_sort(m_symbols.begin(), m_symbols.end(),
+                     [](const Symbol& lhs, const Symbol& rhs) {
+                         return lhs.address < rhs.address;
+                     });
+    m_symbols.erase(std::unique(m_symbols.begin(), m_symbols.end(),
+                                [](const Symbol& lhs, const Symbol& rhs) {
+                                    return lhs.address == rhs.address;
+                                }),
+                    m_symbols.end());
+    m_symbols.shrink_to_fit();
+}
+
+bool ModuleSymbols::loadTable(const char* symtabName, const char* strtabName)
+{
+    const ElfSection symtab = m_elf.section(symtabName);
+    const ElfSection strtab = m_elf.section(strtabName);
+    if (!symtab || !strtab || strtab.size == 0 || strtab.data[strtab.size - 1] != '\0')
+    {
+        return false;
+    }
+
+    const size_t count = symtab.size / sizeof(Elf64_Sym);
+    const auto* syms = reinterpret_cast<const Elf64_Sym*>(symtab.data);
+    // first pass: global symbols, second pass: all others
+    for (bool global : { true, false })
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            const Elf64_Sym& sym = syms[i];
+            const unsigned type = ELF64_ST_TYPE(sym.st_info);
+            if ((type != STT_FUNC && type != STT_GNU_IFUNC) || sym.st_shndx == SHN_UNDEF ||
+                sym.st_value == 0 || sym.st_name >= strtab.size ||
+                (ELF64_ST_BIND(sym.st_info) == STB_GLOBAL) != global)
+            {
+                continue;
+            }
+            m_symbols.push_back(Symbol{ sym.st_value, sym.st_size,
+                                        reinterpret_cast<const char*>(strtab.data + sym.st_name) });
+        }
+    }
+    m_names = strtab;
+    return !m_symbols.empty();
+}
+
+const char* ModuleSymbols::find(uint64_t addr, uint64_t& offset) const noexcept
+{
+    auto it = std::upper_bound(m_symbols.begin(), m_symbols.end(), addr,
+                               [](uint64_t a, const Symbol& sym) { return a < sym.address; });
+    if (it == m_symbols.begin())
+    {
+        return nullptr;
+    }
+    --it;
+    // symbols without size (e.g. from assembly) extend up to the next one
+    if (it->size != 0 && addr - it->address >= it->size)
+    {
+        return nullptr;
+    }
+    offset = addr - it->address;
+    return it->name;
+}
+
+void ModuleSymbols::forEachRange(MemoryRangeFunc func) const noexcept
+{
+    if (!m_symbols.empty())
+    {
+        func(m_symbols.data(), m_symbols.size() * sizeof(Symbol));
+        func(m_names.data, m_names.size);
+    }
+}
+
+
+/// guards s_symbols
+static std::mutex s_symbolsMutex;
+
+/// symbol tables of all modules looked at (never freed: names point into their mappings)
+static std::vector<std::unique_ptr<ModuleSymbols>> s_symbols;
+
+
+/// Looks up a loaded symbol table (s_symbolsMutex must be locked).
+static const ModuleSymbols* findLoaded(const ModuleInfo& module)
+{
+    for (const auto& mod : s_symbols)
+    {
+        if (mod->bias == module.base && mod->path == module.path)
+        {
+            return mod.get();
+        }
+    }
+    return nullptr;
+}
+
+const ModuleSymbols* loadModuleSymbols(const ModuleInfo& module) noexcept
+{
+    try
+    {
+        {
+            const std::lock_guard<std::mutex> lock(s_symbolsMutex);
+            const ModuleSymbols* symbols = findLoaded(module);
+            if (symbols != nullptr)
+            {
+                countStat(StatCounter::SymbolTableHits);
+                return symbols;
+            }
+        }
+        countStat(StatCounter::SymbolTableMisses);
+
+        // load without holding the lock - this may take a while for large modules
+        std::unique_ptr<ModuleSymbols> symbols(new ModuleSymbols(module.base, module.path));
+        symbols->load();
+
+        const std::lock_guard<std::mutex> lock(s_symbolsMutex);
+        // another thread may have been faster
+        const ModuleSymbols* loaded = findLoaded(module);
+        if (loaded != nullptr)
+        {
+            return loaded;
+        }
+        s_symbols.push_back(std::move(symbols));
+        return s_symbols.back().get();
+    }
+    catch (const std::bad_alloc&)
+    {
+        return nullptr;
+    }
+}
+
+const char* findSymbol(const ModuleSymbols& symbols, uintptr_t addr, uint64_t& offset) noexcept
+{
+    countStat(StatCounter::SymbolLookups);
+    return symbols.find(addr - symbols.bias, offset);
+}
+
+void forEachSymbolTableRange(const ModuleSymbols& symbols, MemoryRangeFunc func) noexcept
+{
+    symbols.forEachRange(func);
+}
+
+const char* findSymbol(const ModuleInfo& module, uintptr_t addr, uint64_t& offset) noexcept
+{
+    const ModuleSymbols* symbols = loadModuleSymbols(module);
+    if (symbols == nullptr)
+    {
+        countStat(StatCounter::SymbolLookups);
+        return nullptr;
+    }
+    return findSymbol(*symbols, addr, offset);
+}
+
+} // namespace ooopsi
+
+#endif // OOOPSI_LINUX
@@ -0,0 +1,74 @@
+/**
+ * @file    symbolizer.hpp
+ * @brief   symbol lookup by address using the modules' ELF symbol tables (Linux only)
+ */
+
+#ifndef SYMBOLIZER_HPP_
+#define SYMBOLIZER_HPP_
+
+#include "internal.hpp"
+
+#ifdef OOOPSI_LINUX
+
+#include "module_map.hpp"
+
+namespace ooopsi
+{
+
+/**
+ * Looks up the function containing the given address, using the module's symbol table (.symtab
+ * or, if the module is stripped, .dynsym). This doesn't need an unwinding context, so it works
+ * for raw addresses collected earlier or even in another process.
+ *
+ * The symbol tables are loaded on first use and cached.
+ * Note: not safe to use in signal handlers.
+ *
+ * @param[in]  module   the module containing 'addr'
+ * @param[in]  addr     the (absolute) address to look up
+ * @param[out] offset   receives the offset of 'addr' relative to the start of the symbol
+ * @return the (mangled) symbol name or nullptr if not found; the pointer stays valid
+ */
+const char* findSymbol(const ModuleInfo& module, uintptr_t addr, uint64_t& offset) noexcept;
+
+/// The symbol table of a module (see loadModuleSymbols()).
+class ModuleSymbols;
+
+/**
+ * Returns the symbol table of a module, loading it if necessary. The table is immutable once
+ * loaded, so lookups via findSymbol(const ModuleSymbols&, ...) can run concurrently without
+ * locking. Different modules can be loaded concurrently as well.
+ * Note: not safe to use in signal handlers.
+ *
+ * @param[in] module    the module
+ * @return the symbol table (never freed), nullptr if out of memory
+ */
+const ModuleSymbols* loadModuleSymbols(const ModuleInfo& module) noexcept;
+
+/// Same as findSymbol() above, using a symbol table returned by loadModuleSymbols(). Lock-free.
+const char* findSymbol(const ModuleSymbols& symbols, uintptr_t addr, uint64_t& offset) noexcept;
+
+/**
+ * Looks up an address in the functions registered via registerSymbol(), the perf map and the
+ * application's lookup function (see setSymbolLookupFunc()) - for addresses that aren't found
+ * in the modules' symbol tables, e.g. in JIT code.
+ *
+ * @param[in]  addr         the address to look up
+ * @param[out] offset       receives the offset of 'addr' relative to the start of the function
+ * @param[in]  signalSafe   only search the registered functions, without blocking (if they're
+ *                          being changed, nothing is found)
+ * @return the name or nullptr if not found; the pointer stays valid
+ */
+const char* findProvidedSymbol(uintptr_t addr, uint64_t& offset, bool signalSafe = false) noexcept;
+
+/// Receives a range of memory.
+typedef void (*MemoryRangeFunc)(const void* address, size_t size);
+
+/// Calls 'func' for each range of memory a symbol table uses when looking up symbols (the
+/// sorted symbols and their names), e.g. to page it in.
+void forEachSymbolTableRange(const ModuleSymbols& symbols, MemoryRangeFunc func) noexcept;
+
+} // namespace ooopsi
+
+#endif // OOOPSI_LINUX
+
+#endif /* SYMBOLIZER_HPP_ */
@@ -0,0 +1,252 @@
+/**
+ * @file    tracepoints.cpp
+ * @brief   named trace points with hit counters and sampled stack traces
+ */
+
+// public library header
+#include "ooopsi.hpp"
+// private library headers
+#include "internal.hpp"
+#include "stack_depot.hpp"
+#ifdef OOOPSI_LINUX
+#include "pprof_writer.hpp"
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <tuple> // for std::ignore
+
+namespace ooopsi
+{
+
+/// maximum number of trace points (further ones aren't counted)
+static constexpr size_t s_MAX_TRACE_POINTS = 1024;
+/// number of counters per trace point, threads are distributed over them
+static constexpr size_t s_NUM_STRIPES = 16;
+/// maximum number of distinct stack traces per trace point
+static constexpr size_t s_MAX_TRACE_POINT_STACKS = 16;
+
+/// a registered trace point (the counters are kept separately, see s_hits)
+struct TracePoint
+{
+    /// the name (set last, when registered)
+    std::atomic<const char*> name;
+    /// the sampled stack traces (depot IDs, 0: unused)
+    std::atomic<uint32_t> stacks[s_MAX_TRACE_POINT_STACKS];
+    /// number of samples per stack trace
+    std::atomic<uint64_t> stackSamples[s_MAX_TRACE_POINT_STACKS];
+    /// samples that didn't fit into the table (or the depot)
+    std::atomic<uint64_t> droppedSamples;
+};
+
+/// the trace points
+static TracePoint s_tracePoints[s_MAX_TRACE_POINTS];
+/// number of registered trace points (may exceed s_MAX_TRACE_POINTS)
+static std::atomic<size_t> s_numTracePoints{ 0 };
+
+/// The hit counters: one row per stripe, so threads using different stripes don't share cache
+/// lines (except at the edges of the rows), similar to per-CPU counters.
+alignas(64) static std::atomic<uint64_t> s_hits[s_NUM_STRIPES][s_MAX_TRACE_POINTS];
+/// the stripe assigned to the next thread
+static std::atomic<size_t> s_nextStripe{ 0 };
+/// the current thread's stripe (s_NUM_STRIPES: not assigned yet)
+static thread_local size_t s_stripe OOOPSI_TLS_INITIAL_EXEC = s_NUM_STRIPES;
+
+/// record every n-th hit (0: none)
+static std::atomic<unsigned> s_tracePointSampling{ 1000 };
+
+
+TracePoint* registerTracePoint(const char* name) noexcept
+{
+    const size_t index = s_numTracePoints++;
+    if (index >= s_MAX_TRACE_POINTS || name == nullptr)
+    {
+        return nullptr;
+    }
+    TracePoint& point = s_tracePoints[index];
+    point.name.store(name, std::memory_order_release);
+    return &point;
+}
+
+/// Records the current stack trace for a hit of the given trace point.
+static void sampleTracePoint(TracePoint& point) noexcept
+{
+    TraceSettings settings;
+    settings.maxFrames = s_MAX_DEPOT_FRAMES;
+    // skip this function and hitTracePoint() (whether inlined or tail-called, or not)
+    settings.skipInternalFrames = true;
+    RawFrame frames[s_MAX_DEPOT_FRAMES];
+    const size_t numFrames = collectRawStackTrace(frames, s_MAX_DEPOT_FRAMES, settings);
+
+    pointer_t addresses[s_MAX_DEPOT_FRAMES];
+    for (size_t i = 0; i < numFrames; ++i)
+    {
+        addresses[i] = frames[i].address;
+    }
+    const uint32_t id = depotStore(addresses, numFrames);
+    if (id != 0)
+    {
+        for (size_t i = 0; i < s_MAX_TRACE_POINT_STACKS; ++i)
+        {
+            uint32_t stack = point.stacks[i].load(std::memory_order_acquire);
+            if (stack == 0 && point.stacks[i].compare_exchange_strong(stack, id))
+            {
+                stack = id;
+            }
+            if (stack == id)
+            {
+                point.stackSamples[i].fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+        }
+    }
+    point.droppedSamples.fetch_add(1, std::memory_order_relaxed);
+}
+
+void hitTracePoint(TracePoint* point) noexcept
+{
+    if (point == nullptr)
+    {
+        return;
+    }
+    size_t stripe = s_stripe;
+    if (stripe == s_NUM_STRIPES)
+    {
+        stripe = s_nextStripe++ % s_NUM_STRIPES;
+        s_stripe = stripe;
+    }
+    const auto index = static_cast<size_t>(point - s_tracePoints);
+    const uint64_t count = s_hits[stripe][index].fetch_add(1, std::memory_order_relaxed);
+
+    // (the first hit per stripe is always recorded, to catch rare events)
+    const unsigned interval = s_tracePointSampling.load(std::memory_order_relaxed);
+    if (interval != 0 && count % interval == 0)
+    {
+        sampleTracePoint(*point);
+    }
+}
+
+void setTracePointSampling(unsigned interval) noexcept
+{
+    s_tracePointSampling.store(interval, std::memory_order_relaxed);
+}
+
+void printTracePoints(LogSettings settings, size_t maxStacks)
+{
+    if (settings.logFunc == nullptr)
+    {
+        settings.logFunc = getAbortLogFunc();
+    }
+
+    logLine(settings, "--------- TRACE POINTS --------");
+
+    const size_t numTracePoints = std::min(s_numTracePoints.load(), s_MAX_TRACE_POINTS);
+    for (size_t index = 0; index < numTracePoints; ++index)
+    {
+        const TracePoint& point = s_tracePoints[index];
+        const char* name = point.name.load(std::memory_order_acquire);
+        if (name == nullptr)
+        {
+            // (still being registered)
+            continue;
+        }
+        uint64_t hits = 0;
+        for (size_t stripe = 0; stripe < s_NUM_STRIPES; ++stripe)
+        {
+            hits += s_hits[stripe][index].load(std::memory_order_relaxed);
+        }
+
+        // the most frequent stack traces first
+        size_t order[s_MAX_TRACE_POINT_STACKS];
+        uint64_t samples[s_MAX_TRACE_POINT_STACKS];
+        uint64_t numSamples = point.droppedSamples.load(std::memory_order_relaxed);
+        size_t numStacks = 0;
+        for (size_t i = 0; i < s_MAX_TRACE_POINT_STACKS; ++i)
+        {
+            samples[i] = point.stackSamples[i].load(std::memory_order_relaxed);
+            numSamples += samples[i];
+            if (point.stacks[i].load(std::memory_order_acquire) != 0)
+            {
+                order[numStacks++] = i;
+            }
+        }
+        std::stable_sort(order, order + numStacks,
+                         [&samples](size_t lhs, size_t rhs) {
+                             return samples[lhs] > samples[rhs];
+                         });
+
+        char messageBuffer[512];
+        snprintf(messageBuffer, sizeof(messageBuffer), "%s: %" PRIu64 " hits, %" PRIu64 " sampled",
+                 name, hits, numSamples);
+        logLine(settings, messageBuffer);
+
+        for (size_t i = 0; i < std::min(numStacks, maxStacks); ++i)
+        {
+            const pointer_t* addresses = nullptr;
+            uint32_t parent = 0;
+            const size_t numFrames =
+              depotGet(point.stacks[order[i]].load(std::memory_order_relaxed), addresses, parent);
+
+            RawFrame frames[s_MAX_DEPOT_FRAMES];
+            for (size_t j = 0; j < numFrames; ++j)
+            {
+                frames[j].address = addresses[j];
+                frames[j].exact = false;
+            }
+            snprintf(messageBuffer, sizeof(messageBuffer), "  %" PRIu64 " samples:",
+                     samples[order[i]]);
+            logLine(settings, messageBuffer);
+            printRawStackTrace(frames, numFrames, settings, nullptr, true);
+        }
+    }
+
+    logLine(settings, "-------------------------------");
+    // END
+    logLine(settings, nullptr);
+}
+
+bool writeTracePointProfile(const char* path)
+{
+#ifdef OOOPSI_LINUX
+    PprofWriter writer;
+    if (!writer.open(path))
+    {
+        return false;
+    }
+    writer.addSampleType("samples", "count");
+    const size_t numTracePoints = std::min(s_numTracePoints.load(), s_MAX_TRACE_POINTS);
+    for (size_t index = 0; index < numTracePoints; ++index)
+    {
+        const TracePoint& point = s_tracePoints[index];
+        const char* name = point.name.load(std::memory_order_acquire);
+        for (size_t i = 0; name != nullptr && i < s_MAX_TRACE_POINT_STACKS; ++i)
+        {
+            const uint32_t id = point.stacks[i].load(std::memory_order_acquire);
+            if (id == 0)
+            {
+                continue;
+            }
+            const pointer_t* frames = nullptr;
+            uint32_t parent = 0;
+            const size_t numFrames = depotGet(id, frames, parent);
+            uintptr_t addresses[s_MAX_DEPOT_FRAMES];
+            for (size_t j = 0; j < numFrames; ++j)
+            {
+                addresses[j] = reinterpret_cast<uintptr_t>(frames[j]);
+            }
+            const auto samples =
+              static_cast<int64_t>(point.stackSamples[i].load(std::memory_order_relaxed));
+            writer.addSample(addresses, numFrames, false, &samples, 1, "tracepoint", name);
+        }
+    }
+    return writer.finish();
+#else
+    // not supported (yet)
+    std::ignore = path;
+    return false;
+#endif
+}
+
+} // namespace ooopsi
@@ -0,0 +1,108 @@
+/**
+ * @file    bench_symbolize.cpp
+ * @brief   Measures the throughput of the bulk symbol lookup with 1..N threads
+ */
+#include "internal.hpp"
+#include "ooopsi.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#ifdef OOOPSI_LINUX
+#include <link.h>
+
+/// Collects the executable segments of all loaded modules.
+static int collectSegment(dl_phdr_info* info, size_t /*size*/, void* data)
+{
+    auto& segments = *static_cast<std::vector<std::pair<uintptr_t, uintptr_t>>*>(data);
+    for (ElfW(Half) i = 0; i < info->dlpi_phnum; ++i)
+    {
+        const ElfW(Phdr)& phdr = info->dlpi_phdr[i];
+        if (phdr.p_type == PT_LOAD && (phdr.p_flags & PF_X) != 0 && phdr.p_memsz > 0)
+        {
+            const uintptr_t begin = info->dlpi_addr + phdr.p_vaddr;
+            segments.emplace_back(begin, begin + phdr.p_memsz);
+        }
+    }
+    return 0;
+}
+#endif // OOOPSI_LINUX
+
+int main(int argc, char** argv)
+{
+    // number of addresses to look up
+    const size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200000;
+    // maximum number of threads
+    unsigned maxThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    if (argc > 2)
+    {
+        maxThreads = static_cast<unsigned>(std::strtoul(argv[2], nullptr, 10));
+    }
+
+#ifdef OOOPSI_LINUX
+    std::vector<std::pair<uintptr_t, uintptr_t>> segments;
+    dl_iterate_phdr(collectSegment, &segments);
+    if (segments.empty())
+    {
+        std::fputs("no code segments found\n", stderr);
+        return 1;
+    }
+
+    // spread the addresses over all modules, with some duplicates (like a profile)
+    std::vector<ooopsi::pointer_t> addresses(count);
+    uint64_t random = 42;
+    for (size_t i = 0; i < count; ++i)
+    {
+        random = random * 6364136223846793005ULL + 1442695040888963407ULL;
+        const auto& segment = segments[(random >> 33) % segments.size()];
+        const uintptr_t size = segment.second - segment.first;
+        // every fourth address is a "hot" one
+        const uintptr_t offset = (random >> 35) % 4 == 0 ? size / 2 : (random >> 17) % size;
+        addresses[i] = reinterpret_cast<ooopsi::pointer_t>(segment.first + offset);
+    }
+    std::vector<ooopsi::SymbolInfo> results(count);
+
+    // the first run loads the symbol tables
+    auto start = std::chrono::steady_clock::now();
+    ooopsi::symbolizeAddresses(addresses.data(), count, results.data(), 1);
+    auto duration = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() -
+                                                              start);
+    const size_t found = static_cast<size_t>(std::count_if(
+        results.begin(), results.end(),
+        [](const ooopsi::SymbolInfo& result) { return result.function != nullptr; }));
+    std::printf("%zu addresses in %zu segments, %zu found\n", count, segments.size(), found);
+    std::printf("first run (loading symbols): %9.2f ms\n", duration.count());
+
+    double singleThreaded = 0;
+    for (unsigned threads = 1; threads <= maxThreads; ++threads)
+    {
+        static constexpr int s_RUNS = 5;
+        start = std::chrono::steady_clock::now();
+        for (int run = 0; run < s_RUNS; ++run)
+        {
+            ooopsi::symbolizeAddresses(addresses.data(), count, results.data(), threads);
+        }
+        duration = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() -
+                                                             start) /
+                   s_RUNS;
+        if (threads == 1)
+        {
+            singleThreaded = duration.count();
+        }
+        std::printf("%2u thread(s): %9.2f ms  %6.2f M addresses/s  speedup %.2fx\n", threads,
+                    duration.count(), static_cast<double>(count) / duration.count() / 1000.0,
+                    singleThreaded / duration.count());
+    }
+    return 0;
+#else
+    (void)count;
+    (void)maxThreads;
+    std::fputs("not supported (yet)\n", stderr);
+    return 1;
+#endif // OOOPSI_LINUX
+}
@@ -0,0 +1,65 @@
+/**
+ * @file    temp_file.hpp
+ *
+ * Temporary files for tests, e.g. for the files written by the library.
+ */
+
+#ifndef TEMP_FILE_HPP_
+#define TEMP_FILE_HPP_
+
+// include OS defines
+#include "internal.hpp"
+
+#ifdef OOOPSI_LINUX
+
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+
+/// An empty file in /tmp, removed when going out of scope (not in forked child processes that
+/// don't return, e.g. death tests).
+class TempFile
+{
+public:
+    /// Creates the file, e.g. "/tmp/ooopsi-journal-XXXXXX" for the name "journal".
+    explicit TempFile(const char* name) : m_path(std::string("/tmp/ooopsi-") + name + "-XXXXXX")
+    {
+        const int fd = mkstemp(&m_path[0]);
+        if (fd < 0)
+        {
+            throw std::runtime_error("Failed to create '" + m_path + "': " + strerror(errno));
+        }
+        close(fd);
+    }
+    ~TempFile() { unlink(m_path.c_str()); }
+
+    // not copyable or movable
+    TempFile(const TempFile&) = delete;
+    TempFile& operator=(const TempFile&) = delete;
+    TempFile(TempFile&&) = delete;
+    TempFile& operator=(TempFile&&) = delete;
+
+    /// Returns the file's path.
+    const char* path() const noexcept { return m_path.c_str(); }
+
+    /// Returns the file's current content.
+    std::string read() const
+    {
+        std::ifstream file(m_path, std::ios::binary);
+        return std::string((std::istreambuf_iterator<char>(file)),
+                           std::istreambuf_iterator<char>());
+    }
+
+private:
+    std::string m_path;
+};
+
+#endif // OOOPSI_LINUX
+
+#endif /* TEMP_FILE_HPP_ */
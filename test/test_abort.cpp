@@ -5,10 +5,26 @@
  */
 
 #include "ooopsi.hpp"
+#include "temp_file.hpp"
 #include "test_helper.hpp"
 
 #include <gtest/gtest.h>
 
+#ifdef OOOPSI_LINUX
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <thread>
+
 // detect compilation with AddressSanitizer: we need to exclude some bad stuff here...
 #ifdef __SANITIZE_ADDRESS__
 #define OOOPSI_ASAN
@@ -122,6 +138,101 @@ TEST(Abort, AbortDeath)
     ASSERT_DEATH(ooopsi::abort("ooops", settings), "^ooops\n$");
 }
 
+/// a log function that shows where the log ends
+static void logWithEnd(const char* message)
+{
+    fprintf(stderr, "%s\n", message != nullptr ? message : "END");
+}
+
+TEST(Abort, StatsDeath)
+{
+    // the stats are part of the report (before its end)
+    ooopsi::AbortSettings settings;
+    settings.logFunc = logWithEnd;
+    settings.printStats = true;
+    ASSERT_DEATH(ooopsi::abort("ooops", settings),
+                 "^ooops\n.*BACKTRACE.*\n------------ STATS ------------\n.*\n"
+                 "abort time: +[0-9]+ ns\n-------------------------------\nEND\n$");
+    settings.printStackTrace = false;
+    ASSERT_DEATH(ooopsi::abort("ooops", settings),
+                 "^ooops\n------------ STATS ------------\n.*\nEND\n$");
+}
+
+#ifdef OOOPSI_LINUX
+/// a log function that takes its time
+static void logSlowly(const char* message)
+{
+    if (message != nullptr)
+    {
+        fprintf(stderr, "%s\n", message);
+        usleep(20 * 1000);
+    }
+}
+
+TEST(Abort, TimeBoundedDeath)
+{
+    // two phases: raw addresses, then symbols
+    ooopsi::AbortSettings settings;
+    settings.symbolizeTimeoutMs = 5000;
+    ASSERT_DEATH(ooopsi::abort("ooops", settings), makeBtRegex("^ooops\n.*BACKTRACE"));
+
+    // cut short
+    settings.logFunc = logSlowly;
+    settings.symbolizeTimeoutMs = 100;
+    ASSERT_DEATH(ooopsi::abort("ooops", settings),
+                 "^ooops\n.*BACKTRACE.*!!! SYMBOLIZATION CUT SHORT "
+                 "\\(deadline of 100 ms exceeded\\)");
+
+    // the deadline is the crashing thread's: another thread waiting for SIGALRM doesn't get it
+    auto crashInThread = [&settings]() {
+        sigset_t alarmMask;
+        sigemptyset(&alarmMask);
+        sigaddset(&alarmMask, SIGALRM);
+        pthread_sigmask(SIG_BLOCK, &alarmMask, nullptr);
+        std::thread crashing([&settings] { ooopsi::abort("ooops", settings); });
+        int sig = 0;
+        for (;;)
+        {
+            sigwait(&alarmMask, &sig);
+        }
+    };
+    ASSERT_DEATH(crashInThread(), "^ooops\n.*!!! SYMBOLIZATION CUT SHORT");
+}
+
+TEST(Abort, BreadcrumbsDeath)
+{
+    ooopsi::leaveBreadcrumb("before the crash", 1, 2);
+    ASSERT_DEATH(ooopsi::abort("ooops"),
+                 "^ooops\n--------- BREADCRUMBS ---------\n  thread [0-9]+ \\(current\\):\n"
+                 "    -[0-9]+\\.[0-9]+ ms  before the crash \\(1, 2\\)\n.*BACKTRACE");
+
+    // another thread's breadcrumbs are only printed on request
+    std::atomic<int> state{ 0 };
+    std::thread other([&state] {
+        ooopsi::leaveBreadcrumb("in another thread");
+        state = 1;
+        while (state != 2)
+        {
+            usleep(1000);
+        }
+    });
+    while (state != 1)
+    {
+        usleep(1000);
+    }
+    ooopsi::AbortSettings settings;
+    ASSERT_DEATH(ooopsi::abort("ooops", settings), "^ooops\n.*before the crash.*BACKTRACE");
+    settings.allThreadBreadcrumbs = true;
+    ASSERT_DEATH(ooopsi::abort("ooops", settings),
+                 "^ooops\n.*before the crash.*thread [0-9]+:\n.*in another thread.*BACKTRACE");
+    // or not at all
+    settings.numBreadcrumbs = 0;
+    ASSERT_DEATH(ooopsi::abort("ooops", settings), "^ooops\n---------- BACKTRACE");
+    state = 2;
+    other.join();
+}
+#endif // OOOPSI_LINUX
+
 TEST(Abort, StdAbortDeath)
 {
     ASSERT_DEATH(std::abort(), makeBtRegex("!!! TERMINATING DUE TO std::abort\\(\\)"));
@@ -218,4 +329,404 @@ TEST(Abort, IllegalInstructionDeath)
                  "!!! TERMINATING DUE TO ILLEGAL INSTRUCTION.*\n.*BACKTRACE.*");
 }
 
+#ifdef OOOPSI_LINUX
+TEST(Abort, CrashHelper)
+{
+    // the helper outlives the crashing process, so the death test macros can't be used: collect
+    // the output until the helper closes the pipe as well
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    const pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0)
+    {
+        close(fds[0]);
+        dup2(fds[1], STDERR_FILENO);
+        close(fds[1]);
+        setenv("OOOPSI_PRINT_REGISTERS", "1", 1);
+        // re-reads the environment
+        ooopsi::HandlerSetup setup;
+        if (!ooopsi::startCrashHelper())
+        {
+            _exit(1);
+        }
+        ooopsi::leaveBreadcrumb("before handing off", 3, 4);
+        failSegmentationFault();
+        _exit(2);
+    }
+    close(fds[1]);
+
+    std::string output;
+    char buffer[4096];
+    ssize_t n;
+    while ((n = read(fds[0], buffer, sizeof(buffer))) > 0)
+    {
+        output.append(buffer, static_cast<size_t>(n));
+    }
+    close(fds[0]);
+
+    int status = 0;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    ASSERT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(WEXITSTATUS(status), 127);
+
+    EXPECT_NE(output.find("!!! TERMINATING DUE TO SEGMENTATION FAULT"), std::string::npos)
+      << output;
+    // the helper highlights the faulting frame and resolves the symbols on its own
+    EXPECT_NE(output.find("BACKTRACE"), std::string::npos) << output;
+    EXPECT_NE(output.find("=>"), std::string::npos) << output;
+    EXPECT_NE(output.find("Abort_CrashHelper_Test"), std::string::npos) << output;
+    EXPECT_NE(output.find("REGISTERS"), std::string::npos) << output;
+    // the sections that need the crashing process' memory are passed on
+    EXPECT_NE(output.find("BREADCRUMBS"), std::string::npos) << output;
+    EXPECT_NE(output.find("ms  before handing off (3, 4)\n"), std::string::npos) << output;
+    EXPECT_NE(output.find("------------ STACK ------------\n"), std::string::npos) << output;
+}
+
+TEST(Abort, CrashHelperForkedChild)
+{
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    const pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0)
+    {
+        close(fds[0]);
+        dup2(fds[1], STDERR_FILENO);
+        close(fds[1]);
+        if (!ooopsi::startCrashHelper())
+        {
+            _exit(1);
+        }
+        // a child inherits the connection to the helper, but reports its crash on its own
+        const pid_t child = fork();
+        if (child == 0)
+        {
+            ooopsi::abort("crash in the child");
+        }
+        int status = 0;
+        if (child < 0 || waitpid(child, &status, 0) != child)
+        {
+            _exit(2);
+        }
+        // the helper is still waiting for its parent (it would exit after a report)
+        usleep(200 * 1000);
+        if (waitpid(-1, &status, WNOHANG) != 0)
+        {
+            _exit(3);
+        }
+        failSegmentationFault();
+        _exit(4);
+    }
+    close(fds[1]);
+
+    std::string output;
+    char buffer[4096];
+    ssize_t n;
+    while ((n = read(fds[0], buffer, sizeof(buffer))) > 0)
+    {
+        output.append(buffer, static_cast<size_t>(n));
+    }
+    close(fds[0]);
+
+    int status = 0;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    ASSERT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(WEXITSTATUS(status), 127) << output;
+    EXPECT_NE(output.find("crash in the child"), std::string::npos) << output;
+    EXPECT_NE(output.find("!!! TERMINATING DUE TO SEGMENTATION FAULT"), std::string::npos)
+      << output;
+}
+
+TEST(Abort, CrashNotification)
+{
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_DGRAM, 0, fds), 0);
+    auto crash = [&fds]() {
+        setenv("OOOPSI_NOTIFY_FD", std::to_string(fds[1]).c_str(), 1);
+        // re-reads the environment
+        ooopsi::HandlerSetup setup;
+        std::abort();
+    };
+    ASSERT_DEATH(crash(), makeBtRegex("!!! TERMINATING DUE TO std::abort\\(\\)"));
+
+    char message[128];
+    const ssize_t len = recv(fds[0], message, sizeof(message) - 1, MSG_DONTWAIT);
+    ASSERT_GT(len, 0);
+    message[len] = '\0';
+    EXPECT_NE(strstr(message, "ooopsi: crash pid="), nullptr) << message;
+    EXPECT_NE(strstr(message, " signal=6\n"), nullptr) << message;
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(Abort, CrashNotificationFullPipe)
+{
+    // nobody reads the pipe, and it's full
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    const int flags = fcntl(fds[1], F_GETFL);
+    ASSERT_EQ(fcntl(fds[1], F_SETFL, flags | O_NONBLOCK), 0);
+    const char chunk[4096] = {};
+    while (write(fds[1], chunk, sizeof(chunk)) > 0)
+    {
+    }
+    ASSERT_EQ(fcntl(fds[1], F_SETFL, flags), 0);
+
+    // the crash report is written anyway (instead of hanging)
+    auto crash = [&fds]() {
+        setenv("OOOPSI_NOTIFY_FD", std::to_string(fds[1]).c_str(), 1);
+        // re-reads the environment
+        ooopsi::HandlerSetup setup;
+        std::abort();
+    };
+    ASSERT_DEATH(crash(), makeBtRegex("!!! TERMINATING DUE TO std::abort\\(\\)"));
+    // the inherited descriptor hasn't been changed
+    EXPECT_EQ(fcntl(fds[1], F_GETFL) & O_NONBLOCK, 0);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+/// a line of a hexdump, without the prefix
+#define HEXDUMP_LINE_REGEX "0x[0-9a-f]{16}:  [0-9a-f]{16} [0-9a-f]{16}  \\|.{16}\\|"
+
+TEST(Abort, CrashJournal)
+{
+    // an empty file is initialized
+    const TempFile journal("journal");
+
+    auto crash = [&journal]() {
+        setenv("OOOPSI_JOURNAL", journal.path(), 1);
+        setenv("OOOPSI_JOURNAL_SIZE", "65536", 1);
+        // re-reads the environment
+        ooopsi::HandlerSetup setup;
+        std::abort();
+    };
+    // the reports are appended
+    ASSERT_DEATH(crash(), makeBtRegex("!!! TERMINATING DUE TO std::abort\\(\\)"));
+    ASSERT_DEATH(crash(), makeBtRegex("!!! TERMINATING DUE TO std::abort\\(\\)"));
+
+    const std::string content = journal.read();
+    ASSERT_EQ(content.size(), 65536u);
+    EXPECT_EQ(content.compare(0, 8, "OOOPSIJ1"), 0);
+    const size_t first = content.find("!!! TERMINATING DUE TO std::abort()\n");
+    ASSERT_NE(first, std::string::npos);
+    EXPECT_NE(content.find("---------- BACKTRACE", first), std::string::npos);
+    EXPECT_NE(content.find("!!! TERMINATING DUE TO std::abort()\n", first + 1), std::string::npos);
+}
+
+static void ignoreLine(const char* /*line*/) {}
+
+TEST(Abort, CrashJournalConcurrent)
+{
+    const TempFile journal("journal");
+
+    // processes sharing the journal crash at the same time
+    constexpr int numProcesses = 4;
+    int start[2];
+    ASSERT_EQ(pipe(start), 0);
+    pid_t pids[numProcesses];
+    for (int i = 0; i < numProcesses; ++i)
+    {
+        pids[i] = fork();
+        ASSERT_GE(pids[i], 0);
+        if (pids[i] == 0)
+        {
+            setenv("OOOPSI_JOURNAL", journal.path(), 1);
+            setenv("OOOPSI_JOURNAL_SIZE", "1048576", 1);
+            ooopsi::HandlerSetup setup;
+            close(start[1]);
+            char c = 0;
+            std::ignore = read(start[0], &c, 1);
+            const std::string reason = "crash #" + std::to_string(i);
+            ooopsi::AbortSettings settings;
+            settings.logFunc = ignoreLine;
+            ooopsi::abort(reason.c_str(), settings);
+        }
+    }
+    close(start[0]);
+    // go
+    close(start[1]);
+    for (pid_t pid : pids)
+    {
+        int status = 0;
+        ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    }
+
+    const std::string content = journal.read();
+    // none of the reports has been overwritten
+    for (int i = 0; i < numProcesses; ++i)
+    {
+        const std::string reason = "crash #" + std::to_string(i) + "\n";
+        const size_t pos = content.find(reason);
+        ASSERT_NE(pos, std::string::npos) << reason;
+        EXPECT_NE(content.find("---------- BACKTRACE", pos), std::string::npos) << reason;
+    }
+}
+
+TEST(Abort, MachineStateDeath)
+{
+#ifdef OOOPSI_ASAN
+    GTEST_SKIP();
+#endif
+
+    auto crash = []() {
+        setenv("OOOPSI_PRINT_REGISTERS", "1", 1);
+        setenv("OOOPSI_MEMORY_DUMP_SIZE", "64", 1);
+        // re-reads the environment
+        ooopsi::HandlerSetup setup;
+        failSegmentationFault();
+    };
+    // the fault address isn't mapped: its memory is skipped without faulting again
+    ASSERT_DEATH(crash(),
+                 "SEGMENTATION FAULT.*REGISTERS.*  rip     0x[0-9a-f]{16}.*"
+                 "STACK ------------\n(   " HEXDUMP_LINE_REGEX "\n)*=> " HEXDUMP_LINE_REGEX "\n.*"
+                 "FAULT ADDRESS --------\n   0x0000000012345650:  \\(not readable\\)\n"
+                 "-------------------------------\n.*BACKTRACE");
+}
+
+TEST(Abort, DumpCoreDeath)
+{
+    // the signal is raised again after the report (no actual core files while testing, though)
+    auto crash = []() {
+        prctl(PR_SET_DUMPABLE, 0);
+        setenv("OOOPSI_DUMP_CORE", "1", 1);
+        // re-reads the environment
+        ooopsi::HandlerSetup setup;
+        failSegmentationFault();
+    };
+    ASSERT_EXIT(crash(), testing::KilledBySignal(SIGSEGV),
+                makeBtRegex("!!! TERMINATING DUE TO SEGMENTATION FAULT"));
+
+    // SIGABRT if there was no signal (the deadline must not interfere)
+    ooopsi::AbortSettings settings;
+    settings.dumpCore = true;
+    settings.symbolizeTimeoutMs = 5000;
+    auto abort = [&settings]() {
+        prctl(PR_SET_DUMPABLE, 0);
+        ooopsi::abort("ooops", settings);
+    };
+    ASSERT_EXIT(abort(), testing::KilledBySignal(SIGABRT), makeBtRegex("^ooops"));
+}
+
+TEST(Abort, PrefaultDeath)
+{
+    auto crash = []() {
+        setenv("OOOPSI_PREFAULT", "1", 1);
+        // re-reads the environment
+        ooopsi::HandlerSetup setup;
+        ooopsi::abort("ooops");
+    };
+    // the stats are logged at setup
+    ASSERT_DEATH(crash(),
+                 "ooopsi: paged in [1-9][0-9]* KiB for crash reports \\(0 KiB locked\\).*ooops");
+}
+
+/// Returns the VmFlags of the mapping starting at the given address (empty if not found).
+static std::string mappingFlags(const void* address)
+{
+    std::ifstream smaps("/proc/self/smaps");
+    std::string line;
+    bool found = false;
+    while (std::getline(smaps, line))
+    {
+        // the header of a mapping starts with its address range
+        if (line.find('-') < line.find(' '))
+        {
+            found = strtoull(line.c_str(), nullptr, 16) == reinterpret_cast<uintptr_t>(address);
+        }
+        else if (found && line.compare(0, 8, "VmFlags:") == 0)
+        {
+            return line + ' ';
+        }
+    }
+    return std::string();
+}
+
+TEST(Abort, ExcludeFromCoreDump)
+{
+    const auto pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    auto* memory = static_cast<char*>(
+      mmap(nullptr, 4 * pageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    ASSERT_NE(memory, MAP_FAILED);
+
+    // only the whole pages in the middle
+    ASSERT_TRUE(ooopsi::excludeFromCoreDump(memory + 1, 3 * pageSize));
+    EXPECT_EQ(mappingFlags(memory).find(" dd "), std::string::npos);
+    EXPECT_NE(mappingFlags(memory + pageSize).find(" dd "), std::string::npos);
+    EXPECT_EQ(mappingFlags(memory + 3 * pageSize).find(" dd "), std::string::npos);
+
+    ASSERT_TRUE(ooopsi::includeInCoreDump(memory, 4 * pageSize));
+    EXPECT_EQ(mappingFlags(memory).find(" dd "), std::string::npos);
+    EXPECT_EQ(mappingFlags(memory + pageSize).find(" dd "), std::string::npos);
+
+    munmap(memory, 4 * pageSize);
+    ASSERT_FALSE(ooopsi::excludeFromCoreDump(memory, 4 * pageSize));
+}
+
+#ifdef OOOPSI_LOCKPROF_PATH
+/// locks a mutex that is held by another thread
+static __attribute__((noinline)) void lockContended(pthread_mutex_t* mutex)
+{
+    pthread_mutex_lock(mutex);
+    pthread_mutex_unlock(mutex);
+}
+
+/// waits until another thread sets the flag
+static __attribute__((noinline)) void waitForCondition(pthread_mutex_t* mutex,
+                                                       pthread_cond_t* cond, const bool& flag)
+{
+    pthread_mutex_lock(mutex);
+    while (!flag)
+    {
+        pthread_cond_wait(cond, mutex);
+    }
+    pthread_mutex_unlock(mutex);
+}
+
+TEST(Abort, LockProfiler)
+{
+#ifdef OOOPSI_ASAN
+    GTEST_SKIP();
+#endif
+
+    auto contend = []() {
+        pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+        pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+        bool flag = false;
+
+        pthread_mutex_lock(&mutex);
+        std::thread locker([&mutex]() { lockContended(&mutex); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        pthread_mutex_unlock(&mutex);
+        locker.join();
+
+        std::thread signaller([&mutex, &cond, &flag]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            pthread_mutex_lock(&mutex);
+            flag = true;
+            pthread_cond_signal(&cond);
+            pthread_mutex_unlock(&mutex);
+        });
+        waitForCondition(&mutex, &cond, flag);
+        signaller.join();
+        // prints the profile
+        exit(0);
+    };
+
+    // the interposer must be loaded at startup: run the test in a new process
+    const std::string deathTestStyle = testing::GTEST_FLAG(death_test_style);
+    testing::GTEST_FLAG(death_test_style) = "threadsafe";
+    setenv("LD_PRELOAD", OOOPSI_LOCKPROF_PATH, 1);
+    setenv("OOOPSI_LOCK_PROFILE", "1", 1);
+    EXPECT_EXIT(contend(), testing::ExitedWithCode(0),
+                "mutex: [1-9][0-9]* waits.*condition: [1-9][0-9]* waits.*"
+                "BACKTRACE.*lockContended.*BACKTRACE.*waitForCondition");
+    unsetenv("OOOPSI_LOCK_PROFILE");
+    unsetenv("LD_PRELOAD");
+    testing::GTEST_FLAG(death_test_style) = deathTestStyle;
+}
+#endif // OOOPSI_LOCKPROF_PATH
+#endif // OOOPSI_LINUX
+
 // TODO: Windows-specific tests
@@ -40,3 +40,77 @@ TEST(Demangle, CppNames)
     ASSERT_EQ(result, "ooopsi::printStackTrace(ooopsi::LogSettings, void const* const*)");
 #endif
 }
+
+#ifndef _MSC_VER
+TEST(Demangle, CompactNames)
+{
+    // template arguments beyond the given depth are elided
+    const char* pushBack = "_ZNSt6vectorIiSaIiEE9push_backERKi";
+    ASSERT_EQ(ooopsi::demangleCompact(pushBack, 2),
+              "std::vector<int, std::allocator<int> >::push_back(int const&)");
+    ASSERT_EQ(ooopsi::demangleCompact(pushBack, 1),
+              "std::vector<int, std::allocator<...> >::push_back(int const&)");
+    ASSERT_EQ(ooopsi::demangleCompact(pushBack, 0), "std::vector<...>::push_back(int const&)");
+    const char* mapAt = "_ZNSt3mapIiSt6vectorIiSaIiEESt4lessIiESaISt4pairIKiS2_EEE2atERS6_";
+    ASSERT_EQ(ooopsi::demangleCompact(mapAt),
+              "std::map<int, std::vector<...>, std::less<...>, std::allocator<...> >"
+              "::at(int const&)");
+
+    // inline namespaces and well-known typedefs
+    ASSERT_EQ(ooopsi::demangleCompact(
+                "_ZNSt7__cxx1112basic_stringIcSt11char_traitsIcESaIcEE6appendEPKc", 0),
+              "std::string::append(char const*)");
+    ASSERT_EQ(ooopsi::demangleCompact(
+                "_ZNSt3__112basic_stringIcNS_11char_traitsIcEENS_9allocatorIcEEE6appendEPKc", 0),
+              "std::string::append(char const*)");
+    ASSERT_EQ(ooopsi::demangleCompact("_ZlsRSoRKi"), "operator<<(std::ostream&, int const&)");
+
+    // lambdas and anonymous namespaces
+    ASSERT_EQ(ooopsi::demangleCompact("_ZZ4mainENKUliE_clEi"),
+              "main::{lambda#1}::operator()(int) const");
+    ASSERT_EQ(ooopsi::demangleCompact("_ZN12_GLOBAL__N_13fooEv"), "(anon)::foo()");
+
+    // operators aren't template argument lists
+    ASSERT_EQ(ooopsi::demangleCompact("_ZltIiEbRKT_S2_", 0),
+              "bool operator< <...>(int const&, int const&)");
+    ASSERT_EQ(ooopsi::demangleCompact("_ZN1XptEv", 0), "X::operator->()");
+    // neither are comparisons in template arguments
+    ASSERT_EQ(ooopsi::demangleCompact("_Z1f1AIXgtLi1ELi2EEE", 0), "f(A<...>)");
+    ASSERT_EQ(ooopsi::demangleCompact("_Z1f1AIXltLi1ELi2EEE", 0), "f(A<...>)");
+    ASSERT_EQ(ooopsi::demangleCompact("_Z1f1AIXgtLi1ELi2EEE"), "f(A<((1)>(2))>)");
+    // template argument lists within function types
+    ASSERT_EQ(ooopsi::demangleCompact("_Z1gSt8functionIFvSt6vectorIiSaIiEEEE"),
+              "g(std::function<void (std::vector<...>)>)");
+
+    // plain C names
+    ASSERT_EQ(ooopsi::demangleCompact("strlen"), "strlen");
+}
+#endif
+
+TEST(Demangle, Batch)
+{
+    const char* symbols[] = { "foo", nullptr, "strlen" };
+    std::string output = "to be replaced";
+    size_t offsets[3];
+    ooopsi::demangle(symbols, 3, output, offsets);
+    ASSERT_STREQ(output.c_str() + offsets[0], "foo");
+    ASSERT_STREQ(output.c_str() + offsets[1], "");
+    ASSERT_STREQ(output.c_str() + offsets[2], "strlen");
+    ASSERT_EQ(output.size(), 12u);
+
+#ifndef _MSC_VER
+    // growing and shrinking names (the demangler's buffer is reused)
+    const char* cppSymbols[] = {
+        "_ZNKSt16initializer_listIiE3endEv",
+        "_ZNSt3mapIiSt6vectorIiSaIiEESt4lessIiESaISt4pairIKiS2_EEE2atERS6_",
+        "main",
+        "_ZN6ooopsi15printStackTraceENS_11LogSettingsEPKPKv",
+    };
+    size_t cppOffsets[4];
+    ooopsi::demangle(cppSymbols, 4, output, cppOffsets);
+    for (size_t i = 0; i < 4; ++i)
+    {
+        ASSERT_EQ(output.c_str() + cppOffsets[i], ooopsi::demangle(cppSymbols[i]));
+    }
+#endif
+}
@@ -5,7 +5,9 @@
  */
 
 #include "internal.hpp"
+#include "interval_index.hpp"
 #include "ooopsi.hpp"
+#include "temp_file.hpp"
 
 #ifdef OOOPSI_MSVC
 // gmock triggers a warning because an ignored warning doesn't exist ... :(
@@ -15,10 +17,27 @@
 #include <gmock/gmock-matchers.h>
 #include <gtest/gtest.h>
 
+#include <algorithm>
 #include <csignal>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
 #include <thread>
 #include <vector>
 
+#ifdef OOOPSI_LINUX
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+#endif
+#ifdef OOOPSI_HAVE_ZLIB
+#include <zlib.h>
+
+#include <cstring>
+#include <set>
+#endif
+
 #ifdef OOOPSI_MINGW
 
 // minimalistic std::thread replacement
@@ -212,3 +231,973 @@ TEST(StackTrace, CollectMultiThreaded)
         });
     }
 }
+
+// compact traces
+TEST(StackTrace, Capture)
+{
+    ooopsi::StackTrace trace;
+    ASSERT_TRUE(trace.empty());
+    const size_t numFrames = trace.capture();
+    ASSERT_GE(numFrames, 2u);
+    ASSERT_EQ(trace.size(), numFrames);
+
+    size_t count = 0;
+    for (auto frame : trace)
+    {
+        ASSERT_NE(frame.address(), nullptr);
+        ++count;
+    }
+    ASSERT_EQ(count, numFrames);
+#ifdef OOOPSI_LINUX
+    // the names are looked up lazily
+    ASSERT_THAT(trace[0].demangledFunction(), ::testing::HasSubstr("StackTrace_Capture_Test"));
+    ASSERT_STREQ(trace[numFrames - 1].function(), "_start");
+#endif
+
+    // move-only
+    ooopsi::StackTrace moved(std::move(trace));
+    ASSERT_EQ(moved.size(), numFrames);
+    ASSERT_TRUE(trace.empty());
+    trace = std::move(moved);
+    ASSERT_EQ(trace.size(), numFrames);
+
+    // no allocation with a user-provided buffer, which limits the depth
+    alignas(void*) char buffer[ooopsi::StackTrace::bufferSizeFor(2)];
+    ooopsi::StackTrace small(buffer, sizeof(buffer));
+    ASSERT_EQ(small.capture(), 2u);
+    // same caller
+    ASSERT_EQ(small[1].address(), trace[1].address());
+}
+
+#ifdef OOOPSI_LINUX
+
+/// Checks if this test binary contains debug information (section names are stored as strings).
+static bool hasDebugInfo()
+{
+    std::ifstream exe("/proc/self/exe", std::ios::binary);
+    const std::string content((std::istreambuf_iterator<char>(exe)),
+                              std::istreambuf_iterator<char>());
+    return content.find(std::string(".debug_info\0", 12)) != std::string::npos;
+}
+
+/// always inlined into the caller, so it only shows up as inlined frame
+static inline __attribute__((always_inline)) size_t collectInlined(ooopsi::StackFrame* frames,
+                                                                   size_t maxFrames)
+{
+    return ooopsi::collectStackTrace(frames, maxFrames);
+}
+
+// inlined frames are added if debug information is available
+TEST(StackTrace, CollectInlined)
+{
+    if (!hasDebugInfo())
+    {
+        std::cout << "[  SKIPPED ] no debug information available\n";
+        return;
+    }
+
+    constexpr size_t maxFrames = 128;
+    ooopsi::StackFrame frames[maxFrames];
+    size_t numFrames = collectInlined(frames, maxFrames);
+    ASSERT_GE(numFrames, 2u);
+
+    // the first frame is the library's function
+    size_t i = 0;
+    while (i < numFrames && !frames[i].inlined)
+    {
+        ++i;
+    }
+    ASSERT_LT(i + 1, numFrames);
+    auto& inlined = frames[i];
+    ASSERT_THAT(inlined.function, ::testing::HasSubstr("collectInlined"));
+    ASSERT_EQ(inlined.offset, 0u);
+    // followed by the actual function, at the same address
+    auto& caller = frames[i + 1];
+    ASSERT_FALSE(caller.inlined);
+    ASSERT_EQ(caller.address, inlined.address);
+}
+
+/// frames collected by onCollectSignal()
+static ooopsi::StackFrame s_signalFrames[16];
+static size_t s_numSignalFrames = 0;
+
+static void onCollectSignal(int)
+{
+    ooopsi::TraceSettings settings;
+    settings.skipInternalFrames = true;
+    s_numSignalFrames = ooopsi::collectStackTrace(s_signalFrames, 16, settings);
+}
+
+// skip frames, limit the depth and stop early
+TEST(StackTrace, CollectFiltered)
+{
+    constexpr size_t maxFrames = 128;
+    ooopsi::StackFrame all[maxFrames];
+    ooopsi::TraceSettings settings;
+    settings.skipInternalFrames = true;
+    const size_t numAll = ooopsi::collectStackTrace(all, maxFrames, settings);
+    ASSERT_GE(numAll, 3u);
+    // the library's own frames are gone
+    ASSERT_THAT(all[0].function, ::testing::Not(::testing::HasSubstr("ooopsi::")));
+
+    // skip the first (physical) frame
+    size_t next = 1;
+    while (next < numAll && all[next].address == all[0].address)
+    {
+        ++next;
+    }
+    ooopsi::StackFrame frames[maxFrames];
+    settings.skipFrames = 1;
+    size_t numFrames = ooopsi::collectStackTrace(frames, maxFrames, settings);
+    ASSERT_GE(numFrames, 1u);
+    ASSERT_EQ(frames[0].function, all[next].function);
+
+    // limit the depth
+    settings.skipFrames = 0;
+    settings.maxFrames = 2;
+    ASSERT_EQ(ooopsi::collectStackTrace(frames, maxFrames, settings), 2u);
+
+    // stop at main()
+    settings.maxFrames = maxFrames;
+    settings.stopAt = [](const char* symbol) { return strcmp(symbol, "main") == 0; };
+    numFrames = ooopsi::collectStackTrace(frames, maxFrames, settings);
+    ASSERT_GE(numFrames, 1u);
+    ASSERT_LT(numFrames, numAll);
+    ASSERT_EQ(frames[numFrames - 1].function, "main");
+
+    // in a signal handler, everything up to the signal frame is skipped
+    signal(SIGUSR1, onCollectSignal);
+    raise(SIGUSR1);
+    signal(SIGUSR1, SIG_DFL);
+    ASSERT_GE(s_numSignalFrames, 1u);
+    for (size_t i = 0; i < s_numSignalFrames; ++i)
+    {
+        ASSERT_THAT(s_signalFrames[i].function,
+                    ::testing::Not(::testing::HasSubstr("onCollectSignal")));
+    }
+}
+
+/// the lines of the last stack trace written via collectStackTraceLine()
+static std::vector<std::string> s_stackTraceLines;
+
+static void collectStackTraceLine(const char* line)
+{
+    if (line)
+    {
+        s_stackTraceLines.emplace_back(line);
+    }
+}
+
+/// "enqueues" a task, returning its causal parent
+static __attribute__((noinline)) ooopsi::AsyncParentId enqueueTask()
+{
+    // (no tail call, this function must show up in the trace)
+    volatile ooopsi::AsyncParentId id = ooopsi::captureAsyncParent();
+    return id;
+}
+
+// the stack trace of a task continues with the trace of the code that enqueued it
+TEST(StackTrace, AsyncParent)
+{
+    // (a single call site, the loop must not be unrolled)
+    ooopsi::AsyncParentId ids[2];
+    for (volatile size_t i = 0; i < 2; ++i)
+    {
+        ids[i] = enqueueTask();
+    }
+    const ooopsi::AsyncParentId parent = ids[0];
+    ASSERT_NE(parent, 0u);
+    // same trace, same ID
+    ASSERT_EQ(parent, ids[1]);
+
+    std::thread worker([parent] {
+        ASSERT_EQ(ooopsi::currentAsyncParent(), 0u);
+        {
+            ooopsi::AsyncParentScope scope(parent);
+            ASSERT_EQ(ooopsi::currentAsyncParent(), parent);
+
+            ooopsi::LogSettings settings;
+            settings.logFunc = collectStackTraceLine;
+            ooopsi::printStackTrace(settings);
+        }
+        ASSERT_EQ(ooopsi::currentAsyncParent(), 0u);
+    });
+    worker.join();
+
+    auto isSeparator = [](const std::string& line) {
+        return line.find("ASYNC PARENT") != std::string::npos;
+    };
+    auto isEnqueueTask = [](const std::string& line) {
+        return line.find("enqueueTask") != std::string::npos;
+    };
+    auto separator = std::find_if(s_stackTraceLines.begin(), s_stackTraceLines.end(), isSeparator);
+    ASSERT_NE(separator, s_stackTraceLines.end());
+    ASSERT_NE(std::find_if(separator, s_stackTraceLines.end(), isEnqueueTask),
+              s_stackTraceLines.end());
+
+    // as in signal handlers: modules and offsets only
+    s_stackTraceLines.clear();
+    {
+        ooopsi::AsyncParentScope scope(parent);
+        ooopsi::LogSettings settings;
+        settings.logFunc = collectStackTraceLine;
+        settings.resolveAsyncParents = false;
+        ooopsi::printStackTrace(settings);
+    }
+    separator = std::find_if(s_stackTraceLines.begin(), s_stackTraceLines.end(), isSeparator);
+    ASSERT_NE(separator, s_stackTraceLines.end());
+    ASSERT_EQ(std::find_if(separator, s_stackTraceLines.end(), isEnqueueTask),
+              s_stackTraceLines.end());
+    ASSERT_THAT(separator[1], testing::HasSubstr("tests+0x"));
+
+    // sampling: only every 2nd call is recorded, the others return the current parent
+    ooopsi::setAsyncSampling(0);
+    ASSERT_EQ(enqueueTask(), 0u);
+    ooopsi::setAsyncSampling(2);
+    ooopsi::AsyncParentScope scope(parent);
+    ASSERT_EQ(enqueueTask(), parent);
+    ASSERT_NE(enqueueTask(), parent);
+    ooopsi::setAsyncSampling(1);
+}
+
+// many addresses at once, in the input order
+TEST(StackTrace, SymbolizeAddresses)
+{
+    const auto task = reinterpret_cast<uintptr_t>(&enqueueTask) + 1;
+    const auto lib = reinterpret_cast<uintptr_t>(&ooopsi::captureAsyncParent) + 2;
+    const std::vector<ooopsi::pointer_t> addresses = {
+        reinterpret_cast<ooopsi::pointer_t>(lib),  reinterpret_cast<ooopsi::pointer_t>(task),
+        reinterpret_cast<ooopsi::pointer_t>(16),   reinterpret_cast<ooopsi::pointer_t>(lib),
+        reinterpret_cast<ooopsi::pointer_t>(task),
+    };
+    std::vector<ooopsi::SymbolInfo> results(addresses.size());
+    for (unsigned threads : { 1u, 4u })
+    {
+        ooopsi::symbolizeAddresses(addresses.data(), addresses.size(), results.data(), threads);
+
+        ASSERT_NE(results[0].function, nullptr);
+        ASSERT_THAT(results[0].function, testing::HasSubstr("captureAsyncParent"));
+        ASSERT_EQ(results[0].offset, 2u);
+        ASSERT_NE(results[1].function, nullptr);
+        ASSERT_THAT(results[1].function, testing::HasSubstr("enqueueTask"));
+        ASSERT_EQ(results[1].offset, 1u);
+        // not in any module
+        ASSERT_EQ(results[2].function, nullptr);
+        // duplicates
+        ASSERT_STREQ(results[3].function, results[0].function);
+        ASSERT_STREQ(results[4].function, results[1].function);
+    }
+
+    // many more addresses than unique ones, in several chunks
+    const std::vector<ooopsi::SymbolInfo> expected = results;
+    std::vector<ooopsi::pointer_t> many;
+    for (size_t i = 0; i < 10000; ++i)
+    {
+        many.push_back(addresses[i % addresses.size()]);
+    }
+    results.resize(many.size());
+    for (unsigned threads : { 1u, 4u })
+    {
+        ooopsi::symbolizeAddresses(many.data(), many.size(), results.data(), threads);
+        for (size_t i = 0; i < many.size(); ++i)
+        {
+            ASSERT_EQ(results[i].function, expected[i % expected.size()].function) << "at " << i;
+            ASSERT_EQ(results[i].offset, expected[i % expected.size()].offset) << "at " << i;
+        }
+    }
+}
+
+/// an event worth counting
+static __attribute__((noinline)) void missCache()
+{
+    OOOPSI_TRACEPOINT("test-cache-miss");
+    // (no tail call)
+    volatile int dummy = 0;
+    static_cast<void>(dummy);
+}
+
+// counted hits and sampled stack traces
+TEST(StackTrace, TracePoint)
+{
+    ooopsi::setTracePointSampling(4);
+    for (volatile size_t i = 0; i < 10; ++i)
+    {
+        missCache();
+    }
+    ooopsi::setTracePointSampling(1000);
+
+    s_stackTraceLines.clear();
+    ooopsi::LogSettings settings;
+    settings.logFunc = collectStackTraceLine;
+    ooopsi::printTracePoints(settings);
+
+    // the 1st, 5th and 9th hit were sampled, all with the same trace
+    const auto point = std::find(s_stackTraceLines.begin(), s_stackTraceLines.end(),
+                                 "test-cache-miss: 10 hits, 3 sampled");
+    ASSERT_NE(point, s_stackTraceLines.end());
+    ASSERT_NE(point + 1, s_stackTraceLines.end());
+    ASSERT_EQ(point[1], "  3 samples:");
+    ASSERT_NE(point + 3, s_stackTraceLines.end());
+    ASSERT_EQ(point[2], "---------- BACKTRACE ----------");
+    ASSERT_THAT(point[3], testing::HasSubstr("missCache"));
+}
+
+// paging in the unwind tables etc.
+TEST(StackTrace, PrefaultCrashPath)
+{
+    const ooopsi::PrefaultStats stats = ooopsi::prefaultCrashPath();
+    // at least the unwind tables of this executable and the library, and the alternate stack
+    ASSERT_GE(stats.touchedBytes, 3u * 4096u);
+    ASSERT_EQ(stats.lockedBytes, 0u);
+
+    // only once
+    const ooopsi::PrefaultStats again = ooopsi::prefaultCrashPath(true);
+    ASSERT_EQ(again.touchedBytes, stats.touchedBytes);
+    ASSERT_EQ(again.lockedBytes, 0u);
+}
+
+/// a suspicious, but not fatal problem
+static __attribute__((noinline)) bool reportProblem(const char* message)
+{
+    // (no tail call, this function must show up in the trace)
+    volatile bool reported = ooopsi::reportOnce(message, ooopsi::LogSettings());
+    return reported;
+}
+
+// only the first report per trace is logged, and not too often
+TEST(StackTrace, ReportOnce)
+{
+    ooopsi::setAbortLogFunc(collectStackTraceLine);
+    s_stackTraceLines.clear();
+
+    ooopsi::setReportRateLimit(1000 * 1000, 1000);
+    size_t numReported = 0;
+    for (volatile size_t i = 0; i < 100; ++i)
+    {
+        numReported += reportProblem("test-problem") ? 1u : 0u;
+    }
+    ASSERT_EQ(numReported, 1u);
+    ASSERT_EQ(std::count(s_stackTraceLines.begin(), s_stackTraceLines.end(), "test-problem"), 1);
+    ASSERT_NE(std::find_if(s_stackTraceLines.begin(), s_stackTraceLines.end(),
+                           [](const std::string& line) {
+                               return line.find("reportProblem") != std::string::npos;
+                           }),
+              s_stackTraceLines.end());
+
+    // another trace
+    ASSERT_TRUE(ooopsi::reportOnce("test-other-problem"));
+
+    // the rate limit is checked for new call paths only
+    ooopsi::setReportRateLimit(1, 1);
+    ASSERT_TRUE(ooopsi::reportOnce("test-rate-limited"));
+    for (volatile size_t i = 0; i < 10; ++i)
+    {
+        ASSERT_FALSE(reportProblem("test-problem"));
+    }
+    ASSERT_FALSE(ooopsi::reportOnce("test-rate-limited"));
+    ooopsi::setReportRateLimit(0, 1);
+    ASSERT_FALSE(ooopsi::reportOnce("test-rate-limited"));
+    ooopsi::setReportRateLimit(10, 10);
+
+    s_stackTraceLines.clear();
+    ooopsi::printReportSummary();
+    ooopsi::setAbortLogFunc(nullptr);
+    ASSERT_THAT(s_stackTraceLines,
+                testing::Contains(testing::MatchesRegex(
+                  "  test-problem \\(trace [0-9]+\\): 109 more suppressed")));
+    ASSERT_THAT(s_stackTraceLines,
+                testing::Contains(testing::StartsWith("  2 suppressed by the rate limit")));
+}
+
+/// captures its callers (via frame pointers or by unwinding)
+template <bool Unwind>
+static __attribute__((noinline)) size_t whoCalledMe(ooopsi::pointer_t (&callers)[3])
+{
+    volatile size_t count = Unwind ? ooopsi::collectCallers(callers, 3)
+                                   : ooopsi::captureCallers(callers);
+    return count;
+}
+
+/// the caller to look for
+template <bool Unwind>
+static __attribute__((noinline)) size_t callWhoCalledMe(ooopsi::pointer_t (&callers)[3])
+{
+    // (no tail call, this function must show up)
+    volatile size_t count = whoCalledMe<Unwind>(callers);
+    return count;
+}
+
+// the shallow trace of the callers
+TEST(StackTrace, CaptureCallers)
+{
+    ooopsi::pointer_t callers[3];
+    const size_t count = callWhoCalledMe<false>(callers);
+    ASSERT_GE(count, 1u);
+    ASSERT_LE(count, 3u);
+    const char* name = ooopsi::callerName(callers[0]);
+    ASSERT_NE(name, nullptr);
+    ASSERT_THAT(name, testing::HasSubstr("callWhoCalledMe<false>"));
+    // cached
+    ASSERT_EQ(ooopsi::callerName(callers[0]), name);
+
+    // the same by unwinding
+    ooopsi::pointer_t unwound[3];
+    ASSERT_EQ(callWhoCalledMe<true>(unwound), 3u);
+    ASSERT_THAT(ooopsi::callerName(unwound[0]), testing::HasSubstr("callWhoCalledMe<true>"));
+    ASSERT_THAT(ooopsi::callerName(unwound[1]), testing::HasSubstr("CaptureCallers"));
+}
+
+#if defined(OOOPSI_LINUX) && defined(__x86_64__)
+/// the contexts of CaptureCallersOnFiber
+static ucontext_t s_mainContext;
+static ucontext_t s_fiberContext;
+static size_t s_fiberCallers = 0;
+
+/// runs on a stack on the heap
+static void fiberMain()
+{
+    ooopsi::pointer_t callers[3];
+    s_fiberCallers = callWhoCalledMe<false>(callers);
+    swapcontext(&s_fiberContext, &s_mainContext);
+}
+
+// the frames on a fiber's stack aren't followed
+TEST(StackTrace, CaptureCallersOnFiber)
+{
+    auto runFiber = []() {
+        // below the thread's stack (like the heap), as is an unmapped page
+        std::vector<char> stack(64 * 1024);
+        const long pageSize = sysconf(_SC_PAGESIZE);
+        void* unmapped = mmap(nullptr, static_cast<size_t>(pageSize), PROT_NONE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        munmap(unmapped, static_cast<size_t>(pageSize));
+
+        getcontext(&s_fiberContext);
+        s_fiberContext.uc_stack.ss_sp = stack.data();
+        s_fiberContext.uc_stack.ss_size = stack.size();
+        s_fiberContext.uc_link = &s_mainContext;
+        makecontext(&s_fiberContext, fiberMain, 0);
+        // the outermost frame of the fiber points to the unmapped page
+        s_fiberContext.uc_mcontext.gregs[REG_RBP] = reinterpret_cast<greg_t>(unmapped);
+        swapcontext(&s_mainContext, &s_fiberContext);
+        exit(s_fiberCallers >= 1 ? 0 : 1);
+    };
+    EXPECT_EXIT(runFiber(), testing::ExitedWithCode(0), "");
+}
+#endif // OOOPSI_LINUX && __x86_64__
+
+/// a custom lock that had to wait
+static __attribute__((noinline)) void waitForSpinLock(uint64_t waitNanos)
+{
+    ooopsi::recordLockWait(ooopsi::LockWaitKind::WriteLock, waitNanos);
+    // (no tail call)
+    volatile int dummy = 0;
+    static_cast<void>(dummy);
+}
+
+// the contention profile
+TEST(StackTrace, LockContention)
+{
+    // long waits are always sampled, with their actual duration (same call site: same trace)
+    for (volatile uint64_t waitMillis = 3; waitMillis > 1; --waitMillis)
+    {
+        waitForSpinLock(waitMillis * 1000 * 1000);
+    }
+    // short ones aren't when sampling is disabled, but they're still counted
+    ooopsi::setLockWaitSampling(UINT64_MAX);
+    waitForSpinLock(1000);
+    ooopsi::setLockWaitSampling(10 * 1000);
+
+    s_stackTraceLines.clear();
+    ooopsi::LogSettings settings;
+    settings.logFunc = collectStackTraceLine;
+    ooopsi::printLockContention(settings);
+
+    ASSERT_THAT(s_stackTraceLines, testing::Contains("write lock: 3 waits, 5001 us blocked"));
+    const auto stack = std::find(s_stackTraceLines.begin(), s_stackTraceLines.end(),
+                                 "  write lock: 5000 us blocked, 2 samples:");
+    ASSERT_NE(stack, s_stackTraceLines.end());
+    ASSERT_NE(stack + 2, s_stackTraceLines.end());
+    ASSERT_EQ(stack[1], "---------- BACKTRACE ----------");
+    ASSERT_THAT(stack[2], testing::HasSubstr("waitForSpinLock"));
+}
+
+#ifdef OOOPSI_HAVE_ZLIB
+/// Decompresses gzip data (empty on errors).
+static std::string gunzip(const std::string& compressed)
+{
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    // (+16: gzip header)
+    if (inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK)
+    {
+        return std::string();
+    }
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(compressed.data()));
+    stream.avail_in = static_cast<uInt>(compressed.size());
+    std::string result;
+    char buffer[16 * 1024];
+    int rc = Z_OK;
+    while (rc == Z_OK)
+    {
+        stream.next_out = reinterpret_cast<Bytef*>(buffer);
+        stream.avail_out = sizeof(buffer);
+        rc = inflate(&stream, Z_NO_FLUSH);
+        result.append(buffer, sizeof(buffer) - stream.avail_out);
+    }
+    inflateEnd(&stream);
+    return rc == Z_STREAM_END ? result : std::string();
+}
+
+/// A field of a protobuf message (see decodeMessage()).
+struct ProtoField
+{
+    /// the field number
+    uint64_t number;
+    /// the value of a varint
+    uint64_t value;
+    /// the data of a length-delimited field
+    std::string bytes;
+};
+
+/// Reads a varint, returns false if the data ends before.
+static bool readVarint(const std::string& data, size_t& pos, uint64_t& value)
+{
+    value = 0;
+    for (unsigned shift = 0; pos < data.size() && shift < 64; shift += 7)
+    {
+        const auto byte = static_cast<uint8_t>(data[pos++]);
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/// Decodes the fields of a protobuf message (only varints and length-delimited fields, which is
+/// all a profile uses). Stops at the first malformed field.
+static std::vector<ProtoField> decodeMessage(const std::string& data)
+{
+    std::vector<ProtoField> fields;
+    size_t pos = 0;
+    uint64_t key = 0;
+    while (readVarint(data, pos, key))
+    {
+        ProtoField field{ key >> 3, 0, std::string() };
+        uint64_t length = 0;
+        if ((key & 7) == 0)
+        {
+            if (!readVarint(data, pos, field.value))
+            {
+                break;
+            }
+        }
+        else if ((key & 7) == 2 && readVarint(data, pos, length) && length <= data.size() - pos)
+        {
+            field.bytes = data.substr(pos, static_cast<size_t>(length));
+            pos += static_cast<size_t>(length);
+        }
+        else
+        {
+            break;
+        }
+        fields.push_back(field);
+    }
+    return fields;
+}
+
+/// Returns the varints of a packed repeated field.
+static std::vector<uint64_t> unpackVarints(const std::string& data)
+{
+    std::vector<uint64_t> values;
+    size_t pos = 0;
+    uint64_t value = 0;
+    while (readVarint(data, pos, value))
+    {
+        values.push_back(value);
+    }
+    return values;
+}
+#endif // OOOPSI_HAVE_ZLIB
+
+// stack traces as pprof profile
+TEST(StackTrace, WriteProfile)
+{
+    const TempFile profile("profile");
+
+    ooopsi::StackFrame frames[32];
+    const size_t numFrames = ooopsi::collectStackTrace(frames, 32);
+    std::vector<ooopsi::pointer_t> addresses;
+    for (size_t i = 0; i < numFrames; ++i)
+    {
+        if (!frames[i].inlined)
+        {
+            addresses.push_back(frames[i].address);
+        }
+    }
+    ooopsi::ProfileSample samples[2];
+    samples[0].frames = addresses.data();
+    samples[0].numFrames = addresses.size();
+    samples[0].value = 3;
+    // the caller only
+    samples[1].frames = addresses.data() + 1;
+    samples[1].numFrames = addresses.size() - 1;
+    samples[1].value = 1;
+    ASSERT_TRUE(ooopsi::writeProfile(profile.path(), samples, 2));
+
+    const std::string content = profile.read();
+    ASSERT_TRUE(ooopsi::writeLockContentionProfile(profile.path()));
+    ASSERT_TRUE(ooopsi::writeTracePointProfile(profile.path()));
+    // a gzip file (deflate), containing more than an empty profile
+    ASSERT_GT(content.size(), 100u);
+    ASSERT_EQ(content.compare(0, 3, "\x1f\x8b\x08"), 0);
+
+#ifdef OOOPSI_HAVE_ZLIB
+    // Profile: 2 = sample, 4 = location, 5 = function, 6 = string table
+    std::vector<size_t> sampleSizes;
+    std::set<uint64_t> locations;
+    std::vector<uint64_t> functionNames;
+    std::vector<std::string> strings;
+    for (const ProtoField& field : decodeMessage(gunzip(content)))
+    {
+        if (field.number == 2)
+        {
+            // Sample: 1 = location IDs (packed)
+            for (const ProtoField& sampleField : decodeMessage(field.bytes))
+            {
+                if (sampleField.number == 1)
+                {
+                    sampleSizes.push_back(unpackVarints(sampleField.bytes).size());
+                }
+            }
+        }
+        else if (field.number == 4)
+        {
+            // Location: 3 = address
+            for (const ProtoField& locationField : decodeMessage(field.bytes))
+            {
+                if (locationField.number == 3)
+                {
+                    locations.insert(locationField.value);
+                }
+            }
+        }
+        else if (field.number == 5)
+        {
+            // Function: 3 = system name (the symbol)
+            for (const ProtoField& functionField : decodeMessage(field.bytes))
+            {
+                if (functionField.number == 3)
+                {
+                    functionNames.push_back(functionField.value);
+                }
+            }
+        }
+        else if (field.number == 6)
+        {
+            strings.push_back(field.bytes);
+        }
+    }
+    ASSERT_FALSE(strings.empty());
+    ASSERT_EQ(strings[0], "");
+    ASSERT_EQ(sampleSizes, (std::vector<size_t>{ addresses.size(), addresses.size() - 1 }));
+
+    // a location per address (at the call instruction), with the function containing it
+    std::vector<ooopsi::pointer_t> calls;
+    std::set<uint64_t> expectedLocations;
+    for (ooopsi::pointer_t address : addresses)
+    {
+        calls.push_back(static_cast<const char*>(address) - 1);
+        expectedLocations.insert(reinterpret_cast<uintptr_t>(calls.back()));
+    }
+    ASSERT_EQ(locations, expectedLocations);
+    std::vector<ooopsi::SymbolInfo> symbols(calls.size());
+    ooopsi::symbolizeAddresses(calls.data(), calls.size(), symbols.data());
+    std::set<std::string> expectedNames;
+    for (const ooopsi::SymbolInfo& symbol : symbols)
+    {
+        if (symbol.function != nullptr)
+        {
+            expectedNames.insert(symbol.function);
+        }
+    }
+    std::set<std::string> names;
+    for (uint64_t index : functionNames)
+    {
+        ASSERT_LT(index, strings.size());
+        names.insert(strings[static_cast<size_t>(index)]);
+    }
+    ASSERT_EQ(names, expectedNames);
+    ASSERT_THAT(names, testing::Contains(testing::HasSubstr("WriteProfile")));
+#endif
+
+    ASSERT_FALSE(ooopsi::writeProfile("/nonexistent/profile.pb.gz", samples, 2));
+}
+
+static __attribute__((noinline)) bool writeFoldedStacksHere(const char* path)
+{
+    ooopsi::StackFrame frames[32];
+    const size_t numFrames = ooopsi::collectStackTrace(frames, 32);
+    std::vector<ooopsi::pointer_t> addresses;
+    for (size_t i = 0; i < numFrames; ++i)
+    {
+        if (!frames[i].inlined)
+        {
+            addresses.push_back(frames[i].address);
+        }
+    }
+    ooopsi::ProfileSample sample;
+    sample.frames = addresses.data();
+    sample.numFrames = addresses.size();
+    sample.value = 2;
+    // the same stack twice is merged
+    const ooopsi::ProfileSample samples[2] = { sample, sample };
+    return ooopsi::writeFoldedStacks(path, samples, 2);
+}
+
+TEST(StackTrace, WriteFoldedStacks)
+{
+    const TempFile folded("folded");
+
+    ASSERT_TRUE(writeFoldedStacksHere(folded.path()));
+    std::istringstream file(folded.read());
+    std::vector<std::string> lines;
+    std::string line;
+    while (std::getline(file, line))
+    {
+        lines.push_back(line);
+    }
+
+    // one line: the callers first, the function that collected the stack last
+    ASSERT_EQ(lines.size(), 1u);
+    const size_t caller = lines[0].find(";StackTrace_WriteFoldedStacks_Test::TestBody();");
+    const size_t callee = lines[0].find(";writeFoldedStacksHere(char const*);");
+    ASSERT_NE(caller, std::string::npos) << lines[0];
+    ASSERT_NE(callee, std::string::npos) << lines[0];
+    EXPECT_LT(caller, callee);
+    EXPECT_EQ(lines[0].substr(lines[0].size() - 2), " 4");
+
+    ASSERT_FALSE(ooopsi::writeFoldedStacks("/nonexistent/folded.txt", nullptr, 0));
+}
+
+
+/// looks up the last third of the fake JIT code
+static const char* lookupJitCode(ooopsi::pointer_t address, size_t* offset)
+{
+    *offset = 7;
+    return reinterpret_cast<uintptr_t>(address) % 3 == 0 ? "jit::lookedUp" : nullptr;
+}
+
+TEST(StackTrace, SymbolProviders)
+{
+    // heap memory, outside of all modules
+    std::vector<char> code(3000);
+    const char* jit = code.data();
+    auto lookup = [](const char* address) {
+        ooopsi::SymbolInfo info;
+        const ooopsi::pointer_t addr = address;
+        ooopsi::symbolizeAddresses(&addr, 1, &info, 1);
+        return info;
+    };
+
+    ASSERT_TRUE(ooopsi::registerSymbol(jit, 1000, "jit::outer"));
+    ASSERT_TRUE(ooopsi::registerSymbol(jit + 100, 100, "_Z5innerv"));
+    ASSERT_STREQ(lookup(jit + 50).function, "jit::outer");
+    ASSERT_EQ(lookup(jit + 50).offset, 50u);
+    // nested: the inner one wins
+    ASSERT_STREQ(lookup(jit + 150).function, "_Z5innerv");
+    ASSERT_EQ(lookup(jit + 150).offset, 50u);
+    ASSERT_STREQ(lookup(jit + 200).function, "jit::outer");
+    ASSERT_STREQ(ooopsi::callerName(jit + 121), "inner()");
+    // re-registered (e.g. recompiled): the later one wins
+    ASSERT_TRUE(ooopsi::registerSymbol(jit + 100, 100, "jit::recompiled"));
+    ASSERT_STREQ(lookup(jit + 150).function, "jit::recompiled");
+
+    // the perf map (hex numbers)
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/perf-%d.map", static_cast<int>(getpid()));
+    {
+        std::ofstream perfMap(path);
+        perfMap << std::hex << reinterpret_cast<uintptr_t>(jit + 1000) << " 64 jit::fromPerfMap\n"
+                << "garbage\n";
+    }
+    ASSERT_STREQ(lookup(jit + 1050).function, "jit::fromPerfMap");
+    // appended lines are picked up as well
+    {
+        std::ofstream perfMap(path, std::ios::app);
+        perfMap << std::hex << reinterpret_cast<uintptr_t>(jit + 1100) << " 64 jit::appended\n";
+    }
+    ASSERT_STREQ(lookup(jit + 1150).function, "jit::appended");
+    ASSERT_STREQ(lookup(jit + 1050).function, "jit::fromPerfMap");
+    unlink(path);
+
+    // the application's lookup function
+    const char* lookedUp = jit + 2000 + (3 - reinterpret_cast<uintptr_t>(jit + 2000) % 3) % 3;
+    ASSERT_EQ(lookup(lookedUp + 1).function, nullptr);
+    ooopsi::setSymbolLookupFunc(lookupJitCode);
+    ASSERT_STREQ(lookup(lookedUp).function, "jit::lookedUp");
+    ASSERT_EQ(lookup(lookedUp).offset, 7u);
+    ASSERT_EQ(lookup(lookedUp + 1).function, nullptr);
+    ooopsi::setSymbolLookupFunc(nullptr);
+
+
+    // the code is freed
+    ASSERT_EQ(ooopsi::unregisterSymbols(jit, code.size()), 5u);
+    ASSERT_EQ(lookup(jit + 50).function, nullptr);
+    ASSERT_EQ(lookup(jit + 1050).function, nullptr);
+}
+
+// a long interval in front of many small ones, some of them nested, added in several batches
+TEST(StackTrace, IntervalIndex)
+{
+    using Index = ooopsi::IntervalIndex<size_t>;
+    Index index;
+    // all intervals ever added (the value is the position), and whether they are still there
+    std::vector<Index::Entry> all;
+    std::vector<bool> removed;
+    auto add = [&](uint64_t low, uint64_t high) {
+        index.add(low, high, all.size());
+        all.push_back({ low, high, all.size() });
+        removed.push_back(false);
+    };
+    auto check = [&]() {
+        for (uint64_t addr = 0; addr < 10100; addr += 7)
+        {
+            std::vector<size_t> wanted;
+            const Index::Entry* wantedLast = nullptr;
+            for (const auto& entry : all)
+            {
+                if (!removed[entry.value] && entry.low <= addr && addr < entry.high)
+                {
+                    wanted.push_back(entry.value);
+                    if (wantedLast == nullptr || entry.low >= wantedLast->low)
+                    {
+                        wantedLast = &entry;
+                    }
+                }
+            }
+
+            std::vector<size_t> found;
+            uint64_t previousLow = UINT64_MAX;
+            index.forEachContaining(addr, [&](const Index::Entry& entry) {
+                // inner intervals first
+                EXPECT_LE(entry.low, previousLow);
+                previousLow = entry.low;
+                found.push_back(entry.value);
+            });
+            std::sort(found.begin(), found.end());
+            ASSERT_EQ(found, wanted) << addr;
+
+            const Index::Entry* last = index.findLast(addr);
+            if (wantedLast == nullptr)
+            {
+                ASSERT_EQ(last, nullptr) << addr;
+            }
+            else
+            {
+                ASSERT_NE(last, nullptr) << addr;
+                ASSERT_EQ(last->value, wantedLast->value) << addr;
+            }
+        }
+    };
+
+    add(10, 10000);
+    for (uint64_t low = 20; low < 9000; low += 30)
+    {
+        add(low, low + 20);
+    }
+    add(5000, 5100);
+    index.build();
+    check();
+
+    // more of them, some starting where earlier ones start
+    for (uint64_t low = 5; low < 10000; low += 110)
+    {
+        add(low, low + 40);
+        add(low, low + 10);
+    }
+    add(9990, 10050);
+    index.build();
+    check();
+
+    const size_t numRemoved =
+      index.removeIf([](const Index::Entry& entry) { return entry.value % 3 == 0; });
+    for (size_t i = 0; i < all.size(); i += 3)
+    {
+        removed[i] = true;
+    }
+    ASSERT_EQ(numRemoved, (all.size() + 2) / 3);
+    ASSERT_EQ(index.size(), all.size() - numRemoved);
+    check();
+
+    index.clear();
+    ASSERT_TRUE(index.empty());
+    ASSERT_EQ(index.findLast(100), nullptr);
+}
+
+// the library's own counters and timings
+TEST(StackTrace, Stats)
+{
+    const ooopsi::Stats before = ooopsi::getStats();
+
+    ooopsi::StackFrame frames[16];
+    const size_t numFrames = ooopsi::collectStackTrace(frames, 16);
+    ASSERT_GT(numFrames, 0u);
+    // the frames for inlined calls aren't walked
+    const auto numWalked = static_cast<uint64_t>(std::count_if(
+      frames, frames + numFrames, [](const ooopsi::StackFrame& frame) { return !frame.inlined; }));
+    ASSERT_EQ(ooopsi::demangle("_Z5innerv"), "inner()");
+    // an address no other test looks up: a miss, then a hit
+    const auto address = reinterpret_cast<const char*>(&missCache) + 3;
+    ASSERT_STREQ(ooopsi::callerName(address), ooopsi::callerName(address));
+
+    const ooopsi::Stats after = ooopsi::getStats();
+    ASSERT_EQ(after.captures, before.captures + 1);
+    ASSERT_GE(after.framesWalked, before.framesWalked + numWalked);
+    ASSERT_EQ(after.unwindTime.count, before.unwindTime.count + 1);
+    ASSERT_GE(after.symbolLookups, before.symbolLookups + numWalked);
+    ASSERT_GE(after.demangleTime.count, before.demangleTime.count + 1);
+    ASSERT_EQ(after.callerNameMisses, before.callerNameMisses + 1);
+    ASSERT_EQ(after.callerNameHits, before.callerNameHits + 1);
+    ASSERT_GT(after.unwindTime.percentile(99), 0u);
+    ASSERT_GE(after.unwindTime.percentile(99), after.unwindTime.percentile(50));
+
+    s_stackTraceLines.clear();
+    ooopsi::LogSettings settings;
+    settings.logFunc = collectStackTraceLine;
+    ooopsi::printStats(settings);
+    ASSERT_GE(s_stackTraceLines.size(), 8u);
+    ASSERT_EQ(s_stackTraceLines.front(), "------------ STATS ------------");
+    ASSERT_THAT(s_stackTraceLines, testing::Contains(testing::StartsWith("captures:")));
+    // the printed lines are counted as well
+    ASSERT_GE(ooopsi::getStats().logLines, after.logLines + s_stackTraceLines.size());
+}
+
+/// captures the stack trace, then doesn't return
+[[noreturn]] static __attribute__((noinline)) void captureAndThrow(ooopsi::StackTrace& trace)
+{
+    trace.capture();
+    throw std::runtime_error("captured");
+}
+
+/// ends with a call that doesn't return: the return address may be past the end of the function
+static __attribute__((noinline)) void callNoReturn(ooopsi::StackTrace& trace)
+{
+    captureAndThrow(trace);
+}
+
+// return addresses are looked up at the call instruction
+TEST(StackTrace, NoReturnCall)
+{
+    ooopsi::StackTrace trace;
+    ASSERT_THROW(callNoReturn(trace), std::runtime_error);
+    ASSERT_GE(trace.size(), 2u);
+    ASSERT_THAT(trace[0].demangledFunction(), testing::HasSubstr("captureAndThrow"));
+    ASSERT_THAT(trace[1].demangledFunction(), testing::HasSubstr("callNoReturn"));
+    // the offset is still relative to the return address
+    ASSERT_GT(trace[1].offset(), 0u);
+}
+
+#endif // OOOPSI_LINUX
@@ -0,0 +1,417 @@
+/**
+ * @file    flamegraph.cpp
+ * @brief   Renders folded stacks (see ooopsi::writeFoldedStacks()) as interactive SVG flame graph.
+ *
+ * The SVG is self-contained: the frames are laid out here, a small embedded script adds zooming
+ * (click on a frame), searching and the details of the frame under the mouse. Without scripts,
+ * it's a static image.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace
+{
+/// A node of the merged stack traces.
+struct Frame
+{
+    std::string name;
+    /// sum of the samples of this frame and its callees
+    double value = 0;
+    /// the callees by name (indices of the frames), so they are sorted
+    std::map<std::string, size_t> children;
+};
+
+/// Rendering options.
+struct Options
+{
+    std::string title = "Flame Graph";
+    double width = 1200;
+    /// draw the root at the top (icicle graph)?
+    bool inverted = false;
+};
+} // namespace
+
+/// height of a frame
+static constexpr double s_FRAME_HEIGHT = 16;
+/// font size of the frames' names
+static constexpr double s_FONT_SIZE = 12;
+/// approximate width of a character (relative to the font size)
+static constexpr double s_CHAR_WIDTH = 0.59;
+/// horizontal padding
+static constexpr double s_X_PAD = 10;
+/// space for the title and the buttons
+static constexpr double s_TOP_PAD = 40;
+/// space for the details line
+static constexpr double s_BOTTOM_PAD = 30;
+/// frames narrower than this (in pixels) are left out, with their callees
+static constexpr double s_MIN_WIDTH = 0.1;
+
+/// the script for zooming and searching
+static const char* const s_SCRIPT = R"(
+var frames = [].slice.call(document.querySelectorAll('g.f'));
+var details = document.getElementById('details');
+var matched = document.getElementById('matched');
+var width = +document.documentElement.getAttribute('width');
+function num(g, a) { return +g.getAttribute(a); }
+function place(g, x, w) {
+    var rect = g.querySelector('rect'), text = g.querySelector('text');
+    g.style.display = w < 0.1 ? 'none' : '';
+    rect.setAttribute('x', x.toFixed(2));
+    rect.setAttribute('width', Math.max(w, 0).toFixed(2));
+    text.setAttribute('x', (x + 3).toFixed(2));
+    var name = g.getAttribute('data-n'), n = Math.floor((w - 6) / (12 * 0.59));
+    text.textContent = n < 3 ? '' : name.length <= n ? name : name.substr(0, n - 2) + '..';
+}
+function zoom(target) {
+    var x0 = num(target, 'data-x'), v0 = num(target, 'data-v'), d0 = num(target, 'data-d');
+    var scale = (width - 20) / v0;
+    frames.forEach(function(g) {
+        var x = num(g, 'data-x'), v = num(g, 'data-v'), d = num(g, 'data-d');
+        var inside = x >= x0 && x + v <= x0 + v0 * (1 + 1e-9);
+        var parent = d < d0 && x <= x0 && x + v >= x0 + v0 * (1 - 1e-9);
+        g.style.opacity = parent ? 0.5 : 1;
+        if (parent) { place(g, 10, width - 20); }
+        else if (inside && d >= d0) { place(g, 10 + (x - x0) * scale, v * scale); }
+        else { g.style.display = 'none'; }
+    });
+}
+function search() {
+    var pattern = prompt('Search (regular expression):', '');
+    if (pattern === null) { return; }
+    var re = new RegExp(pattern), ranges = [];
+    frames.forEach(function(g) {
+        var rect = g.querySelector('rect');
+        if (!rect.hasAttribute('data-c')) {
+            rect.setAttribute('data-c', rect.getAttribute('fill'));
+        }
+        var hit = pattern !== '' && re.test(g.getAttribute('data-n'));
+        rect.setAttribute('fill', hit ? 'rgb(230,0,230)' : rect.getAttribute('data-c'));
+        if (hit) { ranges.push([num(g, 'data-x'), num(g, 'data-x') + num(g, 'data-v')]); }
+    });
+    // the matched share, without counting nested matches twice
+    ranges.sort(function(a, b) { return a[0] - b[0]; });
+    var total = 0, end = -1, all = num(frames[0], 'data-v');
+    ranges.forEach(function(r) {
+        if (r[1] > end) { total += r[1] - Math.max(r[0], end); end = r[1]; }
+    });
+    matched.textContent = pattern === '' ? '' : 'Matched: ' + (100 * total / all).toFixed(1) + '%';
+}
+document.documentElement.addEventListener('click', function(e) {
+    var g = e.target.closest ? e.target.closest('g.f') : null;
+    if (g) { zoom(g); }
+});
+document.documentElement.addEventListener('mouseover', function(e) {
+    var g = e.target.closest ? e.target.closest('g.f') : null;
+    details.textContent = g ? g.querySelector('title').textContent : ' ';
+});
+document.getElementById('reset').addEventListener('click', function(e) {
+    e.stopPropagation(); zoom(frames[0]);
+});
+document.getElementById('search').addEventListener('click', function(e) {
+    e.stopPropagation(); search();
+});
+)";
+
+
+/// Reads folded stacks ("a;b;c 42") and merges them into the tree below frames[0].
+static void readFolded(std::istream& in, std::vector<Frame>& frames)
+{
+    std::string line;
+    while (std::getline(in, line))
+    {
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.pop_back();
+        }
+        const size_t space = line.rfind(' ');
+        if (space == std::string::npos || space == 0)
+        {
+            continue;
+        }
+        char* end = nullptr;
+        const double value = strtod(line.c_str() + space + 1, &end);
+        if (end == line.c_str() + space + 1 || *end != '\0' || !(value > 0))
+        {
+            continue;
+        }
+
+        size_t index = 0;
+        frames[0].value += value;
+        size_t start = 0;
+        while (start < space)
+        {
+            size_t separator = line.find(';', start);
+            if (separator == std::string::npos || separator > space)
+            {
+                separator = space;
+            }
+            const std::string name = line.substr(start, separator - start);
+            start = separator + 1;
+
+            const auto child = frames[index].children.find(name);
+            if (child != frames[index].children.end())
+            {
+                index = child->second;
+            }
+            else
+            {
+                frames[index].children.emplace(name, frames.size());
+                index = frames.size();
+                frames.emplace_back();
+                frames.back().name = name;
+            }
+            frames[index].value += value;
+        }
+    }
+}
+
+/// Escapes text for XML.
+static std::string escapeXml(const std::string& text)
+{
+    std::string result;
+    for (char c : text)
+    {
+        switch (c)
+        {
+        case '&':
+            result += "&amp;";
+            break;
+        case '<':
+            result += "&lt;";
+            break;
+        case '>':
+            result += "&gt;";
+            break;
+        case '"':
+            result += "&quot;";
+            break;
+        default:
+            result += c;
+            break;
+        }
+    }
+    return result;
+}
+
+/// Returns the color of a frame: a warm one, derived from the name (so it's stable).
+static std::string frameColor(const std::string& name)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (char c : name)
+    {
+        hash = (hash ^ static_cast<uint8_t>(c)) * 16777619u;
+    }
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "rgb(%u,%u,%u)", 205 + (hash & 0xff) * 50 / 255,
+             ((hash >> 8) & 0xff) * 230 / 255, ((hash >> 16) & 0xff) * 55 / 255);
+    return buffer;
+}
+
+/// Writes a frame and its callees.
+static void writeFrame(std::ostream& out, const std::vector<Frame>& frames, size_t index,
+                       double x, unsigned depth, double total, double scale, double height,
+                       const Options& options)
+{
+    const Frame& frame = frames[index];
+    const double width = frame.value * scale;
+    if (width < s_MIN_WIDTH)
+    {
+        return;
+    }
+    const double left = s_X_PAD + x * scale;
+    const double y = options.inverted ? s_TOP_PAD + depth * s_FRAME_HEIGHT
+                                      : height - s_BOTTOM_PAD - (depth + 1) * s_FRAME_HEIGHT;
+    const std::string name = escapeXml(frame.name);
+    const auto maxChars = static_cast<size_t>((width - 6) / (s_FONT_SIZE * s_CHAR_WIDTH));
+    std::string label;
+    if (maxChars >= 3)
+    {
+        label = frame.name.size() <= maxChars ? frame.name
+                                               : frame.name.substr(0, maxChars - 2) + "..";
+    }
+
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer),
+             "<g class=\"f\" data-x=\"%.15g\" data-v=\"%.15g\" data-d=\"%u\" ", x,
+             frame.value, depth);
+    out << buffer << "data-n=\"" << name << "\"><title>" << name;
+    snprintf(buffer, sizeof(buffer), " (%.15g samples, %.2f%%)", frame.value,
+             100 * frame.value / total);
+    out << buffer << "</title>";
+    snprintf(buffer, sizeof(buffer),
+             "<rect x=\"%.2f\" y=\"%.1f\" width=\"%.2f\" height=\"%.1f\" rx=\"2\" fill=\"%s\"/>",
+             left, y, width, s_FRAME_HEIGHT - 1, frameColor(frame.name).c_str());
+    out << buffer;
+    snprintf(buffer, sizeof(buffer), "<text x=\"%.2f\" y=\"%.1f\">", left + 3,
+             y + s_FRAME_HEIGHT - 4.5);
+    out << buffer << escapeXml(label) << "</text></g>\n";
+
+    for (const auto& child : frame.children)
+    {
+        writeFrame(out, frames, child.second, x, depth + 1, total, scale, height, options);
+        x += frames[child.second].value;
+    }
+}
+
+/// Returns the depth of the tree below the given frame (only counting frames that are drawn).
+static unsigned treeDepth(const std::vector<Frame>& frames, size_t index, double scale)
+{
+    unsigned depth = 0;
+    for (const auto& child : frames[index].children)
+    {
+        if (frames[child.second].value * scale >= s_MIN_WIDTH)
+        {
+            depth = std::max(depth, 1 + treeDepth(frames, child.second, scale));
+        }
+    }
+    return depth;
+}
+
+/// Writes the flame graph.
+static void writeSvg(std::ostream& out, const std::vector<Frame>& frames, const Options& options)
+{
+    const double total = frames[0].value;
+    const double scale = (options.width - 2 * s_X_PAD) / total;
+    const unsigned depth = treeDepth(frames, 0, scale);
+    const double height = s_TOP_PAD + (depth + 1) * s_FRAME_HEIGHT + s_BOTTOM_PAD;
+
+    char buffer[512];
+    snprintf(buffer, sizeof(buffer),
+             "<svg version=\"1.1\" width=\"%.0f\" height=\"%.0f\" viewBox=\"0 0 %.0f %.0f\" "
+             "xmlns=\"http://www.w3.org/2000/svg\">\n",
+             options.width, height, options.width, height);
+    out << "<?xml version=\"1.0\" standalone=\"no\"?>\n" << buffer;
+    out << "<style>text { font-family: monospace; font-size: 12px; fill: #000; } "
+           "g.f text { pointer-events: none; } g.f:hover rect { stroke: #000; stroke-width: 0.5; } "
+           ".button { cursor: pointer; fill: #333; }</style>\n";
+    snprintf(buffer, sizeof(buffer),
+             "<rect x=\"0\" y=\"0\" width=\"%.0f\" height=\"%.0f\" fill=\"#f8f8f8\"/>\n",
+             options.width, height);
+    out << buffer;
+    snprintf(buffer, sizeof(buffer),
+             "<text x=\"%.1f\" y=\"20\" text-anchor=\"middle\" style=\"font-size: 16px\">",
+             options.width / 2);
+    out << buffer << escapeXml(options.title) << "</text>\n";
+    out << "<text id=\"reset\" class=\"button\" x=\"10\" y=\"20\">Reset Zoom</text>\n";
+    snprintf(buffer, sizeof(buffer),
+             "<text id=\"search\" class=\"button\" x=\"%.1f\" y=\"20\" text-anchor=\"end\">"
+             "Search</text>\n",
+             options.width - 10);
+    out << buffer;
+    snprintf(buffer, sizeof(buffer),
+             "<text id=\"matched\" x=\"%.1f\" y=\"%.1f\" text-anchor=\"end\"></text>\n",
+             options.width - 10, height - 10);
+    out << buffer;
+    snprintf(buffer, sizeof(buffer), "<text id=\"details\" x=\"10\" y=\"%.1f\"> </text>\n",
+             height - 10);
+    out << buffer;
+
+    writeFrame(out, frames, 0, 0, 0, total, scale, height, options);
+
+    out << "<script><![CDATA[" << s_SCRIPT << "]]></script>\n";
+    out << "</svg>\n";
+}
+
+/// Prints the usage.
+static int usage(const char* argv0)
+{
+    std::cout << "usage: " << argv0 << " [-t TITLE] [-w WIDTH] [-i] [-o FILE] [FOLDED...]\n";
+    std::cout << "\nRenders folded stacks (\"a;b;c 42\" per line) as interactive SVG flame graph."
+                 "\nReads from STDIN if no files are given.\n";
+    std::cout << "  -t TITLE     the title (default: Flame Graph)\n";
+    std::cout << "  -w WIDTH     width of the image (default: 1200)\n";
+    std::cout << "  -i           draw the callers at the top (icicle graph)\n";
+    std::cout << "  -o FILE      write the SVG to a file (default: STDOUT)\n";
+    return 1;
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    const char* outputPath = nullptr;
+    std::vector<const char*> inputPaths;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (arg == "-t" && i + 1 < argc)
+        {
+            options.title = argv[++i];
+        }
+        else if (arg == "-w" && i + 1 < argc)
+        {
+            options.width = strtod(argv[++i], nullptr);
+        }
+        else if (arg == "-i")
+        {
+            options.inverted = true;
+        }
+        else if (arg == "-o" && i + 1 < argc)
+        {
+            outputPath = argv[++i];
+        }
+        else if (arg == "-" || (!arg.empty() && arg[0] != '-'))
+        {
+            inputPaths.push_back(argv[i]);
+        }
+        else
+        {
+            return usage(argv[0]);
+        }
+    }
+    if (!(options.width >= 100))
+    {
+        return usage(argv[0]);
+    }
+
+    std::vector<Frame> frames(1);
+    frames[0].name = "all";
+    if (inputPaths.empty())
+    {
+        inputPaths.push_back("-");
+    }
+    for (const char* path : inputPaths)
+    {
+        if (strcmp(path, "-") == 0)
+        {
+            readFolded(std::cin, frames);
+            continue;
+        }
+        std::ifstream file(path);
+        if (!file)
+        {
+            std::cerr << path << ": can't read the file\n";
+            return 1;
+        }
+        readFolded(file, frames);
+    }
+    if (frames[0].value <= 0)
+    {
+        std::cerr << "no stacks found\n";
+        return 1;
+    }
+
+    if (outputPath == nullptr)
+    {
+        writeSvg(std::cout, frames, options);
+        return std::cout ? 0 : 1;
+    }
+    std::ofstream file(outputPath);
+    writeSvg(file, frames, options);
+    file.close();
+    if (!file)
+    {
+        std::cerr << outputPath << ": can't write the file\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,106 @@
+/**
+ * @file    journal_reader.cpp
+ * @brief   Extracts the crash reports from a journal file (see OOOPSI_JOURNAL).
+ */
+
+#include "journal.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace
+{
+/// a report found in the journal
+struct Report
+{
+    ooopsi::JournalRecord record;
+    std::string text;
+};
+} // namespace
+
+/// Collects all (intact) reports of a journal, oldest first.
+static std::vector<Report> readReports(const std::vector<char>& data,
+                                       const ooopsi::JournalHeader& header)
+{
+    std::vector<Report> reports;
+    // the records are 8-byte aligned: after overwriting older records, the start of the next
+    // intact one isn't known, so simply try every position
+    size_t offset = (sizeof(ooopsi::JournalHeader) + 7) & ~size_t{ 7 };
+    while (offset + sizeof(ooopsi::JournalRecord) <= data.size())
+    {
+        ooopsi::JournalRecord record; // NOLINT (initialized below)
+        memcpy(&record, data.data() + offset, sizeof(record));
+        const size_t textOffset = offset + sizeof(record);
+        if (record.magic != ooopsi::s_JOURNAL_RECORD_MAGIC || record.sequence == 0 ||
+            record.sequence >= header.nextSequence || record.length > data.size() - textOffset)
+        {
+            offset += 8;
+            continue;
+        }
+        Report report;
+        report.record = record;
+        report.text.assign(data.data() + textOffset, static_cast<size_t>(record.length));
+        reports.push_back(std::move(report));
+        offset = (textOffset + static_cast<size_t>(record.length) + 7) & ~size_t{ 7 };
+    }
+    std::sort(reports.begin(), reports.end(), [](const Report& lhs, const Report& rhs) {
+        return lhs.record.sequence < rhs.record.sequence;
+    });
+    return reports;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 2 || strcmp(argv[1], "--help") == 0 || strcmp(argv[1], "-h") == 0)
+    {
+        std::cout << "usage: " << argv[0] << " JOURNAL\n";
+        std::cout << "\nPrints all crash reports found in the journal file, oldest first.\n";
+        return 1;
+    }
+
+    std::ifstream file(argv[1], std::ios::binary);
+    const std::vector<char> data((std::istreambuf_iterator<char>(file)),
+                                 std::istreambuf_iterator<char>());
+    ooopsi::JournalHeader header; // NOLINT (initialized below)
+    if (!file || data.size() < sizeof(header))
+    {
+        std::cerr << argv[1] << ": can't read the file\n";
+        return 1;
+    }
+    memcpy(&header, data.data(), sizeof(header));
+    if (memcmp(header.magic, ooopsi::s_JOURNAL_MAGIC, sizeof(header.magic)) != 0 ||
+        header.headerSize != sizeof(header))
+    {
+        std::cerr << argv[1] << ": not a journal file\n";
+        return 1;
+    }
+
+    for (const Report& report : readReports(data, header))
+    {
+        char when[64] = "?";
+        const auto timestamp = static_cast<time_t>(report.record.timestamp);
+        tm utc; // NOLINT (initialized by gmtime_r)
+        if (gmtime_r(&timestamp, &utc) != nullptr)
+        {
+            strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S UTC", &utc);
+        }
+        std::cout << "==== report #" << report.record.sequence << ": pid "
+                  << report.record.processId << ", " << when;
+        if ((report.record.flags & ooopsi::s_JOURNAL_RECORD_COMPLETE) == 0)
+        {
+            std::cout << " (incomplete)";
+        }
+        if ((report.record.flags & ooopsi::s_JOURNAL_RECORD_TRUNCATED) != 0)
+        {
+            std::cout << " (truncated)";
+        }
+        std::cout << " ====\n" << report.text << '\n';
+    }
+    return 0;
+}
@@ -0,0 +1,532 @@
+/**
+ * @file    stack_sampler.cpp
+ * @brief   Samples the thread stacks of a running process, which doesn't need to use ooopsi.
+ *
+ * Every sample stops all threads of the process via ptrace, unwinds their stacks using
+ * libunwind's remote mode and lets them continue right away. Symbols are looked up afterwards,
+ * so the process is only paused for the unwinding itself.
+ */
+
+#include "elf_file.hpp"
+#include "module_map.hpp"
+#include "pprof_writer.hpp"
+#include "symbolizer.hpp"
+
+#include <libunwind-ptrace.h>
+
+#include <dirent.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+using ooopsi::ModuleInfo;
+
+namespace
+{
+/// A thread stopped for unwinding.
+struct StoppedThread
+{
+    pid_t tid;
+    /// signal that arrived while stopping the thread (re-delivered when detaching)
+    int pendingSignal;
+};
+
+/// A thread's stack in a single sample.
+struct ThreadStack
+{
+    pid_t tid;
+    /// the program counters, innermost first
+    std::vector<uintptr_t> pcs;
+};
+} // namespace
+
+/// Lists the threads of a process.
+static std::vector<pid_t> listThreads(pid_t pid)
+{
+    std::vector<pid_t> tids;
+    const std::string path = "/proc/" + std::to_string(pid) + "/task";
+    DIR* dir = opendir(path.c_str());
+    if (dir == nullptr)
+    {
+        return tids;
+    }
+    while (const dirent* entry = readdir(dir)) // NOLINT (single-threaded)
+    {
+        if (entry->d_name[0] != '.')
+        {
+            tids.push_back(static_cast<pid_t>(strtol(entry->d_name, nullptr, 10)));
+        }
+    }
+    closedir(dir);
+    return tids;
+}
+
+/// Returns a thread's name.
+static std::string threadName(pid_t pid, pid_t tid)
+{
+    std::ifstream file("/proc/" + std::to_string(pid) + "/task/" + std::to_string(tid) + "/comm");
+    std::string name;
+    std::getline(file, name);
+    return name;
+}
+
+/// Reads the memory mappings of a process (/proc/<pid>/maps).
+static std::string readMaps(pid_t pid)
+{
+    std::ifstream file("/proc/" + std::to_string(pid) + "/maps");
+    return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+}
+
+/**
+ * Returns the modules in the mappings of a process (see readMaps()), sorted by address. The
+ * files are accessed via /proc/<pid>/root, so this works for processes in other mount
+ * namespaces (containers) as well.
+ */
+static std::vector<ModuleInfo> parseModules(pid_t pid, const std::string& mapsText)
+{
+    // the image base only depends on the file
+    static std::map<std::string, uint64_t> s_imageBases;
+
+    std::vector<ModuleInfo> modules;
+    const std::string root = "/proc/" + std::to_string(pid) + "/root";
+    std::istringstream maps(mapsText);
+    std::string line;
+    while (std::getline(maps, line))
+    {
+        // format: begin-end perms offset dev inode path
+        std::istringstream fields(line);
+        std::string range, perms, offset, device, inode, path;
+        fields >> range >> perms >> offset >> device >> inode;
+        std::getline(fields >> std::ws, path);
+        if (path.empty() || path[0] != '/' || path.find(" (deleted)") != std::string::npos)
+        {
+            continue;
+        }
+        const uintptr_t begin = strtoull(range.c_str(), nullptr, 16);
+        const uintptr_t end = strtoull(range.c_str() + range.find('-') + 1, nullptr, 16);
+        const uintptr_t fileOffset = strtoull(offset.c_str(), nullptr, 16);
+
+        const std::string fullPath = root + path;
+        if (!modules.empty() && fullPath == modules.back().path)
+        {
+            // another segment of the same module
+            modules.back().end = std::max(modules.back().end, end);
+            continue;
+        }
+        if (fullPath.size() >= ooopsi::s_MAX_MODULE_PATH)
+        {
+            continue;
+        }
+
+        auto imageBase = s_imageBases.find(fullPath);
+        if (imageBase == s_imageBases.end())
+        {
+            ooopsi::ElfFile elf;
+            if (!elf.open(fullPath.c_str()))
+            {
+                continue;
+            }
+            imageBase = s_imageBases.emplace(fullPath, elf.imageBase()).first;
+        }
+
+        ModuleInfo module; // NOLINT (initialized below)
+        memset(&module, 0, sizeof(module));
+        module.begin = begin;
+        module.end = end;
+        module.base = begin - fileOffset - imageBase->second;
+        memcpy(module.path, fullPath.c_str(), fullPath.size() + 1);
+        modules.push_back(module);
+    }
+    std::sort(modules.begin(), modules.end(),
+              [](const ModuleInfo& lhs, const ModuleInfo& rhs) { return lhs.begin < rhs.begin; });
+    return modules;
+}
+
+/// Checks whether two modules are the same file mapped at the same addresses.
+static bool sameModule(const ModuleInfo& lhs, const ModuleInfo& rhs)
+{
+    return lhs.begin == rhs.begin && lhs.end == rhs.end && lhs.base == rhs.base &&
+           strcmp(lhs.path, rhs.path) == 0;
+}
+
+/// Stops a thread (returns false if it can't be traced, e.g. because it terminated already).
+static bool stopThread(pid_t tid, StoppedThread& stopped)
+{
+    if (ptrace(PTRACE_SEIZE, tid, nullptr, nullptr) != 0)
+    {
+        return false;
+    }
+    stopped.tid = tid;
+    stopped.pendingSignal = 0;
+    if (ptrace(PTRACE_INTERRUPT, tid, nullptr, nullptr) != 0)
+    {
+        ptrace(PTRACE_DETACH, tid, nullptr, nullptr);
+        return false;
+    }
+    int status = 0;
+    if (waitpid(tid, &status, __WALL) != tid || !WIFSTOPPED(status))
+    {
+        // don't leave it attached (fails harmlessly if it terminated meanwhile)
+        ptrace(PTRACE_DETACH, tid, nullptr, nullptr);
+        return false;
+    }
+    // a signal may have been on its way: it must not get lost
+    if (status >> 16 != PTRACE_EVENT_STOP)
+    {
+        stopped.pendingSignal = WSTOPSIG(status);
+    }
+    return true;
+}
+
+/// Unwinds the stack of a stopped thread.
+static void unwindThread(unw_addr_space_t addressSpace, void* context, size_t maxFrames,
+                         std::vector<uintptr_t>& pcs)
+{
+    unw_cursor_t cursor;
+    if (unw_init_remote(&cursor, addressSpace, context) != 0)
+    {
+        return;
+    }
+    do
+    {
+        unw_word_t pc = 0;
+        if (unw_get_reg(&cursor, UNW_REG_IP, &pc) != 0 || pc == 0)
+        {
+            break;
+        }
+        pcs.push_back(static_cast<uintptr_t>(pc));
+    } while (pcs.size() < maxFrames && unw_step(&cursor) > 0);
+}
+
+/// Formats a frame: function name and module (if found).
+static std::string describeFrame(const std::vector<ModuleInfo>& modules, uintptr_t pc,
+                                 bool isReturnAddress)
+{
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "0x%012" PRIxPTR, pc);
+    std::string result = buffer;
+
+    // return addresses point behind the call, which may be the start of the next function
+    const uintptr_t lookup = isReturnAddress ? pc - 1 : pc;
+    const ModuleInfo* module = ooopsi::findModule(modules.data(), modules.size(), lookup);
+    if (module == nullptr)
+    {
+        return result;
+    }
+    uint64_t offset = 0;
+    const char* symbol = ooopsi::findSymbol(*module, lookup, offset);
+    if (symbol != nullptr)
+    {
+        snprintf(buffer, sizeof(buffer), "+0x%" PRIx64, offset + (pc - lookup));
+        result += " in " + ooopsi::demangle(symbol) + buffer;
+    }
+    result += " (";
+    result += module->name();
+    result += ')';
+    return result;
+}
+
+/// Returns the name of a frame's function for folded stacks ("[module]" if not found).
+static std::string functionName(const std::vector<ModuleInfo>& modules, uintptr_t pc,
+                                bool isReturnAddress, bool compact)
+{
+    const uintptr_t lookup = isReturnAddress ? pc - 1 : pc;
+    const ModuleInfo* module = ooopsi::findModule(modules.data(), modules.size(), lookup);
+    if (module == nullptr)
+    {
+        return "[unknown]";
+    }
+    uint64_t offset = 0;
+    const char* symbol = ooopsi::findSymbol(*module, lookup, offset);
+    if (symbol == nullptr)
+    {
+        return std::string("[") + module->name() + ']';
+    }
+    std::string name = compact ? ooopsi::demangleCompact(symbol) : ooopsi::demangle(symbol);
+    // the separator mustn't show up in the names
+    std::replace(name.begin(), name.end(), ';', ':');
+    return name;
+}
+
+/// Prints the usage.
+static int usage(const char* argv0)
+{
+    std::cout << "usage: " << argv0
+              << " [-n SAMPLES] [-r RATE] [-d DEPTH] [-o FILE | -f [-c]] PID\n";
+    std::cout << "\nSamples the thread stacks of a running process and prints them, most frequent"
+                 " first.\n";
+    std::cout << "  -n SAMPLES   number of samples (default: 1)\n";
+    std::cout << "  -r RATE      samples per second (default: 10)\n";
+    std::cout << "  -d DEPTH     maximum number of frames per stack (default: 64)\n";
+    std::cout << "  -o FILE      write a pprof profile instead\n";
+    std::cout << "  -f           print folded stacks instead (for ooopsi-flamegraph)\n";
+    std::cout << "  -c           compact function names in folded stacks\n";
+    return 1;
+}
+
+int main(int argc, char** argv)
+{
+    unsigned numSamples = 1;
+    double rate = 10;
+    size_t maxFrames = 64;
+    const char* profilePath = nullptr;
+    bool folded = false;
+    bool compactNames = false;
+    pid_t pid = 0;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (arg == "-n" && i + 1 < argc)
+        {
+            numSamples = static_cast<unsigned>(strtoul(argv[++i], nullptr, 10));
+        }
+        else if (arg == "-r" && i + 1 < argc)
+        {
+            rate = strtod(argv[++i], nullptr);
+        }
+        else if (arg == "-d" && i + 1 < argc)
+        {
+            maxFrames = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "-o" && i + 1 < argc)
+        {
+            profilePath = argv[++i];
+        }
+        else if (arg == "-f")
+        {
+            folded = true;
+        }
+        else if (arg == "-c")
+        {
+            compactNames = true;
+        }
+        else if (pid == 0 && !arg.empty() && arg[0] != '-')
+        {
+            pid = static_cast<pid_t>(strtol(argv[i], nullptr, 10));
+        }
+        else
+        {
+            return usage(argv[0]);
+        }
+    }
+    if (pid <= 0 || numSamples == 0 || rate <= 0 || maxFrames == 0)
+    {
+        return usage(argv[0]);
+    }
+
+    unw_addr_space_t addressSpace = unw_create_addr_space(&_UPT_accessors, 0);
+    if (addressSpace == nullptr)
+    {
+        std::cerr << "can't create the unwinding context\n";
+        return 1;
+    }
+    unw_set_caching_policy(addressSpace, UNW_CACHE_GLOBAL);
+    // per thread, they cache the unwinding information of the modules
+    std::map<pid_t, void*> contexts;
+
+    // aggregated by module snapshot, thread name and stack
+    std::map<std::tuple<size_t, std::string, std::vector<uintptr_t>>, unsigned> counts;
+    std::map<pid_t, std::string> names;
+    // the modules at the time of the samples (a new snapshot only when they changed)
+    std::vector<std::vector<ModuleInfo>> snapshots;
+    size_t numStacks = 0;
+    unsigned numSampled = 0;
+    double totalPauseMs = 0;
+    double maxPauseMs = 0;
+
+    const auto interval = std::chrono::duration<double>(1.0 / rate);
+    auto next = std::chrono::steady_clock::now();
+    for (unsigned sample = 0; sample < numSamples; ++sample)
+    {
+        std::this_thread::sleep_until(next);
+        next += std::chrono::duration_cast<std::chrono::steady_clock::duration>(interval);
+
+        // stop all threads first, so the stacks are consistent
+        const std::vector<pid_t> tids = listThreads(pid);
+        if (tids.empty())
+        {
+            std::cerr << "process " << pid << " not found\n";
+            break;
+        }
+        const auto pauseStart = std::chrono::steady_clock::now();
+        std::vector<StoppedThread> stopped;
+        for (pid_t tid : tids)
+        {
+            StoppedThread thread; // NOLINT (initialized by stopThread)
+            errno = 0;
+            if (stopThread(tid, thread))
+            {
+                stopped.push_back(thread);
+            }
+            else if (errno == EPERM)
+            {
+                std::cerr << "not allowed to trace process " << pid << ": "
+                          << strerror(errno) << '\n';
+                return 1;
+            }
+        }
+        std::vector<ThreadStack> stacks;
+        for (const StoppedThread& thread : stopped)
+        {
+            void*& context = contexts[thread.tid];
+            if (context == nullptr)
+            {
+                context = _UPT_create(thread.tid);
+            }
+            stacks.push_back(ThreadStack{ thread.tid, {} });
+            unwindThread(addressSpace, context, maxFrames, stacks.back().pcs);
+        }
+        // the modules the stacks refer to (parsed later)
+        const std::string maps = readMaps(pid);
+        for (const StoppedThread& thread : stopped)
+        {
+            ptrace(PTRACE_DETACH, thread.tid, nullptr,
+                   reinterpret_cast<void*>(static_cast<intptr_t>(thread.pendingSignal)));
+        }
+        const double pauseMs = std::chrono::duration<double, std::milli>(
+                                 std::chrono::steady_clock::now() - pauseStart)
+                                 .count();
+        totalPauseMs += pauseMs;
+        ++numSampled;
+        maxPauseMs = std::max(maxPauseMs, pauseMs);
+
+        // the rest is done while the process is running again
+        std::vector<ModuleInfo> modules = parseModules(pid, maps);
+        if (snapshots.empty() || modules.size() != snapshots.back().size() ||
+            !std::equal(modules.begin(), modules.end(), snapshots.back().begin(), sameModule))
+        {
+            snapshots.push_back(std::move(modules));
+        }
+        const size_t snapshot = snapshots.size() - 1;
+        for (ThreadStack& stack : stacks)
+        {
+            auto name = names.find(stack.tid);
+            if (name == names.end())
+            {
+                name = names.emplace(stack.tid, threadName(pid, stack.tid)).first;
+            }
+            ++counts[std::make_tuple(snapshot, name->second, std::move(stack.pcs))];
+            ++numStacks;
+        }
+    }
+
+    for (const auto& context : contexts)
+    {
+        if (context.second != nullptr)
+        {
+            _UPT_destroy(context.second);
+        }
+    }
+    unw_destroy_addr_space(addressSpace);
+    if (numStacks == 0)
+    {
+        return 1;
+    }
+
+    if (profilePath != nullptr)
+    {
+        // each sample represents the sampling interval (of wall-clock time)
+        const auto intervalNs = static_cast<int64_t>(interval.count() * 1e9);
+        ooopsi::PprofWriter writer;
+        size_t snapshot = 0;
+        if (!writer.open(profilePath, snapshots[0].data(), snapshots[0].size()))
+        {
+            std::cerr << "can't write " << profilePath << ": " << strerror(errno) << '\n';
+            return 1;
+        }
+        writer.addSampleType("samples", "count");
+        writer.addSampleType("wall", "nanoseconds");
+        writer.setPeriod("wall", "nanoseconds", intervalNs);
+        for (const auto& entry : counts)
+        {
+            // (the samples are ordered by snapshot)
+            if (std::get<0>(entry.first) != snapshot)
+            {
+                snapshot = std::get<0>(entry.first);
+                writer.setModules(snapshots[snapshot].data(), snapshots[snapshot].size());
+            }
+            const int64_t values[] = { entry.second, entry.second * intervalNs };
+            const std::vector<uintptr_t>& pcs = std::get<2>(entry.first);
+            writer.addSample(pcs.data(), pcs.size(), true, values, 2, "thread",
+                             std::get<1>(entry.first).c_str());
+        }
+        if (!writer.finish())
+        {
+            std::cerr << "can't write " << profilePath << '\n';
+            return 1;
+        }
+        return 0;
+    }
+
+    if (folded)
+    {
+        // the thread name is the outermost frame
+        std::map<std::string, unsigned> lines;
+        for (const auto& entry : counts)
+        {
+            std::string line = std::get<1>(entry.first);
+            std::replace(line.begin(), line.end(), ';', ':');
+            const std::vector<ModuleInfo>& modules = snapshots[std::get<0>(entry.first)];
+            const std::vector<uintptr_t>& pcs = std::get<2>(entry.first);
+            for (size_t i = pcs.size(); i-- > 0;)
+            {
+                line += ';' + functionName(modules, pcs[i], i > 0, compactNames);
+            }
+            lines[line] += entry.second;
+        }
+        for (const auto& line : lines)
+        {
+            std::cout << line.first << ' ' << line.second << '\n';
+        }
+        return 0;
+    }
+
+    // most frequent first
+    std::vector<std::pair<unsigned, const decltype(counts)::key_type*>> sorted;
+    for (const auto& entry : counts)
+    {
+        sorted.emplace_back(entry.second, &entry.first);
+    }
+    std::stable_sort(sorted.begin(), sorted.end(),
+                     [](const decltype(sorted)::value_type& lhs,
+                        const decltype(sorted)::value_type& rhs) { return lhs.first > rhs.first; });
+
+    char summary[256];
+    snprintf(summary, sizeof(summary),
+             "%zu stacks of process %d, paused %.3f ms per sample on average (max: %.3f ms)",
+             numStacks, pid, totalPauseMs / numSampled, maxPauseMs);
+    std::cout << summary << "\n";
+    for (const auto& entry : sorted)
+    {
+        snprintf(summary, sizeof(summary), "\n%u (%.1f%%) in thread '%s':", entry.first,
+                 100.0 * entry.first / static_cast<double>(numStacks),
+                 std::get<1>(*entry.second).c_str());
+        std::cout << summary << '\n';
+        const std::vector<ModuleInfo>& modules = snapshots[std::get<0>(*entry.second)];
+        const std::vector<uintptr_t>& pcs = std::get<2>(*entry.second);
+        for (size_t i = 0; i < pcs.size(); ++i)
+        {
+            std::cout << "  #" << std::left << std::setw(3) << i
+                      << describeFrame(modules, pcs[i], i > 0) << '\n';
+        }
+    }
+    return 0;
+}